@@ -0,0 +1,213 @@
+#include <stddef.h>
+
+#include "app_core.h"
+#include "app_port.h"
+
+void app_core_init(app_core_t *core)
+{
+	core->mode = MODE_IDLE;
+	core->loop = LOOP_NONE;
+	core->threshold = 0;
+	core->sched_id = -1;
+
+	for (int i = 0; i < APP_REPORT_MAX; i++) {
+		core->report[i] = (app_report_t) {
+			.deadband = APP_REPORT_DEADBAND,
+			.min_s = APP_REPORT_MIN_S,
+			.max_s = APP_REPORT_MAX_S,
+			.force_req = 1,
+		};
+	}
+}
+
+static int report_index(app_char_t chr)
+{
+	if (chr == APP_CHAR_RSSI)
+		return APP_REPORT_RSSI;
+	if (chr == APP_CHAR_SOLAR)
+		return APP_REPORT_SOLAR;
+	return -1;
+}
+
+bool app_core_report_valid(uint8_t deadband, uint8_t min_s, uint16_t max_s)
+{
+	return deadband <= 100 && (!max_s || max_s >= min_s);
+}
+
+app_core_err_t app_core_set_report(app_core_t *core, app_char_t chr,
+						uint8_t deadband, uint8_t min_s, uint16_t max_s)
+{
+	int i = report_index(chr);
+
+	if (i < 0)
+		return APP_CORE_ERR_CHAR;
+	if (!app_core_report_valid(deadband, min_s, max_s))
+		return APP_CORE_ERR_VALUE;
+
+	core->report[i].deadband = deadband;
+	core->report[i].min_s = min_s;
+	core->report[i].max_s = max_s;
+	return APP_CORE_OK;
+}
+
+void app_core_report_now(app_core_t *core, app_char_t chr)
+{
+	int i = report_index(chr);
+
+	if (i >= 0)
+		core->report[i].force_req++;
+}
+
+//one tick passed with reading val, notify it if the policy says so
+static void report_tick(app_report_t *r, app_char_t chr, uint8_t val)
+{
+	int delta = val > r->last ? val - r->last : r->last - val;
+	uint8_t force_req = r->force_req;
+	uint32_t age_s;
+	bool due;
+
+	if (r->age < UINT16_MAX)
+		r->age++;
+	age_s = (uint32_t) r->age * APP_TICK_MS / 1000;
+
+	due = force_req != r->force_ack || (age_s >= r->min_s && (delta > r->deadband ||
+									(r->max_s && age_s >= r->max_s)));
+	if (!due) {
+		app_port_set_value(chr, val);
+		return;
+	}
+
+	app_port_notify(chr, val);
+	r->last = val;
+	r->age = 0;
+	r->force_ack = force_req;
+}
+
+static void sched_cancel(app_core_t *core)
+{
+	if (core->sched_id >= 0)
+		app_port_sched_cancel(core->sched_id);
+	core->sched_id = -1;
+}
+
+static app_core_err_t set_mode(app_core_t *core, uint8_t val)
+{
+	switch (val) {
+	case 0x00:
+		if (core->mode != MODE_LOOP)
+			return APP_CORE_ERR_STATE; //can only enter idle state from loop state
+
+		core->mode = MODE_IDLE;
+		sched_cancel(core);
+		app_port_loop_stop();
+		return APP_CORE_OK;
+	case 0x01:
+	case 0x03:
+		if (core->mode == MODE_FWUPDATE)
+			return APP_CORE_ERR_STATE; //don't enter update state twice
+		if (val == 0x03 && !app_port_fw_sta_ready())
+			return APP_CORE_ERR_STATE; //nowhere to pull the image from
+		if (!app_port_fw_update(val == 0x03))
+			return APP_CORE_ERR_STATE; //no updater to hand over to
+
+		if (core->mode == MODE_LOOP) {
+			sched_cancel(core);
+			app_port_loop_stop();
+		}
+
+		core->mode = MODE_FWUPDATE;
+		return APP_CORE_OK;
+	case 0x02:
+		if (core->mode != MODE_IDLE)
+			return APP_CORE_ERR_STATE; //only idle state can enter loop state
+
+		core->mode = MODE_LOOP;
+		core->loop = LOOP_NONE;
+		app_port_loop_start();
+		return APP_CORE_OK;
+	default:
+		return APP_CORE_ERR_VALUE;
+	}
+}
+
+app_core_err_t app_core_write(app_core_t *core, app_char_t chr, uint8_t val)
+{
+	switch (chr) {
+	case APP_CHAR_BUZZ:
+		if (val > 0x01)
+			return APP_CORE_ERR_VALUE;
+		app_port_buzzer(val == 0x01);
+		return APP_CORE_OK;
+	case APP_CHAR_MODE:
+		return set_mode(core, val);
+	case APP_CHAR_FIXEDINT:
+		//one beep every val minutes, 0 is silent
+		sched_cancel(core);
+		core->loop = LOOP_FIXEDINT;
+		core->threshold = val;
+		if (core->mode == MODE_LOOP && val)
+			core->sched_id = app_port_sched_fixed((uint32_t) val * 60 * 1000);
+		return APP_CORE_OK;
+	case APP_CHAR_RANDINT:
+		//val beeps at random times every hour
+		sched_cancel(core);
+		core->loop = LOOP_RANDINT;
+		core->threshold = val;
+		if (core->mode == MODE_LOOP && val)
+			core->sched_id = app_port_sched_random(val, 3600 * 1000);
+		return APP_CORE_OK;
+	case APP_CHAR_RSSIMIN:
+		sched_cancel(core);
+		core->loop = LOOP_RSSI;
+		core->threshold = val;
+		return APP_CORE_OK;
+	case APP_CHAR_SOLARMIN:
+		sched_cancel(core);
+		core->loop = LOOP_SOLAR;
+		core->threshold = val;
+		return APP_CORE_OK;
+	default:
+		return APP_CORE_ERR_CHAR;
+	}
+}
+
+uint8_t app_core_rssi_pct(int rssi_dbm)
+{
+	int pct = (rssi_dbm - APP_RSSI_MIN) * 100 / APP_RSSI_RANGE;
+
+	return pct < 0 ? 0 : pct > 100 ? 100 : pct;
+}
+
+uint8_t app_core_solar_pct(int solar_mv)
+{
+	int pct = solar_mv * 100 / APP_SOLAR_MV_MAX;
+
+	return pct < 0 ? 0 : pct > 100 ? 100 : pct;
+}
+
+void app_core_tick(app_core_t *core, int rssi_dbm, int solar_mv)
+{
+	uint8_t rssi = app_core_rssi_pct(rssi_dbm);
+	uint8_t solar = app_core_solar_pct(solar_mv);
+
+	report_tick(&core->report[APP_REPORT_RSSI], APP_CHAR_RSSI, rssi);
+	report_tick(&core->report[APP_REPORT_SOLAR], APP_CHAR_SOLAR, solar);
+
+	//fixed and random intervals fire from their schedules
+	switch (core->loop) {
+	case LOOP_FIXEDINT:
+	case LOOP_RANDINT:
+		break;
+	case LOOP_SOLAR:
+		if (solar > core->threshold)
+			app_port_beep();
+		break;
+	case LOOP_RSSI:
+		if (rssi > core->threshold)
+			app_port_beep();
+		break;
+	default:
+		app_port_silence();
+		break;
+	}
+}
@@ -0,0 +1,104 @@
+#ifndef __APP_CORE_H__
+#define __APP_CORE_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+//buzzer application logic: mode state machine, beep schedules, threshold
+//checks and sensor scaling. pure C, everything device specific goes
+//through app_port.h, so this builds and runs on any host. test/ has the
+//host build against stub ports: make test, make bench
+
+//characteristics, in 0xFF01.. order
+typedef enum app_char {
+	APP_CHAR_BUZZ,		//0xFF01 buzzer on / off
+	APP_CHAR_MODE,		//0xFF02 idle / fw update / loop / fw update (station)
+	APP_CHAR_FIXEDINT,	//0xFF03 fixed beep interval, minutes
+	APP_CHAR_RANDINT,	//0xFF04 random beeps per hour
+	APP_CHAR_RSSI,		//0xFF05 rssi %, notify
+	APP_CHAR_RSSIMIN,	//0xFF06 rssi threshold %
+	APP_CHAR_PASS,		//0xFF07 OTA AP passphrase
+	APP_CHAR_SOLAR,		//0xFF08 light sensor %, notify
+	APP_CHAR_SOLARMIN,	//0xFF09 light threshold %
+	APP_CHAR_MAX
+} app_char_t;
+
+typedef enum mode_internal {
+	MODE_IDLE,		//can receive manual beep events
+	MODE_FWUPDATE,	//fw update triggered, no return to idle/loop until reset
+	MODE_LOOP		//characteristic notify & threshold check loop is running
+} mode_internal_t;
+
+typedef enum mode_loop_type {
+	LOOP_FIXEDINT,
+	LOOP_RANDINT,
+	LOOP_SOLAR,
+	LOOP_RSSI,
+	LOOP_NONE
+} mode_loop_type_t;
+
+typedef enum app_core_err {
+	APP_CORE_OK,
+	APP_CORE_ERR_STATE,		//not allowed in the current mode, ignored
+	APP_CORE_ERR_VALUE,		//invalid value
+	APP_CORE_ERR_CHAR		//characteristic is not writable
+} app_core_err_t;
+
+//reporting policy of a notifying characteristic. a reading is notified
+//when it moved more than deadband % from the last report, and at least
+//every max_s seconds (0: on change only), but never twice in min_s
+typedef struct app_report {
+	uint8_t deadband;
+	uint8_t min_s;
+	uint16_t max_s;
+	uint8_t last;			//last reported value
+	uint16_t age;			//ticks since that report
+	//report on the next tick while they differ. force_req is only bumped
+	//by app_core_report_now, force_ack only set by the tick, so a
+	//request made during a tick is never lost
+	uint8_t force_req;
+	uint8_t force_ack;
+} app_report_t;
+
+enum {
+	APP_REPORT_RSSI,
+	APP_REPORT_SOLAR,
+	APP_REPORT_MAX
+};
+
+typedef struct app_core {
+	mode_internal_t mode;
+	mode_loop_type_t loop;
+	uint8_t threshold;
+	int sched_id;			//beep schedule of the interval modes, -1 none
+	app_report_t report[APP_REPORT_MAX];
+} app_core_t;
+
+#define APP_RSSI_MIN		(-127)	//dBm, 0%
+#define APP_RSSI_RANGE		147		//dBm, -127..20 is 0..100%
+#define APP_SOLAR_MV_MAX	1100	//ADC full scale at 0dB attenuation
+
+#define APP_TICK_MS				1000	//app_core_tick period
+#define APP_REPORT_DEADBAND		2		//%, defaults of both readings
+#define APP_REPORT_MIN_S		1
+#define APP_REPORT_MAX_S		60
+
+void app_core_init(app_core_t *core);
+//a write of val to chr. runs the state machine, calls back into the port
+app_core_err_t app_core_write(app_core_t *core, app_char_t chr, uint8_t val);
+//one sensor loop iteration, every APP_TICK_MS: notify the scaled readings
+//due by their report policy, beep on threshold
+void app_core_tick(app_core_t *core, int rssi_dbm, int solar_mv);
+//reporting policy of APP_CHAR_RSSI or APP_CHAR_SOLAR. like the writes,
+//from the task that owns the core
+app_core_err_t app_core_set_report(app_core_t *core, app_char_t chr,
+						uint8_t deadband, uint8_t min_s, uint16_t max_s);
+//the values app_core_set_report would accept
+bool app_core_report_valid(uint8_t deadband, uint8_t min_s, uint16_t max_s);
+//notify chr on the next tick regardless of its policy (new subscriber)
+void app_core_report_now(app_core_t *core, app_char_t chr);
+
+uint8_t app_core_rssi_pct(int rssi_dbm);
+uint8_t app_core_solar_pct(int solar_mv);
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef __APP_PORT_H__
+#define __APP_PORT_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "app_core.h"
+
+//implemented by the platform (gatts_ble.c on the esp32), called by
+//app_core. none of these may block
+
+//manual buzz: buzzer and white LED on / off
+void app_port_buzzer(bool on);
+void app_port_beep();
+//no loop type selected, keep quiet
+void app_port_silence();
+//start / stop the sensor loop (app_core_tick) and its indicators
+void app_port_loop_start();
+void app_port_loop_stop();
+//start the firmware update in the background, the device restarts into
+//the updater app for it (see updater.h). station: join the provisioned
+//network and pull the image instead of serving the SoftAP. false if the
+//update can't be started
+bool app_port_fw_update(bool station);
+//a station config was provisioned
+bool app_port_fw_sta_ready();
+//beep schedules, return an id or -1
+int app_port_sched_fixed(uint32_t period_ms);
+int app_port_sched_random(uint16_t count, uint32_t window_ms);
+void app_port_sched_cancel(int id);
+//update a characteristic value and notify it
+void app_port_notify(app_char_t chr, uint8_t val);
+//update a characteristic value for reads only
+void app_port_set_value(app_char_t chr, uint8_t val);
+
+#endif
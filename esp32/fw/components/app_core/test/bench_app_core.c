@@ -0,0 +1,59 @@
+#include <stdio.h>
+#include <time.h>
+
+#include "app_core.h"
+#include "port_stub.h"
+
+//per-tick cost and memory of the app core on the host: make bench.
+//the port calls are the stub's counters, so this is the core's own cost
+#define BENCH_TICKS		2000000
+
+static int64_t now_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+//readings: steady (reports by max interval only) or moving by more than
+//the deadband every tick (a notification per reading per tick)
+static void bench(const char *name, mode_loop_type_t loop, bool moving)
+{
+	app_core_t core;
+	int64_t t0, dt;
+	int solar;
+
+	stub_reset();
+	app_core_init(&core);
+	app_core_write(&core, APP_CHAR_MODE, 0x02);
+	if (loop == LOOP_SOLAR)
+		app_core_write(&core, APP_CHAR_SOLARMIN, 50);
+	else if (loop == LOOP_RSSI)
+		app_core_write(&core, APP_CHAR_RSSIMIN, 50);
+
+	t0 = now_ns();
+	for (int i = 0; i < BENCH_TICKS; i++) {
+		solar = moving ? (i & 1) * APP_SOLAR_MV_MAX : APP_SOLAR_MV_MAX / 2;
+		app_core_tick(&core, moving ? -40 - (i & 1) * 60 : -60, solar);
+	}
+	dt = now_ns() - t0;
+
+	printf("%-22s %6.1f ns/tick  %8d notifies  %6d beeps\n", name,
+			(double) dt / BENCH_TICKS, stub.notifies, stub.beeps);
+}
+
+int main()
+{
+	printf("sizeof(app_core_t)     %zu bytes\n", sizeof(app_core_t));
+	printf("sizeof(app_report_t)   %zu bytes\n", sizeof(app_report_t));
+	printf("%d ticks each\n", BENCH_TICKS);
+
+	bench("no loop, steady", LOOP_NONE, false);
+	bench("solar loop, steady", LOOP_SOLAR, false);
+	bench("rssi loop, steady", LOOP_RSSI, false);
+	bench("solar loop, moving", LOOP_SOLAR, true);
+	bench("rssi loop, moving", LOOP_RSSI, true);
+
+	return 0;
+}
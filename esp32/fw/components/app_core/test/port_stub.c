@@ -0,0 +1,89 @@
+#include <string.h>
+
+#include "app_port.h"
+#include "port_stub.h"
+
+port_stub_t stub;
+
+void stub_reset()
+{
+	memset(&stub, 0, sizeof(stub));
+	stub.fw_update_ok = true;
+	for (int i = 0; i < APP_CHAR_MAX; i++) {
+		stub.last_notified[i] = -1;
+		stub.value[i] = -1;
+	}
+}
+
+void app_port_buzzer(bool on)
+{
+	if (on)
+		stub.buzzer_on++;
+	else
+		stub.buzzer_off++;
+}
+
+void app_port_beep()
+{
+	stub.beeps++;
+}
+
+void app_port_silence()
+{
+	stub.silence++;
+}
+
+void app_port_loop_start()
+{
+	stub.loop_start++;
+}
+
+void app_port_loop_stop()
+{
+	stub.loop_stop++;
+}
+
+bool app_port_fw_update(bool station)
+{
+	stub.fw_update++;
+	return stub.fw_update_ok;
+}
+
+bool app_port_fw_sta_ready()
+{
+	return stub.fw_sta_ready;
+}
+
+int app_port_sched_fixed(uint32_t period_ms)
+{
+	stub.sched_fixed++;
+	stub.last_period_ms = period_ms;
+	return stub.next_sched_id++;
+}
+
+int app_port_sched_random(uint16_t count, uint32_t window_ms)
+{
+	stub.sched_random++;
+	stub.last_count = count;
+	stub.last_period_ms = window_ms;
+	return stub.next_sched_id++;
+}
+
+void app_port_sched_cancel(int id)
+{
+	stub.sched_cancel++;
+}
+
+void app_port_notify(app_char_t chr, uint8_t val)
+{
+	stub.notifies++;
+	stub.notified[chr]++;
+	stub.last_notified[chr] = val;
+	stub.value[chr] = val;
+}
+
+void app_port_set_value(app_char_t chr, uint8_t val)
+{
+	stub.set_values++;
+	stub.value[chr] = val;
+}
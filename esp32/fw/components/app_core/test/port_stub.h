@@ -0,0 +1,44 @@
+#ifndef __PORT_STUB_H__
+#define __PORT_STUB_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "app_core.h"
+
+//host implementation of app_port.h. every call is counted, and per
+//characteristic what a central would have seen
+typedef struct port_stub {
+	//GPIO: buzzer / LED
+	int buzzer_on;
+	int buzzer_off;
+	int beeps;
+	int silence;
+	//loop task
+	int loop_start;
+	int loop_stop;
+	//fw update
+	int fw_update;
+	bool fw_update_ok;		//what app_port_fw_update returns
+	bool fw_sta_ready;
+	//timers: beep schedules
+	int sched_fixed;
+	int sched_random;
+	int sched_cancel;
+	int next_sched_id;
+	uint32_t last_period_ms;
+	uint16_t last_count;
+	//GATT
+	int notifies;
+	int set_values;
+	int notified[APP_CHAR_MAX];
+	int last_notified[APP_CHAR_MAX];	//-1 if none
+	int value[APP_CHAR_MAX];			//attribute value, -1 if never set
+} port_stub_t;
+
+extern port_stub_t stub;
+
+//zeroes the record, an updater is available, no station config
+void stub_reset();
+
+#endif
@@ -0,0 +1,362 @@
+#include <stdio.h>
+
+#include "app_core.h"
+#include "port_stub.h"
+
+//host unit tests of the app core against port_stub.c: make test
+
+static int checks, failures;
+
+#define CHECK(cond) do { \
+	checks++; \
+	if (!(cond)) { \
+		failures++; \
+		printf("  %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+	} \
+} while (0)
+
+#define CHECK_EQ(a, b) do { \
+	long _a = (a), _b = (b); \
+	checks++; \
+	if (_a != _b) { \
+		failures++; \
+		printf("  %s:%d: %s == %ld, expected %ld\n", __FILE__, __LINE__, \
+														#a, _a, _b); \
+	} \
+} while (0)
+
+//exact percentages of the light reading
+#define SOLAR_MV(pct)	((pct) * APP_SOLAR_MV_MAX / 100)
+
+static app_core_t core;
+
+static void setup()
+{
+	stub_reset();
+	app_core_init(&core);
+}
+
+//ticks with a constant reading, the forced first report already out
+static void ticks(int n, int solar_pct)
+{
+	for (int i = 0; i < n; i++)
+		app_core_tick(&core, APP_RSSI_MIN, SOLAR_MV(solar_pct));
+}
+
+static void test_init()
+{
+	setup();
+	CHECK_EQ(core.mode, MODE_IDLE);
+	CHECK_EQ(core.loop, LOOP_NONE);
+	CHECK_EQ(core.sched_id, -1);
+	CHECK_EQ(core.report[APP_REPORT_SOLAR].deadband, APP_REPORT_DEADBAND);
+	CHECK_EQ(core.report[APP_REPORT_SOLAR].min_s, APP_REPORT_MIN_S);
+	CHECK_EQ(core.report[APP_REPORT_SOLAR].max_s, APP_REPORT_MAX_S);
+}
+
+static void test_mode_transitions()
+{
+	setup();
+
+	//idle only goes to loop or update
+	CHECK_EQ(app_core_write(&core, APP_CHAR_MODE, 0x00), APP_CORE_ERR_STATE);
+	CHECK_EQ(app_core_write(&core, APP_CHAR_MODE, 0x02), APP_CORE_OK);
+	CHECK_EQ(core.mode, MODE_LOOP);
+	CHECK_EQ(core.loop, LOOP_NONE);
+	CHECK_EQ(stub.loop_start, 1);
+
+	CHECK_EQ(app_core_write(&core, APP_CHAR_MODE, 0x02), APP_CORE_ERR_STATE);
+	CHECK_EQ(stub.loop_start, 1);
+
+	CHECK_EQ(app_core_write(&core, APP_CHAR_MODE, 0x00), APP_CORE_OK);
+	CHECK_EQ(core.mode, MODE_IDLE);
+	CHECK_EQ(stub.loop_stop, 1);
+
+	CHECK_EQ(app_core_write(&core, APP_CHAR_MODE, 0x04), APP_CORE_ERR_VALUE);
+	CHECK_EQ(core.mode, MODE_IDLE);
+}
+
+static void test_fw_update()
+{
+	setup();
+
+	//no station config, nowhere to pull from
+	CHECK_EQ(app_core_write(&core, APP_CHAR_MODE, 0x03), APP_CORE_ERR_STATE);
+	CHECK_EQ(stub.fw_update, 0);
+
+	//no updater to hand over to
+	stub.fw_update_ok = false;
+	CHECK_EQ(app_core_write(&core, APP_CHAR_MODE, 0x01), APP_CORE_ERR_STATE);
+	CHECK_EQ(core.mode, MODE_IDLE);
+
+	//from the loop, its schedule and task are stopped first
+	stub.fw_update_ok = true;
+	app_core_write(&core, APP_CHAR_MODE, 0x02);
+	app_core_write(&core, APP_CHAR_FIXEDINT, 1);
+	CHECK_EQ(app_core_write(&core, APP_CHAR_MODE, 0x01), APP_CORE_OK);
+	CHECK_EQ(core.mode, MODE_FWUPDATE);
+	CHECK_EQ(core.sched_id, -1);
+	CHECK_EQ(stub.sched_cancel, 1);
+	CHECK_EQ(stub.loop_stop, 1);
+
+	//no way out until reset
+	CHECK_EQ(app_core_write(&core, APP_CHAR_MODE, 0x01), APP_CORE_ERR_STATE);
+	CHECK_EQ(app_core_write(&core, APP_CHAR_MODE, 0x00), APP_CORE_ERR_STATE);
+	CHECK_EQ(app_core_write(&core, APP_CHAR_MODE, 0x02), APP_CORE_ERR_STATE);
+
+	setup();
+	stub.fw_sta_ready = true;
+	CHECK_EQ(app_core_write(&core, APP_CHAR_MODE, 0x03), APP_CORE_OK);
+	CHECK_EQ(stub.fw_update, 1);
+}
+
+static void test_loop_transitions()
+{
+	setup();
+
+	//outside the loop the type is kept, nothing is scheduled
+	CHECK_EQ(app_core_write(&core, APP_CHAR_FIXEDINT, 5), APP_CORE_OK);
+	CHECK_EQ(core.loop, LOOP_FIXEDINT);
+	CHECK_EQ(stub.sched_fixed, 0);
+
+	app_core_write(&core, APP_CHAR_MODE, 0x02);
+	CHECK_EQ(app_core_write(&core, APP_CHAR_FIXEDINT, 5), APP_CORE_OK);
+	CHECK_EQ(stub.sched_fixed, 1);
+	CHECK_EQ(stub.last_period_ms, 5 * 60 * 1000);
+	CHECK(core.sched_id >= 0);
+
+	//every loop type change cancels the running schedule
+	CHECK_EQ(app_core_write(&core, APP_CHAR_RANDINT, 3), APP_CORE_OK);
+	CHECK_EQ(stub.sched_cancel, 1);
+	CHECK_EQ(stub.sched_random, 1);
+	CHECK_EQ(stub.last_count, 3);
+	CHECK_EQ(stub.last_period_ms, 3600 * 1000);
+
+	CHECK_EQ(app_core_write(&core, APP_CHAR_RSSIMIN, 40), APP_CORE_OK);
+	CHECK_EQ(core.loop, LOOP_RSSI);
+	CHECK_EQ(core.threshold, 40);
+	CHECK_EQ(core.sched_id, -1);
+	CHECK_EQ(stub.sched_cancel, 2);
+
+	CHECK_EQ(app_core_write(&core, APP_CHAR_SOLARMIN, 60), APP_CORE_OK);
+	CHECK_EQ(core.loop, LOOP_SOLAR);
+	CHECK_EQ(core.threshold, 60);
+	CHECK_EQ(stub.sched_cancel, 2);
+
+	//0 is silent
+	CHECK_EQ(app_core_write(&core, APP_CHAR_FIXEDINT, 0), APP_CORE_OK);
+	CHECK_EQ(stub.sched_fixed, 1);
+	CHECK_EQ(core.sched_id, -1);
+
+	//leaving the loop cancels
+	app_core_write(&core, APP_CHAR_RANDINT, 2);
+	app_core_write(&core, APP_CHAR_MODE, 0x00);
+	CHECK_EQ(core.sched_id, -1);
+	CHECK_EQ(stub.sched_cancel, 3);
+}
+
+static void test_writes()
+{
+	setup();
+
+	CHECK_EQ(app_core_write(&core, APP_CHAR_BUZZ, 0x01), APP_CORE_OK);
+	CHECK_EQ(app_core_write(&core, APP_CHAR_BUZZ, 0x00), APP_CORE_OK);
+	CHECK_EQ(app_core_write(&core, APP_CHAR_BUZZ, 0x02), APP_CORE_ERR_VALUE);
+	CHECK_EQ(stub.buzzer_on, 1);
+	CHECK_EQ(stub.buzzer_off, 1);
+
+	//read only characteristics
+	CHECK_EQ(app_core_write(&core, APP_CHAR_RSSI, 1), APP_CORE_ERR_CHAR);
+	CHECK_EQ(app_core_write(&core, APP_CHAR_SOLAR, 1), APP_CORE_ERR_CHAR);
+	CHECK_EQ(app_core_write(&core, APP_CHAR_PASS, 1), APP_CORE_ERR_CHAR);
+	CHECK_EQ(app_core_write(&core, APP_CHAR_MAX, 1), APP_CORE_ERR_CHAR);
+}
+
+static void test_thresholds()
+{
+	setup();
+	app_core_write(&core, APP_CHAR_MODE, 0x02);
+
+	//no loop type yet
+	app_core_tick(&core, -40, SOLAR_MV(100));
+	CHECK_EQ(stub.silence, 1);
+	CHECK_EQ(stub.beeps, 0);
+
+	//beeps while above, not at the threshold
+	app_core_write(&core, APP_CHAR_SOLARMIN, 50);
+	app_core_tick(&core, APP_RSSI_MIN, SOLAR_MV(51));
+	app_core_tick(&core, APP_RSSI_MIN, SOLAR_MV(50));
+	app_core_tick(&core, APP_RSSI_MIN, SOLAR_MV(10));
+	CHECK_EQ(stub.beeps, 1);
+
+	//-40 dBm is 59%, -100 dBm 18%
+	stub.beeps = 0;
+	app_core_write(&core, APP_CHAR_RSSIMIN, 50);
+	app_core_tick(&core, -40, 0);
+	app_core_tick(&core, -100, SOLAR_MV(100));
+	CHECK_EQ(stub.beeps, 1);
+
+	//interval loops beep from their schedules only
+	stub.beeps = 0;
+	stub.silence = 0;
+	app_core_write(&core, APP_CHAR_FIXEDINT, 1);
+	app_core_tick(&core, 20, SOLAR_MV(100));
+	CHECK_EQ(stub.beeps, 0);
+	CHECK_EQ(stub.silence, 0);
+}
+
+static void test_scaling()
+{
+	CHECK_EQ(app_core_rssi_pct(APP_RSSI_MIN), 0);
+	CHECK_EQ(app_core_rssi_pct(-1000), 0);
+	CHECK_EQ(app_core_rssi_pct(APP_RSSI_MIN + APP_RSSI_RANGE), 100);
+	CHECK_EQ(app_core_rssi_pct(1000), 100);
+	CHECK_EQ(app_core_rssi_pct(-40), 59);
+
+	CHECK_EQ(app_core_solar_pct(-5), 0);
+	CHECK_EQ(app_core_solar_pct(0), 0);
+	CHECK_EQ(app_core_solar_pct(APP_SOLAR_MV_MAX / 2), 50);
+	CHECK_EQ(app_core_solar_pct(APP_SOLAR_MV_MAX), 100);
+	CHECK_EQ(app_core_solar_pct(5000), 100);
+}
+
+static void test_report_first_and_now()
+{
+	setup();
+
+	//both readings go out on the first tick, then only on change
+	ticks(1, 30);
+	CHECK_EQ(stub.notified[APP_CHAR_RSSI], 1);
+	CHECK_EQ(stub.notified[APP_CHAR_SOLAR], 1);
+	CHECK_EQ(stub.last_notified[APP_CHAR_SOLAR], 30);
+
+	ticks(5, 30);
+	CHECK_EQ(stub.notified[APP_CHAR_SOLAR], 1);
+	CHECK_EQ(stub.value[APP_CHAR_SOLAR], 30);
+
+	//a new subscriber doesn't wait for a change
+	app_core_report_now(&core, APP_CHAR_SOLAR);
+	ticks(1, 30);
+	CHECK_EQ(stub.notified[APP_CHAR_SOLAR], 2);
+	CHECK_EQ(stub.notified[APP_CHAR_RSSI], 1);
+
+	app_core_report_now(&core, APP_CHAR_BUZZ);
+	ticks(1, 30);
+	CHECK_EQ(stub.notifies, 3);
+}
+
+static void test_report_deadband()
+{
+	setup();
+	ticks(1, 30);
+
+	//not more than the 2% deadband: value updated, not notified
+	ticks(1, 32);
+	CHECK_EQ(stub.notified[APP_CHAR_SOLAR], 1);
+	CHECK_EQ(stub.value[APP_CHAR_SOLAR], 32);
+
+	//measured from the last report, not the last reading
+	ticks(1, 33);
+	CHECK_EQ(stub.notified[APP_CHAR_SOLAR], 2);
+	CHECK_EQ(stub.last_notified[APP_CHAR_SOLAR], 33);
+
+	ticks(1, 30);
+	CHECK_EQ(stub.notified[APP_CHAR_SOLAR], 3);
+
+	//deadband 0 reports any change
+	app_core_set_report(&core, APP_CHAR_SOLAR, 0, 1, 0);
+	ticks(1, 31);
+	CHECK_EQ(stub.notified[APP_CHAR_SOLAR], 4);
+	ticks(1, 31);
+	CHECK_EQ(stub.notified[APP_CHAR_SOLAR], 4);
+}
+
+static void test_report_intervals()
+{
+	setup();
+	ticks(1, 30);
+
+	//max interval: a steady reading still goes out every max_s
+	ticks(APP_REPORT_MAX_S - 1, 30);
+	CHECK_EQ(stub.notified[APP_CHAR_SOLAR], 1);
+	ticks(1, 30);
+	CHECK_EQ(stub.notified[APP_CHAR_SOLAR], 2);
+
+	//max 0: on change only
+	CHECK_EQ(app_core_set_report(&core, APP_CHAR_SOLAR, 2, 1, 0),
+													APP_CORE_OK);
+	ticks(1000, 30);
+	CHECK_EQ(stub.notified[APP_CHAR_SOLAR], 2);
+
+	//min interval: changes within min_s of a report wait for it
+	app_core_set_report(&core, APP_CHAR_SOLAR, 2, 5, 0);
+	ticks(1, 60);
+	CHECK_EQ(stub.notified[APP_CHAR_SOLAR], 3);
+	ticks(4, 90);
+	CHECK_EQ(stub.notified[APP_CHAR_SOLAR], 3);
+	ticks(1, 90);
+	CHECK_EQ(stub.notified[APP_CHAR_SOLAR], 4);
+	CHECK_EQ(stub.last_notified[APP_CHAR_SOLAR], 90);
+
+	//a forced report ignores min_s
+	ticks(1, 10);
+	app_core_report_now(&core, APP_CHAR_SOLAR);
+	ticks(1, 10);
+	CHECK_EQ(stub.notified[APP_CHAR_SOLAR], 5);
+
+	//the other reading keeps its own policy
+	CHECK_EQ(core.report[APP_REPORT_RSSI].min_s, APP_REPORT_MIN_S);
+	CHECK_EQ(core.report[APP_REPORT_RSSI].max_s, APP_REPORT_MAX_S);
+}
+
+static void test_report_policy_values()
+{
+	setup();
+
+	CHECK_EQ(app_core_set_report(&core, APP_CHAR_RSSI, 100, 255, 0),
+													APP_CORE_OK);
+	CHECK_EQ(app_core_set_report(&core, APP_CHAR_RSSI, 101, 1, 60),
+													APP_CORE_ERR_VALUE);
+	CHECK_EQ(app_core_set_report(&core, APP_CHAR_RSSI, 2, 10, 5),
+													APP_CORE_ERR_VALUE);
+	CHECK_EQ(app_core_set_report(&core, APP_CHAR_BUZZ, 2, 1, 60),
+													APP_CORE_ERR_CHAR);
+	//refused values leave the policy alone
+	CHECK_EQ(core.report[APP_REPORT_RSSI].deadband, 100);
+	CHECK_EQ(core.report[APP_REPORT_RSSI].min_s, 255);
+
+	CHECK(app_core_report_valid(0, 0, 0));
+	CHECK(app_core_report_valid(2, 10, 10));
+	CHECK(!app_core_report_valid(2, 10, 9));
+}
+
+int main()
+{
+	static const struct {
+		const char *name;
+		void (*func)();
+	} tests[] = {
+		{ "init", test_init },
+		{ "mode transitions", test_mode_transitions },
+		{ "fw update", test_fw_update },
+		{ "loop transitions", test_loop_transitions },
+		{ "writes", test_writes },
+		{ "thresholds", test_thresholds },
+		{ "scaling", test_scaling },
+		{ "report first / now", test_report_first_and_now },
+		{ "report deadband", test_report_deadband },
+		{ "report intervals", test_report_intervals },
+		{ "report policy values", test_report_policy_values },
+	};
+
+	for (unsigned int i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+		int before = failures;
+
+		tests[i].func();
+		printf("%-24s %s\n", tests[i].name, failures == before ? "ok" :
+																"FAIL");
+	}
+
+	printf("%d checks, %d failed\n", checks, failures);
+	return failures ? 1 : 0;
+}
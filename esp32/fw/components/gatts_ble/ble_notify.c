@@ -0,0 +1,265 @@
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+
+#include "esp_gatts_api.h"
+#include "gatts_ble.h"
+#include "ble_notify.h"
+
+static const char *TAG = "ble notify";
+
+//a value waiting for the link, handle 0 is a free slot
+typedef struct notify_slot {
+	uint16_t handle;
+	uint16_t len;
+	uint8_t *value;
+	uint32_t seq;
+	int64_t at;
+} notify_slot_t;
+
+typedef struct notify_conn {
+	bool used;
+	bool congested;
+	bool flushing;			//waiting values go first, new ones queue
+	uint16_t conn_id;
+	esp_gatt_if_t gatts_if;
+	uint32_t seq;
+	notify_slot_t slots[BLE_NOTIFY_SLOTS];
+	ble_notify_stats_t stats;
+} notify_conn_t;
+
+//the lock is never held across a call into bluedroid, which may block
+//on the BT task that delivers the congestion events
+static notify_conn_t conns[GATTS_CONN_MAX];
+static SemaphoreHandle_t notify_lock;
+static esp_timer_handle_t flush_timer;
+
+static notify_conn_t *conn_find(uint16_t conn_id)
+{
+	for (int i = 0; i < GATTS_CONN_MAX; i++) {
+		if (conns[i].used && conns[i].conn_id == conn_id)
+			return &conns[i];
+	}
+
+	return NULL;
+}
+
+static void slot_free(notify_slot_t *slot)
+{
+	free(slot->value);
+	memset(slot, 0, sizeof(*slot));
+}
+
+//under the lock. latest value per handle wins
+static bool conn_queue(notify_conn_t *c, uint16_t handle,
+								const uint8_t *value, uint16_t len)
+{
+	notify_slot_t *slot = NULL;
+	uint8_t *copy;
+
+	for (int i = 0; i < BLE_NOTIFY_SLOTS; i++) {
+		if (c->slots[i].handle == handle) {
+			slot = &c->slots[i];
+			c->stats.coalesced++;
+			break;
+		}
+		if (!slot && !c->slots[i].handle)
+			slot = &c->slots[i];
+	}
+
+	copy = slot ? malloc(len) : NULL;
+	if (!copy) {
+		c->stats.dropped++;
+		return false;
+	}
+	memcpy(copy, value, len);
+
+	free(slot->value);
+	slot->handle = handle;
+	slot->len = len;
+	slot->value = copy;
+	slot->seq = c->seq++;
+	slot->at = esp_timer_get_time();
+
+	return true;
+}
+
+//under the lock. oldest waiting value, NULL if none
+static notify_slot_t *conn_oldest(notify_conn_t *c)
+{
+	notify_slot_t *oldest = NULL;
+
+	for (int i = 0; i < BLE_NOTIFY_SLOTS; i++) {
+		if (c->slots[i].handle &&
+					(!oldest || c->slots[i].seq - oldest->seq > INT32_MAX))
+			oldest = &c->slots[i];
+	}
+
+	return oldest;
+}
+
+//sends the waiting values of every uncongested connection in order
+static void flush_timer_cb(void *arg)
+{
+	notify_conn_t *c;
+	notify_slot_t *slot, out;
+	esp_gatt_if_t gatts_if;
+	uint16_t conn_id;
+	int64_t now;
+	esp_err_t ret;
+
+	for (int i = 0; i < GATTS_CONN_MAX; i++) {
+		for (;;) {
+			xSemaphoreTake(notify_lock, portMAX_DELAY);
+			c = &conns[i];
+			slot = c->used && !c->congested ? conn_oldest(c) : NULL;
+			if (!slot) {
+				c->flushing = false;
+				xSemaphoreGive(notify_lock);
+				break;
+			}
+			//take the value out, it is sent without the lock
+			out = *slot;
+			memset(slot, 0, sizeof(*slot));
+			now = esp_timer_get_time();
+			if (now - out.at > BLE_NOTIFY_MAX_AGE_MS * 1000) {
+				c->stats.dropped++;
+				xSemaphoreGive(notify_lock);
+				free(out.value);
+				continue;
+			}
+			c->stats.sent++;
+			gatts_if = c->gatts_if;
+			conn_id = c->conn_id;
+			xSemaphoreGive(notify_lock);
+
+			ret = esp_ble_gatts_send_indicate(gatts_if, conn_id,
+								out.handle, out.len, out.value, false);
+			if (ret != ESP_OK)
+				ESP_LOGW(TAG, "conn %d handle %d: %s", conn_id,
+								out.handle, esp_err_to_name(ret));
+			free(out.value);
+		}
+	}
+}
+
+bool ble_notify_send(uint16_t conn_id, uint16_t handle, const uint8_t *value,
+															uint16_t len)
+{
+	notify_conn_t *c;
+	esp_gatt_if_t gatts_if;
+	bool ret;
+
+	xSemaphoreTake(notify_lock, portMAX_DELAY);
+	c = conn_find(conn_id);
+	if (!c) {
+		xSemaphoreGive(notify_lock);
+		return false;
+	}
+
+	//keep the order while anything is waiting
+	if (c->congested || c->flushing) {
+		ret = conn_queue(c, handle, value, len);
+		xSemaphoreGive(notify_lock);
+		return ret;
+	}
+
+	c->stats.sent++;
+	gatts_if = c->gatts_if;
+	xSemaphoreGive(notify_lock);
+
+	if (esp_ble_gatts_send_indicate(gatts_if, conn_id, handle, len,
+											(uint8_t *)value, false)) {
+		xSemaphoreTake(notify_lock, portMAX_DELAY);
+		if ((c = conn_find(conn_id))) {
+			c->stats.sent--;
+			c->stats.dropped++;
+		}
+		xSemaphoreGive(notify_lock);
+		return false;
+	}
+
+	return true;
+}
+
+void ble_notify_congest(uint16_t conn_id, bool congested)
+{
+	notify_conn_t *c;
+	bool flush = false;
+
+	xSemaphoreTake(notify_lock, portMAX_DELAY);
+	c = conn_find(conn_id);
+	if (c && congested && !c->congested)
+		c->stats.congestions++;
+	if (c) {
+		c->congested = congested;
+		flush = !congested && conn_oldest(c);
+		c->flushing |= flush;
+	}
+	xSemaphoreGive(notify_lock);
+
+	//not from the BT task, the sends could block on its own queue
+	if (flush) {
+		esp_timer_stop(flush_timer);
+		esp_timer_start_once(flush_timer, 0);
+	}
+}
+
+void ble_notify_connect(esp_gatt_if_t gatts_if, uint16_t conn_id)
+{
+	xSemaphoreTake(notify_lock, portMAX_DELAY);
+	for (int i = 0; i < GATTS_CONN_MAX; i++) {
+		if (!conns[i].used) {
+			memset(&conns[i], 0, sizeof(conns[i]));
+			conns[i].used = true;
+			conns[i].conn_id = conn_id;
+			conns[i].gatts_if = gatts_if;
+			break;
+		}
+	}
+	xSemaphoreGive(notify_lock);
+}
+
+void ble_notify_disconnect(uint16_t conn_id)
+{
+	notify_conn_t *c;
+
+	xSemaphoreTake(notify_lock, portMAX_DELAY);
+	c = conn_find(conn_id);
+	if (c) {
+		ESP_LOGI(TAG, "conn %d: sent %u coalesced %u dropped %u, "
+				"congested %u times", conn_id, c->stats.sent,
+				c->stats.coalesced, c->stats.dropped, c->stats.congestions);
+		for (int i = 0; i < BLE_NOTIFY_SLOTS; i++)
+			slot_free(&c->slots[i]);
+		c->used = false;
+	}
+	xSemaphoreGive(notify_lock);
+}
+
+bool ble_notify_get_stats(uint16_t conn_id, ble_notify_stats_t *stats)
+{
+	notify_conn_t *c;
+
+	xSemaphoreTake(notify_lock, portMAX_DELAY);
+	c = conn_find(conn_id);
+	if (c)
+		*stats = c->stats;
+	xSemaphoreGive(notify_lock);
+
+	return c != NULL;
+}
+
+void ble_notify_init()
+{
+	notify_lock = xSemaphoreCreateMutex();
+
+	esp_timer_create_args_t timer_args = {
+		.callback = flush_timer_cb,
+		.name = "notify flush"
+	};
+	ESP_ERROR_CHECK(esp_timer_create(&timer_args, &flush_timer));
+}
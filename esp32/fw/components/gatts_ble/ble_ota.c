@@ -0,0 +1,312 @@
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+
+#include "esp_gatts_api.h"
+#include "gatts_ble.h"
+#include "ble_ota.h"
+#include "ble_notify.h"
+#include "ota_session.h"
+
+static const char *TAG = "ble ota";
+
+//a copy of one characteristic write and where it came from
+typedef struct ble_ota_frame {
+	esp_gatt_if_t gatts_if;
+	uint16_t conn_id;
+	uint16_t handle;
+	uint16_t len;
+	uint8_t data[];
+} ble_ota_frame_t;
+
+static xQueueHandle ble_ota_queue = NULL;
+
+//link of the session, set by the task from the hello. while bound, frames
+//from other connections are ignored and their hellos refused
+static esp_gatt_if_t ota_gatts_if;
+static volatile uint16_t ota_conn_id;
+static volatile bool ota_bound = false;
+static uint16_t ota_handle;
+static volatile bool ota_link_lost = false;
+
+//progress subscribers, written from the BT callback
+static uint16_t progress_conn_ids[GATTS_CONN_MAX];
+static int progress_subs;
+static portMUX_TYPE progress_mux = portMUX_INITIALIZER_UNLOCKED;
+
+//progress reporting, only touched from the esp_timer task once started
+static esp_timer_handle_t progress_timer;
+static uint16_t progress_handle;
+static uint8_t progress_last[OTA_PROGRESS_LEN];
+static uint32_t progress_received;
+static uint32_t progress_rate;
+static int64_t progress_at;
+
+static void ble_ota_ack_to(esp_gatt_if_t gatts_if, uint16_t conn_id,
+				uint16_t handle, ota_status_t status, uint32_t offset)
+{
+	uint8_t ack[OTA_V2_ACK_LEN] = {
+		status, 0, BLE_OTA_WINDOW >> 8, BLE_OTA_WINDOW & 0xff,
+		offset >> 24, offset >> 16, offset >> 8, offset
+	};
+
+	//not through ble_notify: a later ack must not replace a resend or
+	//fail, and the client's window already bounds what is in flight
+	esp_ble_gatts_send_indicate(gatts_if, conn_id, handle, sizeof(ack), ack,
+																	false);
+}
+
+//to the session's link
+static void ble_ota_ack(ota_status_t status, uint32_t offset)
+{
+	ble_ota_ack_to(ota_gatts_if, ota_conn_id, ota_handle, status, offset);
+}
+
+//from the task only
+static void ble_ota_bind(const ble_ota_frame_t *frame)
+{
+	ota_gatts_if = frame->gatts_if;
+	ota_handle = frame->handle;
+	ota_conn_id = frame->conn_id;
+	ota_link_lost = false;
+	ota_bound = true;
+}
+
+static void put_be32(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+static uint32_t get_be32(const uint8_t *p)
+{
+	return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+//OTA_ST_DONE or OTA_ST_FAIL once the transfer is over
+static ota_status_t ble_ota_data(const uint8_t *frame, uint16_t len)
+{
+	ota_status_t status;
+	uint32_t offset;
+	uint8_t *data;
+
+	uint32_t seq = get_be32(frame);
+	uint16_t plen = (frame[4] << 8) | frame[5];
+	uint32_t crc = get_be32(frame + 8);
+
+	if (plen != len - OTA_V2_DATA_HDR_LEN) {
+		ESP_LOGW(TAG, "frame length %u, payload %u", len, plen);
+		plen = 0;	//fails the session check, asks for a resend
+	}
+
+	data = ota_session_reserve(plen);
+	if (!data) {
+		ota_session_reset();
+		ble_ota_ack(OTA_ST_FAIL, 0);
+		return OTA_ST_FAIL;
+	}
+
+	memcpy(data, frame + OTA_V2_DATA_HDR_LEN, plen);
+
+	if (ota_session_put(seq, plen, crc, &status, &offset))
+		ble_ota_ack(status, offset);
+
+	return status;
+}
+
+//runs the session off the BT callback task, flash writes block
+static void ble_ota_task(void *arg)
+{
+	ble_ota_frame_t *frame;
+	ota_status_t status;
+	bool active = false;
+	uint32_t offset;
+
+	for (;;) {
+		//frames of a dropped link are still handled, then it's suspended
+		if (!xQueueReceive(ble_ota_queue, &frame, 1000 / portTICK_RATE_MS)) {
+			if (active && ota_link_lost) {
+				ota_session_suspend();
+				active = false;
+				ota_bound = false;
+			}
+			continue;
+		}
+
+		if (frame->len == OTA_V2_HELLO_LEN &&
+							!memcmp(frame->data, OTA_V2_MAGIC, 4)) {
+			//a transfer on a live link isn't taken over by another central.
+			//after a drop the client comes back with a new conn_id
+			if (active && frame->conn_id != ota_conn_id && !ota_link_lost) {
+				ESP_LOGW(TAG, "conn %d: busy with conn %d", frame->conn_id,
+															ota_conn_id);
+				ble_ota_ack_to(frame->gatts_if, frame->conn_id,
+										frame->handle, OTA_ST_FAIL, 0);
+				free(frame);
+				continue;
+			}
+			ble_ota_bind(frame);
+			active = ota_session_start(frame->data, frame->len,
+									BLE_OTA_ACK_EVERY, &offset) == 0;
+			if (active)
+				ble_ota_ack(OTA_ST_OK, offset);
+			else
+				ble_ota_ack(OTA_ST_FAIL, 0);
+			ota_bound = active;
+		} else if (active && frame->conn_id == ota_conn_id &&
+										frame->len > OTA_V2_DATA_HDR_LEN) {
+			status = ble_ota_data(frame->data, frame->len);
+			if (status == OTA_ST_FAIL) {
+				active = false;
+				ota_bound = false;
+			} else if (status == OTA_ST_DONE) {
+				//let the last ack go out
+				vTaskDelay(2000 / portTICK_RATE_MS);
+				esp_restart();
+			}
+		}
+
+		free(frame);
+	}
+}
+
+static void progress_timer_cb(void *arg)
+{
+	uint8_t value[OTA_PROGRESS_LEN] = { 0 };
+	uint16_t ids[GATTS_CONN_MAX];
+	ota_progress_t p;
+	int n;
+	int64_t now = esp_timer_get_time();
+	uint32_t rate = 0;
+
+	ota_progress_get(&p);
+
+	//bytes/s, smoothed over a few periods
+	if (p.received > progress_received && now > progress_at)
+		rate = (uint64_t)(p.received - progress_received) * 1000000 /
+													(now - progress_at);
+	if (p.state == OTA_PROG_RECEIVING)
+		progress_rate = (progress_rate * 3 + rate) / 4;
+	else
+		progress_rate = 0;
+	progress_received = p.received;
+	progress_at = now;
+
+	value[0] = p.state;
+	put_be32(value + 4, p.received);
+	put_be32(value + 8, p.written);
+	put_be32(value + 12, progress_rate);
+
+	if (!memcmp(value, progress_last, sizeof(value)))
+		return;
+	memcpy(progress_last, value, sizeof(value));
+
+	esp_ble_gatts_set_attr_value(progress_handle, sizeof(value), value);
+
+	portENTER_CRITICAL(&progress_mux);
+	n = progress_subs;
+	memcpy(ids, progress_conn_ids, sizeof(ids));
+	portEXIT_CRITICAL(&progress_mux);
+
+	for (int i = 0; i < n; i++)
+		ble_notify_send(ids[i], progress_handle, value, sizeof(value));
+}
+
+void ble_ota_progress_subscribe(esp_gatt_if_t gatts_if, uint16_t conn_id,
+											uint16_t handle, bool enable)
+{
+	ota_progress_t p;
+	int i, was;
+
+	portENTER_CRITICAL(&progress_mux);
+	was = progress_subs;
+	for (i = 0; i < progress_subs; i++) {
+		if (progress_conn_ids[i] == conn_id)
+			break;
+	}
+	if (!enable && i < progress_subs)
+		progress_conn_ids[i] = progress_conn_ids[--progress_subs];
+	else if (enable && i == progress_subs && progress_subs < GATTS_CONN_MAX)
+		progress_conn_ids[progress_subs++] = conn_id;
+	portEXIT_CRITICAL(&progress_mux);
+
+	if (!enable) {
+		if (was && !progress_subs)
+			esp_timer_stop(progress_timer);
+		return;
+	}
+
+	//a new subscriber gets the current state on the next tick, the
+	//others see it once more
+	esp_timer_stop(progress_timer);
+	progress_handle = handle;
+	memset(progress_last, 0xff, sizeof(progress_last));
+	if (!was) {
+		progress_rate = 0;
+		progress_at = esp_timer_get_time();
+		ota_progress_get(&p);
+		progress_received = p.received;
+	}
+
+	esp_timer_start_periodic(progress_timer, BLE_OTA_PROGRESS_MS * 1000);
+}
+
+void ble_ota_init()
+{
+	esp_timer_create_args_t timer_args = {
+		.callback = progress_timer_cb,
+		.name = "ota progress"
+	};
+	ESP_ERROR_CHECK(esp_timer_create(&timer_args, &progress_timer));
+
+	ble_ota_queue = xQueueCreate(BLE_OTA_QUEUE_LEN,
+										sizeof(ble_ota_frame_t *));
+	xTaskCreate(ble_ota_task, "ble ota task", BLE_OTA_TASK_STACK, NULL,
+												BLE_OTA_TASK_PRIO, NULL);
+}
+
+static bool ble_ota_post(esp_gatt_if_t gatts_if, uint16_t conn_id,
+					uint16_t handle, const uint8_t *data, uint16_t len)
+{
+	ble_ota_frame_t *frame;
+
+	frame = malloc(sizeof(ble_ota_frame_t) + len);
+	if (!frame)
+		return false;
+
+	frame->gatts_if = gatts_if;
+	frame->conn_id = conn_id;
+	frame->handle = handle;
+	frame->len = len;
+	memcpy(frame->data, data, len);
+
+	if (xQueueSend(ble_ota_queue, &frame, 0) != pdTRUE) {
+		free(frame);
+		return false;
+	}
+	return true;
+}
+
+bool ble_ota_write(esp_gatt_if_t gatts_if, uint16_t conn_id, uint16_t handle,
+										const uint8_t *data, uint16_t len)
+{
+	if (ble_ota_queue == NULL || len == 0 || len > BLE_OTA_FRAME_MAX)
+		return false;
+
+	//a dropped frame shows up as a sequence gap and gets resent. the
+	//task sorts out which link the frame belongs to
+	return ble_ota_post(gatts_if, conn_id, handle, data, len);
+}
+
+void ble_ota_disconnect(uint16_t conn_id)
+{
+	//other centrals don't affect the transfer
+	if (ota_bound && conn_id == ota_conn_id)
+		ota_link_lost = true;
+}
@@ -0,0 +1,227 @@
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "esp_gap_ble_api.h"
+
+#include "esp_gatts_api.h"
+#include "gatts_ble.h"
+#include "ble_stream.h"
+#include "ble_notify.h"
+#include "light_sensor.h"
+
+static const char *TAG = "ble stream";
+
+//RSSI only changes once per connection event, don't ask for it every sample
+#define RSSI_READ_US	(BLE_STREAM_PERIOD_MS * 1000)
+
+//one per subscribed connection, each frame follows its own link's MTU and
+//is sampled by its own timer
+typedef struct stream_conn {
+	bool used;
+	uint16_t conn_id;
+	uint16_t handle;
+	uint16_t mtu;
+	uint16_t period;
+	esp_bd_addr_t bda;
+	esp_timer_handle_t timer;
+	int64_t rssi_at;
+	uint8_t frame[BLE_STREAM_FRAME_MAX];
+	uint8_t count;
+} stream_conn_t;
+
+//held while sampling, never across a send
+static stream_conn_t conns[GATTS_CONN_MAX];
+static SemaphoreHandle_t stream_lock;
+
+//frame being sent, only touched from the esp_timer task
+static uint8_t out[BLE_STREAM_FRAME_MAX];
+
+static void put_be16(uint8_t *p, uint16_t v)
+{
+	p[0] = v >> 8;
+	p[1] = v;
+}
+
+static void put_be32(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+static uint8_t frame_capacity(uint16_t mtu)
+{
+	uint16_t len = mtu - 3;
+	int n;
+
+	if (len > BLE_STREAM_FRAME_MAX)
+		len = BLE_STREAM_FRAME_MAX;
+
+	n = (len - BLE_STREAM_HDR_LEN) / BLE_STREAM_SAMPLE_LEN;
+	return n > 255 ? 255 : n;
+}
+
+//sample period that fills a frame of the link's MTU in about a flush period
+static uint16_t stream_period(uint16_t mtu)
+{
+	uint8_t n = frame_capacity(mtu);
+	uint16_t period;
+
+	if (n == 0)
+		return BLE_STREAM_PERIOD_MS;
+
+	period = (BLE_STREAM_FLUSH_MS + n - 1) / n;
+	if (period < BLE_STREAM_PERIOD_MIN_MS)
+		return BLE_STREAM_PERIOD_MIN_MS;
+	if (period > BLE_STREAM_PERIOD_MS)
+		return BLE_STREAM_PERIOD_MS;
+
+	return period;
+}
+
+static stream_conn_t *conn_find(uint16_t conn_id)
+{
+	for (int i = 0; i < GATTS_CONN_MAX; i++) {
+		if (conns[i].used && conns[i].conn_id == conn_id)
+			return &conns[i];
+	}
+
+	return NULL;
+}
+
+//under the lock. samples start over at the period of the current MTU
+static void conn_restart(stream_conn_t *c)
+{
+	c->period = stream_period(c->mtu);
+	c->count = 0;
+	esp_timer_stop(c->timer);
+	esp_timer_start_periodic(c->timer, c->period * 1000);
+}
+
+//under the lock. adds a sample, true if the frame was copied to out
+static bool conn_sample(stream_conn_t *c, int64_t now, uint32_t mv,
+															uint16_t *len)
+{
+	uint8_t *s;
+
+	if (c->count == 0) {
+		put_be32(c->frame, now / 1000);
+		put_be16(c->frame + 4, c->period);
+	}
+
+	s = c->frame + BLE_STREAM_HDR_LEN + c->count * BLE_STREAM_SAMPLE_LEN;
+	s[0] = gatts_ble_conn_rssi(c->conn_id);
+	put_be16(s + 1, mv);
+	c->count++;
+
+	if (c->count < frame_capacity(c->mtu))
+		return false;
+
+	c->frame[6] = c->count;
+	*len = BLE_STREAM_HDR_LEN + c->count * BLE_STREAM_SAMPLE_LEN;
+	memcpy(out, c->frame, *len);
+	c->count = 0;
+
+	return true;
+}
+
+static void stream_timer_cb(void *arg)
+{
+	stream_conn_t *c = arg;
+	int64_t now = esp_timer_get_time();
+	esp_bd_addr_t bda;
+	uint16_t conn_id, handle, len;
+	bool flush, read_rssi;
+
+	xSemaphoreTake(stream_lock, portMAX_DELAY);
+	if (!c->used) {
+		xSemaphoreGive(stream_lock);
+		return;
+	}
+	flush = conn_sample(c, now, light_sensor_mv(), &len);
+	conn_id = c->conn_id;
+	handle = c->handle;
+	memcpy(bda, c->bda, sizeof(bda));
+	read_rssi = now - c->rssi_at >= RSSI_READ_US;
+	if (read_rssi)
+		c->rssi_at = now;
+	xSemaphoreGive(stream_lock);
+
+	//the result lands in the link's RSSI for the next samples
+	if (read_rssi)
+		esp_ble_gap_read_rssi(bda);
+
+	//a frame still waiting on a congested link is replaced, the newer
+	//samples win
+	if (flush && !ble_notify_send(conn_id, handle, out, len))
+		ESP_LOGW(TAG, "conn %d: %u samples dropped", conn_id,
+					(len - BLE_STREAM_HDR_LEN) / BLE_STREAM_SAMPLE_LEN);
+}
+
+void ble_stream_subscribe(esp_gatt_if_t gatts_if, uint16_t conn_id,
+			uint16_t handle, const uint8_t *bda, uint16_t mtu, bool enable)
+{
+	stream_conn_t *c;
+
+	xSemaphoreTake(stream_lock, portMAX_DELAY);
+	c = conn_find(conn_id);
+	if (!c && enable) {
+		for (int i = 0; i < GATTS_CONN_MAX && !c; i++) {
+			if (!conns[i].used)
+				c = &conns[i];
+		}
+	}
+	if (c && enable) {
+		c->used = true;
+		c->conn_id = conn_id;
+		c->handle = handle;
+		c->mtu = mtu;
+		memcpy(c->bda, bda, sizeof(esp_bd_addr_t));
+		c->rssi_at = 0;
+		conn_restart(c);
+		ESP_LOGI(TAG, "conn %d streaming, %u samples every %u ms",
+						conn_id, frame_capacity(mtu), c->period);
+	} else if (c) {
+		c->used = false;
+		esp_timer_stop(c->timer);
+	}
+	xSemaphoreGive(stream_lock);
+}
+
+void ble_stream_set_mtu(uint16_t conn_id, uint16_t mtu)
+{
+	stream_conn_t *c;
+
+	xSemaphoreTake(stream_lock, portMAX_DELAY);
+	c = conn_find(conn_id);
+	//the period is part of the frame header, a partial frame is dropped
+	if (c && c->mtu != mtu) {
+		c->mtu = mtu;
+		conn_restart(c);
+		ESP_LOGI(TAG, "conn %d: %u samples every %u ms",
+						conn_id, frame_capacity(mtu), c->period);
+	}
+	xSemaphoreGive(stream_lock);
+}
+
+void ble_stream_disconnect(uint16_t conn_id)
+{
+	ble_stream_subscribe(0, conn_id, 0, NULL, 0, false);
+}
+
+void ble_stream_init()
+{
+	stream_lock = xSemaphoreCreateMutex();
+
+	for (int i = 0; i < GATTS_CONN_MAX; i++) {
+		esp_timer_create_args_t timer_args = {
+			.callback = stream_timer_cb,
+			.arg = &conns[i],
+			.name = "stream"
+		};
+		ESP_ERROR_CHECK(esp_timer_create(&timer_args, &conns[i].timer));
+	}
+}
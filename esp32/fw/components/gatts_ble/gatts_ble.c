@@ -1,8 +1,10 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/queue.h"
 #include "freertos/event_groups.h"
 #include "esp_system.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "nvs_flash.h"
 #include "esp_bt.h"
 
@@ -11,37 +13,217 @@
 #include "esp_bt_main.h"
 #include "gatts_ble.h"
 #include "gpio_handler.h"
+#include "buzzer.h"
+#include "led.h"
+#include "beep_sched.h"
+#include "light_sensor.h"
+#include "ble_ota.h"
+#include "ble_stream.h"
+#include "ble_notify.h"
+#include "ota_proto.h"
 #include "esp_gatt_common_api.h"
 
 #include "wifi_connect.h"
+#include "ota_session.h"
+#include "iap.h"
+#include "updater.h"
+#include "app_core.h"
+#include "app_port.h"
+
+//the WiFi fw update (updater app only) runs while BLE stays connected
+#if defined(CONFIG_DTC_UPDATER) && !defined(CONFIG_SW_COEXIST_ENABLE)
+#error "OTA needs WiFi/BT software coexistence (CONFIG_SW_COEXIST_ENABLE)"
+#endif
 
 static TaskHandle_t check_chars_thandle;
-static bool connected = false;
+static TaskHandle_t app_cmd_thandle;
+static TaskHandle_t ota_thandle;
+static xQueueHandle app_cmd_queue = NULL;
 uint8_t adv_config_done = 0;
-int8_t last_rssi_val = 0;
+static int64_t adv_start_time = 0;
+static bool advertising = false;
 uint16_t m_handles[IDX_NB];
 
-typedef enum mode_internal {
-	MODE_IDLE,		//can receive manual beep events
-	MODE_FWUPDATE,	//fw update triggered, no return to idle/loop until reset
-	MODE_LOOP		//characteristic notify & threshold check loop is running
-} mode_internal_t;
-
-typedef enum mode_loop_type {
-	LOOP_FIXEDINT,
-	LOOP_RANDINT,
-	LOOP_SOLAR,
-	LOOP_RSSI,
-	LOOP_NONE
-} mode_loop_type_t;
-
-static mode_internal_t mode_internal = MODE_IDLE;
-static mode_loop_type_t mode_loop = LOOP_NONE;
-
-static uint8_t threshold_val = 0;
-static int rand_array[3600];
+static app_core_t app_core;
+
+typedef enum app_cmd_type {
+	APP_CMD_WRITE,			//one byte characteristic write
+	APP_CMD_REPORT,			//report policy record
+	APP_CMD_REPORT_NOW,		//new subscriber, report on the next tick
+} app_cmd_type_t;
+
+//handed from the BT callback to the app task, which owns app_core
+typedef struct app_cmd {
+	app_cmd_type_t type;
+	uint16_t handle;
+	uint8_t val;			//written value, app_char_t for the report ones
+	uint8_t deadband;
+	uint8_t min_s;
+	uint16_t max_s;
+} app_cmd_t;
+
+static bool app_cmd_send(const app_cmd_t *cmd);
+
 static uint64_t int_pass;
 
+//one per link: CCCDs, RSSI and MTU are per connection
+typedef struct gatts_conn {
+	bool used;
+	uint16_t conn_id;
+	esp_bd_addr_t bda;
+	uint8_t subs;			//bit per SUB_*
+	int8_t rssi;			//last read, APP_RSSI_MIN until then
+	uint16_t mtu;
+} gatts_conn_t;
+
+//written from the BT callback, read by the notifying tasks
+static gatts_conn_t conns[GATTS_CONN_MAX];
+static portMUX_TYPE conn_mux = portMUX_INITIALIZER_UNLOCKED;
+
+//last valid station config write, handed to the updater
+static uint8_t sta_value[UPDATER_STA_CONFIG_MAX];
+static uint8_t sta_len;
+
+static void conn_add(uint16_t conn_id, const uint8_t *bda)
+{
+	bool added = false;
+
+	portENTER_CRITICAL(&conn_mux);
+	for (int i = 0; i < GATTS_CONN_MAX; i++) {
+		if (!conns[i].used) {
+			conns[i].used = true;
+			conns[i].conn_id = conn_id;
+			memcpy(conns[i].bda, bda, sizeof(esp_bd_addr_t));
+			conns[i].subs = 0;
+			conns[i].rssi = APP_RSSI_MIN;
+			conns[i].mtu = ESP_GATT_DEF_BLE_MTU_SIZE;
+			added = true;
+			break;
+		}
+	}
+	portEXIT_CRITICAL(&conn_mux);
+
+	if (!added)
+		ESP_LOGE(GATTS_TABLE_TAG, "conn %d: no context left", conn_id);
+}
+
+//subscriptions the connection had
+static uint8_t conn_remove(uint16_t conn_id)
+{
+	uint8_t subs = 0;
+
+	portENTER_CRITICAL(&conn_mux);
+	for (int i = 0; i < GATTS_CONN_MAX; i++) {
+		if (conns[i].used && conns[i].conn_id == conn_id) {
+			conns[i].used = false;
+			subs = conns[i].subs;
+		}
+	}
+	portEXIT_CRITICAL(&conn_mux);
+
+	return subs;
+}
+
+static void conn_set_sub(uint16_t conn_id, int sub, bool enable)
+{
+	portENTER_CRITICAL(&conn_mux);
+	for (int i = 0; i < GATTS_CONN_MAX; i++) {
+		if (!conns[i].used || conns[i].conn_id != conn_id)
+			continue;
+		if (enable)
+			conns[i].subs |= 1 << sub;
+		else
+			conns[i].subs &= ~(1 << sub);
+	}
+	portEXIT_CRITICAL(&conn_mux);
+}
+
+static bool conn_has_sub(uint16_t conn_id, int sub)
+{
+	bool ret = false;
+
+	portENTER_CRITICAL(&conn_mux);
+	for (int i = 0; i < GATTS_CONN_MAX; i++) {
+		if (conns[i].used && conns[i].conn_id == conn_id)
+			ret = conns[i].subs & (1 << sub);
+	}
+	portEXIT_CRITICAL(&conn_mux);
+
+	return ret;
+}
+
+//fills ids with the connections subscribed to sub, returns how many
+static int subscribers(int sub, uint16_t *ids)
+{
+	int n = 0;
+
+	portENTER_CRITICAL(&conn_mux);
+	for (int i = 0; i < GATTS_CONN_MAX; i++) {
+		if (conns[i].used && (conns[i].subs & (1 << sub)))
+			ids[n++] = conns[i].conn_id;
+	}
+	portEXIT_CRITICAL(&conn_mux);
+
+	return n;
+}
+
+static int conn_count()
+{
+	int n = 0;
+
+	portENTER_CRITICAL(&conn_mux);
+	for (int i = 0; i < GATTS_CONN_MAX; i++) {
+		if (conns[i].used)
+			n++;
+	}
+	portEXIT_CRITICAL(&conn_mux);
+
+	return n;
+}
+
+//RSSI reads complete by peer address
+static void conn_set_rssi(const uint8_t *bda, int8_t rssi)
+{
+	portENTER_CRITICAL(&conn_mux);
+	for (int i = 0; i < GATTS_CONN_MAX; i++) {
+		if (conns[i].used && !memcmp(conns[i].bda, bda, sizeof(esp_bd_addr_t)))
+			conns[i].rssi = rssi;
+	}
+	portEXIT_CRITICAL(&conn_mux);
+}
+
+//mtu 0 only reads it. returns the MTU of the link, 0 if it is gone
+static uint16_t conn_set_mtu(uint16_t conn_id, uint16_t mtu)
+{
+	uint16_t ret = 0;
+
+	portENTER_CRITICAL(&conn_mux);
+	for (int i = 0; i < GATTS_CONN_MAX; i++) {
+		if (conns[i].used && conns[i].conn_id == conn_id) {
+			if (mtu)
+				conns[i].mtu = mtu;
+			ret = conns[i].mtu;
+		}
+	}
+	portEXIT_CRITICAL(&conn_mux);
+
+	return ret;
+}
+
+int8_t gatts_ble_conn_rssi(uint16_t conn_id)
+{
+	int8_t rssi = APP_RSSI_MIN;
+
+	portENTER_CRITICAL(&conn_mux);
+	for (int i = 0; i < GATTS_CONN_MAX; i++) {
+		if (conns[i].used && conns[i].conn_id == conn_id)
+			rssi = conns[i].rssi;
+	}
+	portEXIT_CRITICAL(&conn_mux);
+
+	return rssi;
+}
+
 #define CONFIG_SET_RAW_ADV_DATA
 #ifdef CONFIG_SET_RAW_ADV_DATA
 uint8_t raw_adv_data[] = {
@@ -131,8 +313,6 @@ struct gatts_profile_inst {
 	esp_bt_uuid_t descr_uuid;
 };
 
-esp_ble_conn_update_params_t conn_params;
-
 void gatts_profile_event_handler(esp_gatts_cb_event_t event, 
 					esp_gatt_if_t gatts_if, esp_ble_gatts_cb_param_t * param);
 
@@ -144,6 +324,9 @@ struct gatts_profile_inst m_profile_tab[PROFILE_NUM] = {
 			     },
 };
 
+static const uint8_t ota_progress_value[OTA_PROGRESS_LEN] = { OTA_PROG_IDLE };
+static const uint8_t ap_info_value[1] = { 0 };	//channel 0: AP not up
+
 // database description of service + attributes
 const esp_gatts_attr_db_t gatt_db[IDX_NB] = {
 	// Service Declaration
@@ -151,18 +334,79 @@ const esp_gatts_attr_db_t gatt_db[IDX_NB] = {
 	[IDX_SVC] = {{ESP_GATT_AUTO_RSP}, 
 		{ESP_UUID_LEN_16, (uint8_t *)& service_uuid, ESP_GATT_PERM_READ, 
 		sizeof(uint16_t), sizeof(SERVICE_UUID), (uint8_t *) & SERVICE_UUID}},
-	DECLARE_CHAR(A, &CHAR_UUID_BUZZ_STAT,	RW_PERM )
-    DECLARE_CHAR(B, &CHAR_UUID_TRIG_MODE,	RW_PERM )
-    DECLARE_CHAR(C, &CHAR_UUID_F_INTVL,		RW_PERM )
-    DECLARE_CHAR(D, &CHAR_UUID_R_INTVL,		RW_PERM )
-    DECLARE_CHAR(E, &CHAR_UUID_RSSI,		READ_PERM )
-    DECLARE_CHAR(F, &CHAR_UUID_RSSI_MIN,	RW_PERM )
-    DECLARE_CHAR(H, &CHAR_UUID_SOLAR,		READ_PERM )
-    DECLARE_CHAR(I, &CHAR_UUID_SOLAR_MIN, 	RW_PERM )
-    DECLARE_CHAR(J, &CHAR_UUID_PASS, 		READ_PERM )
+	DECLARE_CHAR(A, &CHAR_UUID_BUZZ_STAT,	RW_PERM,	char_prop_read_write )
+    DECLARE_CHAR(B, &CHAR_UUID_TRIG_MODE,	RW_PERM,	char_prop_read_write )
+    DECLARE_CHAR(C, &CHAR_UUID_F_INTVL,		RW_PERM,	char_prop_read_write )
+    DECLARE_CHAR(D, &CHAR_UUID_R_INTVL,		RW_PERM,	char_prop_read_write )
+    DECLARE_CHAR(E, &CHAR_UUID_RSSI,		READ_PERM,	char_prop_read_notify )
+    DECLARE_CCC(E)
+    DECLARE_CHAR(F, &CHAR_UUID_RSSI_MIN,	RW_PERM,	char_prop_read_write )
+    DECLARE_CHAR(H, &CHAR_UUID_SOLAR,		READ_PERM,	char_prop_read_notify )
+    DECLARE_CCC(H)
+    DECLARE_CHAR(I, &CHAR_UUID_SOLAR_MIN, 	RW_PERM,	char_prop_read_write )
+    DECLARE_CHAR(J, &CHAR_UUID_PASS, 		READ_PERM,	char_prop_read )
+
+	//OTA frames in (write without response), acks out (notify)
+	[IDX_CHAR_K] = {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16, 
+		(uint8_t *)&character_declaration_uuid, ESP_GATT_PERM_READ,
+		CHAR_DECLARATION_SIZE, CHAR_DECLARATION_SIZE,
+		(uint8_t *)&char_prop_write_nr_notify}},
+	[IDX_CHAR_VAL_K] = {{ESP_GATT_RSP_BY_APP}, {ESP_UUID_LEN_16,
+		(uint8_t *)&CHAR_UUID_OTA, WRITE_PERM,
+		BLE_OTA_FRAME_MAX, 0, NULL}},
+	DECLARE_CCC(K)
+
+	//OTA progress of any transfer, see ota_proto.h
+	[IDX_CHAR_L] = {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16,
+		(uint8_t *)&character_declaration_uuid, ESP_GATT_PERM_READ,
+		CHAR_DECLARATION_SIZE, CHAR_DECLARATION_SIZE,
+		(uint8_t *)&char_prop_read_notify}},
+	[IDX_CHAR_VAL_L] = {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16,
+		(uint8_t *)&CHAR_UUID_OTA_PROGRESS, READ_PERM,
+		OTA_PROGRESS_LEN, sizeof(ota_progress_value),
+		(uint8_t *)ota_progress_value}},
+	DECLARE_CCC(L)
+
+	//station mode OTA config, see wifi_connect.h. write only, the
+	//passphrase is never read back
+	[IDX_CHAR_M] = {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16,
+		(uint8_t *)&character_declaration_uuid, ESP_GATT_PERM_READ,
+		CHAR_DECLARATION_SIZE, CHAR_DECLARATION_SIZE,
+		(uint8_t *)&char_prop_write}},
+	[IDX_CHAR_VAL_M] = {{ESP_GATT_RSP_BY_APP}, {ESP_UUID_LEN_16,
+		(uint8_t *)&CHAR_UUID_OTA_STA, WRITE_PERM,
+		WIFI_STA_CONFIG_MAX, 0, NULL}},
+
+	//SoftAP ssid, channel and address of this update, see wifi_connect.h
+	[IDX_CHAR_N] = {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16,
+		(uint8_t *)&character_declaration_uuid, ESP_GATT_PERM_READ,
+		CHAR_DECLARATION_SIZE, CHAR_DECLARATION_SIZE,
+		(uint8_t *)&char_prop_read}},
+	[IDX_CHAR_VAL_N] = {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16,
+		(uint8_t *)&CHAR_UUID_AP_INFO, READ_PERM,
+		WIFI_AP_INFO_MAX, sizeof(ap_info_value), (uint8_t *)ap_info_value}},
+
+	//batched RSSI and light samples, notify only, see ble_stream.h
+	[IDX_CHAR_O] = {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16,
+		(uint8_t *)&character_declaration_uuid, ESP_GATT_PERM_READ,
+		CHAR_DECLARATION_SIZE, CHAR_DECLARATION_SIZE,
+		(uint8_t *)&char_prop_notify}},
+	[IDX_CHAR_VAL_O] = {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16,
+		(uint8_t *)&CHAR_UUID_STREAM, READ_PERM,
+		BLE_STREAM_FRAME_MAX, 0, NULL}},
+	DECLARE_CCC(O)
+
+	//RSSI and light reporting policies, see REPORT_RECORD_LEN
+	[IDX_CHAR_P] = {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16,
+		(uint8_t *)&character_declaration_uuid, ESP_GATT_PERM_READ,
+		CHAR_DECLARATION_SIZE, CHAR_DECLARATION_SIZE,
+		(uint8_t *)&char_prop_read_write}},
+	[IDX_CHAR_VAL_P] = {{ESP_GATT_RSP_BY_APP}, {ESP_UUID_LEN_16,
+		(uint8_t *)&CHAR_UUID_REPORT, RW_PERM,
+		2 * REPORT_RECORD_LEN, 0, NULL}},
 };
 
-static void show_bonded_devices(void)
+void gatts_ble_show_bonds(void)
 {
 	int dev_num = esp_ble_get_bond_device_num();
 	esp_ble_bond_dev_t *dev_list =
@@ -192,28 +436,6 @@ static void __attribute__ ((unused)) remove_all_bonded_devices(void)
 	free(dev_list);
 }
 
-void blink_out_code(int passkey)
-{
-	int y = 100000;
-	int x = 1000000;
-	int gpios[3] = { GPIO_RED, GPIO_GREEN, GPIO_BLUE };
-	for (int i = 1; i <= 6; i++) {
-		int j = (passkey % x) / y;
-		y /= 10;
-		x /= 10;
-		ESP_LOGI(GATTS_TABLE_TAG, "key digit:%d\n", j);
-		vTaskDelay(1000 / portTICK_PERIOD_MS);
-
-		if (j == 0) {
-			gpio_blink_white();
-		} else {
-			for (int k = 1; k <= j; k++) {
-				gpio_blink_one(gpios[i % 3]);
-			}
-		}
-	}
-}
-
 void
 gap_event_handler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t * param)
 {
@@ -251,12 +473,16 @@ gap_event_handler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t * param)
 			ESP_LOGE(GATTS_TABLE_TAG, "advertising start failed");
 		} else {
 			ESP_LOGI(GATTS_TABLE_TAG, "advertising start successfully");
+			advertising = true;
+			if (!adv_start_time)
+				adv_start_time = esp_timer_get_time();
 		}
 		break;
 	case ESP_GAP_BLE_ADV_STOP_COMPLETE_EVT:
 		if (param->adv_stop_cmpl.status != ESP_BT_STATUS_SUCCESS) {
 			ESP_LOGE(GATTS_TABLE_TAG, "Advertising stop failed");
 		} else {
+			advertising = false;
 			ESP_LOGI(GATTS_TABLE_TAG, "Stop adv successfully\n");
 		}
 		break;
@@ -270,12 +496,19 @@ gap_event_handler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t * param)
 			param->update_conn_params.latency,
 			param->update_conn_params.timeout);
 		break;
+	case ESP_GAP_BLE_SET_PKT_LENGTH_COMPLETE_EVT:
+		ESP_LOGI(GATTS_TABLE_TAG, "data length status %d, rx %d tx %d",
+				 param->pkt_data_lenth_cmpl.status,
+				 param->pkt_data_lenth_cmpl.params.rx_len,
+				 param->pkt_data_lenth_cmpl.params.tx_len);
+		break;
 	case ESP_GAP_BLE_READ_RSSI_COMPLETE_EVT:
 		if (param->read_rssi_cmpl.status != ESP_BT_STATUS_SUCCESS) {
 			ESP_LOGE(GATTS_TABLE_TAG, "remote rssi read failed");
 		} else {
 			//ESP_LOGI(GATTS_TABLE_TAG,"remote rssi read successful");
-			last_rssi_val = param->read_rssi_cmpl.rssi;
+			conn_set_rssi(param->read_rssi_cmpl.remote_addr,
+											param->read_rssi_cmpl.rssi);
 			//xEventGroupSetBits(eg,TASK_1_BIT);
 		}
 		break;
@@ -298,10 +531,9 @@ gap_event_handler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t * param)
 		ESP_LOGI(GATTS_TABLE_TAG,
 			 "ESP_GAP_BLE_NC_REQ_EVT, the passkey Notify number:%d",
 			 param->ble_security.key_notif.passkey);
-		vTaskDelay(1000 / portTICK_PERIOD_MS);
 		#ifndef CONFIG_NUMERIC_COMPARISON_EZ_DEV
-			blink_out_code(param->ble_security.key_notif.passkey);
-        	vTaskDelay(2000 / portTICK_PERIOD_MS);
+			//blinks out while we wait for the button
+			led_passkey(param->ble_security.key_notif.passkey);
 			//check for button press here
 			bool yesno = gpio_get_yesno();
 			if(yesno)
@@ -327,7 +559,7 @@ gap_event_handler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t * param)
 		//to the user to input it in the peer deivce.
 		ESP_LOGI(GATTS_TABLE_TAG, "The passkey Notify number:%d",
 			 param->ble_security.key_notif.passkey);
-		blink_out_code(param->ble_security.key_notif.passkey);
+		led_passkey(param->ble_security.key_notif.passkey);
 		break;
 	case ESP_GAP_BLE_KEY_EVT:
 		//shows the ble key info share with peer device to the user.
@@ -348,7 +580,7 @@ gap_event_handler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t * param)
 			ESP_LOGI(GATTS_TABLE_TAG, "pair status = %s",
 				 param->ble_security.
 				 auth_cmpl.success ? "success" : "fail");
-			show_bonded_devices();
+			gatts_ble_show_bonds();
 			break;
 		}
 	case ESP_GAP_BLE_REMOVE_BOND_DEV_COMPLETE_EVT:
@@ -422,109 +654,408 @@ gap_event_handler(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t * param)
 	}
 }
 
-void set_device_value(uint16_t write_handle, uint8_t write_val)
+//platform side of app_core
+void app_port_buzzer(bool on)
 {
-	if(write_handle == m_handles[IDX_CHAR_VAL_A]) {
-		ESP_LOGI(GATTS_TABLE_TAG, "buzz");
-		if (write_val == 0x00) {
-			gpio_set_level(GPIO_OUTPUT_IO_0, 0);
-			gpio_white_off();
-		} else if (write_val == 0x01) {
-			gpio_set_level(GPIO_OUTPUT_IO_0, 1);
-			gpio_white_on();
-		} else {
-			ESP_LOGE(GATTS_TABLE_TAG, "invalid value. need 1 or 0.");
-		}
+	if (on) {
+		buzzer_on();
+		led_set(LED_WHITE);
+	} else {
+		buzzer_stop();
+		led_set(LED_OFF);
 	}
-	else if(write_handle == m_handles[IDX_CHAR_VAL_B]) {
-		if (write_val == 0x00) {
-			ESP_LOGI(GATTS_TABLE_TAG, "mode: cancel all !!");
-			if(mode_internal != MODE_LOOP)
-				return; //can only enter idle state from loop state
-
-			mode_internal = MODE_IDLE;
-			//stop characteristic handler loop
-			vTaskSuspend( check_chars_thandle  );
-
-		} else if (write_val == 0x01) {
-			ESP_LOGI(GATTS_TABLE_TAG, "mode: fw update");
-			if(mode_internal == MODE_FWUPDATE)
-				return; //don't enter update state twice
-
-			if(mode_internal == MODE_LOOP)
-				vTaskSuspend( check_chars_thandle  ); 
-
-			mode_internal = MODE_FWUPDATE;
-			//stop characteristic handler loop
-			//vTaskSuspend( check_chars_thandle  );
-			//init wifi, AP, socket server, recv, write to partition
-			wifi_connect_init(int_pass);
-			socket_server(); //timeout
-			wifi_connect_destroy();
-			//restart
-			vTaskDelay(2000 / portTICK_RATE_MS);
-			esp_restart();
-		} else if (write_val == 0x02) {
-			ESP_LOGI(GATTS_TABLE_TAG, "mode: check char loop");
-			if(mode_internal != MODE_IDLE)
-				return; //only idle state can enter loop state
-			
-			mode_internal = MODE_LOOP;
-			mode_loop = LOOP_NONE;
-			xTaskCreate(check_char_thresholds_task,"char task loop", 8192, 
-												NULL, 1, &check_chars_thandle);
-		} else {
-			ESP_LOGE(GATTS_TABLE_TAG, "Invalid mode. Enter 0, 1, 2");
-		}
+}
+
+void app_port_beep()
+{
+	short_beep();
+}
+
+void app_port_silence()
+{
+	buzzer_stop();
+}
+
+void app_port_loop_start()
+{
+	led_set_idle(&led_heartbeat);
+	//loop task is created once, suspended in idle
+	if(check_chars_thandle == NULL)
+		xTaskCreate(check_char_thresholds_task,"char task loop", 8192, 
+										NULL, 1, &check_chars_thandle);
+	else
+		vTaskResume( check_chars_thandle );
+}
+
+void app_port_loop_stop()
+{
+	//stop characteristic handler loop
+	vTaskSuspend( check_chars_thandle  );
+	beep_sched_cancel_all();
+	led_set_idle(NULL);
+}
+
+#ifdef CONFIG_DTC_UPDATER
+static void ota_task(void *arg)
+{
+	ota_progress_t progress;
+
+	if (arg) {
+		//init wifi, join the network, pull from the host server
+		if (wifi_connect_init_sta())
+			socket_client();
+	} else {
+		wifi_ap_info_t info;
+		uint8_t value[WIFI_AP_INFO_MAX];
+
+		//init wifi, AP, socket server, recv, write to partition. the
+		//client polls the AP info until the channel is set
+		wifi_connect_init(int_pass, &info);
+		esp_ble_gatts_set_attr_value(m_handles[IDX_CHAR_VAL_N],
+						wifi_connect_ap_info_value(&info, value), value);
+		socket_server(); //timeout
 	}
-	else if(write_handle == m_handles[IDX_CHAR_VAL_C]) {
-		ESP_LOGI(GATTS_TABLE_TAG, "fixed int !!");
-		//change internal mode state
-		mode_loop = LOOP_FIXEDINT;
-		threshold_val = write_val;
-		//parameter check?
-	}
-	else if(write_handle == m_handles[IDX_CHAR_VAL_D]) {
-		ESP_LOGI(GATTS_TABLE_TAG, "random int !!");
-		//change internal mode state
-		mode_loop = LOOP_RANDINT;
-		threshold_val = write_val;
-		uint16_t rand_index;
-		for(int j = 0; j < 3600; j++) {
-			rand_array[j] = 0;
-		}
-		for(int k = 0; k < threshold_val; k++) {
-			rand_index = esp_random() % 3600;
-			if(rand_array[rand_index] != 1) {
-				rand_array[rand_index] = 1;
-			} else {
-				k--;
-			}
-		}
-		ESP_LOGI(GATTS_TABLE_TAG, "random beep schedule:");
-		for(int j = 0; j < 3600; j++) {
-			if(rand_array[j] == 1) {
-				ESP_LOGI(GATTS_TABLE_TAG, "> %d", j);
-			}
-		}
+	wifi_connect_destroy();
+	//restart, let the last progress notification go out
+	vTaskDelay(2000 / portTICK_RATE_MS);
+	ota_progress_get(&progress);
+	updater_exit(progress.state == OTA_PROG_DONE);
+}
+
+//runs the request the normal app left, or waits for an image on a
+//device without a bootable app. never returns to the normal app flow
+static void updater_start()
+{
+	updater_req_t req;
+	bool station = false;
+
+	if (updater_get_request(&req)) {
+		iap_set_target(updater_target(&req));
+		station = req.station &&
+						wifi_connect_set_sta(req.sta_config, req.sta_len);
+	} else {
+		updater_boot_app();
+	}
+
+	xTaskCreate(ota_task, "ota task", OTA_TASK_STACK,
+						station ? (void *)1 : NULL, OTA_TASK_PRIO, &ota_thandle);
+}
+
+//the update is already running
+bool app_port_fw_update(bool station)
+{
+	return false;
+}
+#else
+static void handoff_task(void *arg)
+{
+	vTaskDelay(UPDATER_HANDOFF_MS / portTICK_RATE_MS);
+	esp_restart();
+}
+
+//store the request and reboot into the updater shortly, the write is
+//answered and the pass can be read before the link goes down
+bool app_port_fw_update(bool station)
+{
+	updater_req_t req = {
+		.station = station,
+		.sta_len = sta_len,
+		.pass = int_pass,
+	};
+
+	memcpy(req.sta_config, sta_value, sta_len);
+
+	if (ota_thandle != NULL || !updater_request(&req))
+		return false;
+
+	xTaskCreate(handoff_task, "handoff task", 2048, NULL, OTA_TASK_PRIO,
+															&ota_thandle);
+	return true;
+}
+#endif
+
+bool app_port_fw_sta_ready()
+{
+	return sta_len != 0;
+}
+
+int app_port_sched_fixed(uint32_t period_ms)
+{
+	return beep_sched_fixed(period_ms);
+}
+
+int app_port_sched_random(uint16_t count, uint32_t window_ms)
+{
+	return beep_sched_random(count, window_ms);
+}
+
+void app_port_sched_cancel(int id)
+{
+	beep_sched_cancel(id);
+}
+
+static const uint8_t sub_cfg_idx[SUB_MAX] = {
+	[SUB_RSSI] = IDX_CHAR_CFG_E,
+	[SUB_SOLAR] = IDX_CHAR_CFG_H,
+	[SUB_OTA] = IDX_CHAR_CFG_K,
+	[SUB_PROGRESS] = IDX_CHAR_CFG_L,
+	[SUB_STREAM] = IDX_CHAR_CFG_O,
+};
+
+static int handle_to_sub(uint16_t handle)
+{
+	for (int i = 0; i < SUB_MAX; i++) {
+		if (m_handles[sub_cfg_idx[i]] == handle)
+			return i;
+	}
+
+	return -1;
+}
+
+//the value is always updated for reads, only subscribers are notified
+void app_port_notify(app_char_t chr, uint8_t val)
+{
+	uint16_t ids[GATTS_CONN_MAX];
+	uint16_t handle;
+	int sub, n;
+
+	if (chr == APP_CHAR_RSSI) {
+		handle = m_handles[IDX_CHAR_VAL_E];
+		sub = SUB_RSSI;
+	} else if (chr == APP_CHAR_SOLAR) {
+		handle = m_handles[IDX_CHAR_VAL_H];
+		sub = SUB_SOLAR;
+	} else {
+		return;
+	}
+
+	esp_ble_gatts_set_attr_value(handle, sizeof(val), &val);
+
+	n = subscribers(sub, ids);
+	for (int i = 0; i < n; i++)
+		ble_notify_send(ids[i], handle, &val, sizeof(val));
+}
+
+void app_port_set_value(app_char_t chr, uint8_t val)
+{
+	if (chr == APP_CHAR_RSSI)
+		esp_ble_gatts_set_attr_value(m_handles[IDX_CHAR_VAL_E], 1, &val);
+	else if (chr == APP_CHAR_SOLAR)
+		esp_ble_gatts_set_attr_value(m_handles[IDX_CHAR_VAL_H], 1, &val);
+}
+
+//checked here so the write can be answered, applied by app_cmd_task
+static void report_write(esp_gatt_if_t gatts_if, esp_ble_gatts_cb_param_t *param)
+{
+	esp_gatt_status_t status = ESP_GATT_OK;
+	const uint8_t *v = param->write.value;
+	app_cmd_t cmd = { .type = APP_CMD_REPORT, .val = APP_CHAR_MAX };
+
+	if (param->write.len == REPORT_RECORD_LEN) {
+		if (v[0] == (CHAR_UUID_RSSI & 0xff))
+			cmd.val = APP_CHAR_RSSI;
+		else if (v[0] == (CHAR_UUID_SOLAR & 0xff))
+			cmd.val = APP_CHAR_SOLAR;
+		cmd.deadband = v[1];
+		cmd.min_s = v[2];
+		cmd.max_s = (v[3] << 8) | v[4];
+	}
+
+	if (param->write.len != REPORT_RECORD_LEN || param->write.offset)
+		status = ESP_GATT_INVALID_ATTR_LEN;
+	else if (cmd.val == APP_CHAR_MAX ||
+			!app_core_report_valid(cmd.deadband, cmd.min_s, cmd.max_s))
+		status = ESP_GATT_OUT_OF_RANGE;
+	else if (!app_cmd_send(&cmd))
+		status = ESP_GATT_BUSY;
+
+	if (param->write.need_rsp)
+		esp_ble_gatts_send_response(gatts_if, param->write.conn_id,
+								param->write.trans_id, status, NULL);
+}
+
+static void report_read(esp_gatt_if_t gatts_if, esp_ble_gatts_cb_param_t *param)
+{
+	static const uint16_t *uuids[APP_REPORT_MAX] = {
+		[APP_REPORT_RSSI] = &CHAR_UUID_RSSI,
+		[APP_REPORT_SOLAR] = &CHAR_UUID_SOLAR,
+	};
+	esp_gatt_rsp_t rsp;
+	uint8_t *v = rsp.attr_value.value;
+
+	memset(&rsp, 0, sizeof(rsp));
+	rsp.attr_value.handle = param->read.handle;
+	rsp.attr_value.len = APP_REPORT_MAX * REPORT_RECORD_LEN;
+	for (int i = 0; i < APP_REPORT_MAX; i++, v += REPORT_RECORD_LEN) {
+		v[0] = *uuids[i] & 0xff;
+		v[1] = app_core.report[i].deadband;
+		v[2] = app_core.report[i].min_s;
+		v[3] = app_core.report[i].max_s >> 8;
+		v[4] = app_core.report[i].max_s;
 	}
-	else if(write_handle == m_handles[IDX_CHAR_VAL_F]) {
-		ESP_LOGI(GATTS_TABLE_TAG, "rssi min !!");
-		//change internal mode state
-		mode_loop = LOOP_RSSI;
-		threshold_val = write_val;
+
+	esp_ble_gatts_send_response(gatts_if, param->read.conn_id,
+						param->read.trans_id, ESP_GATT_OK, &rsp);
+}
+
+//CCCD write, bit 0 enables notifications. indications aren't offered
+static void ccc_write(esp_gatt_if_t gatts_if, esp_ble_gatts_cb_param_t *param,
+																	int sub)
+{
+	esp_gatt_status_t status = ESP_GATT_OK;
+	uint16_t conn_id = param->write.conn_id;
+	bool enable;
+
+	if (param->write.len != 2 || param->write.offset) {
+		status = ESP_GATT_INVALID_ATTR_LEN;
+		goto done;
 	}
-	else if(write_handle == m_handles[IDX_CHAR_VAL_I]) {
-		ESP_LOGI(GATTS_TABLE_TAG, "solar min !!");
-		//change internal mode state
-		mode_loop = LOOP_SOLAR;
-		threshold_val = write_val;
+
+	enable = param->write.value[0] & 0x01;
+	conn_set_sub(conn_id, sub, enable);
+
+	switch (sub) {
+	case SUB_RSSI:
+		//the new subscriber gets a value without waiting for a change
+		if (enable)
+			app_cmd_send(&(app_cmd_t) { .type = APP_CMD_REPORT_NOW,
+											.val = APP_CHAR_RSSI });
+		break;
+	case SUB_SOLAR:
+		if (enable)
+			app_cmd_send(&(app_cmd_t) { .type = APP_CMD_REPORT_NOW,
+											.val = APP_CHAR_SOLAR });
+		break;
+	case SUB_PROGRESS:
+		ble_ota_progress_subscribe(gatts_if, conn_id,
+							m_handles[IDX_CHAR_VAL_L], enable);
+		break;
+	case SUB_STREAM:
+		ble_stream_subscribe(gatts_if, conn_id, m_handles[IDX_CHAR_VAL_O],
+				param->write.bda, conn_set_mtu(conn_id, 0), enable);
+		break;
+	default:
+		//OTA acks go to the writer, RSSI/light through app_port_notify
+		break;
+	}
+
+done:
+	if (param->write.need_rsp)
+		esp_ble_gatts_send_response(gatts_if, param->write.conn_id,
+								param->write.trans_id, status, NULL);
+}
+
+static void ccc_read(esp_gatt_if_t gatts_if, esp_ble_gatts_cb_param_t *param)
+{
+	esp_gatt_rsp_t rsp;
+	int sub = handle_to_sub(param->read.handle);
+
+	if (sub < 0) {
+		esp_ble_gatts_send_response(gatts_if, param->read.conn_id,
+					param->read.trans_id, ESP_GATT_INVALID_HANDLE, NULL);
+		return;
+	}
+
+	memset(&rsp, 0, sizeof(rsp));
+	rsp.attr_value.handle = param->read.handle;
+	rsp.attr_value.len = 2;
+	rsp.attr_value.value[0] = conn_has_sub(param->read.conn_id, sub);
+	esp_ble_gatts_send_response(gatts_if, param->read.conn_id,
+						param->read.trans_id, ESP_GATT_OK, &rsp);
+}
+
+static int handle_to_char(uint16_t handle)
+{
+	static const int idx[APP_CHAR_MAX] = {
+		IDX_CHAR_VAL_A, IDX_CHAR_VAL_B, IDX_CHAR_VAL_C,
+		IDX_CHAR_VAL_D, IDX_CHAR_VAL_E, IDX_CHAR_VAL_F,
+		IDX_CHAR_VAL_J, IDX_CHAR_VAL_H, IDX_CHAR_VAL_I
+	};
+	int i;
+
+	for (i = 0; i < APP_CHAR_MAX; i++) {
+		if (m_handles[idx[i]] == handle)
+			return i;
+	}
+
+	return -1;
+}
+
+void set_device_value(uint16_t write_handle, uint8_t write_val)
+{
+	int chr = handle_to_char(write_handle);
+	app_core_err_t err;
+
+	if (chr < 0) {
+		ESP_LOGI(GATTS_TABLE_TAG, "can't write that handle!");
+		return;
 	}
-	else {
+
+	err = app_core_write(&app_core, chr, write_val);
+	switch (err) {
+	case APP_CORE_OK:
+		ESP_LOGI(GATTS_TABLE_TAG, "char %d: mode %d loop %d threshold %d",
+				chr, app_core.mode, app_core.loop, app_core.threshold);
+		break;
+	case APP_CORE_ERR_STATE:
+		ESP_LOGI(GATTS_TABLE_TAG, "char %d: 0x%02x ignored in mode %d",
+									chr, write_val, app_core.mode);
+		break;
+	case APP_CORE_ERR_VALUE:
+		ESP_LOGE(GATTS_TABLE_TAG, "char %d: invalid value 0x%02x",
+												chr, write_val);
+		break;
+	default:
 		ESP_LOGI(GATTS_TABLE_TAG, "can't write that handle!");
+		break;
 	}
 }
 
+//owns all mode and state transitions. runs writes in order, off the BT 
+//callback task, so they may block (fw update never returns)
+static void app_cmd_task(void *arg)
+{
+	app_cmd_t cmd;
+	for (;;) {
+		if (!xQueueReceive(app_cmd_queue, &cmd, portMAX_DELAY))
+			continue;
+
+		switch (cmd.type) {
+		case APP_CMD_WRITE:
+			ESP_LOGI(GATTS_TABLE_TAG, "write handle = %d, value = 0x%02x",
+													cmd.handle, cmd.val);
+			set_device_value(cmd.handle, cmd.val);
+			break;
+		case APP_CMD_REPORT:
+			if (app_core_set_report(&app_core, cmd.val, cmd.deadband,
+									cmd.min_s, cmd.max_s) == APP_CORE_OK)
+				ESP_LOGI(GATTS_TABLE_TAG, "report char %d: deadband %d%% "
+						"min %ds max %ds", cmd.val, cmd.deadband, cmd.min_s,
+						cmd.max_s);
+			break;
+		case APP_CMD_REPORT_NOW:
+			app_core_report_now(&app_core, cmd.val);
+			break;
+		}
+	}
+}
+
+//called from the BT callback task, must not block
+static bool app_cmd_send(const app_cmd_t *cmd)
+{
+	if (app_cmd_queue == NULL)
+		return false;
+
+	return xQueueSend(app_cmd_queue, cmd, 0) == pdTRUE;
+}
+
+static bool app_cmd_post(uint16_t handle, uint8_t val)
+{
+	app_cmd_t cmd = { .type = APP_CMD_WRITE, .handle = handle, .val = val };
+
+	return app_cmd_send(&cmd);
+}
+
 void
 gatts_profile_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if,
 											esp_ble_gatts_cb_param_t * param)
@@ -548,23 +1079,63 @@ gatts_profile_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if,
 	}
 	case ESP_GATTS_READ_EVT:
 		ESP_LOGI(GATTS_TABLE_TAG, "ESP_GATTS_READ_EVT");
+		//only the CCCDs and the report policy are answered by the app
+		if (param->read.need_rsp &&
+						param->read.handle == m_handles[IDX_CHAR_VAL_P])
+			report_read(gatts_if, param);
+		else if (param->read.need_rsp)
+			ccc_read(gatts_if, param);
 		break;
 	case ESP_GATTS_WRITE_EVT:
-		if (!param->write.is_prep) {
-			// length of gattc write data must be < GATTS_CHAR_VAL_LEN_MAX.
-			ESP_LOGI(GATTS_TABLE_TAG,
-						"GATT_WRITE_EVT, handle = %d, value len = %d, value :",
-				 						param->write.handle, param->write.len);
-			esp_log_buffer_hex(
-						GATTS_TABLE_TAG, param->write.value, param->write.len);
+		if (!param->write.is_prep &&
+							param->write.handle == m_handles[IDX_CHAR_VAL_K]) {
+			//OTA frames, no response
+			if (!ble_ota_write(gatts_if, param->write.conn_id,
+						param->write.handle, param->write.value,
+													param->write.len))
+				ESP_LOGW(GATTS_TABLE_TAG, "ota frame dropped");
+		} else if (!param->write.is_prep &&
+						param->write.handle == m_handles[IDX_CHAR_VAL_P]) {
+			report_write(gatts_if, param);
+		} else if (!param->write.is_prep &&
+						handle_to_sub(param->write.handle) >= 0) {
+			ccc_write(gatts_if, param, handle_to_sub(param->write.handle));
+		} else if (!param->write.is_prep &&
+						param->write.handle == m_handles[IDX_CHAR_VAL_M]) {
+			//station config, not a one byte command. kept for the update
+			//request, the updater hands it to wifi_connect_set_sta
+			esp_gatt_status_t status = ESP_GATT_OK;
+
+			if (param->write.len > sizeof(sta_value) ||
+					!updater_sta_config_valid(param->write.value,
+												param->write.len)) {
+				status = ESP_GATT_INVALID_ATTR_LEN;
+			} else {
+				memcpy(sta_value, param->write.value, param->write.len);
+				sta_len = param->write.len;
+			}
 
-			//all vals must be 1 byte long
-			set_device_value(param->write.handle, param->write.value[0]);
+			if (param->write.need_rsp) {
+				esp_ble_gatts_send_response(gatts_if,param->write.conn_id,
+							    	param->write.trans_id, status, NULL);
+			}
+		} else if (!param->write.is_prep) {
+			esp_gatt_status_t status = ESP_GATT_OK;
+
+			// length of gattc write data must be < GATTS_CHAR_VAL_LEN_MAX.
+			//all vals must be 1 byte long. handled by app_cmd_task
+			if (param->write.len < 1) {
+				status = ESP_GATT_INVALID_ATTR_LEN;
+			} else if (!app_cmd_post(param->write.handle,
+											param->write.value[0])) {
+				ESP_LOGE(GATTS_TABLE_TAG, "cmd queue full, write dropped");
+				status = ESP_GATT_BUSY;
+			}
 
 			// send response when param->write.need_rsp is true
 			if (param->write.need_rsp) {
 				esp_ble_gatts_send_response(gatts_if,param->write.conn_id,
-							    	param->write.trans_id,ESP_GATT_OK, NULL);
+							    	param->write.trans_id, status, NULL);
 			}
 		} else {
 			ESP_LOGI(GATTS_TABLE_TAG, "bad code path ");
@@ -578,6 +1149,8 @@ gatts_profile_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if,
 	case ESP_GATTS_MTU_EVT:
 		ESP_LOGI(GATTS_TABLE_TAG, "ESP_GATTS_MTU_EVT, MTU %d",
 			 param->mtu.mtu);
+		conn_set_mtu(param->mtu.conn_id, param->mtu.mtu);
+		ble_stream_set_mtu(param->mtu.conn_id, param->mtu.mtu);
 		break;
 	case ESP_GATTS_CONF_EVT:
 		//ESP_LOGI(GATTS_TABLE_TAG,"ESP_GATTS_CONF_EVT %d",param->conf.status);
@@ -587,6 +1160,9 @@ gatts_profile_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if,
 			 param->start.status, param->start.service_handle);
 		break;
 	case ESP_GATTS_CONNECT_EVT:
+	{
+		esp_ble_conn_update_params_t conn_params;
+
 		ESP_LOGI(GATTS_TABLE_TAG, "ESP_GATTS_CONNECT_EVT, conn_id = %d",
 													 param->connect.conn_id);
 		esp_log_buffer_hex(GATTS_TABLE_TAG, param->connect.remote_bda, 6);
@@ -599,18 +1175,36 @@ gatts_profile_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if,
 		conn_params.min_int = 0x10;	// min_int = 0x10*1.25ms = 20ms
 		conn_params.timeout = 400;	// timeout = 400*10ms = 4000ms
 		//start sent the update connection parameters to the peer device.
-		connected = true;
-        show_bonded_devices();
+		conn_add(param->connect.conn_id, param->connect.remote_bda);
+		ble_notify_connect(gatts_if, param->connect.conn_id);
+		//longer LL packets, a 511 byte stream frame (MTU 517) takes 3 of
+		//them instead of 20
+		esp_ble_gap_set_pkt_data_len(param->connect.remote_bda,
+												BLE_STREAM_DATA_LEN);
         //needed? 
 		//esp_ble_gap_update_conn_params(&conn_params);
+
+		//the controller stops advertising on a connection, keep taking
+		//centrals while it has links left
+		advertising = false;
+		if (conn_count() < GATTS_CONN_MAX)
+			esp_ble_gap_start_advertising(&adv_params);
 		break;
+	}
 	case ESP_GATTS_DISCONNECT_EVT:
 		ESP_LOGI(GATTS_TABLE_TAG, "ESP_GATTS_DISCONNECT_EVT, reason = %d",
 													 param->disconnect.reason);
-		connected = false;
+		ble_ota_disconnect(param->disconnect.conn_id);
+		ble_stream_disconnect(param->disconnect.conn_id);
+		ble_notify_disconnect(param->disconnect.conn_id);
+		if (conn_remove(param->disconnect.conn_id) & (1 << SUB_PROGRESS))
+			ble_ota_progress_subscribe(gatts_if, param->disconnect.conn_id,
+											0, false);
 		//mode_internal = MODE_IDLE;
 		////vTaskSuspend( check_chars_thandle );
-		esp_ble_gap_start_advertising(&adv_params);
+		//still up unless every link was taken
+		if (!advertising)
+			esp_ble_gap_start_advertising(&adv_params);
 		break;
 	case ESP_GATTS_CREAT_ATTR_TAB_EVT:
 	{
@@ -628,12 +1222,16 @@ gatts_profile_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if,
 		}
 		break;
 	}
+	case ESP_GATTS_CONGEST_EVT:
+		ESP_LOGD(GATTS_TABLE_TAG, "conn %d congested %d",
+				 param->congest.conn_id, param->congest.congested);
+		ble_notify_congest(param->congest.conn_id, param->congest.congested);
+		break;
 	case ESP_GATTS_STOP_EVT:
 	case ESP_GATTS_OPEN_EVT:
 	case ESP_GATTS_CANCEL_OPEN_EVT:
 	case ESP_GATTS_CLOSE_EVT:
 	case ESP_GATTS_LISTEN_EVT:
-	case ESP_GATTS_CONGEST_EVT:
 	case ESP_GATTS_UNREG_EVT:
 	case ESP_GATTS_DELETE_EVT:
 	default:
@@ -663,82 +1261,84 @@ gatts_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if,
 	}
 }
 
+//strongest link, the nearest central drives the RSSI loop
 int get_rssi()
 {
+	esp_bd_addr_t bdas[GATTS_CONN_MAX];
+	int rssi = APP_RSSI_MIN;
+	int n = 0;
+
+	portENTER_CRITICAL(&conn_mux);
+	for (int i = 0; i < GATTS_CONN_MAX; i++) {
+		if (!conns[i].used)
+			continue;
+		memcpy(bdas[n++], conns[i].bda, sizeof(esp_bd_addr_t));
+		if (conns[i].rssi > rssi)
+			rssi = conns[i].rssi;
+	}
+	portEXIT_CRITICAL(&conn_mux);
+
 	// We make the API call to read the RSSI value which is an async operation
 	// receiving ESP_GAP_BLE_READ_RSSI_COMPLETE_EVT indicates completion
-	esp_err_t rc = esp_ble_gap_read_rssi(conn_params.bda);
-	if (rc != ESP_OK) {
-		ESP_LOGE(LOG_TAG, "<< getRssi: esp_ble_gap_read_rssi: rc=%d", rc);
-		return 0;
+	for (int i = 0; i < n; i++) {
+		esp_err_t rc = esp_ble_gap_read_rssi(bdas[i]);
+		if (rc != ESP_OK)
+			ESP_LOGE(LOG_TAG, "<< getRssi: esp_ble_gap_read_rssi: rc=%d", rc);
 	}
 
-	return last_rssi_val;
+	return rssi;
 }
 
 //read sensor data and beep depending on mode and thresholds or schedule
 void check_char_thresholds_task()
 {
-	int rssi, solar;
-	uint8_t notify_data2[1];
-	uint8_t notify_data[1];
+	int rssi = APP_RSSI_MIN, solar = 0;
+	uint16_t ids[GATTS_CONN_MAX];
+	bool want_rssi, want_solar;
 	uint16_t secs = 0;
 	for (;;) {
 		secs = (secs + 1) % 3600;
-		if (connected) {
-
-			rssi = get_rssi();
-			notify_data[0] = (float)(rssi + 127)/147 * 100;
-			esp_ble_gatts_set_attr_value(m_handles
-						     [IDX_CHAR_VAL_E], 0x1, notify_data);
-			esp_ble_gatts_send_indicate(m_profile_tab[PROFILE_IDX].gatts_if,
-						    m_profile_tab[PROFILE_IDX].conn_id,
-						    m_handles[IDX_CHAR_VAL_E],
-						    sizeof(notify_data), notify_data, false);
-
-			solar = gpio_sample_adc();
-			notify_data2[0] = (float)solar/4095 * 100;
-			//notify_data2[1] = (solar >> 8) & 0xFF;
-			esp_ble_gatts_set_attr_value(m_handles[IDX_CHAR_VAL_H], 0x1,
-						     notify_data2);
-			esp_ble_gatts_send_indicate(m_profile_tab[PROFILE_IDX].gatts_if,
-						    m_profile_tab[PROFILE_IDX].conn_id,
-						    m_handles[IDX_CHAR_VAL_H],
-						    sizeof(notify_data2), notify_data2, false);
-
-			switch(mode_loop) {
-				case LOOP_FIXEDINT:
-					if((secs % (threshold_val * 60)) == 0) { short_beep(); }
-					break;
-				case LOOP_RANDINT:
-					if(rand_array[secs]==1) { short_beep(); }
-					break;
-				case LOOP_SOLAR:
-					if(notify_data2[0] > threshold_val) { short_beep(); }
-					break;
-				case LOOP_RSSI:
-					if(notify_data[0] > threshold_val) { short_beep(); }
-					break;
-				default:
-					gpio_set_level(GPIO_OUTPUT_IO_0, 0);
-					break;
-			}
+		//a threshold loop needs its reading, a notification a subscriber.
+		//skipped readings keep their last value
+		want_rssi = app_core.loop == LOOP_RSSI || subscribers(SUB_RSSI, ids);
+		want_solar = app_core.loop == LOOP_SOLAR ||
+											subscribers(SUB_SOLAR, ids);
+		if (conn_count() && (want_rssi || want_solar)) {
+			if (want_rssi)
+				rssi = get_rssi();
+			//filtered in the background, this only reads it
+			if (want_solar)
+				solar = light_sensor_mv();
+			app_core_tick(&app_core, rssi, solar);
 		
+			//heartbeat LED runs on its own while in loop mode
 			if(secs % 5 == 0) {
-				gpio_blink_one(GPIO_GREEN);
-				ESP_LOGI(GATTS_TABLE_TAG,"solar %d rssi %d \n", solar, rssi);
+				ESP_LOGI(GATTS_TABLE_TAG,"solar %d mV rssi %d \n", solar, rssi);
 			}
 		}
-		vTaskDelay(1000 / portTICK_PERIOD_MS);
+		vTaskDelay(APP_TICK_MS / portTICK_PERIOD_MS);
 	}
 }
 
+int64_t gatts_ble_adv_start_time()
+{
+	return adv_start_time;
+}
+
 //OTA update is over WiFi; make a random password for the AP and store
 // in encrypted attribute to be read later. regenerated every reboot
 void generate_pass_char()
 {
 	char pass_str[9];
 	uint8_t notify_pass[8];
+#ifdef CONFIG_DTC_UPDATER
+	updater_req_t req;
+
+	//keep the pass the client read from the normal app
+	if (updater_get_request(&req))
+		int_pass = req.pass;
+	else
+#endif
 	int_pass =  (uint64_t) esp_random() << 32 | esp_random() ;
 	for(int i = 0; i < 8; i++) {
 		notify_pass[i] = ((((int_pass >> 8*i) & 0xFF) % 94) + 33);
@@ -755,6 +1355,8 @@ void gatts_ble_init()
 {
 	esp_err_t ret;
 
+	app_core_init(&app_core);
+
 	ESP_ERROR_CHECK(esp_bt_controller_mem_release(ESP_BT_MODE_CLASSIC_BT));
 	esp_bt_controller_config_t bt_cfg = BT_CONTROLLER_INIT_CONFIG_DEFAULT();
 	ret = esp_bt_controller_init(&bt_cfg);
@@ -785,6 +1387,15 @@ void gatts_ble_init()
 		return;
 	}
 
+	ble_ota_init();
+	ble_stream_init();
+	ble_notify_init();
+
+	//writes are queued by the gatts callback, handled in app_cmd_task
+	app_cmd_queue = xQueueCreate(APP_CMD_QUEUE_LEN, sizeof(app_cmd_t));
+	xTaskCreate(app_cmd_task, "app cmd task", APP_CMD_TASK_STACK, NULL,
+										APP_CMD_TASK_PRIO, &app_cmd_thandle);
+
 	ret = esp_ble_gatts_register_callback(gatts_event_handler);
 	if (ret) {
 		ESP_LOGE(GATTS_TABLE_TAG, "gatts register error = %x", ret);
@@ -803,10 +1414,11 @@ void gatts_ble_init()
 		return;
 	}
 
-	//esp_err_t local_mtu_ret = esp_ble_gatt_set_local_mtu(500);
-	//if (local_mtu_ret){
-	//	ESP_LOGE(GATTS_TABLE_TAG, "MTU failed, err code = %x", local_mtu_ret);
-	//}
+	//large frames for BLE OTA
+	esp_err_t local_mtu_ret = esp_ble_gatt_set_local_mtu(BLE_OTA_MTU);
+	if (local_mtu_ret){
+		ESP_LOGE(GATTS_TABLE_TAG, "MTU failed, err code = %x", local_mtu_ret);
+	}
 
 	#ifdef CONFIG_BLE_GATTS_SECURITY
 		// set the security iocap & auth_req & key size & init key response key 
@@ -840,6 +1452,11 @@ void gatts_ble_init()
 	#else
 		ESP_LOGI(GATTS_TABLE_TAG,"v0.1.a");
 	#endif
-		
+
+#ifdef CONFIG_DTC_UPDATER
+	//mode writes are refused, this app only updates
+	app_core.mode = MODE_FWUPDATE;
+	updater_start();
+#endif
 }
 
@@ -0,0 +1,34 @@
+#ifndef __BLE_NOTIFY_H__
+#define __BLE_NOTIFY_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_gatts_api.h"
+
+//notifications go out right away while the link keeps up. once bluedroid
+//reports congestion they wait, one slot per characteristic and
+//connection: a newer value replaces the one waiting (latest wins), values
+//older than BLE_NOTIFY_MAX_AGE_MS are dropped instead of sent late
+#define BLE_NOTIFY_SLOTS		6
+#define BLE_NOTIFY_MAX_AGE_MS	2000
+
+typedef struct ble_notify_stats {
+	uint32_t sent;
+	uint32_t coalesced;		//replaced by a newer value before it went out
+	uint32_t dropped;		//no slot, too old or refused by the stack
+	uint32_t congestions;
+} ble_notify_stats_t;
+
+void ble_notify_init();
+void ble_notify_connect(esp_gatt_if_t gatts_if, uint16_t conn_id);
+//drops what is waiting and logs the stats of the connection
+void ble_notify_disconnect(uint16_t conn_id);
+//from ESP_GATTS_CONGEST_EVT, waiting values are sent once it clears
+void ble_notify_congest(uint16_t conn_id, bool congested);
+//any task. false if the value was dropped
+bool ble_notify_send(uint16_t conn_id, uint16_t handle, const uint8_t *value,
+															uint16_t len);
+bool ble_notify_get_stats(uint16_t conn_id, ble_notify_stats_t *stats);
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef __BLE_OTA_H__
+#define __BLE_OTA_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_gatts_api.h"
+
+//OTA v2 (see ota_proto.h) over the OTA characteristic, no WiFi needed.
+//the client writes the hello and data frames without response, acks come
+//back as notifications on the same characteristic. the central that sent
+//the hello owns the transfer: data frames of others are ignored and their
+//hellos answered with OTA_ST_FAIL until the owner's link drops
+#define BLE_OTA_MTU				517
+#define BLE_OTA_FRAME_MAX		512		//ATT value limit
+#define BLE_OTA_QUEUE_LEN		24		//frames between callback and task
+#define BLE_OTA_WINDOW			16		//frames in flight, < queue len
+#define BLE_OTA_ACK_EVERY		4
+#define BLE_OTA_TASK_STACK		4096
+#define BLE_OTA_TASK_PRIO		5
+#define BLE_OTA_PROGRESS_MS		500		//progress notification period
+
+void ble_ota_init();
+//from the gatts callback, must not block. false if the frame was dropped
+bool ble_ota_write(esp_gatt_if_t gatts_if, uint16_t conn_id, uint16_t handle,
+										const uint8_t *data, uint16_t len);
+//link went away, keep the transfer for a resume if it was the writer's
+void ble_ota_disconnect(uint16_t conn_id);
+//progress characteristic CCCD written. while any connection has it
+//enabled, progress of any transfer is notified to each of them every
+//BLE_OTA_PROGRESS_MS when it changes
+void ble_ota_progress_subscribe(esp_gatt_if_t gatts_if, uint16_t conn_id,
+											uint16_t handle, bool enable);
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef __BLE_STREAM_H__
+#define __BLE_STREAM_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_gatts_api.h"
+
+//sample stream characteristic. while subscribed, RSSI and light are
+//sampled fast enough that a notification of mtu - 3 bytes fills in about
+//BLE_STREAM_FLUSH_MS: 168 samples (511 bytes) every 6 ms at an MTU of
+//517, 58 every 18 ms at 185. small MTUs sample every BLE_STREAM_PERIOD_MS
+//and notify more often. all big endian:
+//	u32 time of the first sample (ms since boot) | u16 period ms |
+//	u8 count | count x { i8 rssi dBm | u16 light mV }
+#define BLE_STREAM_PERIOD_MS	50		//slowest sample period
+#define BLE_STREAM_PERIOD_MIN_MS	5	//light sensor rate, LIGHT_PERIOD_US
+#define BLE_STREAM_FLUSH_MS		1000	//time to fill a frame
+#define BLE_STREAM_HDR_LEN		7
+#define BLE_STREAM_SAMPLE_LEN	3
+#define BLE_STREAM_FRAME_MAX	512		//ATT value limit
+#define BLE_STREAM_DATA_LEN		251		//LL payload asked for on connect
+
+void ble_stream_init();
+//CCCD written, samples start over when enabled. every subscribed
+//connection gets its own frames with the RSSI of its link
+void ble_stream_subscribe(esp_gatt_if_t gatts_if, uint16_t conn_id,
+			uint16_t handle, const uint8_t *bda, uint16_t mtu, bool enable);
+//ATT MTU of the link changed, frames are cut to mtu - 3 and the sample
+//period follows
+void ble_stream_set_mtu(uint16_t conn_id, uint16_t mtu);
+void ble_stream_disconnect(uint16_t conn_id);
+
+#endif
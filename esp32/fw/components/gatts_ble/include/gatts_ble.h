@@ -12,6 +12,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "sdkconfig.h"
 
 #ifdef CONFIG_BLE_GATTS_SECURITY
     #define WRITE_PERM ESP_GATT_PERM_WRITE_ENC_MITM
@@ -34,22 +35,52 @@ enum {
 	IDX_CHAR_VAL_D,
 	IDX_CHAR_E,
 	IDX_CHAR_VAL_E,
+	IDX_CHAR_CFG_E,
 	IDX_CHAR_F,
 	IDX_CHAR_VAL_F,
 	IDX_CHAR_G,
 	IDX_CHAR_VAL_G,
 	IDX_CHAR_H,
 	IDX_CHAR_VAL_H,
+	IDX_CHAR_CFG_H,
 	IDX_CHAR_I,
 	IDX_CHAR_VAL_I,
 	IDX_CHAR_J,
 	IDX_CHAR_VAL_J,
+	IDX_CHAR_K,
+	IDX_CHAR_VAL_K,
+	IDX_CHAR_CFG_K,
+	IDX_CHAR_L,
+	IDX_CHAR_VAL_L,
+	IDX_CHAR_CFG_L,
+	IDX_CHAR_M,
+	IDX_CHAR_VAL_M,
+	IDX_CHAR_N,
+	IDX_CHAR_VAL_N,
+	IDX_CHAR_O,
+	IDX_CHAR_VAL_O,
+	IDX_CHAR_CFG_O,
+	IDX_CHAR_P,
+	IDX_CHAR_VAL_P,
 	IDX_NB,
 };
 
+//characteristics with a CCCD, a subscription bit each per connection
+enum {
+	SUB_RSSI,
+	SUB_SOLAR,
+	SUB_OTA,
+	SUB_PROGRESS,
+	SUB_STREAM,
+	SUB_MAX,
+};
+
 #define LOG_TAG "DTC_GATT"
 #define GATTS_TABLE_TAG "DTC_GATT"
 
+//centrals served at once, one context each. advertising goes on until
+//all are taken
+#define GATTS_CONN_MAX				CONFIG_BT_ACL_CONNECTIONS
 #define PROFILE_NUM                 1
 #define PROFILE_IDX					0
 #define ESP_APP_ID                  0x0
@@ -61,19 +92,41 @@ enum {
 #define PREPARE_BUF_MAX_SIZE        1024
 #define CHAR_DECLARATION_SIZE       (sizeof(uint8_t))
 
+//app command task: characteristic writes and mode transitions
+#define APP_CMD_QUEUE_LEN			8
+#define APP_CMD_TASK_STACK			4096
+#define APP_CMD_TASK_PRIO			5
+
+//fw update over WiFi, BLE stays up next to it (sw coexistence)
+#define OTA_TASK_STACK				8192
+#define OTA_TASK_PRIO				5
+
+//report policy characteristic, one record per notifying reading:
+//u8 uuid low byte (0x05 rssi, 0x08 light) | u8 deadband % |
+//u8 min interval s | u16 max interval s (big endian, 0 on change only).
+//written one record at a time, read back as both
+#define REPORT_RECORD_LEN			5
+
 #define ADV_CONFIG_FLAG             (1 << 0)
 #define SCAN_RSP_CONFIG_FLAG        (1 << 1)
 
-#define DECLARE_CHAR( MIDX, UUID, PERM) \
+#define DECLARE_CHAR( MIDX, UUID, PERM, PROP) \
 [ IDX_CHAR_ ## MIDX ] = \
 {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16, \
  (uint8_t *)&character_declaration_uuid, ESP_GATT_PERM_READ,\
   CHAR_DECLARATION_SIZE, CHAR_DECLARATION_SIZE,\
- (uint8_t *)&char_prop_read_write_notify}}, \
+ (uint8_t *)&PROP}}, \
 [ IDX_CHAR_VAL_ ## MIDX ] = \
 {{ESP_GATT_AUTO_RSP}, {ESP_UUID_LEN_16,  (uint8_t *) UUID , PERM,\
   GATTS_CHAR_VAL_LEN_MAX, sizeof(char_value), (uint8_t *)char_value}},
 
+//CCCD of a notifying characteristic, read and written per connection
+#define DECLARE_CCC( MIDX ) \
+[ IDX_CHAR_CFG_ ## MIDX ] = \
+{{ESP_GATT_RSP_BY_APP}, {ESP_UUID_LEN_16, \
+ (uint8_t *)&character_client_config_uuid, RW_PERM,\
+  sizeof(uint16_t), 0, NULL}},
+
 //event bits
 #define TASK_1_BIT        ( 1 << 0 )    //1                                     
 #define ALL_SYNC_BITS TASK_1_BIT
@@ -95,17 +148,29 @@ static const uint16_t CHAR_UUID_RSSI_MIN = 0xFF06;
 static const uint16_t CHAR_UUID_SOLAR = 0xFF08;
 static const uint16_t CHAR_UUID_SOLAR_MIN = 0xFF09;
 static const uint16_t CHAR_UUID_PASS = 0xFF07;
+static const uint16_t CHAR_UUID_OTA = 0xFF0A;
+static const uint16_t CHAR_UUID_OTA_PROGRESS = 0xFF0B;
+static const uint16_t CHAR_UUID_OTA_STA = 0xFF0C;
+static const uint16_t CHAR_UUID_AP_INFO = 0xFF0D;
+static const uint16_t CHAR_UUID_STREAM = 0xFF0E;
+static const uint16_t CHAR_UUID_REPORT = 0xFF0F;
 
 static const uint16_t service_uuid = ESP_GATT_UUID_PRI_SERVICE;
 static const uint16_t character_declaration_uuid = ESP_GATT_UUID_CHAR_DECLARE;
 static const uint16_t character_client_config_uuid =
     ESP_GATT_UUID_CHAR_CLIENT_CONFIG;
 static const uint8_t char_prop_read = ESP_GATT_CHAR_PROP_BIT_READ;
+static const uint8_t char_prop_notify = ESP_GATT_CHAR_PROP_BIT_NOTIFY;
+static const uint8_t char_prop_read_write =
+    ESP_GATT_CHAR_PROP_BIT_WRITE | ESP_GATT_CHAR_PROP_BIT_READ;
 static const uint8_t char_prop_write = ESP_GATT_CHAR_PROP_BIT_WRITE;
 static const uint8_t char_prop_read_write_notify =
     ESP_GATT_CHAR_PROP_BIT_WRITE | ESP_GATT_CHAR_PROP_BIT_READ |
     ESP_GATT_CHAR_PROP_BIT_NOTIFY;
-static const uint8_t m_ccc[2] = { 0x00, 0x00 };
+static const uint8_t char_prop_read_notify =
+    ESP_GATT_CHAR_PROP_BIT_READ | ESP_GATT_CHAR_PROP_BIT_NOTIFY;
+static const uint8_t char_prop_write_nr_notify =
+    ESP_GATT_CHAR_PROP_BIT_WRITE_NR | ESP_GATT_CHAR_PROP_BIT_NOTIFY;
 static const uint8_t char_value[4] = { 0x11, 0x22, 0x33, 0x44 };
 
 
@@ -125,5 +190,10 @@ void gatts_profile_event_handler(esp_gatts_cb_event_t event,
 void gatts_event_handler(esp_gatts_cb_event_t event, esp_gatt_if_t gatts_if,
 			 								esp_ble_gatts_cb_param_t * param);
 void gatts_ble_init();
+//esp_timer time advertising first came up, 0 until then
+int64_t gatts_ble_adv_start_time();
+//last RSSI read of the link, APP_RSSI_MIN if unknown
+int8_t gatts_ble_conn_rssi(uint16_t conn_id);
+void gatts_ble_show_bonds(void);
 
 #endif
@@ -0,0 +1,200 @@
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+
+#include "gpio_handler.h"
+#include "beep_sched.h"
+
+static const char *TAG = "beep sched";
+
+//each schedule owns a timer and fires from it, nothing polls. random
+//schedules keep their beep times as sorted 16-bit offsets into the
+//window, in units of unit_ms (window / 65536 + 1)
+typedef struct beep_sched {
+	esp_timer_handle_t timer;
+	bool active;
+	bool in_cb;
+	bool random;
+	uint32_t period_ms;		//fixed: period, random: window
+	uint32_t unit_ms;
+	uint16_t count;
+	uint16_t idx;
+	int64_t window_us;		//start of the current window
+	uint16_t offsets[BEEP_RAND_MAX];
+} beep_sched_t;
+
+static beep_sched_t scheds[BEEP_SCHED_MAX];
+static portMUX_TYPE sched_mux = portMUX_INITIALIZER_UNLOCKED;
+
+//count distinct offsets in [0, n), sorted. Floyd's sampling, one random
+//number per offset, no rejection loop
+static void gen_offsets(uint16_t *offsets, uint16_t count, uint32_t n)
+{
+	int len = 0;
+
+	for (uint32_t j = n - count; j < n; j++) {
+		uint32_t t = esp_random() % (j + 1);
+		int lo = 0, hi = len;
+
+		//binary search for t, take j if it is already in
+		while (lo < hi) {
+			int mid = (lo + hi) / 2;
+			if (offsets[mid] < t)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		if (lo < len && offsets[lo] == t) {
+			//j is larger than everything so far
+			t = j;
+			lo = len;
+		}
+
+		memmove(&offsets[lo + 1], &offsets[lo],
+								(len - lo) * sizeof(*offsets));
+		offsets[lo] = t;
+		len++;
+	}
+}
+
+static int64_t next_random_us(beep_sched_t *s)
+{
+	return s->window_us + (int64_t) s->offsets[s->idx] * s->unit_ms * 1000;
+}
+
+static void beep_sched_cb(void *arg)
+{
+	beep_sched_t *s = arg;
+	int64_t delay = 0;
+
+	portENTER_CRITICAL(&sched_mux);
+	if (!s->active) {
+		portEXIT_CRITICAL(&sched_mux);
+		return;
+	}
+	s->in_cb = true;
+	portEXIT_CRITICAL(&sched_mux);
+
+	short_beep();
+
+	if (s->random) {
+		//next beep, or a fresh draw for the next window
+		if (++s->idx == s->count) {
+			s->window_us += (int64_t) s->period_ms * 1000;
+			s->idx = 0;
+			gen_offsets(s->offsets, s->count, s->period_ms / s->unit_ms);
+		}
+		delay = next_random_us(s) - esp_timer_get_time();
+	}
+
+	portENTER_CRITICAL(&sched_mux);
+	if (s->active && s->random)
+		esp_timer_start_once(s->timer, delay > 0 ? delay : 0);
+	s->in_cb = false;
+	portEXIT_CRITICAL(&sched_mux);
+}
+
+//claim a free schedule, one whose callback is not still winding down
+static beep_sched_t *sched_alloc(int *id)
+{
+	beep_sched_t *s = NULL;
+
+	portENTER_CRITICAL(&sched_mux);
+	for (int i = 0; i < BEEP_SCHED_MAX; i++) {
+		if (!scheds[i].active && !scheds[i].in_cb) {
+			s = &scheds[i];
+			s->active = true;
+			*id = i;
+			break;
+		}
+	}
+	portEXIT_CRITICAL(&sched_mux);
+
+	if (s == NULL)
+		ESP_LOGE(TAG, "no free schedule");
+
+	return s;
+}
+
+int beep_sched_fixed(uint32_t period_ms)
+{
+	beep_sched_t *s;
+	int id;
+
+	if (period_ms == 0)
+		return -1;
+
+	s = sched_alloc(&id);
+	if (s == NULL)
+		return -1;
+
+	s->random = false;
+	s->period_ms = period_ms;
+	esp_timer_start_periodic(s->timer, (uint64_t) period_ms * 1000);
+
+	ESP_LOGI(TAG, "%d: beep every %u ms", id, period_ms);
+	return id;
+}
+
+int beep_sched_random(uint16_t count, uint32_t window_ms)
+{
+	beep_sched_t *s;
+	uint32_t n;
+	int id;
+
+	if (count == 0 || window_ms == 0)
+		return -1;
+
+	s = sched_alloc(&id);
+	if (s == NULL)
+		return -1;
+
+	s->random = true;
+	s->period_ms = window_ms;
+	s->unit_ms = window_ms / 65536 + 1;
+	n = window_ms / s->unit_ms;
+	s->count = count < BEEP_RAND_MAX ? count : BEEP_RAND_MAX;
+	if (s->count > n)
+		s->count = n;
+	s->idx = 0;
+	s->window_us = esp_timer_get_time();
+	gen_offsets(s->offsets, s->count, n);
+
+	ESP_LOGI(TAG, "%d: %d random beeps every %u ms, first in %u ms", id,
+				s->count, window_ms, s->offsets[0] * s->unit_ms);
+
+	esp_timer_start_once(s->timer, next_random_us(s) - s->window_us);
+	return id;
+}
+
+void beep_sched_cancel(int id)
+{
+	if (id < 0 || id >= BEEP_SCHED_MAX)
+		return;
+
+	portENTER_CRITICAL(&sched_mux);
+	scheds[id].active = false;
+	portEXIT_CRITICAL(&sched_mux);
+
+	esp_timer_stop(scheds[id].timer);
+}
+
+void beep_sched_cancel_all()
+{
+	for (int i = 0; i < BEEP_SCHED_MAX; i++)
+		beep_sched_cancel(i);
+}
+
+void beep_sched_init()
+{
+	for (int i = 0; i < BEEP_SCHED_MAX; i++) {
+		esp_timer_create_args_t timer_args = {
+			.callback = beep_sched_cb,
+			.arg = &scheds[i],
+			.name = "beep sched"
+		};
+		ESP_ERROR_CHECK(esp_timer_create(&timer_args, &scheds[i].timer));
+	}
+}
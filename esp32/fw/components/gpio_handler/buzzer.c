@@ -0,0 +1,197 @@
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "driver/ledc.h"
+#include "sdkconfig.h"
+
+#include "gpio_handler.h"
+#include "buzzer.h"
+
+static const char *TAG = "buzzer";
+
+//patterns waiting to be played. filled by callers, drained by the timer
+//callback, both under buzzer_mux. only bookkeeping happens under the mux,
+//LEDC and esp_timer calls come after it (ledc_set_freq may log)
+static buzzer_pattern_t queue[BUZZER_QUEUE_LEN];
+static unsigned int q_head, q_len;
+static buzzer_pattern_t cur;
+static unsigned int phases_left;
+//callback pending or timer armed
+static bool busy = false;
+//tone stays on once the queue is empty (buzzer_on)
+static bool hold = false;
+//bumped by buzzer_stop / buzzer_on, a callback that started before acts
+//on nothing: the one they kick applies the new state
+static volatile uint32_t gen;
+static portMUX_TYPE buzzer_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static esp_timer_handle_t buzzer_timer;
+
+typedef enum {
+	BUZZER_ACT_ON,			//tone, next phase after the delay
+	BUZZER_ACT_OFF,			//silence, next phase after the delay
+	BUZZER_ACT_IDLE,		//silence, sequencer stops
+	BUZZER_ACT_HOLD			//tone, sequencer stops
+} buzzer_act_t;
+
+static void tone_on(uint16_t freq_hz)
+{
+	uint32_t duty = BUZZER_DUTY_MAX;
+
+	#ifdef CONFIG_BUZZER_PASSIVE
+		ledc_set_freq(BUZZER_LEDC_MODE, BUZZER_LEDC_TIMER,
+							freq_hz ? freq_hz : CONFIG_BUZZER_FREQ_HZ);
+		duty = BUZZER_DUTY_MAX / 2;
+	#endif
+	//active buzzers make their own tone, drive them with DC
+
+	ledc_set_duty(BUZZER_LEDC_MODE, BUZZER_LEDC_CHANNEL, duty);
+	ledc_update_duty(BUZZER_LEDC_MODE, BUZZER_LEDC_CHANNEL);
+}
+
+static void tone_off()
+{
+	ledc_set_duty(BUZZER_LEDC_MODE, BUZZER_LEDC_CHANNEL, 0);
+	ledc_update_duty(BUZZER_LEDC_MODE, BUZZER_LEDC_CHANNEL);
+}
+
+//run the callback now. a callback already running finishes first: they
+//all run in the esp_timer task
+static void buzzer_kick()
+{
+	esp_timer_stop(buzzer_timer);
+	esp_timer_start_once(buzzer_timer, 0);
+}
+
+//one on or off phase per call, reschedules itself until the queue is empty.
+//the only place the output changes
+static void buzzer_timer_cb(void *arg)
+{
+	buzzer_act_t act;
+	uint16_t freq_hz = 0;
+	uint32_t delay_ms = 0;
+	uint32_t my_gen;
+
+	portENTER_CRITICAL(&buzzer_mux);
+	my_gen = gen;
+	if (phases_left == 0 && q_len > 0) {
+		cur = queue[q_head];
+		q_head = (q_head + 1) % BUZZER_QUEUE_LEN;
+		q_len--;
+		hold = false;
+
+		phases_left = (cur.count ? cur.count : 1) * 2;
+	}
+
+	if (phases_left == 0) {
+		busy = false;
+		act = hold ? BUZZER_ACT_HOLD : BUZZER_ACT_IDLE;
+	} else if (phases_left-- % 2 == 0) {
+		//even: on phase, odd: off phase
+		act = BUZZER_ACT_ON;
+		freq_hz = cur.freq_hz;
+		delay_ms = cur.on_ms;
+	} else {
+		act = BUZZER_ACT_OFF;
+		delay_ms = cur.off_ms;
+	}
+	portEXIT_CRITICAL(&buzzer_mux);
+
+	//stopped or switched on meanwhile, the kicked callback takes over
+	if (my_gen != gen)
+		return;
+
+	switch (act) {
+	case BUZZER_ACT_ON:
+		tone_on(freq_hz);
+		esp_timer_start_once(buzzer_timer, (uint64_t) delay_ms * 1000);
+		break;
+	case BUZZER_ACT_OFF:
+		tone_off();
+		esp_timer_start_once(buzzer_timer, (uint64_t) delay_ms * 1000);
+		break;
+	case BUZZER_ACT_IDLE:
+		tone_off();
+		break;
+	case BUZZER_ACT_HOLD:
+		tone_on(0);
+		break;
+	}
+}
+
+bool buzzer_play(const buzzer_pattern_t *pattern)
+{
+	bool kick = false;
+
+	portENTER_CRITICAL(&buzzer_mux);
+	if (q_len == BUZZER_QUEUE_LEN) {
+		portEXIT_CRITICAL(&buzzer_mux);
+		ESP_LOGW(TAG, "queue full, pattern dropped");
+		return false;
+	}
+	queue[(q_head + q_len) % BUZZER_QUEUE_LEN] = *pattern;
+	q_len++;
+	if (!busy) {
+		busy = true;
+		kick = true;
+	}
+	portEXIT_CRITICAL(&buzzer_mux);
+
+	//idle: start the sequencer, otherwise it picks this up when done
+	if (kick)
+		buzzer_kick();
+
+	return true;
+}
+
+//drop the queue and the pattern playing, the kicked callback sets the
+//output to the tone (on) or silence
+static void buzzer_reset(bool on)
+{
+	portENTER_CRITICAL(&buzzer_mux);
+	q_len = 0;
+	phases_left = 0;
+	hold = on;
+	busy = true;
+	gen++;
+	portEXIT_CRITICAL(&buzzer_mux);
+
+	buzzer_kick();
+}
+
+void buzzer_stop()
+{
+	buzzer_reset(false);
+}
+
+void buzzer_on()
+{
+	buzzer_reset(true);
+}
+
+void buzzer_init()
+{
+	ledc_timer_config_t ledc_timer = {
+		.duty_resolution = BUZZER_DUTY_RES,
+		.freq_hz = CONFIG_BUZZER_FREQ_HZ,
+		.speed_mode = BUZZER_LEDC_MODE,
+		.timer_num = BUZZER_LEDC_TIMER
+	};
+	ledc_timer_config(&ledc_timer);
+
+	ledc_channel_config_t ledc_channel = {
+		.channel = BUZZER_LEDC_CHANNEL,
+		.duty = 0,
+		.gpio_num = GPIO_OUTPUT_IO_0,
+		.speed_mode = BUZZER_LEDC_MODE,
+		.timer_sel = BUZZER_LEDC_TIMER
+	};
+	ledc_channel_config(&ledc_channel);
+
+	esp_timer_create_args_t timer_args = {
+		.callback = buzzer_timer_cb,
+		.name = "buzzer"
+	};
+	ESP_ERROR_CHECK(esp_timer_create(&timer_args, &buzzer_timer));
+}
@@ -2,6 +2,10 @@
 #include "freertos/task.h"
 #include "freertos/queue.h"
 #include "gpio_handler.h"
+#include "buzzer.h"
+#include "led.h"
+#include "beep_sched.h"
+#include "light_sensor.h"
 
 //static TaskHandle_t thandle_1;
 static xQueueHandle gpio_evt_queue = NULL;
@@ -45,57 +49,13 @@ void gpio_idle_blink_task()
 }
 */
 
+//queues the beep and returns, the buzzer driver times it
 void short_beep()
 {
-	gpio_set_level(GPIO_OUTPUT_IO_0, 1);
-	vTaskDelay(300 / portTICK_RATE_MS);
-	gpio_set_level(GPIO_OUTPUT_IO_0, 0);
-}
-
-void gpio_white_on()
-{
-	gpio_set_level(GPIO_RED, 0);
-	gpio_set_level(GPIO_GREEN, 0);
-	gpio_set_level(GPIO_BLUE, 0);
-}
-
-void gpio_white_off()
-{
-	gpio_set_level(GPIO_RED, 1);
-	gpio_set_level(GPIO_GREEN, 1);
-	gpio_set_level(GPIO_BLUE, 1);
-}
-
-void gpio_blink_white()
-{
-	gpio_set_level(GPIO_RED, 0);
-	gpio_set_level(GPIO_GREEN, 0);
-	gpio_set_level(GPIO_BLUE, 0);
-	vTaskDelay(250 / portTICK_RATE_MS);
-	gpio_set_level(GPIO_RED, 1);
-	gpio_set_level(GPIO_GREEN, 1);
-	gpio_set_level(GPIO_BLUE, 1);
-	vTaskDelay(250 / portTICK_RATE_MS);
-}
-
-void gpio_blink_one(int gpio_num)
-{
-	gpio_set_level(gpio_num, 0);
-	vTaskDelay(250 / portTICK_RATE_MS);
-	gpio_set_level(gpio_num, 1);
-	vTaskDelay(250 / portTICK_RATE_MS);
-}
-
-int gpio_sample_adc()
-{
-	int num_samples = 1000;
-	int i = num_samples;
-	double avg = 0.0;
-	while (i > 0) {
-		avg += adc1_get_raw(ADC1_EXAMPLE_CHANNEL);
-		i--;
-	}
-	return (avg / num_samples);
+	static const buzzer_pattern_t beep = {
+		.count = 1, .on_ms = 300, .off_ms = 0, .freq_hz = 0
+	};
+	buzzer_play(&beep);
 }
 
 void gpio_handler_init()
@@ -130,24 +90,23 @@ void gpio_handler_init()
 	gpio_isr_handler_add(GPIO_BUTTON_1, gpio_isr_handler,
 			     (void *)GPIO_BUTTON_1);
 
-	gpio_set_level(GPIO_OUTPUT_IO_0, 0);
-	gpio_set_level(GPIO_RED, 1);
-	gpio_set_level(GPIO_GREEN, 1);
-	gpio_set_level(GPIO_BLUE, 1);
-
-	vTaskDelay(1500 / portTICK_RATE_MS);
-	gpio_blink_one(GPIO_RED);
-	gpio_blink_one(GPIO_GREEN);
-	gpio_blink_one(GPIO_BLUE);
-
-	gpio_blink_one(GPIO_RED);
-	gpio_blink_one(GPIO_GREEN);
-	gpio_blink_one(GPIO_BLUE);
+	//buzzer pin is handed over to LEDC
+	buzzer_init();
+	//LEDs are animated from a timer, init returns right away
+	led_init();
+	beep_sched_init();
 	//xTaskCreate(gpio_idle_blink_task, "gpio_idle_blink_task",
 	//	    10000, NULL, 1, &thandle_1);
 
-	adc1_config_channel_atten(ADC1_EXAMPLE_CHANNEL, ADC_ATTEN_0db);
-	vTaskDelay(2 * portTICK_PERIOD_MS);
-
 	return;
 }
+
+//nothing here is needed to advertise, called from a task after boot
+void gpio_handler_init_late(bool intro)
+{
+	//skipped after brownouts, the LEDs would load the supply again
+	if (intro)
+		led_play(&led_intro);
+
+	light_sensor_init();
+}
@@ -0,0 +1,19 @@
+#ifndef __BEEP_SCHED_H__
+#define __BEEP_SCHED_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define BEEP_SCHED_MAX		4	//concurrent schedules
+#define BEEP_RAND_MAX		256	//random beeps per window
+
+//beep every period_ms. returns a schedule id, -1 if none is free
+int beep_sched_fixed(uint32_t period_ms);
+//count beeps at random times in every window_ms. returns a schedule id,
+//-1 if none is free
+int beep_sched_random(uint16_t count, uint32_t window_ms);
+void beep_sched_cancel(int id);
+void beep_sched_cancel_all();
+void beep_sched_init();
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef __BUZZER_H__
+#define __BUZZER_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+//buzzer output is driven by LEDC, sequenced by esp_timer
+#define BUZZER_LEDC_MODE		LEDC_HIGH_SPEED_MODE
+#define BUZZER_LEDC_TIMER		LEDC_TIMER_0
+#define BUZZER_LEDC_CHANNEL		LEDC_CHANNEL_0
+#define BUZZER_DUTY_RES			LEDC_TIMER_10_BIT
+#define BUZZER_DUTY_MAX			((1 << 10) - 1)
+
+#define BUZZER_QUEUE_LEN		8
+
+//count beeps of on_ms, each followed by off_ms of silence.
+//freq_hz 0 uses CONFIG_BUZZER_FREQ_HZ
+typedef struct buzzer_pattern {
+	uint8_t count;
+	uint16_t on_ms;
+	uint16_t off_ms;
+	uint16_t freq_hz;
+} buzzer_pattern_t;
+
+void buzzer_init();
+//queue a pattern and return, false if the queue is full
+bool buzzer_play(const buzzer_pattern_t *pattern);
+//tone on until buzzer_stop() or the end of the next pattern
+void buzzer_on();
+//silence, drop queued patterns
+void buzzer_stop();
+
+#endif
@@ -19,7 +19,7 @@
 #define GPIO_GREEN			17
 #define GPIO_BLUE			18
 #define GPIO_OUTPUT_PIN_SEL	((1ULL<<GPIO_RED) | (1ULL<<GPIO_GREEN) | \
-                          (1ULL<<GPIO_BLUE) | (1ULL<<GPIO_OUTPUT_IO_0) )
+                          (1ULL<<GPIO_BLUE) )
 
 #define GPIO_BUTTON_0		19
 #define GPIO_BUTTON_1		21
@@ -32,12 +32,8 @@
 
 bool gpio_get_yesno();
 void gpio_handler_init();
+void gpio_handler_init_late(bool intro);
 void gpio_idle_blink_task();
-void gpio_white_on();
-void gpio_white_off();
-void gpio_blink_white();
-void gpio_blink_one(int gpio_num);
-int gpio_sample_adc();
 void short_beep();
 
 #endif
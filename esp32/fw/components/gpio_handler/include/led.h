@@ -0,0 +1,45 @@
+#ifndef __LED_H__
+#define __LED_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+//color bits of the RGB LED (GPIO_RED/GREEN/BLUE, active low)
+#define LED_OFF			0x00
+#define LED_R			0x01
+#define LED_G			0x02
+#define LED_B			0x04
+#define LED_WHITE		(LED_R | LED_G | LED_B)
+
+#define LED_ANIM_STEPS	6
+#define LED_QUEUE_LEN	16
+
+typedef struct led_step {
+	uint8_t color;
+	uint16_t ms;
+} led_step_t;
+
+//steps played in order, the whole sequence repeat times (0 is once)
+typedef struct led_anim {
+	led_step_t steps[LED_ANIM_STEPS];
+	uint8_t n_steps;
+	uint8_t repeat;
+} led_anim_t;
+
+extern const led_anim_t led_intro;
+extern const led_anim_t led_heartbeat;
+
+void led_init();
+//queue an animation and return, false if the queue is full
+bool led_play(const led_anim_t *anim);
+void led_blink(uint8_t color, uint8_t count);
+//six digits as blink counts, 0 is one white blink
+void led_passkey(uint32_t passkey);
+//color shown when no animation is queued. anything but LED_OFF also
+//covers the idle animation, which comes back with led_set(LED_OFF)
+void led_set(uint8_t color);
+//loop this while nothing is queued and the led_set color is LED_OFF,
+//queued animations cut in. NULL to stop
+void led_set_idle(const led_anim_t *anim);
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef __LIGHT_SENSOR_H__
+#define __LIGHT_SENSOR_H__
+
+#include <stdint.h>
+
+//light sensor on ADC1_EXAMPLE_CHANNEL, sampled from a periodic esp_timer.
+//every period a few conversions are summed, the sums go through a median
+//of 3 (drops buzzer/LED switching spikes) and a fixed-point IIR
+#define LIGHT_PERIOD_US		5000	//200 Hz
+#define LIGHT_OVERSAMPLE_SHIFT	2	//4 conversions per period
+#define LIGHT_IIR_SHIFT		5		//alpha 1/32, ~160ms time constant
+#define LIGHT_FRAC_BITS		8
+//used when the chip has no Vref/two point values in efuse
+#define LIGHT_DEFAULT_VREF	1100
+
+//configures the ADC, reads calibration from efuse and starts sampling
+void light_sensor_init();
+//filtered 12 bit reading, 0 before init
+uint16_t light_sensor_raw();
+//filtered reading in calibrated millivolts, 0 before init
+uint32_t light_sensor_mv();
+
+#endif
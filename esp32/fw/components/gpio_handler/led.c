@@ -0,0 +1,220 @@
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "driver/gpio.h"
+
+#include "gpio_handler.h"
+#include "led.h"
+
+static const char *TAG = "led";
+
+const led_anim_t led_intro = {
+	.steps = {
+		{ LED_R, 250 }, { LED_OFF, 250 },
+		{ LED_G, 250 }, { LED_OFF, 250 },
+		{ LED_B, 250 }, { LED_OFF, 250 },
+	},
+	.n_steps = 6,
+	.repeat = 2,
+};
+
+const led_anim_t led_heartbeat = {
+	.steps = {
+		{ LED_G, 60 }, { LED_OFF, 140 },
+		{ LED_G, 60 }, { LED_OFF, 4740 },
+	},
+	.n_steps = 4,
+};
+
+//animations waiting to be played and the idle state. set by callers,
+//read by the timer callback, both under led_mux
+static led_anim_t queue[LED_QUEUE_LEN];
+static unsigned int q_head, q_len;
+static led_anim_t idle_anim;
+static bool idle_set = false;
+static uint8_t hold_color = LED_OFF;
+static bool busy = false;
+static bool playing_idle = false;
+static bool preempt = false;
+static portMUX_TYPE led_mux = portMUX_INITIALIZER_UNLOCKED;
+
+//only touched from the esp_timer task
+static led_anim_t cur;
+static unsigned int step, steps_left;
+
+static esp_timer_handle_t led_timer;
+
+static void led_apply(uint8_t color)
+{
+	gpio_set_level(GPIO_RED, !(color & LED_R));
+	gpio_set_level(GPIO_GREEN, !(color & LED_G));
+	gpio_set_level(GPIO_BLUE, !(color & LED_B));
+}
+
+//one step per call, reschedules itself until nothing is left to show
+static void led_timer_cb(void *arg)
+{
+	const led_step_t *s;
+	uint8_t color;
+
+	portENTER_CRITICAL(&led_mux);
+	if (preempt) {
+		preempt = false;
+		steps_left = 0;
+	}
+
+	if (steps_left == 0) {
+		if (q_len) {
+			cur = queue[q_head];
+			q_head = (q_head + 1) % LED_QUEUE_LEN;
+			q_len--;
+			playing_idle = false;
+		} else if (idle_set && hold_color == LED_OFF) {
+			cur = idle_anim;
+			playing_idle = true;
+		} else {
+			busy = false;
+			playing_idle = false;
+			color = hold_color;
+			portEXIT_CRITICAL(&led_mux);
+			led_apply(color);
+			return;
+		}
+		steps_left = cur.n_steps * (cur.repeat ? cur.repeat : 1);
+		step = 0;
+	}
+	portEXIT_CRITICAL(&led_mux);
+
+	s = &cur.steps[step++ % cur.n_steps];
+	steps_left--;
+
+	led_apply(s->color);
+	esp_timer_start_once(led_timer, (uint64_t) s->ms * 1000);
+}
+
+//start the sequencer if it is not running
+static void led_kick(bool restart)
+{
+	if (restart)
+		esp_timer_stop(led_timer);
+	esp_timer_start_once(led_timer, 0);
+}
+
+bool led_play(const led_anim_t *anim)
+{
+	bool kick = false, restart = false;
+
+	if (anim->n_steps == 0 || anim->n_steps > LED_ANIM_STEPS)
+		return false;
+
+	portENTER_CRITICAL(&led_mux);
+	if (q_len == LED_QUEUE_LEN) {
+		portEXIT_CRITICAL(&led_mux);
+		ESP_LOGW(TAG, "queue full, animation dropped");
+		return false;
+	}
+	queue[(q_head + q_len) % LED_QUEUE_LEN] = *anim;
+	q_len++;
+	if (!busy) {
+		busy = true;
+		kick = true;
+	} else if (playing_idle) {
+		//don't wait for the idle loop to come around
+		preempt = true;
+		kick = restart = true;
+	}
+	portEXIT_CRITICAL(&led_mux);
+
+	if (kick)
+		led_kick(restart);
+
+	return true;
+}
+
+void led_blink(uint8_t color, uint8_t count)
+{
+	led_anim_t anim = {
+		.steps = { { color, 250 }, { LED_OFF, 250 } },
+		.n_steps = 2,
+		.repeat = count,
+	};
+	led_play(&anim);
+}
+
+void led_passkey(uint32_t passkey)
+{
+	static const uint8_t colors[3] = { LED_R, LED_G, LED_B };
+	static const led_anim_t pause = {
+		.steps = { { LED_OFF, 1000 } },
+		.n_steps = 1,
+	};
+	uint32_t div = 100000;
+
+	for (int i = 1; i <= 6; i++) {
+		int digit = (passkey / div) % 10;
+		div /= 10;
+		ESP_LOGI(TAG, "key digit:%d", digit);
+
+		led_play(&pause);
+		if (digit == 0)
+			led_blink(LED_WHITE, 1);
+		else
+			led_blink(colors[i % 3], digit);
+	}
+}
+
+void led_set(uint8_t color)
+{
+	bool kick = false;
+
+	portENTER_CRITICAL(&led_mux);
+	hold_color = color;
+	if (!busy) {
+		busy = true;
+		kick = true;
+	} else if (playing_idle && color != LED_OFF) {
+		//the color covers the idle animation until set back to LED_OFF
+		preempt = true;
+		kick = true;
+	}
+	portEXIT_CRITICAL(&led_mux);
+
+	if (kick)
+		led_kick(true);
+}
+
+void led_set_idle(const led_anim_t *anim)
+{
+	bool kick = false;
+
+	if (anim && (anim->n_steps == 0 || anim->n_steps > LED_ANIM_STEPS))
+		return;
+
+	portENTER_CRITICAL(&led_mux);
+	idle_set = anim != NULL;
+	if (anim)
+		idle_anim = *anim;
+	if (!busy) {
+		busy = true;
+		kick = true;
+	} else if (playing_idle) {
+		preempt = true;
+		kick = true;
+	}
+	portEXIT_CRITICAL(&led_mux);
+
+	if (kick)
+		led_kick(true);
+}
+
+void led_init()
+{
+	esp_timer_create_args_t timer_args = {
+		.callback = led_timer_cb,
+		.name = "led"
+	};
+	ESP_ERROR_CHECK(esp_timer_create(&timer_args, &led_timer));
+
+	led_apply(LED_OFF);
+}
@@ -0,0 +1,91 @@
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "driver/adc.h"
+#include "esp_adc_cal.h"
+
+#include "gpio_handler.h"
+#include "light_sensor.h"
+
+static const char *TAG = "light";
+
+static esp_adc_cal_characteristics_t cal;
+static esp_timer_handle_t light_timer;
+
+//only touched from the esp_timer task
+static int32_t hist[3];
+static unsigned int hist_pos, hist_len;
+static int32_t acc;		//sum of one period, LIGHT_FRAC_BITS fraction
+
+//published by the timer callback, a 16 bit store is atomic
+static volatile uint16_t filtered;
+
+static int32_t median3(int32_t a, int32_t b, int32_t c)
+{
+	if (a > b) {
+		int32_t t = a;
+		a = b;
+		b = t;
+	}
+	//a <= b
+	return c < a ? a : c > b ? b : c;
+}
+
+//a few conversions per call, integer only
+static void light_timer_cb(void *arg)
+{
+	int32_t sum = 0, m;
+
+	for (int i = 0; i < (1 << LIGHT_OVERSAMPLE_SHIFT); i++)
+		sum += adc1_get_raw(ADC1_EXAMPLE_CHANNEL);
+
+	hist[hist_pos] = sum;
+	hist_pos = (hist_pos + 1) % 3;
+	if (hist_len < 3) {
+		//seed the filter instead of ramping up from 0
+		hist_len++;
+		acc = sum << LIGHT_FRAC_BITS;
+	} else {
+		m = median3(hist[0], hist[1], hist[2]);
+		acc += ((m << LIGHT_FRAC_BITS) - acc) >> LIGHT_IIR_SHIFT;
+	}
+
+	//back to 12 bit, rounded
+	filtered = (acc + (1 << (LIGHT_FRAC_BITS + LIGHT_OVERSAMPLE_SHIFT - 1)))
+			>> (LIGHT_FRAC_BITS + LIGHT_OVERSAMPLE_SHIFT);
+}
+
+uint16_t light_sensor_raw()
+{
+	return filtered;
+}
+
+uint32_t light_sensor_mv()
+{
+	if (light_timer == NULL)
+		return 0;
+
+	return esp_adc_cal_raw_to_voltage(filtered, &cal);
+}
+
+void light_sensor_init()
+{
+	esp_adc_cal_value_t src;
+
+	adc1_config_width(ADC_WIDTH_BIT_12);
+	adc1_config_channel_atten(ADC1_EXAMPLE_CHANNEL, ADC_ATTEN_DB_0);
+
+	src = esp_adc_cal_characterize(ADC_UNIT_1, ADC_ATTEN_DB_0,
+					ADC_WIDTH_BIT_12, LIGHT_DEFAULT_VREF, &cal);
+	ESP_LOGI(TAG, "calibration from %s",
+			 src == ESP_ADC_CAL_VAL_EFUSE_TP ? "efuse two point" :
+			 src == ESP_ADC_CAL_VAL_EFUSE_VREF ? "efuse vref" :
+			 "default vref");
+
+	esp_timer_create_args_t timer_args = {
+		.callback = light_timer_cb,
+		.name = "light"
+	};
+	ESP_ERROR_CHECK(esp_timer_create(&timer_args, &light_timer));
+	ESP_ERROR_CHECK(esp_timer_start_periodic(light_timer, LIGHT_PERIOD_US));
+}
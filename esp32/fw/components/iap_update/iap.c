@@ -37,8 +37,7 @@
 #define IAP_STATE_SESSION_OPEN  (1 << 1)
 
 // While the session is open ('iap_begin' called), this module uses a
-// heap-allocated page buffer to accumulate data for writing.
-#define IAP_PAGE_SIZE 4096
+// heap-allocated page buffer (IAP_PAGE_SIZE) to accumulate data for writing.
 
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 
@@ -66,6 +65,9 @@ typedef struct iap_internal_state_
 } iap_internal_state_t;
 
 static iap_internal_state_t iap_state;
+
+// Label set by iap_set_target, NULL for the next boot partition.
+static const char *iap_target;
 static iap_err_t iap_write_page_buffer();
 static iap_err_t iap_finish(int commit);
 static const esp_partition_t *iap_find_next_boot_partition();
@@ -85,9 +87,9 @@ iap_err_t iap_init()
     return IAP_OK;
 }
 
-iap_err_t iap_begin()
+iap_err_t iap_begin(uint32_t image_size)
 {
-    ESP_LOGD(TAG, "iap_begin");
+    ESP_LOGD(TAG, "iap_begin(image_size = %u)", image_size);
     
     // The module needs to be initialized for this method to work.
     if (!(iap_state.module_state_flags & IAP_STATE_INITIALIZED)) {
@@ -121,7 +123,10 @@ iap_err_t iap_begin()
         
     iap_state.cur_flash_address = iap_state.partition_to_program->address;
     
-    esp_err_t result = esp_ota_begin(iap_state.partition_to_program, 0, 
+    // With a known size only the sectors the image covers are erased,
+    // not the whole partition.
+    esp_err_t result = esp_ota_begin(iap_state.partition_to_program,
+                    image_size ? image_size : OTA_SIZE_UNKNOWN,
 														&iap_state.ota_handle);
     if (result != ESP_OK) {
         ESP_LOGE(TAG, "iap_begin: esp_ota_begin failed (%d)!", result);
@@ -158,6 +163,23 @@ iap_err_t iap_write(uint8_t *bytes, uint16_t len)
     
     while (len > 0) {
     
+        // Nothing buffered: whole pages go to flash straight from the
+        // caller's buffer, without the copy.
+        if (iap_state.page_buffer_ix == 0 && len >= IAP_PAGE_SIZE) {
+            uint16_t nofBytesDirect = len - len % IAP_PAGE_SIZE;
+            esp_err_t result = esp_ota_write(iap_state.ota_handle, bytes,
+															nofBytesDirect);
+            if (result != ESP_OK) {
+                ESP_LOGE(TAG, "iap_write: write failed (%d)!", result);
+                return IAP_ERR_WRITE_FAILED;
+            }
+
+            iap_state.cur_flash_address += nofBytesDirect;
+            bytes += nofBytesDirect;
+            len -= nofBytesDirect;
+            continue;
+        }
+
         uint16_t spaceRemaining = IAP_PAGE_SIZE - iap_state.page_buffer_ix;
         uint16_t nofBytesToCopy = MIN(spaceRemaining, len);
         
@@ -292,6 +314,11 @@ static iap_err_t iap_finish(int commit)
     return IAP_OK;
 }
 
+void iap_set_target(const char *label)
+{
+    iap_target = label;
+}
+
 static const esp_partition_t *iap_find_next_boot_partition()
 {
     // Factory -> OTA_0
@@ -300,6 +327,11 @@ static const esp_partition_t *iap_find_next_boot_partition()
     
     const esp_partition_t *currentBootPartition = esp_ota_get_boot_partition();
     const esp_partition_t *nextBootPartition = NULL;
+
+    if (iap_target) {
+        return esp_partition_find_first(ESP_PARTITION_TYPE_APP,
+										ESP_PARTITION_SUBTYPE_ANY, iap_target);
+    }
     
     if (!strcmp("factory", currentBootPartition->label)) {
         nextBootPartition = esp_partition_find_first(ESP_PARTITION_TYPE_APP, 
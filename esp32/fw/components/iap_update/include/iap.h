@@ -39,16 +39,26 @@ typedef int32_t iap_err_t;
 #define IAP_ERR_PARTITION_NOT_FOUND     0x106
 #define IAP_ERR_WRITE_FAILED            0x107
 
+// Flash page size the module writes in.
+#define IAP_PAGE_SIZE 4096
+
 // Call once at application startup, before calling any other function of this module.
 iap_err_t iap_init();
 
 // Call to start a programming session.
 // Sets the programming pointer to the start of the next OTA flash partition.
-iap_err_t iap_begin();
+// image_size is the size of the new firmware if known, or 0. Only the
+// flash the image needs is erased when it is given.
+iap_err_t iap_begin(uint32_t image_size);
+
+// Call before iap_begin to program the app partition with this label
+// instead of the one after the boot partition. NULL goes back to that.
+void iap_set_target(const char *label);
 
 // Call to write a block of data to the current location in flash.
 // If the write fails, you need to abort the current programming session
 // with 'iap_abort' and start again from the beginning.
+// Page aligned data (see IAP_PAGE_SIZE) is written without being copied.
 iap_err_t iap_write(uint8_t *bytes, uint16_t len);
 
 // Call to close a programming session and activate the programmed partition.
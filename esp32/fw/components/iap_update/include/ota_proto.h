@@ -0,0 +1,54 @@
+#ifndef __OTA_PROTO_H__
+#define __OTA_PROTO_H__
+
+//OTA wire protocol, all fields big endian.
+//
+//v1: u64 image size, then the raw image. no acks, no resume.
+//
+//v2: the client sends a hello, the device answers with an ack carrying
+//the offset to start (or resume) from and the window, in chunks, the
+//client may send ahead of the last ack. the client then sends data
+//frames of up to chunk bytes, numbered by chunk. the device acks
+//as it goes; a bad crc or unexpected sequence number gets an
+//OTA_ST_RESEND ack with the offset to go back to, frames are dropped
+//until that one arrives. once the whole image is in and its sha256
+//matches, the device answers OTA_ST_DONE. if the connection drops, the
+//client reconnects and sends the same hello to resume.
+
+#define OTA_V2_MAGIC		"SOTA"
+#define OTA_V2_VERSION		2
+#define OTA_V2_CHUNK		4096
+#define OTA_V2_WINDOW		8		//chunks in flight
+#define OTA_V2_ACK_EVERY	2		//chunks per ack
+
+//hello: magic[4] | u8 version | u8 flags | u16 chunk | u32 size |
+//       sha256[32]
+//       chunk is the payload size of full data frames, 0 for OTA_V2_CHUNK
+#define OTA_V2_HELLO_LEN	44
+//data:  u32 seq | u16 len | u16 reserved | u32 crc32 | payload[len]
+#define OTA_V2_DATA_HDR_LEN	12
+//ack:   u8 status | u8 reserved | u16 window | u32 offset
+#define OTA_V2_ACK_LEN		8
+
+//progress, notified over BLE while any transfer (TCP or BLE) runs:
+//       u8 state | u8 reserved | u16 reserved | u32 received |
+//       u32 written | u32 rate (bytes/s)
+#define OTA_PROGRESS_LEN	16
+
+typedef enum ota_prog_state {
+	OTA_PROG_IDLE,
+	OTA_PROG_RECEIVING,
+	OTA_PROG_SUSPENDED,	//link dropped, waiting for a resume
+	OTA_PROG_VERIFYING,	//whole image in, checking and activating it
+	OTA_PROG_DONE,		//verified and activated
+	OTA_PROG_FAILED
+} ota_prog_state_t;
+
+typedef enum ota_status {
+	OTA_ST_OK,			//received up to offset
+	OTA_ST_RESEND,		//go back to offset
+	OTA_ST_DONE,		//image verified and activated
+	OTA_ST_FAIL			//update failed, start over
+} ota_status_t;
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef __OTA_SESSION_H__
+#define __OTA_SESSION_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "iap.h"
+#include "ota_proto.h"
+
+//receive and flash writes are pipelined: the transport fills a pool of
+//page aligned buffers, a writer task writes full ones to flash and hands
+//them back. the link keeps moving while flash is busy
+#define OTA_BUF_SIZE		(2 * IAP_PAGE_SIZE)
+#define OTA_BUF_COUNT		3
+#define OTA_WRITER_STACK	4096
+#define OTA_WRITER_PRIO		5
+
+typedef struct ota_buf {
+	uint8_t *data;
+	int len;			//bytes in data, or one of the markers below
+} ota_buf_t;
+
+#define OTA_MARK_COMMIT		0
+#define OTA_MARK_ABORT		-1
+#define OTA_MARK_SUSPEND	-2	//keep the iap session open, v2 resumes it
+
+typedef struct ota_pipe ota_pipe_t;
+
+//allocate the buffer pool and start the writer. with resume the open iap
+//session is continued instead of starting a new one
+ota_pipe_t *ota_pipe_open(uint32_t image_size, bool resume);
+//take an empty buffer, fails once the writer has given up
+int ota_pipe_get(ota_pipe_t *pipe, ota_buf_t *buf);
+//hand a filled buffer to the writer (an empty one goes back to the pool)
+void ota_pipe_put(ota_pipe_t *pipe, ota_buf_t *buf);
+//hand the writer a marker, wait for it to drain and free the pipe
+int ota_pipe_close(ota_pipe_t *pipe, int mark);
+
+//v2 transfer, independent of the transport (TCP or BLE). one at a time,
+//it outlives a dropped link so the same image can resume.
+
+//start or resume from a hello. on success *offset is where the client
+//picks up. acks are asked for every ack_every accepted frames
+int ota_session_start(const uint8_t *hello, int len, int ack_every,
+														uint32_t *offset);
+//where the payload of the next frame goes, NULL if flash writes failed
+uint8_t *ota_session_reserve(uint16_t len);
+//check the frame just copied to ota_session_reserve(). returns true when
+//*status and *offset should be sent back as an ack. OTA_ST_DONE and
+//OTA_ST_FAIL end the session
+bool ota_session_put(uint32_t seq, uint16_t len, uint32_t crc,
+								ota_status_t *status, uint32_t *offset);
+//link dropped, keep what was acked for a resume
+void ota_session_suspend();
+//give up on the transfer
+void ota_session_reset();
+
+//progress of the current (or last) transfer, over any transport. the
+//fields are updated from different tasks, a snapshot may be slightly off
+typedef struct ota_progress {
+	ota_prog_state_t state;
+	uint32_t size;
+	uint32_t received;		//accepted from the link
+	uint32_t written;		//in flash
+} ota_progress_t;
+
+void ota_progress_get(ota_progress_t *progress);
+//for transports driving the pipe directly (v1)
+void ota_progress_received(uint32_t received);
+
+#endif
@@ -0,0 +1,432 @@
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "rom/crc.h"
+#include "mbedtls/sha256.h"
+
+#include "iap.h"
+#include "ota_session.h"
+
+static const char *TAG = "ota session";
+
+struct ota_pipe {
+	QueueHandle_t free_q;
+	QueueHandle_t full_q;
+	SemaphoreHandle_t done;
+	uint32_t image_size;
+	bool resume;
+	volatile int result;
+};
+
+//v2 transfer state, outlives a dropped connection
+typedef struct ota_session {
+	bool open;
+	uint32_t size;
+	uint32_t offset;		//received and handed to the writer
+	uint16_t chunk;
+	uint8_t sha[32];
+	mbedtls_sha256_context sha_ctx;
+
+	//current link
+	ota_pipe_t *pipe;
+	ota_buf_t buf;			//being filled, data NULL if none
+	int ack_every;
+	int since_ack;
+	bool resend;			//go-back requested, drop until it arrives
+} ota_session_t;
+
+static ota_session_t ota_session;
+static volatile ota_progress_t ota_progress;
+
+static void ota_writer_task(void *arg)
+{
+	ota_pipe_t *pipe = arg;
+	ota_buf_t buf;
+	int result = 0;
+
+	#ifdef CONFIG_OTA_CAN_WRITE_FLASH
+		//erases the image range while the first buffers are received
+		iap_err_t err;
+		if (!pipe->resume) {
+			iap_init();
+			err = iap_begin(pipe->image_size);
+			if (err == IAP_ERR_SESSION_ALREADY_OPEN) {
+				iap_abort();
+				err = iap_begin(pipe->image_size);
+			}
+
+			if (err != IAP_OK) {
+				ESP_LOGE(TAG, "iap_begin failed (%d)!", err);
+				ota_progress.state = OTA_PROG_FAILED;
+				result = -1;
+			}
+		}
+	#endif
+
+	for (;;) {
+		xQueueReceive(pipe->full_q, &buf, portMAX_DELAY);
+		if (buf.len <= 0)
+			break;
+
+		#ifdef CONFIG_OTA_CAN_WRITE_FLASH
+			if (result == 0) {
+				err = iap_write(buf.data, buf.len);
+				if (err != IAP_OK) {
+					ESP_LOGE(TAG, "iap_write failed (%d), abort fw update!",
+																	err);
+					iap_abort();
+					ota_progress.state = OTA_PROG_FAILED;
+					result = -1;
+				}
+			}
+		#endif
+
+		if (result == 0)
+			ota_progress.written += buf.len;
+
+		//the receiver checks result before refilling
+		pipe->result = result;
+		xQueueSend(pipe->free_q, &buf, portMAX_DELAY);
+	}
+
+	#ifdef CONFIG_OTA_CAN_WRITE_FLASH
+		if (result == 0 && buf.len == OTA_MARK_COMMIT) {
+			err = iap_commit();
+			if (err != IAP_OK) {
+				ESP_LOGE(TAG, "iap: closing the session has failed (%d)!", err);
+				result = -1;
+			}
+		} else if (result == 0 && buf.len == OTA_MARK_ABORT) {
+			iap_abort();
+			result = -1;
+		}
+	#else
+		if (buf.len == OTA_MARK_ABORT)
+			result = -1;
+	#endif
+
+	if (result != 0)
+		ota_progress.state = OTA_PROG_FAILED;
+	else if (buf.len == OTA_MARK_COMMIT)
+		ota_progress.state = OTA_PROG_DONE;
+	else
+		ota_progress.state = OTA_PROG_SUSPENDED;
+
+	pipe->result = result;
+	xSemaphoreGive(pipe->done);
+	vTaskDelete(NULL);
+}
+
+static void ota_pipe_free(ota_pipe_t *pipe)
+{
+	ota_buf_t buf;
+
+	if (pipe->free_q) {
+		while (xQueueReceive(pipe->free_q, &buf, 0))
+			free(buf.data);
+		vQueueDelete(pipe->free_q);
+	}
+	if (pipe->full_q)
+		vQueueDelete(pipe->full_q);
+	if (pipe->done)
+		vSemaphoreDelete(pipe->done);
+	free(pipe);
+}
+
+ota_pipe_t *ota_pipe_open(uint32_t image_size, bool resume)
+{
+	ota_pipe_t *pipe = calloc(1, sizeof(ota_pipe_t));
+	ota_buf_t buf;
+	int i;
+
+	if (!pipe)
+		return NULL;
+
+	pipe->image_size = image_size;
+	pipe->resume = resume;
+	pipe->free_q = xQueueCreate(OTA_BUF_COUNT, sizeof(ota_buf_t));
+	//one more for the marker
+	pipe->full_q = xQueueCreate(OTA_BUF_COUNT + 1, sizeof(ota_buf_t));
+	pipe->done = xSemaphoreCreateBinary();
+	if (!pipe->free_q || !pipe->full_q || !pipe->done)
+		goto fail;
+
+	for (i = 0; i < OTA_BUF_COUNT; i++) {
+		buf.data = malloc(OTA_BUF_SIZE);
+		buf.len = 0;
+		if (!buf.data) {
+			ESP_LOGE(TAG, "not enough heap for OTA buffers");
+			goto fail;
+		}
+		xQueueSend(pipe->free_q, &buf, 0);
+	}
+
+	if (!resume) {
+		ota_progress.size = image_size;
+		ota_progress.received = 0;
+		ota_progress.written = 0;
+	}
+	ota_progress.state = OTA_PROG_RECEIVING;
+
+	if (xTaskCreate(ota_writer_task, "ota writer", OTA_WRITER_STACK, pipe,
+								OTA_WRITER_PRIO, NULL) != pdPASS)
+		goto fail;
+
+	return pipe;
+
+fail:
+	ota_pipe_free(pipe);
+	return NULL;
+}
+
+int ota_pipe_get(ota_pipe_t *pipe, ota_buf_t *buf)
+{
+	xQueueReceive(pipe->free_q, buf, portMAX_DELAY);
+	buf->len = 0;
+
+	if (pipe->result != 0) {
+		xQueueSend(pipe->free_q, buf, 0);
+		return -1;
+	}
+	return 0;
+}
+
+void ota_pipe_put(ota_pipe_t *pipe, ota_buf_t *buf)
+{
+	if (buf->len > 0)
+		xQueueSend(pipe->full_q, buf, portMAX_DELAY);
+	else
+		xQueueSend(pipe->free_q, buf, 0);
+}
+
+int ota_pipe_close(ota_pipe_t *pipe, int mark)
+{
+	ota_buf_t buf = { .data = NULL, .len = mark };
+	int result;
+
+	if (mark == OTA_MARK_COMMIT)
+		ota_progress.state = OTA_PROG_VERIFYING;
+
+	xQueueSend(pipe->full_q, &buf, portMAX_DELAY);
+	xSemaphoreTake(pipe->done, portMAX_DELAY);
+	result = pipe->result;
+
+	ota_pipe_free(pipe);
+	return result;
+}
+
+static uint32_t get_be32(const uint8_t *p)
+{
+	return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+//hand over the buffer being filled and stop the writer
+static int session_close(int mark)
+{
+	ota_session_t *s = &ota_session;
+
+	if (s->buf.data)
+		ota_pipe_put(s->pipe, &s->buf);
+	s->buf.data = NULL;
+
+	int result = ota_pipe_close(s->pipe, mark);
+	s->pipe = NULL;
+	return result;
+}
+
+static void session_end()
+{
+	mbedtls_sha256_free(&ota_session.sha_ctx);
+	ota_session.open = false;
+}
+
+void ota_session_reset()
+{
+	ota_session_t *s = &ota_session;
+
+	if (!s->open)
+		return;
+
+	if (s->pipe) {
+		session_close(OTA_MARK_ABORT);
+	} else {
+		#ifdef CONFIG_OTA_CAN_WRITE_FLASH
+			iap_abort();
+		#endif
+		ota_progress.state = OTA_PROG_FAILED;
+	}
+	session_end();
+}
+
+void ota_session_suspend()
+{
+	ota_session_t *s = &ota_session;
+
+	if (!s->open || !s->pipe)
+		return;
+
+	//everything acked so far still goes to flash
+	if (session_close(OTA_MARK_SUSPEND) == 0) {
+		ESP_LOGI(TAG, "- transfer interrupted at %u", s->offset);
+		return;
+	}
+
+	//the writer already gave up on the session
+	session_end();
+}
+
+int ota_session_start(const uint8_t *hello, int len, int ack_every,
+														uint32_t *offset)
+{
+	ota_session_t *s = &ota_session;
+
+	if (len != OTA_V2_HELLO_LEN || memcmp(hello, OTA_V2_MAGIC, 4))
+		return -1;
+
+	if (hello[4] != OTA_V2_VERSION) {
+		ESP_LOGE(TAG, "unsupported OTA protocol version %d", hello[4]);
+		return -1;
+	}
+
+	uint16_t chunk = (hello[6] << 8) | hello[7];
+	uint32_t size = get_be32(hello + 8);
+
+	if (!chunk)
+		chunk = OTA_V2_CHUNK;
+	if (size == 0 || chunk > OTA_V2_CHUNK)
+		return -1;
+
+	//still attached to a link that never said goodbye
+	ota_session_suspend();
+
+	//a different image starts over
+	if (s->open && (s->size != size || s->chunk != chunk ||
+										memcmp(s->sha, hello + 12, 32)))
+		ota_session_reset();
+
+	s->pipe = ota_pipe_open(size, s->open);
+	if (!s->pipe) {
+		ota_session_reset();
+		return -1;
+	}
+
+	if (!s->open) {
+		s->open = true;
+		s->size = size;
+		s->chunk = chunk;
+		s->offset = 0;
+		memcpy(s->sha, hello + 12, 32);
+		mbedtls_sha256_init(&s->sha_ctx);
+		mbedtls_sha256_starts(&s->sha_ctx, 0);
+	}
+
+	s->buf.data = NULL;
+	s->ack_every = ack_every;
+	s->since_ack = 0;
+	s->resend = false;
+
+	ota_progress.received = s->offset;
+	ESP_LOGI(TAG, "- firmware size (bytes): %u, from %u", size, s->offset);
+	*offset = s->offset;
+	return 0;
+}
+
+uint8_t *ota_session_reserve(uint16_t len)
+{
+	ota_session_t *s = &ota_session;
+
+	if (!s->open || !s->pipe || len > OTA_BUF_SIZE)
+		return NULL;
+
+	if (s->buf.data && OTA_BUF_SIZE - s->buf.len < len) {
+		ota_pipe_put(s->pipe, &s->buf);
+		s->buf.data = NULL;
+	}
+	if (!s->buf.data && ota_pipe_get(s->pipe, &s->buf) < 0) {
+		s->buf.data = NULL;
+		return NULL;
+	}
+
+	return s->buf.data + s->buf.len;
+}
+
+bool ota_session_put(uint32_t seq, uint16_t len, uint32_t crc,
+								ota_status_t *status, uint32_t *offset)
+{
+	ota_session_t *s = &ota_session;
+	uint8_t sha[32];
+	uint8_t *data;
+
+	if (!s->open || !s->pipe || !s->buf.data) {
+		*status = OTA_ST_FAIL;
+		*offset = 0;
+		return true;
+	}
+
+	data = s->buf.data + s->buf.len;
+	*offset = s->offset;
+
+	if (len == 0 || seq != s->offset / s->chunk || len > s->chunk ||
+			len > s->size - s->offset || crc32_le(0, data, len) != crc) {
+		ESP_LOGW(TAG, "bad frame %u, resend from %u", seq, s->offset);
+		//one request per go-back, the rest in flight is dropped
+		*status = OTA_ST_RESEND;
+		if (s->resend)
+			return false;
+		s->resend = true;
+		return true;
+	}
+
+	s->resend = false;
+	mbedtls_sha256_update(&s->sha_ctx, data, len);
+	s->buf.len += len;
+	s->offset += len;
+	*offset = s->offset;
+	ota_progress.received = s->offset;
+
+	if (s->buf.len == OTA_BUF_SIZE) {
+		ota_pipe_put(s->pipe, &s->buf);
+		s->buf.data = NULL;
+	}
+
+	if (s->offset < s->size) {
+		*status = OTA_ST_OK;
+		if (++s->since_ack < s->ack_every)
+			return false;
+		s->since_ack = 0;
+		return true;
+	}
+
+	//whole image is in
+	ota_progress.state = OTA_PROG_VERIFYING;
+	mbedtls_sha256_finish(&s->sha_ctx, sha);
+	if (memcmp(sha, s->sha, sizeof(sha))) {
+		ESP_LOGE(TAG, "image sha256 mismatch");
+		session_close(OTA_MARK_ABORT);
+		*status = OTA_ST_FAIL;
+	} else {
+		*status = session_close(OTA_MARK_COMMIT) == 0 ? OTA_ST_DONE :
+															OTA_ST_FAIL;
+	}
+
+	ESP_LOGI(TAG, "- data written (bytes): %u", s->size);
+	session_end();
+	return true;
+}
+
+void ota_progress_get(ota_progress_t *progress)
+{
+	progress->state = ota_progress.state;
+	progress->size = ota_progress.size;
+	progress->received = ota_progress.received;
+	progress->written = ota_progress.written;
+}
+
+void ota_progress_received(uint32_t received)
+{
+	ota_progress.received = received;
+}
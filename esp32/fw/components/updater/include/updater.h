@@ -0,0 +1,46 @@
+#ifndef __UPDATER_H__
+#define __UPDATER_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+//two-stage update. the normal app (ota_0 / ota_1) only does BLE, sensors
+//and scheduling; WiFi, lwIP and the TCP OTA transports live in the
+//updater app in the factory partition (CONFIG_DTC_UPDATER). entering
+//update mode stores a request in nvs and reboots into the updater, which
+//programs the other app slot and boots into it on commit, or back into
+//the app that asked when the update fails.
+
+#define UPDATER_NVS_NAMESPACE	"updater"
+#define UPDATER_NVS_KEY			"req"
+#define UPDATER_REQ_VERSION		1
+#define UPDATER_STA_CONFIG_MAX	104		//WIFI_STA_CONFIG_MAX
+#define UPDATER_HANDOFF_MS		2000	//let the client read the pass first
+
+typedef struct updater_req {
+	uint8_t version;
+	uint8_t station;		//station mode, else SoftAP
+	uint8_t sta_len;
+	uint8_t sta_config[UPDATER_STA_CONFIG_MAX];	//0xFF0C value
+	uint64_t pass;			//SoftAP passphrase seed, 0xFF07 keeps its value
+	char app[17];			//partition label to return to
+} updater_req_t;
+
+//normal app: checks the layout of a station config (0xFF0C value, see
+//wifi_connect_set_sta) without WiFi code, the updater parses it again
+bool updater_sta_config_valid(const uint8_t *value, uint16_t len);
+//normal app: boot into the updater on the next restart. false if there
+//is no updater partition or the request could not be stored
+bool updater_request(updater_req_t *req);
+//updater: the request that started it, false on a cold boot
+bool updater_get_request(updater_req_t *req);
+//updater, cold boot: boot a valid app slot. false if there is none
+bool updater_boot_app();
+//updater: the app slot to program, never the one the request returns to
+const char *updater_target(const updater_req_t *req);
+//updater: drop the request and restart. after a commit the new app is
+//already the boot partition, otherwise go back to the app that asked.
+//without one (cold boot, nothing to return to) the updater runs again
+void updater_exit(bool committed);
+
+#endif
@@ -0,0 +1,153 @@
+#include <string.h>
+#include "esp_system.h"
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "nvs.h"
+
+#include "updater.h"
+
+static const char *TAG = "updater";
+
+static const esp_partition_t *find_app(const char *label)
+{
+	return esp_partition_find_first(ESP_PARTITION_TYPE_APP,
+				label ? ESP_PARTITION_SUBTYPE_ANY :
+						ESP_PARTITION_SUBTYPE_APP_FACTORY, label);
+}
+
+bool updater_request(updater_req_t *req)
+{
+	const esp_partition_t *updater = find_app(NULL);
+	const esp_partition_t *running = esp_ota_get_running_partition();
+	nvs_handle nvs;
+	esp_err_t err;
+
+	if (!updater || updater == running) {
+		ESP_LOGE(TAG, "no updater partition");
+		return false;
+	}
+
+	req->version = UPDATER_REQ_VERSION;
+	memset(req->app, 0, sizeof(req->app));
+	strncpy(req->app, running->label, sizeof(req->app) - 1);
+
+	err = nvs_open(UPDATER_NVS_NAMESPACE, NVS_READWRITE, &nvs);
+	if (err != ESP_OK) {
+		ESP_LOGE(TAG, "nvs open failed (%d)", err);
+		return false;
+	}
+
+	err = nvs_set_blob(nvs, UPDATER_NVS_KEY, req, sizeof(*req));
+	if (err == ESP_OK)
+		err = nvs_commit(nvs);
+	nvs_close(nvs);
+
+	if (err != ESP_OK) {
+		ESP_LOGE(TAG, "storing the request failed (%d)", err);
+		return false;
+	}
+
+	//also checks the updater image
+	err = esp_ota_set_boot_partition(updater);
+	if (err != ESP_OK) {
+		ESP_LOGE(TAG, "updater not bootable (%d)", err);
+		return false;
+	}
+
+	ESP_LOGI(TAG, "handing over to the updater, back to %s", req->app);
+	return true;
+}
+
+bool updater_sta_config_valid(const uint8_t *value, uint16_t len)
+{
+	uint8_t ssid_len, pass_len;
+	const uint8_t *p = value;
+
+	if (len < 1 || len > UPDATER_STA_CONFIG_MAX)
+		return false;
+	ssid_len = *p++;
+	if (ssid_len == 0 || ssid_len > 32 || len < 1 + ssid_len + 1)
+		return false;
+	p += ssid_len;
+
+	pass_len = *p++;
+	if ((pass_len && pass_len < 8) || pass_len > 64 ||
+							len != 1 + ssid_len + 1 + pass_len + 4 + 2)
+		return false;
+	p += pass_len;
+
+	//server address and port, network order
+	return (p[0] | p[1] | p[2] | p[3]) && (p[4] | p[5]);
+}
+
+bool updater_get_request(updater_req_t *req)
+{
+	size_t len = sizeof(*req);
+	nvs_handle nvs;
+	esp_err_t err;
+
+	if (nvs_open(UPDATER_NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK)
+		return false;
+
+	err = nvs_get_blob(nvs, UPDATER_NVS_KEY, req, &len);
+	nvs_close(nvs);
+
+	if (err != ESP_OK || len != sizeof(*req) ||
+								req->version != UPDATER_REQ_VERSION) {
+		memset(req, 0, sizeof(*req));
+		return false;
+	}
+
+	req->app[sizeof(req->app) - 1] = '\0';
+	if (req->sta_len > sizeof(req->sta_config))
+		req->sta_len = 0;
+
+	return true;
+}
+
+bool updater_boot_app()
+{
+	static const char *slots[] = { "ota_0", "ota_1" };
+	const esp_partition_t *app;
+	int i;
+
+	for (i = 0; i < sizeof(slots) / sizeof(slots[0]); i++) {
+		app = find_app(slots[i]);
+		//only succeeds for a valid image
+		if (app && esp_ota_set_boot_partition(app) == ESP_OK) {
+			ESP_LOGI(TAG, "no request, booting %s", slots[i]);
+			esp_restart();
+		}
+	}
+
+	return false;
+}
+
+const char *updater_target(const updater_req_t *req)
+{
+	return strcmp(req->app, "ota_0") ? "ota_0" : "ota_1";
+}
+
+void updater_exit(bool committed)
+{
+	const esp_partition_t *app = NULL;
+	updater_req_t req;
+	nvs_handle nvs;
+
+	if (updater_get_request(&req) && !committed)
+		app = find_app(req.app);
+
+	if (nvs_open(UPDATER_NVS_NAMESPACE, NVS_READWRITE, &nvs) == ESP_OK) {
+		nvs_erase_key(nvs, UPDATER_NVS_KEY);
+		nvs_commit(nvs);
+		nvs_close(nvs);
+	}
+
+	if (app && esp_ota_set_boot_partition(app) != ESP_OK)
+		ESP_LOGE(TAG, "can't return to %s", req.app);
+
+	ESP_LOGI(TAG, "update %s, restarting", committed ? "committed" :
+															"failed");
+	esp_restart();
+}
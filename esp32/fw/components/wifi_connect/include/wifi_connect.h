@@ -18,13 +18,50 @@
 #include "esp_wifi.h"
 #include "esp_event_loop.h"
 
-#define DTC_ESP_WIFI_MODE_AP   "TRUE"   //TRUE:AP FALSE:STA
-#define DTC_ESP_WIFI_SSID      "DTCAP"
+#define DTC_ESP_WIFI_SSID      "DTC-"   //+ last 3 bytes of the AP mac
 #define DTC_ESP_WIFI_PASS      "12345678" //overwritten later
-#define DTC_MAX_STA_CONN       1
+#define DTC_MAX_STA_CONN       1        //one uploader per device
 #define PORT_NUMBER 5000
 
-void wifi_connect_init(uint64_t pass_int);
+//SoftAP identity, so several devices can update side by side: the ssid
+//comes from the mac, the subnet is 10.<mac[5]>.<random>.0/24 per
+//session and the channel is the least busy of 1/6/11 (scanned first).
+//reported over BLE next to the pass, layout:
+//  u8 channel (0 until the AP is up) | u32 ip | u8 ssid_len | ssid
+#define WIFI_AP_INFO_MAX		(1 + 4 + 1 + 32)
+#define WIFI_AP_SCAN_MAX		32		//scan results looked at
+#define WIFI_AP_OVERLAP			4		//channels an AP spills into
+
+typedef struct wifi_ap_info {
+	char ssid[33];
+	uint8_t channel;
+	uint32_t ip;		//network order
+} wifi_ap_info_t;
+
+#define OTA_RECV_TIMEOUT	10		//seconds, stalled recv / wait to resume
+#define OTA_ACCEPT_MAX		5		//connections per update
+#define OTA_ACCEPT_TIMEOUT	120		//seconds for the host to join and connect
+
+//station mode: join a maintenance network and pull the image from a host
+//server (same protocol, the device connects instead of accepting).
+//provisioned over BLE, kept in RAM until reset. config value layout:
+//  u8 ssid_len | ssid | u8 pass_len | pass | u32 server ip | u16 port
+//all big endian, pass_len 0 for an open network
+#define WIFI_STA_CONFIG_MAX		(1 + 32 + 1 + 64 + 4 + 2)
+#define WIFI_STA_JOIN_TIMEOUT	30		//seconds to get an address
+
+//SoftAP mode, info is filled in once the AP is up
+void wifi_connect_init(uint64_t pass_int, wifi_ap_info_t *info);
+//characteristic value for info, returns its length
+uint16_t wifi_connect_ap_info_value(const wifi_ap_info_t *info,
+														uint8_t *value);
 void wifi_connect_destroy();
 void socket_server();
+
+//station mode
+bool wifi_connect_set_sta(const uint8_t *value, uint16_t len);
+bool wifi_connect_has_sta();
+//false if the network could not be joined
+bool wifi_connect_init_sta();
+void socket_client();
 #endif
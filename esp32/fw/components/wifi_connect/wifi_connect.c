@@ -1,95 +1,194 @@
 #include <inttypes.h>
+#include <sys/param.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/event_groups.h"
 #include "freertos/task.h"
 #include "freertos/queue.h"
+#include "freertos/semphr.h"
 #include "esp_log.h"
 #include "sdkconfig.h"
 
 #include "wifi_connect.h"
 #include "iap.h"
+#include "ota_session.h"
 
 // FreeRTOS event group to signal when we are connected
 static EventGroupHandle_t wifi_event_group;
 static const int WIFI_CONNECTED_BIT = BIT0;
 static const char *TAG = "wifi connect";
 
-int recv_fw(int client_sock) 
-{
-    iap_err_t result;
-	ESP_LOGI(TAG, "- IAP (In-App Programming) init ");
+typedef struct wifi_sta_config {
+	bool valid;
+	wifi_config_t wifi;
+	struct sockaddr_in server;
+} wifi_sta_config_t;
 
-	// setup space for new client data
-	int chunk = 10 * 1024;
-	int size_used = 0;
-	char *data = malloc(chunk);
-    char *data_len = malloc(8);
+static wifi_sta_config_t sta_config;
+static bool sta_join;		//connect on STA start, not while scanning
 
-	// recv length of fw bin
-	ssize_t size_read = recv(client_sock, data_len, 8, 0);
-	if (size_read != 8) {
-		ESP_LOGE(TAG, "recv: %d %s", size_read, strerror(errno));
-		return -1;
+static int recv_all(int client_sock, uint8_t *data, int len)
+{
+	int got = 0;
+
+	while (got < len) {
+		ssize_t size_read = recv(client_sock, data + got, len - got, 0);
+		if (size_read < 0) {
+			ESP_LOGE(TAG, "recv: %d %s", size_read, strerror(errno));
+			return -1;
+		}
+		if (size_read == 0) {
+			ESP_LOGE(TAG, "recv: connection closed early");
+			return -1;
+		}
+		got += size_read;
 	}
+	return 0;
+}
+
+static uint32_t get_be32(const uint8_t *p)
+{
+	return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
 
-    uint64_t ilen = 
-		data_len[7] | (data_len[6]<<8) | (data_len[5]<<16) | (data_len[4]<<24)|
-		((uint64_t)data_len[3] << 32) | ((uint64_t)data_len[2] << 40) |
-		((uint64_t)data_len[1] << 48) | ((uint64_t)data_len[0] << 56);
+//v1: u64 size then raw data, no acks
+static int recv_fw_v1(int client_sock, const uint8_t *data_len)
+{
+	ota_pipe_t *pipe;
+	ota_buf_t buf;
+	uint32_t size_used = 0;
+
+	uint64_t ilen = 
+		((uint64_t)get_be32(data_len) << 32) | get_be32(data_len + 4);
 	ESP_LOGI(TAG, "- firmware size (bytes): %" PRIu64 "\n", ilen);
 
-	#ifdef CONFIG_OTA_CAN_WRITE_FLASH
-		iap_init();
-    	result = iap_begin();
-    	if (result == IAP_ERR_SESSION_ALREADY_OPEN) {
-        	iap_abort();
-        	result = iap_begin();
-    	}
+	if (ilen == 0 || ilen > UINT32_MAX) {
+		ESP_LOGE(TAG, "invalid firmware size");
+		return -1;
+	}
 
-    	if (result != IAP_OK) {
-        	ESP_LOGE(TAG, "iap_begin failed (%d)!", result);
-        	return -1;
-    	}
-	#endif
+	pipe = ota_pipe_open(ilen, false);
+	if (!pipe)
+		return -1;
 
 	ESP_LOGI(TAG, "- begin receiving fw data");
-	while (1) {
-		ssize_t size_read = recv(client_sock, data, ilen-size_used, 0);
-		if (size_read < 0) {
-			ESP_LOGE(TAG, "recv: %d %s", size_read, strerror(errno));
-			return -1;
+	while (size_used < ilen) {
+		int want = MIN(OTA_BUF_SIZE, ilen - size_used);
+
+		if (ota_pipe_get(pipe, &buf) < 0)
+			break;
+		if (recv_all(client_sock, buf.data, want) < 0) {
+			ota_pipe_put(pipe, &buf);
+			break;
+		}
+
+		buf.len = want;
+		size_used += want;
+		ota_pipe_put(pipe, &buf);
+		ota_progress_received(size_used);
+	}
+
+	ESP_LOGI(TAG, "- data received (bytes): %u", size_used);
+	return ota_pipe_close(pipe, size_used == ilen ? OTA_MARK_COMMIT :
+														OTA_MARK_ABORT);
+}
+
+static int send_ack(int client_sock, ota_status_t status, uint32_t offset)
+{
+	uint8_t ack[OTA_V2_ACK_LEN] = {
+		status, 0, OTA_V2_WINDOW >> 8, OTA_V2_WINDOW & 0xff,
+		offset >> 24, offset >> 16, offset >> 8, offset
+	};
+
+	return send(client_sock, ack, sizeof(ack), 0) == sizeof(ack) ? 0 : -1;
+}
+
+//v2: framed, acked, resumable. 0 done, -1 failed, 1 dropped but resumable
+static int recv_fw_v2(int client_sock, const uint8_t *hello)
+{
+	uint8_t hdr[OTA_V2_DATA_HDR_LEN];
+	ota_status_t status;
+	uint32_t offset;
+	uint8_t *data;
+
+	if (ota_session_start(hello, OTA_V2_HELLO_LEN, OTA_V2_ACK_EVERY,
+														&offset) < 0) {
+		send_ack(client_sock, OTA_ST_FAIL, 0);
+		return -1;
+	}
+
+	if (send_ack(client_sock, OTA_ST_OK, offset) < 0)
+		goto suspend;
+
+	for (;;) {
+		if (recv_all(client_sock, hdr, sizeof(hdr)) < 0)
+			goto suspend;
+
+		uint32_t seq = get_be32(hdr);
+		uint16_t len = (hdr[4] << 8) | hdr[5];
+		uint32_t crc = get_be32(hdr + 8);
+
+		if (len == 0 || len > OTA_V2_CHUNK) {
+			ESP_LOGE(TAG, "bad frame length %u", len);
+			goto suspend;
 		}
-		if (size_read == 0) { break; }
-		size_used += size_read;
-
-		#ifdef CONFIG_OTA_CAN_WRITE_FLASH
-			// Write the received data to the flash.
-			result = iap_write((uint8_t*)data, size_read);
-			if (result != IAP_OK) {
-				ESP_LOGE(TAG, "iap_write failed (%d), abort fw update!", result);
-				iap_abort();
-				return -1;
-			}
-		#endif
-	}
-
-	ESP_LOGI(TAG, "- data written (bytes): %d", size_used);
-	#ifdef CONFIG_OTA_CAN_WRITE_FLASH
-		result = iap_commit();
-    	if (result != IAP_OK) {
-        	ESP_LOGE(TAG, "iap: closing the session has failed (%d)!", result);
+
+		//straight into the pool buffer, dropped again if it's no good
+		data = ota_session_reserve(len);
+		if (!data) {
+			ota_session_reset();
+			send_ack(client_sock, OTA_ST_FAIL, 0);
 			return -1;
-    	}
-	#endif
-	free(data);
-	return 0;
+		}
+
+		if (recv_all(client_sock, data, len) < 0)
+			goto suspend;
+
+		if (!ota_session_put(seq, len, crc, &status, &offset))
+			continue;
+
+		if (status == OTA_ST_DONE || status == OTA_ST_FAIL) {
+			send_ack(client_sock, status, offset);
+			return status == OTA_ST_DONE ? 0 : -1;
+		}
+
+		if (send_ack(client_sock, status, offset) < 0)
+			goto suspend;
+	}
+
+suspend:
+	ota_session_suspend();
+	return 1;
 }
 
-//tcp socket server. receives fw bin on connection and writes it to flash
+int recv_fw(int client_sock) 
+{
+	uint8_t hello[OTA_V2_HELLO_LEN];
+
+	ESP_LOGI(TAG, "- IAP (In-App Programming) init ");
+
+	//v1 starts with the u64 size, v2 with the magic
+	if (recv_all(client_sock, hello, 8) < 0)
+		return 1;
+
+	if (memcmp(hello, OTA_V2_MAGIC, 4))
+		return recv_fw_v1(client_sock, hello);
+
+	if (recv_all(client_sock, hello + 8, OTA_V2_HELLO_LEN - 8) < 0)
+		return 1;
+
+	return recv_fw_v2(client_sock, hello);
+}
+
+//tcp socket server. receives fw bin on connection and writes it to flash.
+//an interrupted v2 transfer is resumed on the next connection
 void socket_server()
 {
 	struct sockaddr_in client_addr;
 	struct sockaddr_in server_addr;
+	struct timeval tv = { .tv_sec = OTA_RECV_TIMEOUT, .tv_usec = 0 };
+	struct timeval tv_accept = { .tv_sec = OTA_ACCEPT_TIMEOUT, .tv_usec = 0 };
+	int attempt, result = 1;
+
 	ESP_LOGI(TAG, " - socket");
 	// Create a socket that we will listen upon.
 	int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
@@ -106,6 +205,7 @@ void socket_server()
 	int rc = bind(sock, (struct sockaddr *)&server_addr, sizeof(server_addr));
 	if (rc < 0) {
 		ESP_LOGE(TAG, "bind: %d %s", rc, strerror(errno));
+		close(sock);
 		return;
 	}
 
@@ -114,32 +214,94 @@ void socket_server()
 	rc = listen(sock, 5);
 	if (rc < 0) {
 		ESP_LOGE(TAG, "listen: %d %s", rc, strerror(errno));
+		close(sock);
 		return;
 	}
 
-	ESP_LOGI(TAG, "- accept");
-	// Listen for a new client connection.
-	socklen_t client_addr_len = sizeof(client_addr);
-	int client_sock = accept(sock, (struct sockaddr *)&client_addr, 
-		&client_addr_len);
+	//accept times out too: a host that never shows up must not keep the
+	//device in the updater, the caller goes back to the app
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv_accept, sizeof(tv_accept));
 
-	if (client_sock < 0) {
-		ESP_LOGE(TAG, "accept: %d %s", client_sock, strerror(errno));
-		return;
+	for (attempt = 0; attempt < OTA_ACCEPT_MAX && result == 1; attempt++) {
+		ESP_LOGI(TAG, "- accept");
+		// Listen for a new client connection.
+		socklen_t client_addr_len = sizeof(client_addr);
+		int client_sock = accept(sock, (struct sockaddr *)&client_addr, 
+			&client_addr_len);
+
+		if (client_sock < 0) {
+			ESP_LOGE(TAG, "accept: %d %s", client_sock, strerror(errno));
+			break;
+		}
+
+		//a stalled link counts as a dropped one, and a client that
+		//doesn't come back to resume gives up the update
+		setsockopt(client_sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		result = recv_fw(client_sock);
+
+		ESP_LOGI(TAG, "- close");
+		close(client_sock);
 	}
 
-	ESP_LOGI(TAG, "- accept");
-	recv_fw(client_sock);
+	ota_session_reset();
+	close(sock);
+}
+
+static int connect_server()
+{
+	struct timeval tv = { .tv_sec = OTA_RECV_TIMEOUT, .tv_usec = 0 };
+	int sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+
+	if (sock < 0) {
+		ESP_LOGE(TAG, "socket: %d %s", sock, strerror(errno));
+		return -1;
+	}
+
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+	if (connect(sock, (struct sockaddr *)&sta_config.server,
+										sizeof(sta_config.server)) < 0) {
+		ESP_LOGE(TAG, "connect: %s", strerror(errno));
+		close(sock);
+		return -1;
+	}
+	return sock;
+}
+
+//tcp client, the station mode counterpart of socket_server. the server
+//sends the image as it would to a client; a dropped v2 transfer is
+//resumed on the next connection
+void socket_client()
+{
+	int attempt, result = 1;
+
+	for (attempt = 0; attempt < OTA_ACCEPT_MAX && result == 1; attempt++) {
+		if (attempt)
+			vTaskDelay(OTA_RECV_TIMEOUT * 1000 / portTICK_RATE_MS / 5);
+
+		ESP_LOGI(TAG, "- connect %s:%u",
+				inet_ntoa(sta_config.server.sin_addr),
+				ntohs(sta_config.server.sin_port));
+		int sock = connect_server();
+		if (sock < 0)
+			continue;
 
-	ESP_LOGI(TAG, "- close");
-	close(client_sock);
+		result = recv_fw(sock);
+
+		ESP_LOGI(TAG, "- close");
+		close(sock);
+	}
+
+	ota_session_reset();
 }
 
 static esp_err_t event_handler(void *ctx, system_event_t * event)
 {
 	switch (event->event_id) {
 	case SYSTEM_EVENT_STA_START:
-		esp_wifi_connect();
+		if (sta_join)
+			esp_wifi_connect();
 		break;
 	case SYSTEM_EVENT_STA_GOT_IP:
 		ESP_LOGI(TAG, "got ip:%s",
@@ -157,7 +319,8 @@ static esp_err_t event_handler(void *ctx, system_event_t * event)
 			 event->event_info.sta_disconnected.aid);
 		break;
 	case SYSTEM_EVENT_STA_DISCONNECTED:
-		esp_wifi_connect();
+		if (sta_join)
+			esp_wifi_connect();
 		xEventGroupClearBits(wifi_event_group, WIFI_CONNECTED_BIT);
 		break;
 	default:
@@ -166,9 +329,69 @@ static esp_err_t event_handler(void *ctx, system_event_t * event)
 	return ESP_OK;
 }
 
-void wifi_connect_init(uint64_t pass_int)
+//least busy of the non overlapping channels 1/6/11. every AP heard
+//within WIFI_AP_OVERLAP channels counts, the louder the more. ties go
+//by mac so devices scanning at the same time spread out
+static uint8_t select_channel(const uint8_t *mac)
+{
+	static const uint8_t channels[] = { 1, 6, 11 };
+	uint32_t load[sizeof(channels)] = { 0 };
+	wifi_scan_config_t scan = { .show_hidden = true };
+	wifi_ap_record_t *aps;
+	uint16_t num = WIFI_AP_SCAN_MAX;
+	int i, k, best;
+
+	aps = malloc(num * sizeof(*aps));
+	if (!aps)
+		return channels[mac[5] % sizeof(channels)];
+
+	ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
+	ESP_ERROR_CHECK(esp_wifi_start());
+	if (esp_wifi_scan_start(&scan, true) != ESP_OK ||
+							esp_wifi_scan_get_ap_records(&num, aps) != ESP_OK)
+		num = 0;
+	ESP_ERROR_CHECK(esp_wifi_stop());
+
+	for (i = 0; i < num; i++) {
+		for (k = 0; k < sizeof(channels); k++) {
+			if (abs(aps[i].primary - channels[k]) > WIFI_AP_OVERLAP)
+				continue;
+			//-100 dBm barely counts, -30 dBm a lot
+			load[k] += MAX(aps[i].rssi + 100, 1);
+		}
+	}
+	free(aps);
+
+	best = mac[5] % sizeof(channels);
+	for (k = 0; k < sizeof(channels); k++) {
+		if (load[k] < load[best])
+			best = k;
+	}
+
+	ESP_LOGI(TAG, "%u APs around, load 1:%u 6:%u 11:%u, using %u", num,
+				load[0], load[1], load[2], channels[best]);
+	return channels[best];
+}
+
+uint16_t wifi_connect_ap_info_value(const wifi_ap_info_t *info,
+														uint8_t *value)
 {
+	uint8_t ssid_len = strlen(info->ssid);
+
+	value[0] = info->channel;
+	memcpy(value + 1, &info->ip, 4);
+	value[5] = ssid_len;
+	memcpy(value + 6, info->ssid, ssid_len);
+
+	return 6 + ssid_len;
+}
+
+void wifi_connect_init(uint64_t pass_int, wifi_ap_info_t *info)
+{
+	uint8_t mac[6];
+
 	wifi_event_group = xEventGroupCreate();
+	esp_read_mac(mac, ESP_MAC_WIFI_SOFTAP);
 
 	char pass_str[9];// = (char*)malloc(9);
     for(int i = 0; i < 8; i++) {
@@ -183,14 +406,17 @@ void wifi_connect_init(uint64_t pass_int)
 	ESP_ERROR_CHECK(tcpip_adapter_dhcps_stop(TCPIP_ADAPTER_IF_AP));
 	ESP_LOGI(TAG, "- DHCP server stopped\n");
 
-	// assign a static IP to the network interface
-	tcpip_adapter_ip_info_t info;
-	memset(&info, 0, sizeof(info));
-	IP4_ADDR(&info.ip, 192, 168, 1, 1);
-	IP4_ADDR(&info.gw, 192, 168, 1, 1);
-	IP4_ADDR(&info.netmask, 255, 255, 255, 0);
-	ESP_ERROR_CHECK(tcpip_adapter_set_ip_info(TCPIP_ADAPTER_IF_AP, &info));
-	ESP_LOGI(TAG, "- TCP adapter configured with IP 192.168.1.1/24\n");
+	// assign a static IP to the network interface, a new subnet each
+	// session so a client still holding an old lease can't mix them up
+	uint8_t subnet = esp_random() & 0xff;
+	tcpip_adapter_ip_info_t ip_info;
+	memset(&ip_info, 0, sizeof(ip_info));
+	IP4_ADDR(&ip_info.ip, 10, mac[5], subnet, 1);
+	IP4_ADDR(&ip_info.gw, 10, mac[5], subnet, 1);
+	IP4_ADDR(&ip_info.netmask, 255, 255, 255, 0);
+	ESP_ERROR_CHECK(tcpip_adapter_set_ip_info(TCPIP_ADAPTER_IF_AP, &ip_info));
+	ESP_LOGI(TAG, "- TCP adapter configured with IP 10.%u.%u.1/24\n",
+															mac[5], subnet);
 
 	// start the DHCP server   
 	ESP_ERROR_CHECK(tcpip_adapter_dhcps_start(TCPIP_ADAPTER_IF_AP));
@@ -200,27 +426,107 @@ void wifi_connect_init(uint64_t pass_int)
 
 	wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
 	ESP_ERROR_CHECK(esp_wifi_init(&cfg));
+	ESP_ERROR_CHECK(esp_wifi_set_storage(WIFI_STORAGE_RAM));
 	wifi_config_t wifi_config = {
 		.ap = {
-		       .ssid = DTC_ESP_WIFI_SSID,
-		       .ssid_len = strlen(DTC_ESP_WIFI_SSID),
 		       .password = DTC_ESP_WIFI_PASS,
 		       .max_connection = DTC_MAX_STA_CONN,
 		       .authmode = WIFI_AUTH_WPA_WPA2_PSK
 		},
 	}; 
 
+	snprintf(info->ssid, sizeof(info->ssid), DTC_ESP_WIFI_SSID "%02X%02X%02X",
+													mac[3], mac[4], mac[5]);
+	memcpy(wifi_config.ap.ssid, info->ssid, strlen(info->ssid));
+	wifi_config.ap.ssid_len = strlen(info->ssid);
+	wifi_config.ap.channel = select_channel(mac);
     memcpy(wifi_config.ap.password, pass_str, 8);
 
 	ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_AP));
 	ESP_ERROR_CHECK(esp_wifi_set_config(ESP_IF_WIFI_AP, &wifi_config));
 	ESP_ERROR_CHECK(esp_wifi_start());
 
-	ESP_LOGI(TAG, "wifi_init_softap finished.SSID:%s password:%s",
-		 DTC_ESP_WIFI_SSID, pass_str);
+	info->channel = wifi_config.ap.channel;
+	info->ip = ip_info.ip.addr;
+
+	ESP_LOGI(TAG, "wifi_init_softap finished.SSID:%s channel:%u password:%s",
+		 info->ssid, info->channel, pass_str);
 }
 
 void wifi_connect_destroy()
 {
 	ESP_ERROR_CHECK(esp_wifi_stop());
 }
+
+bool wifi_connect_set_sta(const uint8_t *value, uint16_t len)
+{
+	wifi_sta_config_t c = { .valid = true };
+	uint8_t ssid_len, pass_len;
+	const uint8_t *p = value;
+
+	if (len < 1)
+		return false;
+	ssid_len = *p++;
+	if (ssid_len == 0 || ssid_len > sizeof(c.wifi.sta.ssid) ||
+											len < 1 + ssid_len + 1)
+		return false;
+	memcpy(c.wifi.sta.ssid, p, ssid_len);
+	p += ssid_len;
+
+	pass_len = *p++;
+	if ((pass_len && pass_len < 8) || pass_len > sizeof(c.wifi.sta.password)
+							|| len != 1 + ssid_len + 1 + pass_len + 4 + 2)
+		return false;
+	memcpy(c.wifi.sta.password, p, pass_len);
+	p += pass_len;
+
+	//already network order
+	c.server.sin_family = AF_INET;
+	memcpy(&c.server.sin_addr.s_addr, p, 4);
+	memcpy(&c.server.sin_port, p + 4, 2);
+	if (c.server.sin_addr.s_addr == 0 || c.server.sin_port == 0)
+		return false;
+
+	sta_config = c;
+	ESP_LOGI(TAG, "station config: ssid %.*s, server %s:%u", ssid_len,
+			(char *)c.wifi.sta.ssid, inet_ntoa(c.server.sin_addr),
+			ntohs(c.server.sin_port));
+	return true;
+}
+
+bool wifi_connect_has_sta()
+{
+	return sta_config.valid;
+}
+
+bool wifi_connect_init_sta()
+{
+	if (!sta_config.valid)
+		return false;
+
+	sta_join = true;
+	wifi_event_group = xEventGroupCreate();
+
+	tcpip_adapter_init();
+	ESP_ERROR_CHECK(esp_event_loop_init(event_handler, NULL));
+
+	wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
+	ESP_ERROR_CHECK(esp_wifi_init(&cfg));
+	ESP_ERROR_CHECK(esp_wifi_set_storage(WIFI_STORAGE_RAM));
+	ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
+	ESP_ERROR_CHECK(esp_wifi_set_config(ESP_IF_WIFI_STA, &sta_config.wifi));
+	//connects on SYSTEM_EVENT_STA_START, reconnects on disconnect
+	ESP_ERROR_CHECK(esp_wifi_start());
+
+	ESP_LOGI(TAG, "wifi_init_sta finished, joining %s",
+										(char *)sta_config.wifi.sta.ssid);
+
+	EventBits_t bits = xEventGroupWaitBits(wifi_event_group,
+						WIFI_CONNECTED_BIT, pdFALSE, pdTRUE,
+						WIFI_STA_JOIN_TIMEOUT * 1000 / portTICK_RATE_MS);
+	if (!(bits & WIFI_CONNECTED_BIT)) {
+		ESP_LOGE(TAG, "could not join %s", (char *)sta_config.wifi.sta.ssid);
+		return false;
+	}
+	return true;
+}
@@ -7,6 +7,7 @@
 #include "esp_gatts_api.h"
 #include "esp_bt_main.h"
 #include "esp_system.h"
+#include "esp_timer.h"
 #include "nvs_flash.h"
 #include "esp_log.h"
 #include "esp_bt.h"
@@ -14,6 +15,39 @@
 #include "gpio_handler.h"
 #include "gatts_ble.h"
 
+#define BOOT_TAG "boot"
+#define BOOT_TASK_STACK 3072
+#define BOOT_TASK_PRIO 1
+//give up on the advertising timestamp after this long
+#define BOOT_ADV_WAIT_MS 5000
+
+//end of each boot phase, esp_timer us
+static int64_t t_nvs, t_ble, t_gpio;
+
+//runs below the BT tasks, advertising is up before most of this
+static void boot_late_task(void *arg)
+{
+	esp_reset_reason_t reason = esp_reset_reason();
+	int64_t t_adv;
+	int waited = 0;
+
+	gpio_handler_init_late(reason == ESP_RST_POWERON ||
+						   reason == ESP_RST_EXT);
+	gatts_ble_show_bonds();
+
+	while (!(t_adv = gatts_ble_adv_start_time()) &&
+								waited < BOOT_ADV_WAIT_MS) {
+		vTaskDelay(10 / portTICK_PERIOD_MS);
+		waited += 10;
+	}
+
+	ESP_LOGI(BOOT_TAG, "reset %d: nvs %lld ms, ble %lld ms, gpio %lld ms, "
+			 "adv %lld ms, late %lld ms", reason, t_nvs / 1000,
+			 t_ble / 1000, t_gpio / 1000, t_adv / 1000,
+			 esp_timer_get_time() / 1000);
+	vTaskDelete(NULL);
+}
+
 void app_main()
 {
 	esp_err_t ret;
@@ -24,7 +58,16 @@ void app_main()
 		ret = nvs_flash_init();
 	}
 	ESP_ERROR_CHECK(ret);
+	t_nvs = esp_timer_get_time();
 
+	//advertising starts from the BT callbacks once this returns
 	gatts_ble_init();
+	t_ble = esp_timer_get_time();
+
+	//pins, buttons, buzzer and LED timer only
 	gpio_handler_init();
+	t_gpio = esp_timer_get_time();
+
+	xTaskCreate(boot_late_task, "boot late task", BOOT_TASK_STACK, NULL,
+										BOOT_TASK_PRIO, NULL);
 }
@@ -27,15 +27,14 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <readline/readline.h>
+#include <glib.h>
 
-#include "gdbus/gdbus.h"
+#include "libsonic/sonic.h"
 #include "display.h"
 #include "agent.h"
 
-#define AGENT_PATH "/org/bluez/agent"
-#define AGENT_INTERFACE "org.bluez.Agent1"
-
 #define AGENT_PROMPT	COLOR_RED "[agent]" COLOR_OFF " "
 
 const char * const agent_arguments[8] = {
@@ -49,9 +48,7 @@ const char * const agent_arguments[8] = {
 	NULL 
 };
 
-static gboolean agent_registered = FALSE;
-static const char *agent_capability = NULL;
-static DBusMessage *pending_message = NULL;
+static enum sonic_agent_request pending_request;
 static char *agent_saved_prompt = NULL;
 static int agent_saved_point = 0;
 
@@ -94,163 +91,73 @@ static void agent_release_prompt(void)
 	agent_saved_prompt = NULL;
 }
 
-dbus_bool_t agent_completion(void)
+gboolean agent_completion(struct sonic_ctx *ctx)
 {
-	if (!pending_message)
+	if (!sonic_agent_is_pending(ctx))
 		return FALSE;
 
 	return TRUE;
 }
 
-static void pincode_response(DBusConnection *conn, const char *input)
+static void pincode_response(struct sonic_ctx *ctx, const char *input)
 {
-	g_dbus_send_reply(conn, pending_message, DBUS_TYPE_STRING, &input,
-							DBUS_TYPE_INVALID);
+	sonic_agent_reply_pincode(ctx, input);
 }
 
-static void passkey_response(DBusConnection *conn, const char *input)
+static void passkey_response(struct sonic_ctx *ctx, const char *input)
 {
-	dbus_uint32_t passkey;
+	unsigned int passkey;
 	if (sscanf(input, "%u", &passkey) == 1)
-		g_dbus_send_reply(conn, pending_message, DBUS_TYPE_UINT32,
-						&passkey, DBUS_TYPE_INVALID);
+		sonic_agent_reply_passkey(ctx, passkey);
 	else if (!strcmp(input, "no"))
-		g_dbus_send_error(conn, pending_message,
-					"org.bluez.Error.Rejected", NULL);
+		sonic_agent_reject(ctx);
 	else
-		g_dbus_send_error(conn, pending_message,
-					"org.bluez.Error.Canceled", NULL);
+		sonic_agent_cancel(ctx);
 }
 
-static void confirm_response(DBusConnection *conn, const char *input)
+static void confirm_response(struct sonic_ctx *ctx, const char *input)
 {
 	if (!strcmp(input, "yes"))
-		g_dbus_send_reply(conn, pending_message, DBUS_TYPE_INVALID);
+		sonic_agent_accept(ctx);
 	else if (!strcmp(input, "no"))
-		g_dbus_send_error(conn, pending_message,
-					"org.bluez.Error.Rejected", NULL);
+		sonic_agent_reject(ctx);
 	else
-		g_dbus_send_error(conn, pending_message,
-					"org.bluez.Error.Canceled", NULL);
+		sonic_agent_cancel(ctx);
 }
 
-dbus_bool_t agent_input(DBusConnection *conn, const char *input)
+gboolean agent_input(struct sonic_ctx *ctx, const char *input)
 {
-	const char *member;
-
-	if (!pending_message)
+	if (!sonic_agent_is_pending(ctx))
 		return FALSE;
 
 	agent_release_prompt();
 
-	member = dbus_message_get_member(pending_message);
-
-	if (!strcmp(member, "RequestPinCode"))
-		pincode_response(conn, input);
-	else if (!strcmp(member, "RequestPasskey"))
-		passkey_response(conn, input);
-	else if (!strcmp(member, "RequestConfirmation"))
-		confirm_response(conn, input);
-	else if (!strcmp(member, "RequestAuthorization"))
-		confirm_response(conn, input);
-	else if (!strcmp(member, "AuthorizeService"))
-		confirm_response(conn, input);
-	else
-		g_dbus_send_error(conn, pending_message,
-					"org.bluez.Error.Canceled", NULL);
-
-	dbus_message_unref(pending_message);
-	pending_message = NULL;
-
-	return TRUE;
-}
-
-static void agent_release(DBusConnection *conn)
-{
-	agent_registered = FALSE;
-	agent_capability = NULL;
-
-	if (pending_message) {
-		dbus_message_unref(pending_message);
-		pending_message = NULL;
+	switch (pending_request) {
+	case SONIC_AGENT_PINCODE:
+		pincode_response(ctx, input);
+		break;
+	case SONIC_AGENT_PASSKEY:
+		passkey_response(ctx, input);
+		break;
+	case SONIC_AGENT_CONFIRM:
+	case SONIC_AGENT_AUTHORIZE:
+	case SONIC_AGENT_AUTHORIZE_SERVICE:
+		confirm_response(ctx, input);
+		break;
+	default:
+		sonic_agent_cancel(ctx);
+		break;
 	}
 
-	agent_release_prompt();
-
-	g_dbus_unregister_interface(conn, AGENT_PATH, AGENT_INTERFACE);
-}
-
-static DBusMessage *release_agent(DBusConnection *conn,
-					DBusMessage *msg, void *user_data)
-{
-	rl_printf("Agent released\n");
-
-	agent_release(conn);
-
-	return dbus_message_new_method_return(msg);
-}
-
-static DBusMessage *request_pincode(DBusConnection *conn,
-					DBusMessage *msg, void *user_data)
-{
-	const char *device;
-
-	rl_printf("Request PIN code\n");
-
-	dbus_message_get_args(msg, NULL, DBUS_TYPE_OBJECT_PATH, &device,
-							DBUS_TYPE_INVALID);
-
-	agent_prompt("Enter PIN code: ");
-
-	pending_message = dbus_message_ref(msg);
-
-	return NULL;
-}
-
-static DBusMessage *display_pincode(DBusConnection *conn,
-					DBusMessage *msg, void *user_data)
-{
-	const char *device;
-	const char *pincode;
-
-	dbus_message_get_args(msg, NULL, DBUS_TYPE_OBJECT_PATH, &device,
-				DBUS_TYPE_STRING, &pincode, DBUS_TYPE_INVALID);
-
-	rl_printf(AGENT_PROMPT "PIN code: %s\n", pincode);
-
-	return dbus_message_new_method_return(msg);
-}
-
-static DBusMessage *request_passkey(DBusConnection *conn,
-					DBusMessage *msg, void *user_data)
-{
-	const char *device;
-
-	rl_printf("Request passkey\n");
-
-	dbus_message_get_args(msg, NULL, DBUS_TYPE_OBJECT_PATH, &device,
-							DBUS_TYPE_INVALID);
-
-	agent_prompt("Enter passkey (number in 0-999999): ");
-
-	pending_message = dbus_message_ref(msg);
-
-	return NULL;
+	return TRUE;
 }
 
-static DBusMessage *display_passkey(DBusConnection *conn,
-					DBusMessage *msg, void *user_data)
+static void display_passkey(const struct sonic_agent_info *info)
 {
-	const char *device;
-	dbus_uint32_t passkey;
-	dbus_uint16_t entered;
 	char passkey_full[7];
+	size_t entered = info->entered;
 
-	dbus_message_get_args(msg, NULL, DBUS_TYPE_OBJECT_PATH, &device,
-			DBUS_TYPE_UINT32, &passkey, DBUS_TYPE_UINT16, &entered,
-							DBUS_TYPE_INVALID);
-
-	snprintf(passkey_full, sizeof(passkey_full), "%.6u", passkey);
+	snprintf(passkey_full, sizeof(passkey_full), "%.6u", info->passkey);
 	passkey_full[6] = '\0';
 
 	if (entered > strlen(passkey_full))
@@ -258,246 +165,130 @@ static DBusMessage *display_passkey(DBusConnection *conn,
 
 	rl_printf(AGENT_PROMPT "Passkey: "
 			COLOR_BOLDGRAY "%.*s" COLOR_BOLDWHITE "%s\n" COLOR_OFF,
-				entered, passkey_full, passkey_full + entered);
-
-	return dbus_message_new_method_return(msg);
-}
-
-static DBusMessage *request_confirmation(DBusConnection *conn,
-					DBusMessage *msg, void *user_data)
-{
-	const char *device;
-	dbus_uint32_t passkey;
-	char *str;
-
-	rl_printf("Request confirmation\n");
-
-	dbus_message_get_args(msg, NULL, DBUS_TYPE_OBJECT_PATH, &device,
-				DBUS_TYPE_UINT32, &passkey, DBUS_TYPE_INVALID);
-
-	str = g_strdup_printf("Confirm passkey %06u (yes/no): ", passkey);
-	agent_prompt(str);
-	g_free(str);
-
-	pending_message = dbus_message_ref(msg);
-
-	return NULL;
-}
-
-static DBusMessage *request_authorization(DBusConnection *conn,
-					DBusMessage *msg, void *user_data)
-{
-	const char *device;
-
-	rl_printf("Request authorization\n");
-
-	dbus_message_get_args(msg, NULL, DBUS_TYPE_OBJECT_PATH, &device,
-							DBUS_TYPE_INVALID);
-
-	agent_prompt("Accept pairing (yes/no): ");
-
-	pending_message = dbus_message_ref(msg);
-
-	return NULL;
+				(int) entered, passkey_full,
+				passkey_full + entered);
 }
 
-static DBusMessage *authorize_service(DBusConnection *conn,
-					DBusMessage *msg, void *user_data)
+void agent_request(struct sonic_ctx *ctx, enum sonic_agent_request request,
+				const struct sonic_agent_info *info,
+				void *user_data)
 {
-	const char *device, *uuid;
 	char *str;
 
-	rl_printf("Authorize service\n");
-
-	dbus_message_get_args(msg, NULL, DBUS_TYPE_OBJECT_PATH, &device,
-				DBUS_TYPE_STRING, &uuid, DBUS_TYPE_INVALID);
-
-	str = g_strdup_printf("Authorize service %s (yes/no): ", uuid);
-	agent_prompt(str);
-	g_free(str);
-
-	pending_message = dbus_message_ref(msg);
-
-	return NULL;
-}
-
-static DBusMessage *cancel_request(DBusConnection *conn,
-					DBusMessage *msg, void *user_data)
-{
-	rl_printf("Request canceled\n");
-
-	agent_release_prompt();
-	dbus_message_unref(pending_message);
-	pending_message = NULL;
-
-	return dbus_message_new_method_return(msg);
-}
-
-static const GDBusMethodTable methods[] = {
-	{ GDBUS_METHOD("Release", NULL, NULL, release_agent) },
-	{ GDBUS_ASYNC_METHOD("RequestPinCode",
-			GDBUS_ARGS({ "device", "o" }),
-			GDBUS_ARGS({ "pincode", "s" }), request_pincode) },
-	{ GDBUS_METHOD("DisplayPinCode",
-			GDBUS_ARGS({ "device", "o" }, { "pincode", "s" }),
-			NULL, display_pincode) },
-	{ GDBUS_ASYNC_METHOD("RequestPasskey",
-			GDBUS_ARGS({ "device", "o" }),
-			GDBUS_ARGS({ "passkey", "u" }), request_passkey) },
-	{ GDBUS_METHOD("DisplayPasskey",
-			GDBUS_ARGS({ "device", "o" }, { "passkey", "u" },
-							{ "entered", "q" }),
-			NULL, display_passkey) },
-	{ GDBUS_ASYNC_METHOD("RequestConfirmation",
-			GDBUS_ARGS({ "device", "o" }, { "passkey", "u" }),
-			NULL, request_confirmation) },
-	{ GDBUS_ASYNC_METHOD("RequestAuthorization",
-			GDBUS_ARGS({ "device", "o" }),
-			NULL, request_authorization) },
-	{ GDBUS_ASYNC_METHOD("AuthorizeService",
-			GDBUS_ARGS({ "device", "o" }, { "uuid", "s" }),
-			NULL,  authorize_service) },
-	{ GDBUS_METHOD("Cancel", NULL, NULL, cancel_request) },
-	{ }
-};
-
-static void register_agent_setup(DBusMessageIter *iter, void *user_data)
-{
-	const char *path = AGENT_PATH;
-	const char *capability = agent_capability;
+	switch (request) {
+	case SONIC_AGENT_RELEASE:
+		rl_printf("Agent released\n");
+		agent_release_prompt();
+		return;
+	case SONIC_AGENT_PINCODE:
+		rl_printf("Request PIN code\n");
+		agent_prompt("Enter PIN code: ");
+		break;
+	case SONIC_AGENT_DISPLAY_PINCODE:
+		rl_printf(AGENT_PROMPT "PIN code: %s\n", info->pincode);
+		return;
+	case SONIC_AGENT_PASSKEY:
+		rl_printf("Request passkey\n");
+		agent_prompt("Enter passkey (number in 0-999999): ");
+		break;
+	case SONIC_AGENT_DISPLAY_PASSKEY:
+		display_passkey(info);
+		return;
+	case SONIC_AGENT_CONFIRM:
+		rl_printf("Request confirmation\n");
+		str = g_strdup_printf("Confirm passkey %06u (yes/no): ",
+								info->passkey);
+		agent_prompt(str);
+		g_free(str);
+		break;
+	case SONIC_AGENT_AUTHORIZE:
+		rl_printf("Request authorization\n");
+		agent_prompt("Accept pairing (yes/no): ");
+		break;
+	case SONIC_AGENT_AUTHORIZE_SERVICE:
+		rl_printf("Authorize service\n");
+		str = g_strdup_printf("Authorize service %s (yes/no): ",
+								info->uuid);
+		agent_prompt(str);
+		g_free(str);
+		break;
+	case SONIC_AGENT_CANCEL:
+		rl_printf("Request canceled\n");
+		agent_release_prompt();
+		return;
+	}
 
-	dbus_message_iter_append_basic(iter, DBUS_TYPE_OBJECT_PATH, &path);
-	dbus_message_iter_append_basic(iter, DBUS_TYPE_STRING, &capability);
+	pending_request = request;
 }
 
-static void register_agent_reply(DBusMessage *message, void *user_data)
+static void register_agent_reply(const char *error, void *user_data)
 {
-	DBusConnection *conn = user_data;
-	DBusError error;
-
-	dbus_error_init(&error);
-
-	if (dbus_set_error_from_message(&error, message) == FALSE) {
-		agent_registered = TRUE;
-		rl_printf("Agent registered\n");
-	} else {
-		rl_printf("Failed to register agent: %s\n", error.name);
-		dbus_error_free(&error);
-
-		if (g_dbus_unregister_interface(conn, AGENT_PATH,
-						AGENT_INTERFACE) == FALSE)
-			rl_printf("Failed to unregister agent object\n");
+	if (error) {
+		rl_printf("Failed to register agent: %s\n", error);
+		return;
 	}
-}
 
-void agent_register(DBusConnection *conn, GDBusProxy *manager,
-						const char *capability)
+	rl_printf("Agent registered\n");
+}
 
+void agent_register(struct sonic_ctx *ctx, const char *capability)
 {
-	if (agent_registered == TRUE) {
+	if (sonic_agent_is_registered(ctx)) {
 		rl_printf("Agent is already registered\n");
 		return;
 	}
 
-	agent_capability = capability;
-
-	if (g_dbus_register_interface(conn, AGENT_PATH,
-					AGENT_INTERFACE, methods,
-					NULL, NULL, NULL, NULL) == FALSE) {
-		rl_printf("Failed to register agent object\n");
-		return;
-	}
-
-	if (g_dbus_proxy_method_call(manager, "RegisterAgent",
-						register_agent_setup,
-						register_agent_reply,
-						conn, NULL) == FALSE) {
-		rl_printf("Failed to call register agent method\n");
-		return;
-	}
-
-	agent_capability = NULL;
+	if (!sonic_agent_register(ctx, capability, register_agent_reply,
+									NULL))
+		rl_printf("Failed to register agent\n");
 }
 
-static void unregister_agent_setup(DBusMessageIter *iter, void *user_data)
+static void unregister_agent_reply(const char *error, void *user_data)
 {
-	const char *path = AGENT_PATH;
-
-	dbus_message_iter_append_basic(iter, DBUS_TYPE_OBJECT_PATH, &path);
-}
-
-static void unregister_agent_reply(DBusMessage *message, void *user_data)
-{
-	DBusConnection *conn = user_data;
-	DBusError error;
-
-	dbus_error_init(&error);
-
-	if (dbus_set_error_from_message(&error, message) == FALSE) {
-		rl_printf("Agent unregistered\n");
-		agent_release(conn);
-	} else {
-		rl_printf("Failed to unregister agent: %s\n", error.name);
-		dbus_error_free(&error);
+	if (error) {
+		rl_printf("Failed to unregister agent: %s\n", error);
+		return;
 	}
+
+	rl_printf("Agent unregistered\n");
+	agent_release_prompt();
 }
 
-void agent_unregister(DBusConnection *conn, GDBusProxy *manager)
+void agent_unregister(struct sonic_ctx *ctx)
 {
-	if (agent_registered == FALSE) {
+	if (!sonic_agent_is_registered(ctx)) {
 		rl_printf("No agent is registered\n");
 		return;
 	}
 
-	if (!manager) {
-		rl_printf("Agent unregistered\n");
-		agent_release(conn);
-		return;
-	}
-
-	if (g_dbus_proxy_method_call(manager, "UnregisterAgent",
-						unregister_agent_setup,
-						unregister_agent_reply,
-						conn, NULL) == FALSE) {
+	if (!sonic_agent_unregister(ctx, unregister_agent_reply, NULL))
 		rl_printf("Failed to call unregister agent method\n");
-		return;
-	}
 }
 
-static void request_default_setup(DBusMessageIter *iter, void *user_data)
+/* bluetoothd went away, taking the registration with it */
+void agent_unregistered(void)
 {
-	const char *path = AGENT_PATH;
-
-	dbus_message_iter_append_basic(iter, DBUS_TYPE_OBJECT_PATH, &path);
+	rl_printf("Agent unregistered\n");
+	agent_release_prompt();
 }
 
-static void request_default_reply(DBusMessage *message, void *user_data)
+static void request_default_reply(const char *error, void *user_data)
 {
-	DBusError error;
-
-	dbus_error_init(&error);
-
-	if (dbus_set_error_from_message(&error, message) == TRUE) {
-		rl_printf("Failed to request default agent: %s\n", error.name);
-		dbus_error_free(&error);
+	if (error) {
+		rl_printf("Failed to request default agent: %s\n", error);
 		return;
 	}
 
 	rl_printf("Default agent request successful\n");
 }
 
-void agent_default(DBusConnection *conn, GDBusProxy *manager)
+void agent_default(struct sonic_ctx *ctx)
 {
-	if (agent_registered == FALSE) {
+	if (!sonic_agent_is_registered(ctx)) {
 		rl_printf("No agent is registered\n");
 		return;
 	}
 
-	if (g_dbus_proxy_method_call(manager, "RequestDefaultAgent",
-						request_default_setup,
-						request_default_reply,
-						NULL, NULL) == FALSE) {
+	if (!sonic_agent_request_default(ctx, request_default_reply, NULL))
 		rl_printf("Failed to call request default agent method\n");
-		return;
-	}
 }
@@ -21,6 +21,8 @@
  *
  */
 
+#include "libsonic/sonic.h"
+
 extern const char * const agent_arguments[8];/* = {
     "on",
     "off",
@@ -32,10 +34,15 @@ extern const char * const agent_arguments[8];/* = {
     NULL
 };*/
 
-void agent_register(DBusConnection *conn, GDBusProxy *manager,
-						const char *capability);
-void agent_unregister(DBusConnection *conn, GDBusProxy *manager);
-void agent_default(DBusConnection *conn, GDBusProxy *manager);
+void agent_register(struct sonic_ctx *ctx, const char *capability);
+void agent_unregister(struct sonic_ctx *ctx);
+void agent_unregistered(void);
+void agent_default(struct sonic_ctx *ctx);
+
+/* libsonic agent_request callback */
+void agent_request(struct sonic_ctx *ctx, enum sonic_agent_request request,
+				const struct sonic_agent_info *info,
+				void *user_data);
 
-dbus_bool_t agent_completion(void);
-dbus_bool_t agent_input(DBusConnection *conn, const char *input);
+gboolean agent_completion(struct sonic_ctx *ctx);
+gboolean agent_input(struct sonic_ctx *ctx, const char *input);
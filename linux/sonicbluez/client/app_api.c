@@ -10,70 +10,31 @@
 #include <arpa/inet.h>
 #include <sys/stat.h>
 #include <inttypes.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <strings.h>
 
 #include "app_api.h"
 #include "display.h"
 #include "gatt.h"
 #include "wifi.h"
-
-const static char * pass_char_path;
-const static char * mode_char_path;
-const static char * buzz_char_path;
-const static char * randint_char_path;
-const static char * fixedint_char_path;
-const static char * solarmin_char_path;
-const static char * rssimin_char_path;
-const static char * solarval_char_path;
-const static char * rssival_char_path;
+#include "output.h"
 
 static uint8_t solarmin = 0;
 static uint8_t rssimin = 0;
 
-void fill_uuids()
+static gboolean scan_burst_done(gpointer user_data)
 {
-	GList *l;
-	const char *path;
+	cmd_scan("off");
 
-	for (l = gatt_get_charpaths(); l; l = g_list_next(l)) {
-		GDBusProxy *proxy = l->data;
-		path = g_dbus_proxy_get_path(proxy);
-		//rl_printf("+%s\n",path);
-		if(strstr(path, "service0028/char0029") != NULL) {
-			buzz_char_path = path;
-		}
-		else if(strstr(path, "service0028/char0031") != NULL) {
-			rssival_char_path = path;
-		}
-		else if(strstr(path, "service0028/char0035") != NULL) {
-			solarval_char_path = path;
-		}
-		else if(strstr(path, "service0028/char0033") != NULL) {
-			rssimin_char_path = path;
-		}
-		else if(strstr(path, "service0028/char0037") != NULL) {
-			solarmin_char_path = path;
-		}
-		else if(strstr(path, "service0028/char002f") != NULL) {
-			randint_char_path = path;
-		}
-		else if(strstr(path, "service0028/char002d") != NULL) {
-			fixedint_char_path = path;
-		}
-		else if(strstr(path, "service0028/char002b") != NULL) {
-			mode_char_path = path;
-		}
-		else if(strstr(path, "service0028/char0039") != NULL) {
-			pass_char_path = path;
-		}
-	}
+	return FALSE;
 }
 
 void cmd_scan_burst(const char *arg)
 {
 	cmd_power("on");
 	cmd_scan("on");
-	sleep(5);
-	cmd_scan("off");
+	g_timeout_add_seconds(5, scan_burst_done, NULL);
 }
 
 void cmd_connect_bond(const char *arg)
@@ -82,83 +43,190 @@ void cmd_connect_bond(const char *arg)
     if(is_paired(arg)) {
 		rl_printf("was paired\n");
 		cmd_connect(arg);
+	} else if (!sonic_find_device(sonic, arg) &&
+					sonic_inventory_find(sonic, arg)) {
+		//known from a previous session, connect without scanning
+		cmd_connect(arg);
 	} else {
 		rl_printf("was not paired\n");
 		cmd_agent("DisplayYesNo");
 		cmd_default_agent(NULL);
 		cmd_pair(arg);
 	}
-	fill_uuids();
+}
+
+static struct sonic_device *find_app_device(void)
+{
+	if (check_default_ctrl() == FALSE)
+		return NULL;
+
+	if (!default_dev) {
+		rl_printf("No device connected\n");
+		return NULL;
+	}
+
+	sonic_pool_touch(sonic, sonic_device_get_address(default_dev));
+
+	return default_dev;
+}
+
+static void app_reply(const char *error, void *user_data)
+{
+	output_result(user_data, error);
+
+	if (error)
+		rl_printf("Failed to %s: %s\n", (const char *) user_data, error);
 }
 
 void cmd_buzz(const char *arg)
 {
-	dbus_bool_t enable;
+	struct sonic_device *device;
+	gboolean enable;
 
 	if (parse_argument_on_off(arg, &enable) == FALSE)
 		return;
 
-	if (check_default_ctrl() == FALSE)
-    	return;
+	device = find_app_device();
+	if (!device)
+		return;
+
+	if (!sonic_buzz(device, enable == TRUE, app_reply, "beep"))
+		rl_printf("Failed to beep\n");
+}
 
-	fill_uuids();
-	if(buzz_char_path != NULL) {
-		cmd_select_attribute(buzz_char_path);
-		if(enable)
-			cmd_write("0x01");
-		else
-			cmd_write("0x00");	
+static void stats_reply(const char *error, void *user_data)
+{
+	bool enable = GPOINTER_TO_UINT(user_data);
+
+	output_result(enable ? "stats on" : "stats off", error);
+
+	if (error) {
+		rl_printf("Failed to %s stats: %s\n",
+				enable ? "show" : "hide", error);
+		return;
 	}
+
+	rl_printf("Notify %s\n", enable ? "started" : "stopped");
 }
 
-void cmd_rssistats(const char *arg)
+static void set_stats(enum sonic_char chr, const char *arg)
 {
-	dbus_bool_t enable;
+	struct sonic_device *device;
+	gboolean enable;
 
 	if (parse_argument_on_off(arg, &enable) == FALSE)
 		return;
-	
-	fill_uuids();
-	if(mode_char_path != NULL) {
-		cmd_select_attribute(mode_char_path);
-		cmd_write("0x02"); //mode loop	
-	}
 
-	if(rssival_char_path != NULL) {
-		cmd_select_attribute(rssival_char_path);
-	}
+	device = find_app_device();
+	if (!device)
+		return;
 
-	if (!default_attr) {
+	if (!sonic_stats(device, chr, enable == TRUE, stats_reply,
+					GUINT_TO_POINTER(enable == TRUE)))
 		rl_printf("No attribute selected\n");
-		return;
-	}
+}
 
-	gatt_notify_attribute(default_attr, enable ? true : false);
+void cmd_rssistats(const char *arg)
+{
+	set_stats(SONIC_CHAR_RSSI, arg);
 }
 
 void cmd_solarstats(const char *arg)
 {
-	dbus_bool_t enable;
+	set_stats(SONIC_CHAR_SOLAR, arg);
+}
+
+/* Samples are notified in batches, the stream runs in any mode */
+void cmd_stream(const char *arg)
+{
+	struct sonic_device *device;
+	gboolean enable;
 
 	if (parse_argument_on_off(arg, &enable) == FALSE)
 		return;
-	
-	fill_uuids();
-	if(mode_char_path != NULL) {
-		cmd_select_attribute(mode_char_path);
-		cmd_write("0x02"); //mode loop	
+
+	device = find_app_device();
+	if (!device)
+		return;
+
+	if (!sonic_notify(device, SONIC_CHAR_STREAM, enable == TRUE,
+				stats_reply, GUINT_TO_POINTER(enable == TRUE)))
+		rl_printf("Device has no sample stream\n");
+}
+
+void stream_notify(struct sonic_device *device, const uint8_t *value,
+								size_t len)
+{
+	struct sonic_sample samples[255];
+	int count, i, rssi_min = 127, rssi_max = -128;
+	unsigned int light_min = UINT16_MAX, light_max = 0;
+
+	count = sonic_stream_parse(value, len, samples, G_N_ELEMENTS(samples));
+	if (count <= 0)
+		return;
+
+	for (i = 0; i < count; i++) {
+		rssi_min = MIN(rssi_min, samples[i].rssi);
+		rssi_max = MAX(rssi_max, samples[i].rssi);
+		light_min = MIN(light_min, samples[i].light);
+		light_max = MAX(light_max, samples[i].light);
 	}
 
-	if(solarval_char_path != NULL) {
-		cmd_select_attribute(solarval_char_path);
+	rl_printf("[" COLORED_CHG "] Device %s %u.%03us %d samples "
+			"rssi %d..%d dBm light %u..%u mV\n",
+			sonic_device_get_address(device),
+			samples[0].time / 1000, samples[0].time % 1000, count,
+			rssi_min, rssi_max, light_min, light_max);
+}
+
+void cmd_report(const char *arg)
+{
+	struct sonic_device *device;
+	enum sonic_char chr;
+	unsigned int deadband, min_s, max_s;
+	char what[8];
+
+	if (!arg || sscanf(arg, "%7s %u %u %u", what, &deadband, &min_s,
+							&max_s) != 4) {
+		rl_printf("Requires <rssi|solar> <deadband%%> <min s> <max s>\n");
+		return;
 	}
 
-	if (!default_attr) {
-		rl_printf("No attribute selected\n");
+	if (!strcmp(what, "rssi"))
+		chr = SONIC_CHAR_RSSI;
+	else if (!strcmp(what, "solar"))
+		chr = SONIC_CHAR_SOLAR;
+	else {
+		rl_printf("Invalid reading %s\n", what);
+		return;
+	}
+
+	if (deadband > 100 || min_s > UINT8_MAX || max_s > UINT16_MAX ||
+						(max_s && max_s < min_s)) {
+		rl_printf("Invalid policy\n");
 		return;
 	}
 
-	gatt_notify_attribute(default_attr, enable ? true : false);
+	device = find_app_device();
+	if (!device)
+		return;
+
+	if (!sonic_device_get_char(device, SONIC_CHAR_REPORT) ||
+			!sonic_set_report(device, chr, deadband, min_s, max_s,
+							app_reply, "set report policy"))
+		rl_printf("Device has no report policy\n");
+}
+
+static void set_loop(enum sonic_char chr, uint8_t val, const char *what)
+{
+	struct sonic_device *device;
+
+	device = find_app_device();
+	if (!device)
+		return;
+
+	if (!sonic_set_loop(device, chr, val, app_reply, (void *) what))
+		rl_printf("Failed to set %s\n", what);
 }
 
 void cmd_randint(const char *arg)
@@ -167,22 +235,7 @@ void cmd_randint(const char *arg)
 	if (val < 0 || val > 100)
 		return;
 
-	if (check_default_ctrl() == FALSE)
-    	return;
-
-	fill_uuids();
-	if(mode_char_path != NULL) {
-		cmd_select_attribute(mode_char_path);
-		if(val == 0)
-			cmd_write("0x00"); //mode idle
-		else
-			cmd_write("0x02"); //mode loop	
-	}
-
-	if(randint_char_path != NULL) {
-		cmd_select_attribute(randint_char_path);
-		cmd_write(arg);	//loop randint
-	}
+	set_loop(SONIC_CHAR_RANDINT, val, "randint");
 }
 
 void cmd_fixedint(const char *arg)
@@ -191,22 +244,7 @@ void cmd_fixedint(const char *arg)
 	if (val < 0 || val > 100)
 		return;
 
-	if (check_default_ctrl() == FALSE)
-    	return;
-
-	fill_uuids();
-	if(mode_char_path != NULL) {
-		cmd_select_attribute(mode_char_path);
-		if(val == 0)
-			cmd_write("0x00"); //mode idle
-		else
-			cmd_write("0x02"); //mode loop	
-	}
-
-	if(fixedint_char_path != NULL) {
-		cmd_select_attribute(fixedint_char_path);
-		cmd_write(arg);	//loop fixedint
-	}
+	set_loop(SONIC_CHAR_FIXEDINT, val, "fixedint");
 }
 
 void cmd_solarmin(const char *arg) 
@@ -218,22 +256,7 @@ void cmd_solarmin(const char *arg)
 	solarmin = val;
 	rssimin = 0;
 
-	if (check_default_ctrl() == FALSE)
-    	return;
-
-	fill_uuids();
-	if(mode_char_path != NULL) {
-		cmd_select_attribute(mode_char_path);
-		if(val == 0)
-			cmd_write("0x00"); //mode idle
-		else
-			cmd_write("0x02"); //mode loop	
-	}
-
-	if(solarmin_char_path != NULL) {
-		cmd_select_attribute(solarmin_char_path);
-		cmd_write(arg);	//loop solar
-	}
+	set_loop(SONIC_CHAR_SOLARMIN, val, "solarmin");
 }
 
 void cmd_rssimin(const char *arg) 
@@ -245,36 +268,130 @@ void cmd_rssimin(const char *arg)
 	rssimin = val;
 	solarmin = 0;
 
-	if (check_default_ctrl() == FALSE)
-    	return;
+	set_loop(SONIC_CHAR_RSSIMIN, val, "rssimin");
+}
 
-	fill_uuids();
-	if(mode_char_path != NULL) {
-		cmd_select_attribute(mode_char_path);
-		if(val == 0)
-			cmd_write("0x00"); //mode idle
-		else
-			cmd_write("0x02"); //mode loop	
-	}
 
-	if(rssimin_char_path != NULL) {
-		cmd_select_attribute(rssimin_char_path);
-		cmd_write(arg);	//loop rssi
-	}
+#define OTA_SSID		"DTCAP"		/* firmware without AP info */
+#define OTA_ADDR		"192.168.1.1"
+#define OTA_PORT		5000
+#define OTA_TIMEOUT		30	/* seconds without an ack */
+#define OTA_RETRIES		5	/* reconnects before giving up */
+
+/*
+ * OTA wire protocol v2, must match ota_proto.h in the firmware. All
+ * fields big endian.
+ *   hello: "SOTA" | u8 version | u8 flags | u16 chunk | u32 size | sha256[32]
+ *   data:  u32 seq | u16 len | u16 0 | u32 crc32 | payload[len]
+ *   ack:   u8 status | u8 0 | u16 window (chunks) | u32 offset
+ */
+#define OTA_V2_MAGIC		"SOTA"
+#define OTA_V2_VERSION		2
+#define OTA_V2_CHUNK		4096
+#define OTA_V2_HELLO_LEN	44
+#define OTA_V2_DATA_HDR_LEN	12
+#define OTA_V2_ACK_LEN		8
+
+enum ota_status {
+	OTA_ST_OK,
+	OTA_ST_RESEND,
+	OTA_ST_DONE,
+	OTA_ST_FAIL,
+};
+
+#define OTA_STALL		10	/* seconds without progress, then abort */
+
+/*
+ * AP info characteristic: u8 channel | u32 ip | u8 ssid_len | ssid.
+ * The channel is 0 until the device has scanned and brought the AP up.
+ */
+#define OTA_AP_INFO_MIN		6
+#define OTA_AP_POLL_MS		500
+#define OTA_AP_POLL_MAX		60	/* covers the reboot into the updater */
+
+/* Progress characteristic, see ota_proto.h in the firmware */
+#define OTA_PROGRESS_LEN	16
+
+enum ota_prog_state {
+	OTA_PROG_IDLE,
+	OTA_PROG_RECEIVING,
+	OTA_PROG_SUSPENDED,
+	OTA_PROG_VERIFYING,
+	OTA_PROG_DONE,
+	OTA_PROG_FAILED,
+};
+
+static const char * const ota_prog_names[] = {
+	[OTA_PROG_IDLE]		= "idle",
+	[OTA_PROG_RECEIVING]	= "receiving",
+	[OTA_PROG_SUSPENDED]	= "suspended",
+	[OTA_PROG_VERIFYING]	= "verifying",
+	[OTA_PROG_DONE]		= "done",
+	[OTA_PROG_FAILED]	= "failed",
+};
+
+/*
+ * A WiFi transfer runs in its own thread, so the main loop keeps
+ * serving BLE (progress notifications) and the stall watchdog. The
+ * thread only does socket I/O; whatever it prints goes through the
+ * main loop and sock is only shut down, never closed, by the watchdog.
+ */
+struct ota_req {
+	char *path;
+	bool v1;
+	bool ble;
+	char address[18];
+	gchar *contents;
+	unsigned int percent;
+
+	char pass[65];
+	char ssid[33];		/* of the device AP */
+	struct in_addr ap_addr;
+	unsigned int ap_polls;
+
+	GThread *thread;
+	GMutex lock;		/* sock */
+	int sock;
+	gint abort;
+	gint activity;		/* bumped on every ack and progress change */
+	int ret;
+
+	guint watchdog;
+	gint last_activity;
+	unsigned int idle;
+	uint8_t state;		/* last progress state from the device */
+	uint32_t received;
+};
+
+static struct ota_req *ota_active;
+
+static gboolean ota_print(gpointer user_data)
+{
+	rl_printf("%s", (char *) user_data);
+	g_free(user_data);
+
+	return FALSE;
 }
 
+/* rl_printf from the transfer thread */
+static void ota_printf(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	g_idle_add(ota_print, g_strdup_vprintf(fmt, ap));
+	va_end(ap);
+}
 
-static int sendall(int s, char *buf, uint64_t *len)
+static int sendall(int s, const uint8_t *buf, uint64_t *len)
 {
-    int total = 0;        // how many bytes we've sent
-    int bytesleft = *len; // how many we have left to send
-    int n;
+    uint64_t total = 0;        // how many bytes we've sent
+    ssize_t n = 0;
 
     while(total < *len) {
-        n = send(s, buf+total, bytesleft, 0);
+        n = send(s, buf+total, *len-total, MSG_NOSIGNAL);
         if (n == -1) { break; }
         total += n;
-        bytesleft -= n;
     }
 
     *len = total; // return number actually sent here
@@ -282,10 +399,225 @@ static int sendall(int s, char *buf, uint64_t *len)
     return n==-1?-1:0; // return -1 on failure, 0 on success
 } 
 
-static void send_fw_file(char *value, char *fw_file_path)
+static int send_buf(int s, const uint8_t *buf, uint64_t len)
+{
+	uint64_t sent = len;
+
+	return sendall(s, buf, &sent);
+}
+
+static void put_be32(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+static uint32_t get_be32(const uint8_t *p)
 {
-	int i;
-	rl_printf("Connect to ssid DTCAP with pass %s\n",(char*)value);
+	return ((uint32_t) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static int ota_connect(struct ota_req *req)
+{
+	struct timeval tv = { .tv_sec = OTA_TIMEOUT };
+	struct sockaddr_in server;
+	int sock;
+
+	//Create socket
+	sock = socket(AF_INET, SOCK_STREAM, 0);
+	if (sock == -1) {
+		ota_printf("Could not create socket\n");
+		return -1;
+	}
+
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+	memset(&server, 0, sizeof(server));
+	server.sin_addr = req->ap_addr;
+	server.sin_family = AF_INET;
+	server.sin_port = htons(OTA_PORT);
+
+	//Connect to remote server
+	if (connect(sock, (struct sockaddr *)&server, sizeof(server)) < 0) {
+		ota_printf("connect failed. Error: %s\n", strerror(errno));
+		close(sock);
+		return -1;
+	}
+
+	g_mutex_lock(&req->lock);
+	req->sock = sock;
+	g_mutex_unlock(&req->lock);
+
+	/* Aborted while connecting */
+	if (g_atomic_int_get(&req->abort))
+		shutdown(sock, SHUT_RDWR);
+
+	ota_printf("Connected to device server\n");
+
+	return sock;
+}
+
+static void ota_close(struct ota_req *req)
+{
+	g_mutex_lock(&req->lock);
+	close(req->sock);
+	req->sock = -1;
+	g_mutex_unlock(&req->lock);
+}
+
+/* v1: length then the raw image, no acks */
+static int send_fw_v1(struct ota_req *req, const uint8_t *data,
+							uint64_t fsize)
+{
+	uint8_t fs_ptr[8];
+	int k, sock, ret = 0;
+
+	sock = ota_connect(req);
+	if (sock < 0)
+		return -1;
+
+	for(k = 0; k < 8; k++) {
+		fs_ptr[7-k] = (fsize >> k*8) & 0xff; 
+	}
+
+	//send filesize, then file
+	if (send_buf(sock, fs_ptr, sizeof(fs_ptr)) < 0 ||
+					send_buf(sock, data, fsize) < 0) {
+		ota_printf("Send file failed\n");
+		ret = -1;
+	}
+
+	ota_close(req);
+	return ret;
+}
+
+static int send_chunk(int sock, const uint8_t *data, uint32_t size,
+							uint32_t offset)
+{
+	uint8_t hdr[OTA_V2_DATA_HDR_LEN] = { 0 };
+	uint32_t len = MIN(OTA_V2_CHUNK, size - offset);
+
+	put_be32(hdr, offset / OTA_V2_CHUNK);
+	hdr[4] = len >> 8;
+	hdr[5] = len;
+	put_be32(hdr + 8, sonic_ota_crc32(data + offset, len));
+
+	if (send_buf(sock, hdr, sizeof(hdr)) < 0 ||
+				send_buf(sock, data + offset, len) < 0)
+		return -1;
+
+	return len;
+}
+
+/*
+ * v2: framed chunks with crc32, windowed acks and a sha256 over the
+ * image. A dropped connection resumes from the last acked offset.
+ * Returns 0 once the device has verified and activated the image.
+ */
+static int send_fw_v2(struct ota_req *req, const uint8_t *data,
+							uint32_t size)
+{
+	uint8_t hello[OTA_V2_HELLO_LEN] = { 0 }, ack[OTA_V2_ACK_LEN];
+	uint32_t acked, next, offset, window;
+	GChecksum *sum;
+	gsize sum_len = 32;
+	int attempt, sock, len;
+
+	memcpy(hello, OTA_V2_MAGIC, 4);
+	hello[4] = OTA_V2_VERSION;
+	put_be32(hello + 8, size);
+
+	sum = g_checksum_new(G_CHECKSUM_SHA256);
+	g_checksum_update(sum, data, size);
+	g_checksum_get_digest(sum, hello + 12, &sum_len);
+	g_checksum_free(sum);
+
+	for (attempt = 0; attempt <= OTA_RETRIES; attempt++) {
+		if (g_atomic_int_get(&req->abort))
+			return -1;
+
+		if (attempt) {
+			ota_printf("Connection lost, resuming (%d/%d)\n",
+							attempt, OTA_RETRIES);
+			sleep(2);
+		}
+
+		sock = ota_connect(req);
+		if (sock < 0)
+			continue;
+
+		if (send_buf(sock, hello, sizeof(hello)) < 0 ||
+				recv(sock, ack, sizeof(ack), MSG_WAITALL) !=
+							sizeof(ack))
+			goto drop;
+
+		offset = get_be32(ack + 4);
+		window = ((ack[2] << 8) | ack[3]) * OTA_V2_CHUNK;
+		if (ack[0] != OTA_ST_OK || offset > size || !window) {
+			ota_printf("Device refused the update\n");
+			ota_close(req);
+			return -1;
+		}
+
+		if (offset)
+			ota_printf("Resuming at %u of %u bytes\n", offset, size);
+
+		acked = next = offset;
+
+		for (;;) {
+			while (next < size && next - acked < window) {
+				len = send_chunk(sock, data, size, next);
+				if (len < 0)
+					goto drop;
+				next += len;
+			}
+
+			if (recv(sock, ack, sizeof(ack), MSG_WAITALL) !=
+								sizeof(ack))
+				goto drop;
+
+			g_atomic_int_inc(&req->activity);
+			offset = get_be32(ack + 4);
+
+			switch (ack[0]) {
+			case OTA_ST_OK:
+				if (offset > acked && offset <= next)
+					acked = offset;
+				break;
+			case OTA_ST_RESEND:
+				if (offset > size)
+					goto drop;
+				acked = next = offset;
+				break;
+			case OTA_ST_DONE:
+				ota_close(req);
+				return 0;
+			default:
+				ota_printf("Device failed the update\n");
+				ota_close(req);
+				return -1;
+			}
+
+			if (acked * 10 / size > req->percent) {
+				req->percent = acked * 10 / size;
+				ota_printf("%u%%\n", req->percent * 10);
+			}
+		}
+
+drop:
+		ota_close(req);
+	}
+
+	return -1;
+}
+
+static int send_fw_file(struct ota_req *req)
+{
+	GError *err = NULL;
+	gsize fsize;
+	int i, ret;
 
 	char * ssid_result = (char*)malloc(IW_ESSID_MAX_SIZE+1);
 
@@ -294,187 +626,516 @@ static void send_fw_file(char *value, char *fw_file_path)
 		i++; //1 min timeout
 		domain(ssid_result);
 		if(i%30==0)
-			rl_printf("%s\n",ssid_result);
+			ota_printf("%s\n",ssid_result);
 
-		if(i==120) {
-			rl_printf("Timed out.\n");
+		if(i==120 || g_atomic_int_get(&req->abort)) {
+			ota_printf("Timed out.\n");
 			free(ssid_result);
-			return;
+			return -1;
 		}
 		sleep(1);
-	} while(strcmp(ssid_result,"DTCAP")!=0);
+	} while(strcmp(ssid_result, req->ssid)!=0);
 
 	free(ssid_result);
 
-	rl_printf("Associated to AP\n");
+	ota_printf("Associated to AP\n");
 	sleep(7); // lucky 7
 
-	//connect
-	struct sockaddr_in server;
-	char message[1000] , server_reply[2000];
-     
-    //Create socket
-    int sock = socket(AF_INET , SOCK_STREAM , 0);
-    if (sock == -1) { rl_printf("Could not create socket\n"); }
-     
-    server.sin_addr.s_addr = inet_addr("192.168.1.1");
-    server.sin_family = AF_INET;
-    server.sin_port = htons( 5000 );
- 
-    //Connect to remote server
-    if (connect(sock, (struct sockaddr *)&server, sizeof(server)) < 0)
-    {
-        perror("connect failed. Error");
-        return;
-    }
-   
-    rl_printf("Connected to device server\n");
-	//send filesize
-	struct stat st;
-	stat(fw_file_path, &st);
-	//size_t size = st.st_size;
-	rl_printf("%s ok\n\n",fw_file_path);
+	if (!g_file_get_contents(req->path, &req->contents, &fsize, &err)) {
+		ota_printf("Error reading file: %s\n", err->message);
+		g_error_free(err);
+		return -1;
+	}
 
-	uint64_t fsize = st.st_size; // Put your value
-	rl_printf("%" PRIu64 "%" PRIu64 " ok\n\n",st.st_size,fsize);
+	ota_printf("%s %" G_GSIZE_FORMAT " bytes\n", req->path, fsize);
 
-	char fs_ptr[8] = { 0 };
-	for(int k = 0; k < 8; k++) {
-		fs_ptr[7-k] = (char)(fsize >> k*8) & 0xff; 
-	}
-	//memcpy(fs_ptr, (char*)&fsize, 8);
-	if(send(sock, fs_ptr, 8, 0) < 0) 
-	{
-		rl_printf("Send length failed\n");
+	if (req->v1)
+		ret = send_fw_v1(req, (const uint8_t *) req->contents, fsize);
+	else if (fsize > UINT32_MAX)
+		ret = -1;
+	else
+		ret = send_fw_v2(req, (const uint8_t *) req->contents, fsize);
+
+	return ret;
+}
+
+static void ota_req_free(struct ota_req *req)
+{
+	if (req->thread)
+		g_mutex_clear(&req->lock);
+	g_free(req->contents);
+	g_free(req->path);
+	g_free(req);
+}
+
+/* Stop a WiFi transfer, the thread notices and winds down */
+static void ota_abort(struct ota_req *req)
+{
+	if (!req->thread)
 		return;
-	}
 
-	//char filebuf[fsize] = { 0 };
-	char filebuf[fsize + 1];
-	FILE *fp = fopen(fw_file_path, "rb");
-	if (fp != NULL) {
-    	size_t newLen = fread(filebuf, sizeof(char), fsize, fp);
-    	if ( ferror( fp ) != 0 ) {
-        	rl_printf("Error reading file\n");
-    	} else {
-        	filebuf[newLen++] = '\0';
-    	}
-    	fclose(fp);
+	g_atomic_int_set(&req->abort, 1);
+
+	g_mutex_lock(&req->lock);
+	if (req->sock >= 0)
+		shutdown(req->sock, SHUT_RDWR);
+	g_mutex_unlock(&req->lock);
+}
+
+static void ota_end(struct ota_req *req, const char *error)
+{
+	struct sonic_device *device;
+
+	if (req->watchdog)
+		g_source_remove(req->watchdog);
+
+	device = sonic_find_device(sonic, req->address);
+	if (device)
+		sonic_notify(device, SONIC_CHAR_PROGRESS, false, NULL, NULL);
+
+	if (error)
+		rl_printf("Firmware update failed: %s\n", error);
+	else
+		rl_printf("Firmware update sent\n");
+
+	if (ota_active == req)
+		ota_active = NULL;
+	ota_req_free(req);
+}
+
+/* Nothing counts as a stall before the first ack */
+static gboolean ota_watchdog(gpointer user_data)
+{
+	struct ota_req *req = user_data;
+	gint activity = g_atomic_int_get(&req->activity);
+
+	if (!activity || activity != req->last_activity) {
+		req->last_activity = activity;
+		req->idle = 0;
+		return TRUE;
 	}
 
-	//send file
-	if(sendall(sock, filebuf, &fsize) < 0) 
-	{
-		rl_printf("Send file failed\n");
+	if (++req->idle < OTA_STALL)
+		return TRUE;
+
+	rl_printf("No progress for %d seconds, aborting\n", OTA_STALL);
+	req->watchdog = 0;
+	ota_abort(req);
+
+	return FALSE;
+}
+
+void ota_progress_notify(struct sonic_device *device, const uint8_t *value,
+								size_t len)
+{
+	struct ota_req *req = ota_active;
+	const char *address = sonic_device_get_address(device);
+	uint32_t received, written, rate;
+	uint8_t state;
+
+	if (len < OTA_PROGRESS_LEN)
 		return;
+
+	state = value[0];
+	received = get_be32(value + 4);
+	written = get_be32(value + 8);
+	rate = get_be32(value + 12);
+
+	rl_printf("[" COLORED_CHG "] Device %s ota %s rx %u wr %u "
+			"%u.%u KiB/s\n", address,
+			state <= OTA_PROG_FAILED ? ota_prog_names[state] : "?",
+			received, written, rate / 1024, rate % 1024 * 10 / 1024);
+
+	if (!req || strcasecmp(req->address, address))
+		return;
+
+	if (state != req->state || received != req->received)
+		g_atomic_int_inc(&req->activity);
+
+	/* A failure left over from an earlier session doesn't count */
+	if (state == OTA_PROG_FAILED && (req->state == OTA_PROG_RECEIVING ||
+					req->state == OTA_PROG_VERIFYING)) {
+		rl_printf("Device failed the update, aborting\n");
+		ota_abort(req);
 	}
 
-	close(sock);
-	free(fw_file_path);
+	req->state = state;
+	req->received = received;
 }
 
-static void read_pass_reply(DBusMessage *message, void *user_data)
+static gboolean ota_thread_done(gpointer user_data)
 {
-	DBusError error;
-	DBusMessageIter iter, array;
-	uint8_t *value;
-	int len, i;
+	struct ota_req *req = user_data;
 
-	dbus_error_init(&error);
+	g_thread_join(req->thread);
 
-	if (dbus_set_error_from_message(&error, message) == TRUE) {
-		rl_printf("Failed to read: %s\n", error.name);
-		dbus_error_free(&error);
-		return;
+	if (req->ret < 0)
+		ota_end(req, g_atomic_int_get(&req->abort) ? "aborted" :
+								"transfer failed");
+	else
+		ota_end(req, NULL);
+
+	return FALSE;
+}
+
+static gpointer ota_thread(gpointer user_data)
+{
+	struct ota_req *req = user_data;
+
+	req->ret = send_fw_file(req);
+	g_idle_add(ota_thread_done, req);
+
+	return NULL;
+}
+
+static void ble_ota_progress(uint32_t done, uint32_t total, void *user_data)
+{
+	struct ota_req *req = user_data;
+
+	if ((uint64_t) done * 10 / total > req->percent) {
+		req->percent = (uint64_t) done * 10 / total;
+		rl_printf("%u%%\n", req->percent * 10);
 	}
+}
 
-	dbus_message_iter_init(message, &iter);
+static void ble_ota_reply(const char *error, void *user_data)
+{
+	struct ota_req *req = user_data;
 
-	if (dbus_message_iter_get_arg_type(&iter) != DBUS_TYPE_ARRAY) {
-		rl_printf("Invalid response to read\n");
+	output_result("ota_update", error);
+	ota_end(req, error);
+}
+
+/* Straight over the OTA characteristic, no mode switch or WiFi */
+static void send_fw_ble(struct sonic_device *device, struct ota_req *req)
+{
+	GError *err = NULL;
+	gsize fsize;
+
+	if (!g_file_get_contents(req->path, &req->contents, &fsize, &err)) {
+		rl_printf("Error reading file: %s\n", err->message);
+		g_error_free(err);
+		ota_req_free(req);
 		return;
 	}
 
-	dbus_message_iter_recurse(&iter, &array);
-	dbus_message_iter_get_fixed_array(&array, &value, &len);
+	rl_printf("%s %" G_GSIZE_FORMAT " bytes\n", req->path, fsize);
 
-	if (len < 0) {
-		rl_printf("Unable to parse value\n");
+	if (fsize > UINT32_MAX || !sonic_ota_start(device,
+					(const uint8_t *) req->contents, fsize,
+					ble_ota_progress, ble_ota_reply, req)) {
+		rl_printf("Device does not support OTA over BLE\n");
+		ota_req_free(req);
 		return;
 	}
 
-	send_fw_file(value, user_data);
+	ota_active = req;
+	sonic_notify(device, SONIC_CHAR_PROGRESS, true, NULL, NULL);
 }
 
-static void read_pass_setup(DBusMessageIter *iter, void *user_data)
+/* Try to join the device AP right away, the thread waits for it anyway */
+static void wifi_join(struct ota_req *req)
 {
-	DBusMessageIter dict;
+	char *argv[] = { "nmcli", "device", "wifi", "connect", req->ssid,
+					"password", req->pass, NULL };
 
-	dbus_message_iter_open_container(iter, DBUS_TYPE_ARRAY,
-					DBUS_DICT_ENTRY_BEGIN_CHAR_AS_STRING
-					DBUS_TYPE_STRING_AS_STRING
-					DBUS_TYPE_VARIANT_AS_STRING
-					DBUS_DICT_ENTRY_END_CHAR_AS_STRING,
-					&dict);
-	/* TODO: Add offset support */
-	dbus_message_iter_close_container(iter, &dict);
+	g_spawn_async(NULL, argv, NULL, G_SPAWN_SEARCH_PATH |
+				G_SPAWN_STDOUT_TO_DEV_NULL |
+				G_SPAWN_STDERR_TO_DEV_NULL, NULL, NULL, NULL, NULL);
 }
 
-static void cmd_ota_internal(GDBusProxy *proxy, const char * arg)
+static void ota_join(struct ota_req *req)
 {
-	const char *iface;
-	char *f_path;
-	f_path = (char*)malloc(strlen(arg));
-	strcpy(f_path, arg);//, strlen(arg));
+	struct sonic_device *device;
 
-	iface = g_dbus_proxy_get_interface(proxy);
-	if (!strcmp(iface, "org.bluez.GattCharacteristic1") ||
-		!strcmp(iface, "org.bluez.GattDescriptor1"))
-		{
-			if(g_dbus_proxy_method_call(proxy, "ReadValue", 
-										read_pass_setup, read_pass_reply,
-										(void*)f_path, NULL) == FALSE) 
-			{
-				rl_printf("Failed to read\n");
-				return;
-			}
+	rl_printf("Connect to ssid %s with pass %s\n", req->ssid, req->pass);
+	wifi_join(req);
+
+	device = sonic_find_device(sonic, req->address);
+	if (device)
+		sonic_notify(device, SONIC_CHAR_PROGRESS, true, NULL, NULL);
+
+	req->sock = -1;
+	g_mutex_init(&req->lock);
+	req->thread = g_thread_new("ota", ota_thread, req);
+	req->watchdog = g_timeout_add_seconds(1, ota_watchdog, req);
+}
+
+static void ap_info_poll(struct ota_req *req);
+
+static gboolean ap_info_retry(gpointer user_data)
+{
+	ap_info_poll(user_data);
+
+	return FALSE;
+}
+
+static void ap_info_reply(const char *error, const uint8_t *value,
+						size_t len, void *user_data)
+{
+	struct ota_req *req = user_data;
+
+	/* Not up yet: the device scans for a free channel first */
+	if (error || len < OTA_AP_INFO_MIN || !value[0] ||
+				len < OTA_AP_INFO_MIN + (size_t) value[5] ||
+				value[5] >= sizeof(req->ssid)) {
+		if (++req->ap_polls < OTA_AP_POLL_MAX) {
+			g_timeout_add(OTA_AP_POLL_MS, ap_info_retry, req);
+			return;
 		}
+
+		rl_printf("Device AP did not come up%s%s\n",
+					error ? ": " : "", error ? error : "");
+		ota_active = NULL;
+		ota_req_free(req);
+		return;
+	}
+
+	memcpy(&req->ap_addr.s_addr, value + 1, 4);
+	memcpy(req->ssid, value + OTA_AP_INFO_MIN, value[5]);
+	req->ssid[value[5]] = '\0';
+
+	rl_printf("Device AP %s on channel %u, server %s\n", req->ssid,
+					value[0], inet_ntoa(req->ap_addr));
+
+	ota_join(req);
+}
+
+static void ap_info_poll(struct ota_req *req)
+{
+	struct sonic_device *device;
+
+	device = sonic_find_device(sonic, req->address);
+
+	/*
+	 * Two-stage firmware reboots into its updater app, wait for the
+	 * link and services to come back.
+	 */
+	if (device && (!sonic_device_is_connected(device) ||
+			!sonic_device_get_char(device, SONIC_CHAR_APINFO))) {
+		if (!sonic_device_is_connected(device))
+			sonic_device_connect(device, NULL, NULL);
+		ap_info_reply("org.bluez.Error.NotConnected", NULL, 0, req);
+		return;
+	}
+
+	if (device && sonic_read(device, SONIC_CHAR_APINFO, ap_info_reply,
+									req))
+		return;
+
+	rl_printf("Failed to read AP info\n");
+	ota_active = NULL;
+	ota_req_free(req);
+}
+
+static void read_pass_reply(const char *error, const uint8_t *value,
+						size_t len, void *user_data)
+{
+	struct ota_req *req = user_data;
+	struct sonic_device *device;
+
+	output_result("ota_update", error);
+
+	if (error) {
+		rl_printf("Failed to read: %s\n", error);
+		ota_req_free(req);
+		return;
+	}
+
+	snprintf(req->pass, sizeof(req->pass), "%.*s", (int) len,
+							(const char *) value);
+
+	ota_active = req;
+
+	device = sonic_find_device(sonic, req->address);
+	if (!device || !sonic_device_get_char(device, SONIC_CHAR_APINFO)) {
+		/* Older firmware, one fixed AP for every device */
+		g_strlcpy(req->ssid, OTA_SSID, sizeof(req->ssid));
+		inet_aton(OTA_ADDR, &req->ap_addr);
+		ota_join(req);
+		return;
+	}
+
+	ap_info_poll(req);
 }
 
 void cmd_ota(const char *arg)
 {
+	struct sonic_device *device;
+	struct ota_req *req;
+	char *opt;
+
 	//check if connected
-	if (check_default_ctrl() == FALSE)
+	device = find_app_device();
+	if (!device)
 		return;
 
+	if (ota_active) {
+		rl_printf("Firmware update already running\n");
+		return;
+	}
+
 	//check arg (filepath)
 	if(arg == NULL || strlen(arg) < 2 || arg[0] != '/') {
 		rl_printf("Requires absolute path to fw bin\n");
 		return;
 	}
 
+	req = g_new0(struct ota_req, 1);
+	req->path = g_strdup(arg);
+	g_strlcpy(req->address, sonic_device_get_address(device),
+						sizeof(req->address));
+
+	//old firmware only speaks v1, ble skips the WiFi AP
+	opt = strchr(req->path, ' ');
+	if (opt) {
+		*opt++ = '\0';
+		opt = g_strstrip(opt);
+		if (!strcmp(opt, "v1")) {
+			req->v1 = true;
+		} else if (!strcmp(opt, "ble")) {
+			req->ble = true;
+		} else {
+			rl_printf("Unknown option %s\n", opt);
+			ota_req_free(req);
+			return;
+		}
+	}
+
  	struct stat buffer;   
-	if(stat(arg, &buffer) != 0) {
+	if(stat(req->path, &buffer) != 0) {
 		rl_printf("File doesn't exist\n");
+		ota_req_free(req);
 		return;
 	}
 	
-	rl_printf("cmd_ota %s\n", arg);
+	rl_printf("cmd_ota %s\n", req->path);
+
+	if (req->ble) {
+		send_fw_ble(device, req);
+		return;
+	}
+
+	//put device in fw update mode, then read the pass characteristic
+	//off of device and prompt user to connect
+	if (!sonic_fwupdate(device, read_pass_reply, req)) {
+		rl_printf("Failed to read\n");
+		ota_req_free(req);
+	}
+}
+
+static void ota_station_reply(const char *error, void *user_data)
+{
+	char *address = user_data;
+	struct sonic_device *device;
+
+	output_result("ota_station", error);
+
+	if (error) {
+		rl_printf("Failed to start station update: %s\n", error);
+		g_free(address);
+		return;
+	}
+
+	rl_printf("Device is joining the network\n");
+
+	/* Progress of the download is rendered by ota_progress_notify */
+	device = sonic_find_device(sonic, address);
+	if (device)
+		sonic_notify(device, SONIC_CHAR_PROGRESS, true, NULL, NULL);
+
+	g_free(address);
+}
+
+void cmd_ota_station(const char *arg)
+{
+	struct sonic_device *device;
+	struct in_addr addr;
+	unsigned long port = OTA_PORT;
+	const char *pass;
+	char *sep, *end, *address;
+	wordexp_t w;
+
+	device = find_app_device();
+	if (!device)
+		return;
+
+	if (ota_active) {
+		rl_printf("Firmware update already running\n");
+		return;
+	}
 
-	fill_uuids();
-	//put device in fw update mode
-	if(mode_char_path != NULL) {
-		cmd_select_attribute(mode_char_path);
-		cmd_write("0x01");	
+	if (!arg || wordexp(arg, &w, WRDE_NOCMD)) {
+		rl_printf("Invalid argument\n");
+		return;
 	}
 
-	//read the pass characteristic off of device, prompt user to connect
-	if(pass_char_path != NULL) {
-		cmd_select_attribute(pass_char_path);
-		rl_printf("\n");
-		cmd_ota_internal(default_attr, arg);
-		rl_printf("\n");
+	if (w.we_wordc != 3) {
+		rl_printf("Requires <ssid> <pass|-> <server[:port]>\n");
+		goto done;
 	}
+
+	sep = strchr(w.we_wordv[2], ':');
+	if (sep) {
+		*sep++ = '\0';
+		port = strtoul(sep, &end, 10);
+		if (*end != '\0' || !port || port > UINT16_MAX) {
+			rl_printf("Invalid port %s\n", sep);
+			goto done;
+		}
+	}
+
+	if (!inet_aton(w.we_wordv[2], &addr)) {
+		rl_printf("Invalid server address %s\n", w.we_wordv[2]);
+		goto done;
+	}
+
+	/* "-" joins an open network */
+	pass = strcmp(w.we_wordv[1], "-") ? w.we_wordv[1] : NULL;
+
+	address = g_strdup(sonic_device_get_address(device));
+
+	if (!sonic_fwupdate_station(device, w.we_wordv[0], pass, addr.s_addr,
+				htons(port), ota_station_reply, address)) {
+		rl_printf("Invalid network config or no station support\n");
+		g_free(address);
+	}
+
+done:
+	wordfree(&w);
+}
+
+void cmd_pool(const char *arg)
+{
+	GList *list, *l;
+	struct sonic_device *device;
+	char *end;
+	unsigned long limit;
+
+	if (arg && strlen(arg)) {
+		limit = strtoul(arg, &end, 10);
+		if (*end != '\0' || limit > 32) {
+			rl_printf("Invalid pool size, must be 0-32\n");
+			return;
+		}
+
+		sonic_pool_set_limit(sonic, limit);
+	}
+
+	rl_printf("Pool size %u%s\n", sonic_pool_get_limit(sonic),
+			sonic_pool_get_limit(sonic) ? "" : " (disabled)");
+
+	list = sonic_pool_get_addresses(sonic);
+
+	for (l = list; l; l = l->next) {
+		device = sonic_find_device(sonic, l->data);
+
+		rl_printf("\t%s %s\n", (const char *) l->data,
+			device && sonic_device_is_connected(device) ?
+						"connected" : "idle");
+	}
+
+	g_list_free(list);
 }
 
 cmd_table_entry cmd_table[] = {
@@ -483,6 +1144,7 @@ cmd_table_entry cmd_table[] = {
 	{ "connect",	"<dev>",cmd_connect_bond, "Connect device",dev_generator},
 	{ "disconnect",	"[dev]",cmd_disconn, "Disconnect device", dev_generator},
 	{ "remove",		"<dev>",cmd_remove, "Remove device", dev_generator },
+	{ "pool",		"[0-32]",cmd_pool, "keep up to n devices connected" },
 
 	{ "beep",		"<on|off>",	cmd_buzz,		"continuous beep on / off" },
 	{ "randint",	"[0-100]",	cmd_randint,	"set random beep interval" },
@@ -491,7 +1153,12 @@ cmd_table_entry cmd_table[] = {
 	{ "rssistats", 	"<on|off>",	cmd_rssistats,	"show/hide rssi stats" },
 	{ "solarmin",  	"[0-100]",	cmd_solarmin, 	"light sensor threshold %" },
 	{ "solarstats",	"<on|off>",	cmd_solarstats, "show/hide light stats" },
-	{ "ota_update",	"[file_path]", cmd_ota, 	"update fw from abs. path" },
+	{ "stream",		"<on|off>",	cmd_stream,		"batched rssi/light samples" },
+	{ "report",		"<rssi|solar> <deadband%> <min s> <max s>", cmd_report,
+						"notify on change / every max s" },
+	{ "ota_update",	"<file_path> [v1|ble]", cmd_ota, "update fw from abs. path" },
+	{ "ota_station", "<ssid> <pass|-> <server[:port]>", cmd_ota_station,
+						"update fw from a host server" },
 
 	{ "list",		NULL,	cmd_list, "List ble interfaces" },
 	{ "select",		"<if>",	cmd_select, "Select ble interface", ctrl_generator},
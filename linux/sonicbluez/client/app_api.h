@@ -8,11 +8,15 @@ void cmd_connect_bond(const char *arg);
 void cmd_buzz(const char *arg);
 void cmd_rssistats(const char *arg);
 void cmd_solarstats(const char *arg);
+void cmd_stream(const char *arg);
+void cmd_report(const char *arg);
 void cmd_randint(const char *arg);
 void cmd_fixedint(const char *arg);
 void cmd_solarmin(const char *arg); 
 void cmd_rssimin(const char *arg);
 void cmd_ota(const char *arg);
+void cmd_ota_station(const char *arg);
+void cmd_pool(const char *arg);
 
 typedef const struct {
 	const char *cmd;
@@ -23,9 +27,13 @@ typedef const struct {
 	void (*disp) (char **matches, int num_matches, int max_length);
 } cmd_table_entry;
 
-const cmd_table_entry cmd_table[19];
+const cmd_table_entry cmd_table[23];
 
 void init_client(void);
+void ota_progress_notify(struct sonic_device *device, const uint8_t *value,
+								size_t len);
+void stream_notify(struct sonic_device *device, const uint8_t *value,
+								size_t len);
 
 
 #endif	/* APP_API_H */
@@ -20,20 +20,21 @@
 #include "agent.h"
 #include "display.h"
 #include "gatt.h"
+#include "output.h"
+#include "app_api.h"
 
-void print_adapter(GDBusProxy *proxy, const char *description)
+static gboolean agent_manager_up = FALSE;
+
+void print_adapter(struct sonic_adapter *adapter, const char *description)
 {
-	DBusMessageIter iter;
 	const char *address, *name;
 
-	if (g_dbus_proxy_get_property(proxy, "Address", &iter) == FALSE)
+	address = sonic_adapter_get_address(adapter);
+	if (!address)
 		return;
 
-	dbus_message_iter_get_basic(&iter, &address);
-
-	if (g_dbus_proxy_get_property(proxy, "Alias", &iter) == TRUE)
-		dbus_message_iter_get_basic(&iter, &name);
-	else
+	name = sonic_adapter_get_alias(adapter);
+	if (!name)
 		name = "<unknown>";
 
 	rl_printf("%s%s%sController %s %s %s\n",
@@ -41,93 +42,34 @@ void print_adapter(GDBusProxy *proxy, const char *description)
 				description ? : "",
 				description ? "] " : "",
 				address, name,
-				default_ctrl &&
-				default_ctrl->proxy == proxy ?
+				sonic_get_default_adapter(sonic) == adapter ?
 				"[default]" : "");
 
 }
 
-gboolean device_is_child(GDBusProxy *device, GDBusProxy *master)
-{
-	DBusMessageIter iter;
-	const char *adapter, *path;
-
-	if (!master)
-		return FALSE;
-
-	if (g_dbus_proxy_get_property(device, "Adapter", &iter) == FALSE)
-		return FALSE;
-
-	dbus_message_iter_get_basic(&iter, &adapter);
-	path = g_dbus_proxy_get_path(master);
-
-	if (!strcmp(path, adapter))
-		return TRUE;
-
-	return FALSE;
-}
-
-gboolean service_is_child(GDBusProxy *service)
-{
-	GList *l;
-	DBusMessageIter iter;
-	const char *device, *path;
-
-	if (g_dbus_proxy_get_property(service, "Device", &iter) == FALSE)
-		return FALSE;
-
-	dbus_message_iter_get_basic(&iter, &device);
-
-	if (!default_ctrl)
-		return FALSE;
-
-	for (l = default_ctrl->devices; l; l = g_list_next(l)) {
-		struct GDBusProxy *proxy = l->data;
-
-		path = g_dbus_proxy_get_path(proxy);
-
-		if (!strcmp(path, device))
-			return TRUE;
-	}
-
-	return FALSE;
-}
-
-struct adapter *find_parent(GDBusProxy *device)
-{
-	GList *list;
-
-	for (list = g_list_first(ctrl_list); list; list = g_list_next(list)) {
-		struct adapter *adapter = list->data;
-
-		if (device_is_child(device, adapter->proxy) == TRUE)
-			return adapter;
-	}
-	return NULL;
-}
-
-void set_default_device(GDBusProxy *proxy, const char *attribute)
+void set_default_device(struct sonic_device *device, const char *attribute)
 {
 	char *desc = NULL;
-	DBusMessageIter iter;
+	const char *name;
 	const char *path;
 
-	default_dev = proxy;
+	default_dev = device;
 
-	if (proxy == NULL) {
+	if (device == NULL) {
 		default_attr = NULL;
 		goto done;
 	}
 
-	if (!g_dbus_proxy_get_property(proxy, "Alias", &iter)) {
-		if (!g_dbus_proxy_get_property(proxy, "Address", &iter))
+	name = sonic_device_get_alias(device);
+	if (!name) {
+		name = sonic_device_get_address(device);
+		if (!name)
 			goto done;
 	}
 
-	path = g_dbus_proxy_get_path(proxy);
+	path = sonic_device_get_path(device);
 
-	dbus_message_iter_get_basic(&iter, &desc);
-	desc = g_strdup_printf(COLOR_BLUE "[%s%s%s]" COLOR_OFF "# ", desc,
+	desc = g_strdup_printf(COLOR_BLUE "[%s%s%s]" COLOR_OFF "# ", name,
 				attribute ? ":" : "",
 				attribute ? attribute + strlen(path) : "");
 
@@ -138,319 +80,147 @@ done:
 	g_free(desc);
 }
 
-void device_added(GDBusProxy *proxy)
+void set_default_attribute(struct sonic_attr *attr)
 {
-	DBusMessageIter iter;
-	struct adapter *adapter = find_parent(proxy);
-
-	if (!adapter) {
-		/* TODO: Error */
-		return;
-	}
-
-	adapter->devices = g_list_append(adapter->devices, proxy);
-	print_device(proxy, COLORED_NEW);
-
-	if (default_dev)
-		return;
+	const char *path = NULL;
 
-	if (g_dbus_proxy_get_property(proxy, "Connected", &iter)) {
-		dbus_bool_t connected;
+	default_attr = attr;
 
-		dbus_message_iter_get_basic(&iter, &connected);
+	if (attr)
+		path = sonic_attr_get_path(attr);
 
-		if (connected)
-			set_default_device(proxy, NULL);
-	}
+	set_default_device(default_dev, path);
 }
 
-void adapter_added(GDBusProxy *proxy)
+static void output_adapter_event(struct sonic_adapter *adapter,
+						enum output_event event)
 {
-	struct adapter *adapter = g_malloc0(sizeof(struct adapter));
-
-	adapter->proxy = proxy;
-	ctrl_list = g_list_append(ctrl_list, adapter);
-
-	if (!default_ctrl)
-		default_ctrl = adapter;
+	if (!output_enabled())
+		return;
 
-	print_adapter(proxy, COLORED_NEW);
+	output_adapter(event, sonic_adapter_get_address(adapter),
+					sonic_adapter_get_alias(adapter));
 }
 
-void proxy_added(GDBusProxy *proxy, void *user_data)
+void adapter_added(struct sonic_adapter *adapter, void *user_data)
 {
-	const char *interface;
-	const char *proxy_path;
-
-	interface = g_dbus_proxy_get_interface(proxy);
-
-	if (!strcmp(interface, "org.bluez.Device1")) {
-		device_added(proxy);
-	} else if (!strcmp(interface, "org.bluez.Adapter1")) {
-		adapter_added(proxy);
-	} else if (!strcmp(interface, "org.bluez.AgentManager1")) {
-		if (!agent_manager) {
-			agent_manager = proxy;
-
-			if (auto_register_agent)
-				agent_register(dbus_conn, agent_manager,
-							auto_register_agent);
-		}
-	} else if (!strcmp(interface, "org.bluez.GattService1")) {
-		if (service_is_child(proxy))
-			gatt_add_service(proxy);
-	} else if (!strcmp(interface, "org.bluez.GattCharacteristic1")) {
-		gatt_add_characteristic(proxy);
-		proxy_path = g_dbus_proxy_get_path(proxy);
-		//rl_printf("----> %s\n", proxy_path);
-/*
-		if(strstr(proxy_path, "service0028/char0029") != NULL) {
-			buzz_char_path = proxy_path;
-			//rl_printf("its here buzz\n");
-		}
-		else if(strstr(proxy_path, "service0028/char0031") != NULL) {
-			rssival_char_path = proxy_path;
-			//rl_printf("its here rssival\n");
-		}
-		else if(strstr(proxy_path, "service0028/char0035") != NULL) {
-			solarval_char_path = proxy_path;
-			//rl_printf("its here solarval\n");
-		}
-		else if(strstr(proxy_path, "service0028/char0033") != NULL) {
-			rssimin_char_path = proxy_path;
-			//rl_printf("its here rssimin\n");
-		}
-		else if(strstr(proxy_path, "service0028/char0037") != NULL) {
-			solarmin_char_path = proxy_path;
-			//rl_printf("its here solarmin\n");
-		}
-		else if(strstr(proxy_path, "service0028/char002f") != NULL) {
-			randint_char_path = proxy_path;
-			//rl_printf("its here randint\n");
-		}
-		else if(strstr(proxy_path, "service0028/char002d") != NULL) {
-			fixedint_char_path = proxy_path;
-			//rl_printf("its here fixedint\n");
-		}
-		else if(strstr(proxy_path, "service0028/char002b") != NULL) {
-			mode_char_path = proxy_path;
-			//rl_printf("its here mode\n");
-		}
-		else if(strstr(proxy_path, "service0028/char0039") != NULL) {
-			pass_char_path = proxy_path;
-			//rl_printf("its here pass\n");
-		}
-*/
-	} else if (!strcmp(interface, "org.bluez.GattDescriptor1")) {
-		gatt_add_descriptor(proxy);
-	} else if (!strcmp(interface, "org.bluez.GattManager1")) {
-		gatt_add_manager(proxy);
-	}
+	print_adapter(adapter, COLORED_NEW);
+	output_adapter_event(adapter, OUTPUT_NEW);
 }
 
-void set_default_attribute(GDBusProxy *proxy)
+void adapter_removed(struct sonic_adapter *adapter, void *user_data)
 {
-	const char *path;
-
-	default_attr = proxy;
+	print_adapter(adapter, COLORED_DEL);
+	output_adapter_event(adapter, OUTPUT_DEL);
 
-	path = g_dbus_proxy_get_path(proxy);
-
-	set_default_device(default_dev, path);
+	if (default_dev && sonic_device_get_adapter(default_dev) == adapter)
+		set_default_device(NULL, NULL);
 }
 
-void device_removed(GDBusProxy *proxy)
+void device_added(struct sonic_device *device, void *user_data)
 {
-	struct adapter *adapter = find_parent(proxy);
-	if (!adapter) {
-		/* TODO: Error */
+	print_device(device, COLORED_NEW);
+	output_device(OUTPUT_NEW, sonic_device_get_address(device),
+					sonic_device_get_alias(device));
+
+	if (default_dev)
 		return;
-	}
 
-	adapter->devices = g_list_remove(adapter->devices, proxy);
+	if (sonic_device_is_connected(device))
+		set_default_device(device, NULL);
+}
 
-	print_device(proxy, COLORED_DEL);
+void device_removed(struct sonic_device *device, void *user_data)
+{
+	print_device(device, COLORED_DEL);
+	output_device(OUTPUT_DEL, sonic_device_get_address(device),
+					sonic_device_get_alias(device));
 
-	if (default_dev == proxy)
+	if (default_dev == device)
 		set_default_device(NULL, NULL);
 }
 
-void adapter_removed(GDBusProxy *proxy)
+void device_changed(struct sonic_device *device, const char *name,
+				const struct sonic_value *value, void *user_data)
 {
-	GList *ll;
+	bool connected;
 
-	for (ll = g_list_first(ctrl_list); ll; ll = g_list_next(ll)) {
-		struct adapter *adapter = ll->data;
+	output_property(sonic_device_get_address(device), name, value);
 
-		if (adapter->proxy == proxy) {
-			print_adapter(proxy, COLORED_DEL);
+	if (sonic_device_get_adapter(device) !=
+					sonic_get_default_adapter(sonic))
+		return;
 
-			if (default_ctrl && default_ctrl->proxy == proxy) {
-				default_ctrl = NULL;
-				set_default_device(NULL, NULL);
-			}
+	if (strcmp(name, "Connected"))
+		return;
 
-			ctrl_list = g_list_remove_link(ctrl_list, ll);
-			g_list_free(adapter->devices);
-			g_free(adapter);
-			g_list_free(ll);
-			return;
-		}
-	}
+	connected = value->b;
+
+	if (connected && default_dev == NULL)
+		set_default_device(device, NULL);
+	else if (!connected && default_dev == device)
+		set_default_device(NULL, NULL);
 }
 
-void proxy_removed(GDBusProxy *proxy, void *user_data)
+void attribute_removed(struct sonic_attr *attr, void *user_data)
 {
-	const char *interface;
-
-	interface = g_dbus_proxy_get_interface(proxy);
-
-	if (!strcmp(interface, "org.bluez.Device1")) {
-		device_removed(proxy);
-	} else if (!strcmp(interface, "org.bluez.Adapter1")) {
-		adapter_removed(proxy);
-	} else if (!strcmp(interface, "org.bluez.AgentManager1")) {
-		if (agent_manager == proxy) {
-			agent_manager = NULL;
-			if (auto_register_agent)
-				agent_unregister(dbus_conn, NULL);
-		}
-	} else if (!strcmp(interface, "org.bluez.GattService1")) {
-		gatt_remove_service(proxy);
-
-		if (default_attr == proxy)
-			set_default_attribute(NULL);
-	} else if (!strcmp(interface, "org.bluez.GattCharacteristic1")) {
-		gatt_remove_characteristic(proxy);
-
-		if (default_attr == proxy)
-			set_default_attribute(NULL);
-	} else if (!strcmp(interface, "org.bluez.GattDescriptor1")) {
-		gatt_remove_descriptor(proxy);
-
-		if (default_attr == proxy)
-			set_default_attribute(NULL);
-	} else if (!strcmp(interface, "org.bluez.GattManager1")) {
-		gatt_remove_manager(proxy);
-	}
+	if (default_attr == attr)
+		set_default_attribute(NULL);
 }
 
-void property_changed(GDBusProxy *proxy, const char *name,
-					DBusMessageIter *iter, void *user_data)
+void agent_manager_added(struct sonic_ctx *ctx, void *user_data)
 {
-	const char *interface;
-
-	interface = g_dbus_proxy_get_interface(proxy);
-
-	if (!strcmp(interface, "org.bluez.Device1")) {
-		if (default_ctrl && device_is_child(proxy,
-					default_ctrl->proxy) == TRUE) {
-			DBusMessageIter addr_iter;
-			char *str;
-
-			if (g_dbus_proxy_get_property(proxy, "Address",
-							&addr_iter) == TRUE) {
-				const char *address;
+	agent_manager_up = TRUE;
 
-				dbus_message_iter_get_basic(&addr_iter,
-								&address);
-				str = g_strdup_printf("[" COLORED_CHG
-						"] Device %s ", address);
-			} else
-				str = g_strdup("");
-
-			if (strcmp(name, "Connected") == 0) {
-				dbus_bool_t connected;
-
-				dbus_message_iter_get_basic(iter, &connected);
-
-				if (connected && default_dev == NULL)
-					set_default_device(proxy, NULL);
-				else if (!connected && default_dev == proxy)
-					set_default_device(NULL, NULL);
-			}
-
-			//print_iter(str, name, iter);
-			g_free(str);
-		}
-	} else if (!strcmp(interface, "org.bluez.Adapter1")) {
-		DBusMessageIter addr_iter;
-		char *str;
-
-		if (g_dbus_proxy_get_property(proxy, "Address",
-						&addr_iter) == TRUE) {
-			const char *address;
-
-			dbus_message_iter_get_basic(&addr_iter, &address);
-			str = g_strdup_printf("[" COLORED_CHG
-						"] Controller %s ", address);
-		} else
-			str = g_strdup("");
-
-		//print_iter(str, name, iter);
-		g_free(str);
-	} else if (proxy == default_attr) {
-		char *str;
-		char * attr_str;
-		unsigned char byte;
-
-
-		str = g_strdup_printf("[" COLORED_CHG "] Attribute %s ",
-						g_dbus_proxy_get_path(proxy));
-
-		//rl_printf("--> %s\n",name);
-		//rl_printf("-+> %s\n",str);
-		//print_stat(str, name, iter);
-		g_free(str);
-	}
+	if (auto_register_agent)
+		agent_register(ctx, auto_register_agent);
 }
 
-struct adapter *find_ctrl_by_address(GList *source, const char *address)
+void agent_manager_removed(struct sonic_ctx *ctx, void *user_data)
 {
-	GList *list;
+	agent_manager_up = FALSE;
 
-	for (list = g_list_first(source); list; list = g_list_next(list)) {
-		struct adapter *adapter = list->data;
-		DBusMessageIter iter;
-		const char *str;
-
-		if (g_dbus_proxy_get_property(adapter->proxy,
-					"Address", &iter) == FALSE)
-			continue;
-
-		dbus_message_iter_get_basic(&iter, &str);
-
-		if (!strcmp(str, address))
-			return adapter;
-	}
-
-	return NULL;
+	if (auto_register_agent)
+		agent_unregistered();
 }
 
-GDBusProxy *find_proxy_by_address(GList *source, const char *address)
+void attribute_notify(struct sonic_device *device, struct sonic_attr *attr,
+				enum sonic_char chr, const uint8_t *value,
+				size_t len, void *user_data)
 {
-	GList *list;
+	const char *address = device ? sonic_device_get_address(device) : NULL;
 
-	for (list = g_list_first(source); list; list = g_list_next(list)) {
-		GDBusProxy *proxy = list->data;
-		DBusMessageIter iter;
-		const char *str;
+	output_sample(address, chr, value, len);
 
-		if (g_dbus_proxy_get_property(proxy, "Address", &iter) == FALSE)
-			continue;
+	if (device && len > 0 && (chr == SONIC_CHAR_RSSI ||
+					chr == SONIC_CHAR_SOLAR)) {
+		rl_printf("[" COLORED_CHG "] Device %s %s %u%%\n", address,
+				chr == SONIC_CHAR_RSSI ? "rssi" : "light",
+				value[0]);
+		return;
+	}
 
-		dbus_message_iter_get_basic(&iter, &str);
+	if (device && chr == SONIC_CHAR_STREAM) {
+		stream_notify(device, value, len);
+		return;
+	}
 
-		if (!strcmp(str, address))
-			return proxy;
+	if (device && chr == SONIC_CHAR_PROGRESS) {
+		ota_progress_notify(device, value, len);
+		return;
 	}
 
-	return NULL;
+	if (attr != default_attr)
+		return;
+
+	rl_printf("[" COLORED_CHG "] Attribute %s Value:\n",
+						sonic_attr_get_path(attr));
+	rl_hexdump(value, len);
 }
 
 gboolean check_default_ctrl(void)
 {
-	if (!default_ctrl) {
+	if (!sonic_get_default_adapter(sonic)) {
 		rl_printf("No default controller available\n");
 		return FALSE;
 	}
@@ -458,7 +228,7 @@ gboolean check_default_ctrl(void)
 	return TRUE;
 }
 
-gboolean parse_argument_on_off(const char *arg, dbus_bool_t *value)
+gboolean parse_argument_on_off(const char *arg, gboolean *value)
 {
 	if (!arg || !strlen(arg)) {
 		rl_printf("Missing on/off argument\n");
@@ -479,7 +249,7 @@ gboolean parse_argument_on_off(const char *arg, dbus_bool_t *value)
 	return FALSE;
 }
 
-gboolean parse_argument_agent(const char *arg, dbus_bool_t *value,
+gboolean parse_argument_agent(const char *arg, gboolean *value,
 							const char **capability)
 {
 	const char * const *opt;
@@ -516,85 +286,94 @@ void cmd_list(const char *arg)
 {
 	GList *list;
 
-	for (list = g_list_first(ctrl_list); list; list = g_list_next(list)) {
-		struct adapter *adapter = list->data;
-		print_adapter(adapter->proxy, NULL);
+	for (list = sonic_get_adapters(sonic); list;
+						list = g_list_next(list)) {
+		struct sonic_adapter *adapter = list->data;
+		print_adapter(adapter, NULL);
 	}
 }
 
 void cmd_show(const char *arg)
 {
-	struct adapter *adapter;
-	GDBusProxy *proxy;
-	DBusMessageIter iter;
+	struct sonic_adapter *adapter;
 	const char *address;
 
 	if (!arg || !strlen(arg)) {
 		if (check_default_ctrl() == FALSE)
 			return;
 
-		proxy = default_ctrl->proxy;
+		adapter = sonic_get_default_adapter(sonic);
 	} else {
-		adapter = find_ctrl_by_address(ctrl_list, arg);
+		adapter = sonic_find_adapter(sonic, arg);
 		if (!adapter) {
 			rl_printf("Controller %s not available\n", arg);
 			return;
 		}
-		proxy = adapter->proxy;
 	}
 
-	if (g_dbus_proxy_get_property(proxy, "Address", &iter) == FALSE)
+	address = sonic_adapter_get_address(adapter);
+	if (!address)
 		return;
 
-	dbus_message_iter_get_basic(&iter, &address);
 	rl_printf("Controller %s\n", address);
 
-	print_property(proxy, "Name");
+	print_adapter_property(adapter, "Name");
 /*
-	print_property(proxy, "Alias");
-	print_property(proxy, "Class");
-	print_property(proxy, "Powered");
-	print_property(proxy, "Discoverable");
-	print_property(proxy, "Pairable");
-	print_uuids(proxy);
-	print_property(proxy, "Modalias");
+	print_adapter_property(adapter, "Alias");
+	print_adapter_property(adapter, "Class");
+	print_adapter_property(adapter, "Powered");
+	print_adapter_property(adapter, "Discoverable");
+	print_adapter_property(adapter, "Pairable");
+	print_adapter_property(adapter, "Modalias");
 */
-	print_property(proxy, "Discovering");
+	print_adapter_property(adapter, "Discovering");
 }
 
 void cmd_select(const char *arg)
 {
-	struct adapter *adapter;
+	struct sonic_adapter *adapter;
 
 	if (!arg || !strlen(arg)) {
 		rl_printf("Missing controller address argument\n");
 		return;
 	}
 
-	adapter = find_ctrl_by_address(ctrl_list, arg);
+	adapter = sonic_find_adapter(sonic, arg);
 	if (!adapter) {
 		rl_printf("Controller %s not available\n", arg);
 		return;
 	}
 
-	if (default_ctrl && default_ctrl->proxy == adapter->proxy)
+	if (sonic_get_default_adapter(sonic) == adapter)
 		return;
 
-	default_ctrl = adapter;
-	print_adapter(adapter->proxy, NULL);
+	sonic_set_default_adapter(sonic, adapter);
+	print_adapter(adapter, NULL);
 }
 
 void cmd_devices(const char *arg)
 {
+	const struct sonic_inventory_entry *entry;
+	unsigned int i;
 	GList *ll;
 
 	if (check_default_ctrl() == FALSE)
 		return;
 
-	for (ll = g_list_first(default_ctrl->devices);
+	for (ll = sonic_adapter_get_devices(sonic_get_default_adapter(sonic));
 			ll; ll = g_list_next(ll)) {
-		GDBusProxy *proxy = ll->data;
-		print_device(proxy, NULL);
+		struct sonic_device *device = ll->data;
+		print_device(device, NULL);
+	}
+
+	/* Known buzzers bluetoothd has not seen since it started */
+	for (i = 0; (entry = sonic_inventory_get(sonic, i)); i++) {
+		if (sonic_find_device(sonic, entry->address))
+			continue;
+
+		rl_printf("Device %s %s [cached]\n", entry->address,
+						entry->alias[0] ? entry->alias :
+						"<unknown>");
 	}
 }
 
@@ -605,70 +384,60 @@ void cmd_paired_devices(const char *arg)
 	if (check_default_ctrl() == FALSE)
 		return;
 
-	for (ll = g_list_first(default_ctrl->devices);
+	for (ll = sonic_adapter_get_devices(sonic_get_default_adapter(sonic));
 			ll; ll = g_list_next(ll)) {
-		GDBusProxy *proxy = ll->data;
-		DBusMessageIter iter;
-		dbus_bool_t paired;
+		struct sonic_device *device = ll->data;
 
-		if (g_dbus_proxy_get_property(proxy, "Paired", &iter) == FALSE)
+		if (!sonic_device_is_paired(device))
 			continue;
 
-		dbus_message_iter_get_basic(&iter, &paired);
-		if (!paired)
-			continue;
-
-		print_device(proxy, NULL);
+		print_device(device, NULL);
 	}
 }
 
 gboolean is_paired(const char *arg)
 {
-	GList *ll;
-	DBusMessageIter iter;
-	const char *address, *name;
+	struct sonic_device *device;
 
 	if (check_default_ctrl() == FALSE)
 		return FALSE;
 
-	for (ll = g_list_first(default_ctrl->devices);
-			ll; ll = g_list_next(ll)) {
-		GDBusProxy *proxy = ll->data;
-		DBusMessageIter iter;
-		dbus_bool_t paired;
-
-		if (g_dbus_proxy_get_property(proxy, "Paired", &iter) == FALSE)
-			continue;
-
-		dbus_message_iter_get_basic(&iter, &paired);
-		if (!paired)
-			continue;
-
-	    if (g_dbus_proxy_get_property(proxy, "Address", &iter) == FALSE)
-		    return FALSE;
+	device = sonic_find_device(sonic, arg);
+	if (!device || !sonic_device_is_paired(device))
+		return FALSE;
 
-	    dbus_message_iter_get_basic(&iter, &address);
-		if(strcmp(address,arg)==0) {
-			return TRUE;
-		}
-	}
-	return FALSE;
+	return TRUE;
 }
 
-void generic_callback(const DBusError *error, void *user_data)
+/* user_data is a g_malloc'ed description of the change, freed here */
+void generic_callback(const char *error, void *user_data)
 {
 	char *str = user_data;
 
-	if (dbus_error_is_set(error))
-		rl_printf("Failed to set %s: %s\n", str, error->name);
+	output_result(str, error);
+
+	if (error)
+		rl_printf("Failed to set %s: %s\n", str, error);
 	else
 		rl_printf("Changing %s succeeded\n", str);
+
+	g_free(str);
 }
 
-void cmd_system_alias(const char *arg)
+static void set_system_alias(const char *alias)
 {
-	char *name;
+	char *name = g_strdup(alias);
+
+	if (sonic_adapter_set_alias(sonic_get_default_adapter(sonic), alias,
+						generic_callback, name))
+		return;
+
+	rl_printf("Failed to set %s\n", name);
+	g_free(name);
+}
 
+void cmd_system_alias(const char *arg)
+{
 	if (!arg || !strlen(arg)) {
 		rl_printf("Missing name argument\n");
 		return;
@@ -677,37 +446,33 @@ void cmd_system_alias(const char *arg)
 	if (check_default_ctrl() == FALSE)
 		return;
 
-	name = g_strdup(arg);
-
-	if (g_dbus_proxy_set_property_basic(default_ctrl->proxy, "Alias",
-					DBUS_TYPE_STRING, &name,
-					generic_callback, name, g_free) == TRUE)
-		return;
-
-	g_free(name);
+	set_system_alias(arg);
 }
 
 void cmd_reset_alias(const char *arg)
 {
-	char *name;
-
 	if (check_default_ctrl() == FALSE)
 		return;
 
-	name = g_strdup("");
+	set_system_alias("");
+}
+
+static void power_reply(const char *error, void *user_data)
+{
+	const char *str = user_data;
 
-	if (g_dbus_proxy_set_property_basic(default_ctrl->proxy, "Alias",
-					DBUS_TYPE_STRING, &name,
-					generic_callback, name, g_free) == TRUE)
-		return;
+	output_result(str, error);
 
-	g_free(name);
+	if (error)
+		rl_printf("Failed to set %s: %s\n", str, error);
+	else
+		rl_printf("Changing %s succeeded\n", str);
 }
 
 void cmd_power(const char *arg)
 {
-	dbus_bool_t powered;
-	char *str;
+	gboolean powered;
+	const char *str;
 
 	if (parse_argument_on_off(arg, &powered) == FALSE)
 		return;
@@ -715,19 +480,17 @@ void cmd_power(const char *arg)
 	if (check_default_ctrl() == FALSE)
 		return;
 
-	str = g_strdup_printf("power %s", powered == TRUE ? "on" : "off");
-
-	if (g_dbus_proxy_set_property_basic(default_ctrl->proxy, "Powered",
-					DBUS_TYPE_BOOLEAN, &powered,
-					generic_callback, str, g_free) == TRUE)
-		return;
+	str = powered == TRUE ? "power on" : "power off";
 
-	g_free(str);
+	if (!sonic_adapter_set_powered(sonic_get_default_adapter(sonic),
+					powered == TRUE, power_reply,
+					(void *) str))
+		rl_printf("Failed to set %s\n", str);
 }
 
 void cmd_agent(const char *arg)
 {
-	dbus_bool_t enable;
+	gboolean enable;
 	const char *capability;
 
 	if (parse_argument_agent(arg, &enable, &capability) == FALSE)
@@ -737,17 +500,16 @@ void cmd_agent(const char *arg)
 		g_free(auto_register_agent);
 		auto_register_agent = g_strdup(capability);
 
-		if (agent_manager)
-			agent_register(dbus_conn, agent_manager,
-						auto_register_agent);
+		if (agent_manager_up)
+			agent_register(sonic, auto_register_agent);
 		else
 			rl_printf("Agent registration enabled\n");
 	} else {
 		g_free(auto_register_agent);
 		auto_register_agent = NULL;
 
-		if (agent_manager)
-			agent_unregister(dbus_conn, agent_manager);
+		if (agent_manager_up)
+			agent_unregister(sonic);
 		else
 			rl_printf("Agent registration disabled\n");
 	}
@@ -755,20 +517,18 @@ void cmd_agent(const char *arg)
 
 void cmd_default_agent(const char *arg)
 {
-	agent_default(dbus_conn, agent_manager);
+	agent_default(sonic);
 }
 
-void start_discovery_reply(DBusMessage *message, void *user_data)
+static void discovery_reply(const char *error, void *user_data)
 {
-	dbus_bool_t enable = GPOINTER_TO_UINT(user_data);
-	DBusError error;
+	gboolean enable = GPOINTER_TO_UINT(user_data);
 
-	dbus_error_init(&error);
+	output_result(enable == TRUE ? "scan on" : "scan off", error);
 
-	if (dbus_set_error_from_message(&error, message) == TRUE) {
+	if (error) {
 		rl_printf("Failed to %s discovery: %s\n",
-				enable == TRUE ? "start" : "stop", error.name);
-		dbus_error_free(&error);
+				enable == TRUE ? "start" : "stop", error);
 		return;
 	}
 
@@ -777,8 +537,7 @@ void start_discovery_reply(DBusMessage *message, void *user_data)
 
 void cmd_scan(const char *arg)
 {
-	dbus_bool_t enable;
-	const char *method;
+	gboolean enable;
 
 	if (parse_argument_on_off(arg, &enable) == FALSE)
 		return;
@@ -786,23 +545,18 @@ void cmd_scan(const char *arg)
 	if (check_default_ctrl() == FALSE)
 		return;
 
-	if (enable == TRUE)
-		method = "StartDiscovery";
-	else
-		method = "StopDiscovery";
-
-	if (g_dbus_proxy_method_call(default_ctrl->proxy, method,
-				NULL, start_discovery_reply,
-				GUINT_TO_POINTER(enable), NULL) == FALSE) {
+	if (!sonic_adapter_set_discovery(sonic_get_default_adapter(sonic),
+					enable == TRUE, discovery_reply,
+					GUINT_TO_POINTER(enable))) {
 		rl_printf("Failed to %s discovery\n",
 					enable == TRUE ? "start" : "stop");
 		return;
 	}
 }
 
-struct GDBusProxy *find_device(const char *arg)
+struct sonic_device *find_device(const char *arg)
 {
-	GDBusProxy *proxy;
+	struct sonic_device *device;
 
 	if (!arg || !strlen(arg)) {
 		if (default_dev)
@@ -814,58 +568,49 @@ struct GDBusProxy *find_device(const char *arg)
 	if (check_default_ctrl() == FALSE)
 		return NULL;
 
-	proxy = find_proxy_by_address(default_ctrl->devices, arg);
-	if (!proxy) {
+	device = sonic_find_device(sonic, arg);
+	if (!device) {
 		rl_printf("Device %s not available\n", arg);
 		return NULL;
 	}
 
-	return proxy;
+	return device;
 }
 
 void cmd_info(const char *arg)
 {
-	GDBusProxy *proxy;
-	DBusMessageIter iter;
-	const char *address;
-
-	proxy = find_device(arg);
-	if (!proxy)
-		return;
-
-	if (g_dbus_proxy_get_property(proxy, "Address", &iter) == FALSE)
-		return;
-
-	dbus_message_iter_get_basic(&iter, &address);
-	rl_printf("Device %s\n", address);
-
-	print_property(proxy, "Name");
-	print_property(proxy, "Alias");
-	print_property(proxy, "Class");
-	print_property(proxy, "Appearance");
-	print_property(proxy, "Icon");
-	print_property(proxy, "Paired");
-	print_property(proxy, "Trusted");
-	print_property(proxy, "Blocked");
-	print_property(proxy, "Connected");
-	print_property(proxy, "LegacyPairing");
-	//print_uuids(proxy);
-	print_property(proxy, "Modalias");
-	print_property(proxy, "ManufacturerData");
-	print_property(proxy, "ServiceData");
-	print_property(proxy, "RSSI");
-	print_property(proxy, "TxPower");
+	struct sonic_device *device;
+
+	device = find_device(arg);
+	if (!device)
+		return;
+
+	rl_printf("Device %s\n", sonic_device_get_address(device));
+
+	print_device_property(device, "Name");
+	print_device_property(device, "Alias");
+	print_device_property(device, "Class");
+	print_device_property(device, "Appearance");
+	print_device_property(device, "Icon");
+	print_device_property(device, "Paired");
+	print_device_property(device, "Trusted");
+	print_device_property(device, "Blocked");
+	print_device_property(device, "Connected");
+	print_device_property(device, "LegacyPairing");
+	//print_uuids(device);
+	print_device_property(device, "Modalias");
+	print_device_property(device, "ManufacturerData");
+	print_device_property(device, "ServiceData");
+	print_device_property(device, "RSSI");
+	print_device_property(device, "TxPower");
 }
 
-void pair_reply(DBusMessage *message, void *user_data)
+static void pair_reply(const char *error, void *user_data)
 {
-	DBusError error;
+	output_result("pair", error);
 
-	dbus_error_init(&error);
-
-	if (dbus_set_error_from_message(&error, message) == TRUE) {
-		rl_printf("Failed to pair: %s\n", error.name);
-		dbus_error_free(&error);
+	if (error) {
+		rl_printf("Failed to pair: %s\n", error);
 		return;
 	}
 
@@ -874,14 +619,13 @@ void pair_reply(DBusMessage *message, void *user_data)
 
 void cmd_pair(const char *arg)
 {
-	GDBusProxy *proxy;
+	struct sonic_device *device;
 
-	proxy = find_device(arg);
-	if (!proxy)
+	device = find_device(arg);
+	if (!device)
 		return;
 
-	if (g_dbus_proxy_method_call(proxy, "Pair", NULL, pair_reply,
-							NULL, NULL) == FALSE) {
+	if (!sonic_device_pair(device, pair_reply, NULL)) {
 		rl_printf("Failed to pair\n");
 		return;
 	}
@@ -889,93 +633,57 @@ void cmd_pair(const char *arg)
 	rl_printf("Attempting to pair with %s\n", arg);
 }
 
-void cmd_trust(const char *arg)
+static void set_trusted(const char *arg, gboolean trusted)
 {
-	GDBusProxy *proxy;
-	dbus_bool_t trusted;
+	struct sonic_device *device;
 	char *str;
 
-	proxy = find_device(arg);
-	if (!proxy)
+	device = find_device(arg);
+	if (!device)
 		return;
 
-	trusted = TRUE;
+	str = g_strdup_printf("%s %s", arg, trusted ? "trust" : "untrust");
 
-	str = g_strdup_printf("%s trust", arg);
-
-	if (g_dbus_proxy_set_property_basic(proxy, "Trusted",
-					DBUS_TYPE_BOOLEAN, &trusted,
-					generic_callback, str, g_free) == TRUE)
+	if (sonic_device_set_trusted(device, trusted == TRUE,
+						generic_callback, str))
 		return;
 
+	rl_printf("Failed to set %s\n", str);
 	g_free(str);
 }
 
-void cmd_untrust(const char *arg)
+void cmd_trust(const char *arg)
 {
-	GDBusProxy *proxy;
-	dbus_bool_t trusted;
-	char *str;
-
-	proxy = find_device(arg);
-	if (!proxy)
-		return;
-
-	trusted = FALSE;
-
-	str = g_strdup_printf("%s untrust", arg);
-
-	if (g_dbus_proxy_set_property_basic(proxy, "Trusted",
-					DBUS_TYPE_BOOLEAN, &trusted,
-					generic_callback, str, g_free) == TRUE)
-		return;
-
-	g_free(str);
+	set_trusted(arg, TRUE);
 }
 
-void remove_device_reply(DBusMessage *message, void *user_data)
+void cmd_untrust(const char *arg)
 {
-	DBusError error;
+	set_trusted(arg, FALSE);
+}
 
-	dbus_error_init(&error);
+static void remove_device_reply(const char *error, void *user_data)
+{
+	output_result("remove", error);
 
-	if (dbus_set_error_from_message(&error, message) == TRUE) {
-		rl_printf("Failed to remove device: %s\n", error.name);
-		dbus_error_free(&error);
+	if (error) {
+		rl_printf("Failed to remove device: %s\n", error);
 		return;
 	}
 
 	rl_printf("Device has been removed\n");
 }
 
-void remove_device_setup(DBusMessageIter *iter, void *user_data)
+static void remove_device(struct sonic_device *device)
 {
-	const char *path = user_data;
-
-	dbus_message_iter_append_basic(iter, DBUS_TYPE_OBJECT_PATH, &path);
-}
-
-void remove_device(GDBusProxy *proxy)
-{
-	char *path;
-
-	path = g_strdup(g_dbus_proxy_get_path(proxy));
-
-	if (!default_ctrl)
-		return;
-
-	if (g_dbus_proxy_method_call(default_ctrl->proxy, "RemoveDevice",
-						remove_device_setup,
-						remove_device_reply,
-						path, g_free) == FALSE) {
+	if (!sonic_adapter_remove_device(sonic_device_get_adapter(device),
+					device, remove_device_reply, NULL))
 		rl_printf("Failed to remove device\n");
-		g_free(path);
-	}
 }
 
 void cmd_remove(const char *arg)
 {
-	GDBusProxy *proxy;
+	struct sonic_device *device;
 
 	if (!arg || !strlen(arg)) {
 		rl_printf("Missing device address argument\n");
@@ -988,45 +696,75 @@ void cmd_remove(const char *arg)
 	if (strcmp(arg, "*") == 0) {
 		GList *list;
 
-		for (list = default_ctrl->devices; list;
-						list = g_list_next(list)) {
-			GDBusProxy *proxy = list->data;
-
-			remove_device(proxy);
-		}
+		for (list = sonic_adapter_get_devices(
+					sonic_get_default_adapter(sonic));
+					list; list = g_list_next(list))
+			remove_device(list->data);
 		return;
 	}
 
-	proxy = find_proxy_by_address(default_ctrl->devices, arg);
-	if (!proxy) {
+	device = sonic_find_device(sonic, arg);
+	if (!device) {
 		rl_printf("Device %s not available\n", arg);
 		return;
 	}
 
-	remove_device(proxy);
+	remove_device(device);
 }
 
-void connect_reply(DBusMessage *message, void *user_data)
+/*
+ * Replies carry the device address rather than the device, which may be
+ * gone by the time bluetoothd answers.
+ */
+static void connect_reply(const char *error, void *user_data)
 {
-	GDBusProxy *proxy = user_data;
-	DBusError error;
+	char *address = user_data;
+	struct sonic_device *device;
 
-	dbus_error_init(&error);
+	output_result("connect", error);
 
-	if (dbus_set_error_from_message(&error, message) == TRUE) {
-		rl_printf("Failed to connect: %s\n", error.name);
-		dbus_error_free(&error);
+	if (error) {
+		rl_printf("Failed to connect: %s\n", error);
+		g_free(address);
 		return;
 	}
 
 	rl_printf("Connection successful\n");
 
-	set_default_device(proxy, NULL);
+	device = sonic_find_device(sonic, address);
+	if (device)
+		set_default_device(device, NULL);
+
+	g_free(address);
+}
+
+static bool connect_cached(const char *arg)
+{
+	const struct sonic_inventory_entry *entry;
+	char *address;
+
+	entry = sonic_inventory_find(sonic, arg);
+	if (!entry)
+		return false;
+
+	address = g_strdup(entry->address);
+
+	if (!sonic_adapter_connect_address(sonic_get_default_adapter(sonic),
+				address, entry->flags & SONIC_INVENTORY_RANDOM,
+				connect_reply, address)) {
+		g_free(address);
+		return false;
+	}
+
+	rl_printf("Attempting to connect to cached %s\n", arg);
+
+	return true;
 }
 
 void cmd_connect(const char *arg)
 {
-	GDBusProxy *proxy;
+	struct sonic_device *device;
+	char *address;
 
 	if (!arg || !strlen(arg)) {
 		rl_printf("Missing device address argument\n");
@@ -1036,73 +774,88 @@ void cmd_connect(const char *arg)
 	if (check_default_ctrl() == FALSE)
 		return;
 
-	proxy = find_proxy_by_address(default_ctrl->devices, arg);
-	if (!proxy) {
-		rl_printf("Device %s not available\n", arg);
+	//pooled devices are likely still connected, returns right away
+	if (sonic_pool_get_limit(sonic)) {
+		address = g_strdup(arg);
+
+		if (!sonic_pool_acquire(sonic, arg, connect_reply, address)) {
+			rl_printf("Device %s not available\n", arg);
+			g_free(address);
+		}
+		return;
+	}
+
+	device = sonic_find_device(sonic, arg);
+	if (!device) {
+		if (!connect_cached(arg))
+			rl_printf("Device %s not available\n", arg);
 		return;
 	}
 
-	if (g_dbus_proxy_method_call(proxy, "Connect", NULL, connect_reply,
-							proxy, NULL) == FALSE) {
+	address = g_strdup(arg);
+
+	if (!sonic_device_connect(device, connect_reply, address)) {
 		rl_printf("Failed to connect\n");
+		g_free(address);
 		return;
 	}
 
 	rl_printf("Attempting to connect to %s\n", arg);
 }
 
-void disconn_reply(DBusMessage *message, void *user_data)
+static void disconn_reply(const char *error, void *user_data)
 {
-	GDBusProxy *proxy = user_data;
-	DBusError error;
+	char *address = user_data;
 
-	dbus_error_init(&error);
+	output_result("disconnect", error);
 
-	if (dbus_set_error_from_message(&error, message) == TRUE) {
-		rl_printf("Failed to disconnect: %s\n", error.name);
-		dbus_error_free(&error);
+	if (error) {
+		rl_printf("Failed to disconnect: %s\n", error);
+		g_free(address);
 		return;
 	}
 
 	rl_printf("Successful disconnected\n");
 
-	if (proxy != default_dev)
-		return;
+	if (default_dev && sonic_find_device(sonic, address) == default_dev)
+		set_default_device(NULL, NULL);
 
-	set_default_device(NULL, NULL);
+	g_free(address);
 }
 
 void cmd_disconn(const char *arg)
 {
-	GDBusProxy *proxy;
+	struct sonic_device *device;
+	char *address;
 
-	proxy = find_device(arg);
-	if (!proxy)
+	device = find_device(arg);
+	if (!device)
 		return;
 
-	if (g_dbus_proxy_method_call(proxy, "Disconnect", NULL, disconn_reply,
-							proxy, NULL) == FALSE) {
+	address = g_strdup(sonic_device_get_address(device));
+
+	//explicit disconnect, don't let the pool bring it back
+	sonic_pool_release(sonic, address);
+
+	if (!sonic_device_disconnect(device, disconn_reply, address)) {
 		rl_printf("Failed to disconnect\n");
+		g_free(address);
 		return;
 	}
-	if (strlen(arg) == 0) {
-		DBusMessageIter iter;
 
-		if (g_dbus_proxy_get_property(proxy, "Address", &iter) == TRUE)
-			dbus_message_iter_get_basic(&iter, &arg);
-	}
-	rl_printf("Attempting to disconnect from %s\n", arg);
+	rl_printf("Attempting to disconnect from %s\n",
+					sonic_device_get_address(device));
 }
 
 void cmd_list_attributes(const char *arg)
 {
-	GDBusProxy *proxy;
+	struct sonic_device *device;
 
-	proxy = find_device(arg);
-	if (!proxy)
+	device = find_device(arg);
+	if (!device)
 		return;
 
-	gatt_list_attributes(g_dbus_proxy_get_path(proxy));
+	gatt_list_attributes(sonic_device_get_path(device));
 }
 
 void cmd_set_alias(const char *arg)
@@ -1121,17 +874,16 @@ void cmd_set_alias(const char *arg)
 
 	name = g_strdup(arg);
 
-	if (g_dbus_proxy_set_property_basic(default_dev, "Alias",
-					DBUS_TYPE_STRING, &name,
-					generic_callback, name, g_free) == TRUE)
+	if (sonic_device_set_alias(default_dev, arg, generic_callback, name))
 		return;
 
+	rl_printf("Failed to set %s\n", name);
 	g_free(name);
 }
 
 void cmd_select_attribute(const char *arg)
 {
-	GDBusProxy *proxy;
+	struct sonic_attr *attr;
 
 	if (!arg || !strlen(arg)) {
 		rl_printf("Missing attribute argument\n");
@@ -1143,14 +895,14 @@ void cmd_select_attribute(const char *arg)
 		return;
 	}
 
-	proxy = gatt_select_attribute(arg);
-	if (proxy)
-		set_default_attribute(proxy);
+	attr = gatt_select_attribute(arg);
+	if (attr)
+		set_default_attribute(attr);
 }
 
-struct GDBusProxy *find_attribute(const char *arg)
+struct sonic_attr *find_attribute(const char *arg)
 {
-	GDBusProxy *proxy;
+	struct sonic_attr *attr;
 
 	if (!arg || !strlen(arg)) {
 		if (default_attr)
@@ -1159,30 +911,54 @@ struct GDBusProxy *find_attribute(const char *arg)
 		return NULL;
 	}
 
-	proxy = gatt_select_attribute(arg);
-	if (!proxy) {
+	attr = gatt_select_attribute(arg);
+	if (!attr) {
 		rl_printf("Attribute %s not available\n", arg);
 		return NULL;
 	}
 
-	return proxy;
+	return attr;
 }
 
 void cmd_attribute_info(const char *arg)
 {
-	GDBusProxy *proxy;
-	DBusMessageIter iter;
-	const char *iface, *uuid, *text;
-
-	proxy = find_attribute(arg);
-	if (!proxy)
-		return;
-
-	if (g_dbus_proxy_get_property(proxy, "UUID", &iter) == FALSE)
-		return;
-
-	dbus_message_iter_get_basic(&iter, &uuid);
-
+	struct sonic_attr *attr;
+	struct sonic_value value;
+	const char *uuid, *text;
+
+	attr = find_attribute(arg);
+	if (!attr)
+		return;
+
+	uuid = sonic_attr_get_uuid(attr);
+	if (!uuid)
+		return;
+
+	text = uuidstr_to_str(uuid);
+
+	/* Only services carry Primary, only characteristics Service */
+	if (sonic_attr_get_property(attr, "Primary", &value)) {
+		sonic_value_clear(&value);
+		rl_printf("Service - %s\n", text ? text : uuid);
+		print_attr_property(attr, "UUID");
+		print_attr_property(attr, "Primary");
+		print_attr_property(attr, "Characteristics");
+		print_attr_property(attr, "Includes");
+	} else if (sonic_attr_get_property(attr, "Service", &value)) {
+		sonic_value_clear(&value);
+		rl_printf("Characteristic - %s\n", text ? text : uuid);
+		print_attr_property(attr, "UUID");
+		print_attr_property(attr, "Service");
+		print_attr_property(attr, "Value");
+		print_attr_property(attr, "Notifying");
+		print_attr_property(attr, "Flags");
+		print_attr_property(attr, "Descriptors");
+	} else {
+		rl_printf("Descriptor - %s\n", text ? text : uuid);
+		print_attr_property(attr, "UUID");
+		print_attr_property(attr, "Characteristic");
+		print_attr_property(attr, "Value");
+	}
 }
 
 void cmd_read(const char *arg)
@@ -1191,7 +967,7 @@ void cmd_read(const char *arg)
 		rl_printf("No attribute selected\n");
 		return;
 	}
-	gatt_read_attribute(default_attr, arg);
+	gatt_read_attribute(default_attr);
 }
 
 void cmd_write(const char *arg)
@@ -1211,7 +987,7 @@ void cmd_write(const char *arg)
 
 void cmd_notify(const char *arg)
 {
-	dbus_bool_t enable;
+	gboolean enable;
 
 	if (parse_argument_on_off(arg, &enable) == FALSE)
 		return;
@@ -1241,7 +1017,7 @@ void cmd_register_profile(const char *arg)
 		return;
 	}
 
-	gatt_register_profile(dbus_conn, default_ctrl->proxy, &w);
+	gatt_register_profile(sonic_get_default_adapter(sonic), &w);
 
 	wordfree(&w);
 }
@@ -1251,7 +1027,7 @@ void cmd_unregister_profile(const char *arg)
 	if (check_default_ctrl() == FALSE)
 		return;
 
-	gatt_unregister_profile(dbus_conn, default_ctrl->proxy);
+	gatt_unregister_profile(sonic_get_default_adapter(sonic));
 }
 
 void cmd_version(const char *arg)
@@ -1264,10 +1040,10 @@ void cmd_quit(const char *arg)
 	g_main_loop_quit(main_loop);
 }
 
-char *generic_generator(const char *text, int state,
-					GList *source, const char *property)
+char *ctrl_generator(const char *text, int state)
 {
-	static int index, len;
+	static int index = 0;
+	static int len = 0;
 	GList *list;
 
 	if (!state) {
@@ -1275,30 +1051,28 @@ char *generic_generator(const char *text, int state,
 		len = strlen(text);
 	}
 
-	for (list = g_list_nth(source, index); list;
+	for (list = g_list_nth(sonic_get_adapters(sonic), index); list;
 						list = g_list_next(list)) {
-		GDBusProxy *proxy = list->data;
-		DBusMessageIter iter;
+		struct sonic_adapter *adapter = list->data;
 		const char *str;
 
 		index++;
 
-		if (g_dbus_proxy_get_property(proxy, property, &iter) == FALSE)
+		str = sonic_adapter_get_address(adapter);
+		if (!str)
 			continue;
 
-		dbus_message_iter_get_basic(&iter, &str);
-
 		if (!strncmp(str, text, len))
 			return strdup(str);
-        }
+	}
 
 	return NULL;
 }
 
-char *ctrl_generator(const char *text, int state)
+char *dev_generator(const char *text, int state)
 {
-	static int index = 0;
-	static int len = 0;
+	struct sonic_adapter *adapter = sonic_get_default_adapter(sonic);
+	static int index, len;
 	GList *list;
 
 	if (!state) {
@@ -1306,20 +1080,20 @@ char *ctrl_generator(const char *text, int state)
 		len = strlen(text);
 	}
 
-	for (list = g_list_nth(ctrl_list, index); list;
-						list = g_list_next(list)) {
-		struct adapter *adapter = list->data;
-		DBusMessageIter iter;
+	if (!adapter)
+		return NULL;
+
+	for (list = g_list_nth(sonic_adapter_get_devices(adapter), index);
+					list; list = g_list_next(list)) {
+		struct sonic_device *device = list->data;
 		const char *str;
 
 		index++;
 
-		if (g_dbus_proxy_get_property(adapter->proxy,
-					"Address", &iter) == FALSE)
+		str = sonic_device_get_address(device);
+		if (!str)
 			continue;
 
-		dbus_message_iter_get_basic(&iter, &str);
-
 		if (!strncmp(str, text, len))
 			return strdup(str);
 	}
@@ -1327,12 +1101,6 @@ char *ctrl_generator(const char *text, int state)
 	return NULL;
 }
 
-char *dev_generator(const char *text, int state)
-{
-	return generic_generator(text, state,
-			default_ctrl ? default_ctrl->devices : NULL, "Address");
-}
-
 char *attribute_generator(const char *text, int state)
 {
 	return gatt_attribute_generator(text, state);
@@ -1357,4 +1125,3 @@ char *capability_generator(const char *text, int state)
 
 	return NULL;
 }
-
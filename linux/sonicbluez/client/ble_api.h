@@ -1,7 +1,9 @@
 #ifndef BLE_API_H
 #define BLE_API_H
 
-#include "gdbus/gdbus.h"
+#include <glib.h>
+
+#include "libsonic/sonic.h"
 
 /* String display constants */
 #define COLORED_NEW COLOR_GREEN "NEW" COLOR_OFF
@@ -14,42 +16,32 @@
 extern char *auto_register_agent;// = NULL;
 
 extern GMainLoop *main_loop;
-extern DBusConnection *dbus_conn;
-extern GDBusProxy *agent_manager;
+extern struct sonic_ctx *sonic;
+
+extern struct sonic_device *default_dev;
+extern struct sonic_attr *default_attr;
 
-struct adapter {
-    GDBusProxy *proxy;
-    GList *devices;
-};
+void print_adapter(struct sonic_adapter *adapter, const char *description);
+void set_default_device(struct sonic_device *device, const char *attribute);
+void set_default_attribute(struct sonic_attr *attr);
 
-extern struct adapter *default_ctrl;
-extern GDBusProxy *default_dev;
-extern GDBusProxy *default_attr;
-extern GList *ctrl_list;
+/* libsonic event handlers */
+void adapter_added(struct sonic_adapter *adapter, void *user_data);
+void adapter_removed(struct sonic_adapter *adapter, void *user_data);
+void device_added(struct sonic_device *device, void *user_data);
+void device_removed(struct sonic_device *device, void *user_data);
+void device_changed(struct sonic_device *device, const char *name,
+				const struct sonic_value *value, void *user_data);
+void attribute_removed(struct sonic_attr *attr, void *user_data);
+void agent_manager_added(struct sonic_ctx *ctx, void *user_data);
+void agent_manager_removed(struct sonic_ctx *ctx, void *user_data);
+void attribute_notify(struct sonic_device *device, struct sonic_attr *attr,
+				enum sonic_char chr, const uint8_t *value,
+				size_t len, void *user_data);
 
-void print_adapter(GDBusProxy *proxy, const char *description);
-//void print_device(GDBusProxy *proxy, const char *description);
-//void print_iter(const char *label, const char *name, DBusMessageIter *iter);
-//void print_property(GDBusProxy *proxy, const char *name);
-//void print_uuids(GDBusProxy *proxy);
-gboolean device_is_child(GDBusProxy *device, GDBusProxy *master);
-gboolean service_is_child(GDBusProxy *service);
-struct adapter *find_parent(GDBusProxy *device);
-void set_default_device(GDBusProxy *proxy, const char *attribute);
-void device_added(GDBusProxy *proxy);
-void adapter_added(GDBusProxy *proxy);
-void proxy_added(GDBusProxy *proxy, void *user_data);
-void set_default_attribute(GDBusProxy *proxy);
-void device_removed(GDBusProxy *proxy);
-void adapter_removed(GDBusProxy *proxy);
-void proxy_removed(GDBusProxy *proxy, void *user_data);
-void property_changed(GDBusProxy *proxy, const char *name,
-					DBusMessageIter *iter, void *user_data);
-struct adapter *find_ctrl_by_address(GList *source, const char *address);
-GDBusProxy *find_proxy_by_address(GList *source, const char *address);
 gboolean check_default_ctrl(void);
-gboolean parse_argument_on_off(const char *arg, dbus_bool_t *value);
-gboolean parse_argument_agent(const char *arg, dbus_bool_t *value,
+gboolean parse_argument_on_off(const char *arg, gboolean *value);
+gboolean parse_argument_agent(const char *arg, gboolean *value,
 							const char **capability);
 void cmd_list(const char *arg);
 void cmd_show(const char *arg);
@@ -57,32 +49,25 @@ void cmd_select(const char *arg);
 void cmd_devices(const char *arg);
 void cmd_paired_devices(const char *arg);
 gboolean is_paired(const char *arg);
-void generic_callback(const DBusError *error, void *user_data);
+void generic_callback(const char *error, void *user_data);
 void cmd_system_alias(const char *arg);
 void cmd_reset_alias(const char *arg);
 void cmd_power(const char *arg);
 void cmd_agent(const char *arg);
 void cmd_default_agent(const char *arg);
-void start_discovery_reply(DBusMessage *message, void *user_data);
 void cmd_scan(const char *arg);
-struct GDBusProxy *find_device(const char *arg);
+struct sonic_device *find_device(const char *arg);
 void cmd_info(const char *arg);
-void pair_reply(DBusMessage *message, void *user_data);
 void cmd_pair(const char *arg);
 void cmd_trust(const char *arg);
 void cmd_untrust(const char *arg);
-void remove_device_reply(DBusMessage *message, void *user_data);
-void remove_device_setup(DBusMessageIter *iter, void *user_data);
-void remove_device(GDBusProxy *proxy);
 void cmd_remove(const char *arg);
-void connect_reply(DBusMessage *message, void *user_data);
 void cmd_connect(const char *arg);
-void disconn_reply(DBusMessage *message, void *user_data);
 void cmd_disconn(const char *arg);
 void cmd_list_attributes(const char *arg);
 void cmd_set_alias(const char *arg);
 void cmd_select_attribute(const char *arg);
-struct GDBusProxy *find_attribute(const char *arg);
+struct sonic_attr *find_attribute(const char *arg);
 void cmd_attribute_info(const char *arg);
 void cmd_read(const char *arg);
 void cmd_write(const char *arg);
@@ -91,8 +76,6 @@ void cmd_register_profile(const char *arg);
 void cmd_unregister_profile(const char *arg);
 void cmd_version(const char *arg);
 void cmd_quit(const char *arg);
-char *generic_generator(const char *text, int state,
-					GList *source, const char *property);
 char *ctrl_generator(const char *text, int state);
 char *dev_generator(const char *text, int state);
 char *attribute_generator(const char *text, int state);
@@ -30,222 +30,56 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdbool.h>
-#include <sys/uio.h>
 #include <wordexp.h>
 
 #include <readline/readline.h>
 #include <readline/history.h>
 #include <glib.h>
 
-#include "gdbus/gdbus.h"
+#include "ble_api.h"
 #include "uuid.h"
 #include "display.h"
 #include "gatt.h"
 #include "util.h"
-
-#define PROFILE_PATH "/org/bluez/profile"
-#define PROFILE_INTERFACE "org.bluez.GattProfile1"
-
-/* String display constants */
-#define COLORED_NEW	COLOR_GREEN "NEW" COLOR_OFF
-#define COLORED_CHG	COLOR_YELLOW "CHG" COLOR_OFF
-#define COLORED_DEL	COLOR_RED "DEL" COLOR_OFF
-
-static GList *services;
-static GList *characteristics;
-static GList *descriptors;
-static GList *managers;
-
-void gatt_add_service(GDBusProxy *proxy)
-{
-	services = g_list_append(services, proxy);
-
-	//print_service(proxy, COLORED_NEW);
-}
-
-void gatt_remove_service(GDBusProxy *proxy)
-{
-	GList *l;
-
-	l = g_list_find(services, proxy);
-	if (!l)
-		return;
-
-	services = g_list_delete_link(services, l);
-
-	//print_service(proxy, COLORED_DEL);
-}
-
-static gboolean characteristic_is_child(GDBusProxy *characteristic)
-{
-	GList *l;
-	DBusMessageIter iter;
-	const char *service, *path;
-
-	if (!g_dbus_proxy_get_property(characteristic, "Service", &iter))
-		return FALSE;
-
-	dbus_message_iter_get_basic(&iter, &service);
-
-	for (l = services; l; l = g_list_next(l)) {
-		GDBusProxy *proxy = l->data;
-
-		path = g_dbus_proxy_get_path(proxy);
-
-		if (!strcmp(path, service))
-			return TRUE;
-	}
-
-	return FALSE;
-}
-
-void gatt_add_characteristic(GDBusProxy *proxy)
-{
-	if (!characteristic_is_child(proxy))
-		return;
-
-	characteristics = g_list_append(characteristics, proxy);
-
-	//print_characteristic(proxy, COLORED_NEW);
-}
-
-void gatt_remove_characteristic(GDBusProxy *proxy)
-{
-	GList *l;
-
-	l = g_list_find(characteristics, proxy);
-	if (!l)
-		return;
-
-	characteristics = g_list_delete_link(characteristics, l);
-
-	//print_characteristic(proxy, COLORED_DEL);
-}
-
-static gboolean descriptor_is_child(GDBusProxy *characteristic)
-{
-	GList *l;
-	DBusMessageIter iter;
-	const char *service, *path;
-
-	if (!g_dbus_proxy_get_property(characteristic, "Characteristic", &iter))
-		return FALSE;
-
-	dbus_message_iter_get_basic(&iter, &service);
-
-	for (l = characteristics; l; l = g_list_next(l)) {
-		GDBusProxy *proxy = l->data;
-
-		path = g_dbus_proxy_get_path(proxy);
-
-		if (!strcmp(path, service))
-			return TRUE;
-	}
-
-	return FALSE;
-}
-
-GList * gatt_get_charpaths()
-{
-	return characteristics;
-/*
-	GList *l;
-	//DBusMessageIter iter;
-	//const char *service, *path;
-	const char *path;
-
-	for (l = characteristics; l; l = g_list_next(l)) {
-		GDBusProxy *proxy = l->data;
-		path = g_dbus_proxy_get_path(proxy);
-		rl_printf("+%s\n",path);
-	}
-*/
-}
-
-void gatt_add_descriptor(GDBusProxy *proxy)
-{
-	if (!descriptor_is_child(proxy))
-		return;
-
-	descriptors = g_list_append(descriptors, proxy);
-
-	//print_descriptor(proxy, COLORED_NEW);
-}
-
-void gatt_remove_descriptor(GDBusProxy *proxy)
-{
-	GList *l;
-
-	l = g_list_find(descriptors, proxy);
-	if (!l)
-		return;
-
-	descriptors = g_list_delete_link(descriptors, l);
-
-	//print_descriptor(proxy, COLORED_DEL);
-}
+#include "output.h"
 
 static void list_attributes(const char *path, GList *source)
 {
 	GList *l;
 
 	for (l = source; l; l = g_list_next(l)) {
-		GDBusProxy *proxy = l->data;
-		const char *proxy_path;
+		struct sonic_attr *attr = l->data;
+		const char *attr_path;
 
-		proxy_path = g_dbus_proxy_get_path(proxy);
+		attr_path = sonic_attr_get_path(attr);
 
-		if (!g_str_has_prefix(proxy_path, path))
+		if (!g_str_has_prefix(attr_path, path))
 			continue;
 
-		//rl_printf("xxxxxx\n");
-		if (source == services) {
-			print_service(proxy, NULL);
-			list_attributes(proxy_path, characteristics);
-		} else if (source == characteristics) {
-			print_characteristic(proxy, NULL);
-			list_attributes(proxy_path, descriptors);
-		} else if (source == descriptors) {}
-			print_descriptor(proxy, NULL);
-
+		if (source == sonic_get_services(sonic)) {
+			print_service(attr, NULL);
+			list_attributes(attr_path,
+					sonic_get_characteristics(sonic));
+		} else if (source == sonic_get_characteristics(sonic)) {
+			print_characteristic(attr, NULL);
+			list_attributes(attr_path,
+					sonic_get_descriptors(sonic));
+		} else
+			print_descriptor(attr, NULL);
 	}
 }
 
 void gatt_list_attributes(const char *path)
 {
-	list_attributes(path, services);
+	list_attributes(path, sonic_get_services(sonic));
 }
 
-static GDBusProxy *select_proxy(const char *path, GList *source)
+struct sonic_attr *gatt_select_attribute(const char *path)
 {
-	GList *l;
-
-	for (l = source; l; l = g_list_next(l)) {
-		GDBusProxy *proxy = l->data;
-
-		if (strcmp(path, g_dbus_proxy_get_path(proxy)) == 0)
-			return proxy;
-	}
-
-	return NULL;
-}
-
-GDBusProxy *gatt_select_attribute(const char *path)
-{
-	GDBusProxy *proxy;
-
-	proxy = select_proxy(path, services);
-	if (proxy)
-		return proxy;
-
-	proxy = select_proxy(path, characteristics);
-	if (proxy)
-		return proxy;
-
-	return select_proxy(path, descriptors);
+	return sonic_find_attribute(sonic, path);
 }
 
-static char *attribute_generator(const char *text, int state, GList *source)
+static char *path_generator(const char *text, int state, GList *source)
 {
 	static int index, len;
 	GList *list;
@@ -257,12 +91,12 @@ static char *attribute_generator(const char *text, int state, GList *source)
 
 	for (list = g_list_nth(source, index); list;
 						list = g_list_next(list)) {
-		GDBusProxy *proxy = list->data;
+		struct sonic_attr *attr = list->data;
 		const char *path;
 
 		index++;
 
-		path = g_dbus_proxy_get_path(proxy);
+		path = sonic_attr_get_path(attr);
 
 		if (!strncmp(path, text, len))
 			return strdup(path);
@@ -283,133 +117,58 @@ char *gatt_attribute_generator(const char *text, int state)
 			list = NULL;
 		}
 
-		list1 = g_list_copy(characteristics);
-		list1 = g_list_concat(list1, g_list_copy(descriptors));
+		list1 = g_list_copy(sonic_get_characteristics(sonic));
+		list1 = g_list_concat(list1,
+				g_list_copy(sonic_get_descriptors(sonic)));
 
-		list = g_list_copy(services);
+		list = g_list_copy(sonic_get_services(sonic));
 		list = g_list_concat(list, list1);
 	}
 
-	return attribute_generator(text, state, list);
+	return path_generator(text, state, list);
 }
 
-static void read_reply(DBusMessage *message, void *user_preamble)
+static void read_reply(const char *error, const uint8_t *value, size_t len,
+							void *user_data)
 {
-	DBusError error;
-	DBusMessageIter iter, array;
-	uint8_t *value;
-	int len;
+	output_result("read", error);
 
-	dbus_error_init(&error);
-
-	if (dbus_set_error_from_message(&error, message) == TRUE) {
-		rl_printf("Failed to read: %s\n", error.name);
-		dbus_error_free(&error);
-		return;
-	}
-
-	dbus_message_iter_init(message, &iter);
-
-	if (dbus_message_iter_get_arg_type(&iter) != DBUS_TYPE_ARRAY) {
-		rl_printf("Invalid response to read\n");
-		return;
-	}
-
-	dbus_message_iter_recurse(&iter, &array);
-	dbus_message_iter_get_fixed_array(&array, &value, &len);
-
-	if (len < 0) {
-		rl_printf("Unable to parse value\n");
-		return;
-	}
-
-	if(user_preamble != NULL)
-		rl_printf("%s%s\n",(char*)user_preamble,(char*)value);
-	else
-		rl_hexdump(value, len);
-}
-
-static void read_setup(DBusMessageIter *iter, void *user_data)
-{
-	DBusMessageIter dict;
-
-	dbus_message_iter_open_container(iter, DBUS_TYPE_ARRAY,
-					DBUS_DICT_ENTRY_BEGIN_CHAR_AS_STRING
-					DBUS_TYPE_STRING_AS_STRING
-					DBUS_TYPE_VARIANT_AS_STRING
-					DBUS_DICT_ENTRY_END_CHAR_AS_STRING,
-					&dict);
-	/* TODO: Add offset support */
-	dbus_message_iter_close_container(iter, &dict);
-}
-
-static void read_attribute(GDBusProxy *proxy, const char * arg)
-{
-	if (g_dbus_proxy_method_call(proxy, "ReadValue", read_setup, read_reply,
-							(void *)arg, NULL) == FALSE) {
-		rl_printf("Failed to read\n");
+	if (error) {
+		rl_printf("Failed to read: %s\n", error);
 		return;
 	}
 
-	rl_printf("Attempting to read %s\n", g_dbus_proxy_get_path(proxy));
+	rl_hexdump(value, len);
 }
 
-void gatt_read_attribute(GDBusProxy *proxy, const char * arg)
+void gatt_read_attribute(struct sonic_attr *attr)
 {
-	const char *iface;
-
-	iface = g_dbus_proxy_get_interface(proxy);
-	if (!strcmp(iface, "org.bluez.GattCharacteristic1") ||
-				!strcmp(iface, "org.bluez.GattDescriptor1")) {
-		read_attribute(proxy, arg);
+	if (!sonic_attr_read(sonic, attr, read_reply, NULL)) {
+		rl_printf("Unable to read attribute %s\n",
+						sonic_attr_get_path(attr));
 		return;
 	}
 
-	rl_printf("Unable to read attribute %s\n",
-						g_dbus_proxy_get_path(proxy));
+	rl_printf("Attempting to read %s\n", sonic_attr_get_path(attr));
 }
 
-static void write_reply(DBusMessage *message, void *user_data)
+static void write_reply(const char *error, void *user_data)
 {
-	DBusError error;
-
-	dbus_error_init(&error);
+	output_result("write", error);
 
-	if (dbus_set_error_from_message(&error, message) == TRUE) {
-		rl_printf("Failed to write: %s\n", error.name);
-		dbus_error_free(&error);
-		return;
-	}
+	if (error)
+		rl_printf("Failed to write: %s\n", error);
 }
 
-static void write_setup(DBusMessageIter *iter, void *user_data)
+void gatt_write_attribute(struct sonic_attr *attr, const char *arg)
 {
-	struct iovec *iov = user_data;
-	DBusMessageIter array, dict;
-
-	dbus_message_iter_open_container(iter, DBUS_TYPE_ARRAY, "y", &array);
-	dbus_message_iter_append_fixed_array(&array, DBUS_TYPE_BYTE,
-						&iov->iov_base, iov->iov_len);
-	dbus_message_iter_close_container(iter, &array);
-
-	dbus_message_iter_open_container(iter, DBUS_TYPE_ARRAY,
-					DBUS_DICT_ENTRY_BEGIN_CHAR_AS_STRING
-					DBUS_TYPE_STRING_AS_STRING
-					DBUS_TYPE_VARIANT_AS_STRING
-					DBUS_DICT_ENTRY_END_CHAR_AS_STRING,
-					&dict);
-	/* TODO: Add offset support */
-	dbus_message_iter_close_container(iter, &dict);
-}
-
-static void write_attribute(GDBusProxy *proxy, char *arg)
-{
-	struct iovec iov;
 	uint8_t value[512];
-	char *entry;
+	char *entry, *str, *tmp;
 	unsigned int i;
 
-	for (i = 0; (entry = strsep(&arg, " \t")) != NULL; i++) {
+	str = tmp = g_strdup(arg);
+
+	for (i = 0; (entry = strsep(&tmp, " \t")) != NULL; i++) {
 		long int val;
 		char *endptr = NULL;
 
@@ -418,231 +177,89 @@ static void write_attribute(GDBusProxy *proxy, char *arg)
 
 		if (i >= G_N_ELEMENTS(value)) {
 			rl_printf("Too much data\n");
+			g_free(str);
 			return;
 		}
 
 		val = strtol(entry, &endptr, 0);
 		if (!endptr || *endptr != '\0' || val > UINT8_MAX) {
 			rl_printf("Invalid value at index %d\n", i);
+			g_free(str);
 			return;
 		}
 
 		value[i] = val;
 	}
 
-	iov.iov_base = value;
-	iov.iov_len = i;
-
-	if (g_dbus_proxy_method_call(proxy, "WriteValue", write_setup,
-					write_reply, &iov, NULL) == FALSE) {
-		rl_printf("Failed to write\n");
-		return;
-	}
-
-	rl_printf("Attempting to write %s\n", g_dbus_proxy_get_path(proxy));
-}
-
-void gatt_write_attribute(GDBusProxy *proxy, const char *arg)
-{
-	const char *iface;
+	g_free(str);
 
-	iface = g_dbus_proxy_get_interface(proxy);
-	if (!strcmp(iface, "org.bluez.GattCharacteristic1") ||
-				!strcmp(iface, "org.bluez.GattDescriptor1")) {
-		write_attribute(proxy, (char *) arg);
+	if (!sonic_attr_write(sonic, attr, value, i, write_reply, NULL)) {
+		rl_printf("Unable to write attribute %s\n",
+						sonic_attr_get_path(attr));
 		return;
 	}
 
-	rl_printf("Unable to write attribute %s\n",
-						g_dbus_proxy_get_path(proxy));
+	rl_printf("Attempting to write %s\n", sonic_attr_get_path(attr));
 }
 
-static void notify_reply(DBusMessage *message, void *user_data)
+static void notify_reply(const char *error, void *user_data)
 {
 	bool enable = GPOINTER_TO_UINT(user_data);
-	DBusError error;
 
-	dbus_error_init(&error);
+	output_result(enable ? "notify on" : "notify off", error);
 
-	if (dbus_set_error_from_message(&error, message) == TRUE) {
+	if (error) {
 		rl_printf("Failed to %s notify: %s\n",
-				enable ? "start" : "stop", error.name);
-		dbus_error_free(&error);
+				enable ? "start" : "stop", error);
 		return;
 	}
 
 	rl_printf("Notify %s\n", enable == TRUE ? "started" : "stopped");
 }
 
-static void notify_attribute(GDBusProxy *proxy, bool enable)
+void gatt_notify_attribute(struct sonic_attr *attr, bool enable)
 {
-	const char *method;
-
-	if (enable == TRUE)
-		method = "StartNotify";
-	else
-		method = "StopNotify";
-
-	if (g_dbus_proxy_method_call(proxy, method, NULL, notify_reply,
-				GUINT_TO_POINTER(enable), NULL) == FALSE) {
-		rl_printf("Failed to %s notify\n", enable ? "start" : "stop");
-		return;
-	}
-}
-
-void gatt_notify_attribute(GDBusProxy *proxy, bool enable)
-{
-	const char *iface;
-
-	iface = g_dbus_proxy_get_interface(proxy);
-	if (!strcmp(iface, "org.bluez.GattCharacteristic1")) {
-		notify_attribute(proxy, enable);
+	if (sonic_attr_notify(sonic, attr, enable, notify_reply,
+						GUINT_TO_POINTER(enable)))
 		return;
-	}
 
 	rl_printf("Unable to notify attribute %s\n",
-						g_dbus_proxy_get_path(proxy));
+						sonic_attr_get_path(attr));
 }
 
-static void register_profile_setup(DBusMessageIter *iter, void *user_data)
+static void register_profile_reply(const char *error, void *user_data)
 {
-	wordexp_t *w = user_data;
-	DBusMessageIter uuids, opt;
-	const char *path = PROFILE_PATH;
-	size_t i;
-
-	dbus_message_iter_append_basic(iter, DBUS_TYPE_OBJECT_PATH, &path);
-
-	dbus_message_iter_open_container(iter, DBUS_TYPE_ARRAY, "s", &uuids);
-	for (i = 0; i < w->we_wordc; i++)
-		dbus_message_iter_append_basic(&uuids, DBUS_TYPE_STRING,
-							&w->we_wordv[i]);
-	dbus_message_iter_close_container(iter, &uuids);
-
-	dbus_message_iter_open_container(iter, DBUS_TYPE_ARRAY,
-					DBUS_DICT_ENTRY_BEGIN_CHAR_AS_STRING
-					DBUS_TYPE_STRING_AS_STRING
-					DBUS_TYPE_VARIANT_AS_STRING
-					DBUS_DICT_ENTRY_END_CHAR_AS_STRING,
-					&opt);
-	dbus_message_iter_close_container(iter, &opt);
+	output_result("register-profile", error);
 
-}
-
-static void register_profile_reply(DBusMessage *message, void *user_data)
-{
-	DBusError error;
-
-	dbus_error_init(&error);
-
-	if (dbus_set_error_from_message(&error, message) == TRUE) {
-		rl_printf("Failed to register profile: %s\n", error.name);
-		dbus_error_free(&error);
+	if (error) {
+		rl_printf("Failed to register profile: %s\n", error);
 		return;
 	}
 
 	rl_printf("Profile registered\n");
 }
 
-void gatt_add_manager(GDBusProxy *proxy)
+void gatt_register_profile(struct sonic_adapter *adapter, wordexp_t *w)
 {
-	managers = g_list_append(managers, proxy);
-}
-
-void gatt_remove_manager(GDBusProxy *proxy)
-{
-	managers = g_list_remove(managers, proxy);
-}
-
-static int match_proxy(const void *a, const void *b)
-{
-	GDBusProxy *proxy1 = (void *) a;
-	GDBusProxy *proxy2 = (void *) b;
-
-	return strcmp(g_dbus_proxy_get_path(proxy1),
-						g_dbus_proxy_get_path(proxy2));
-}
-
-static DBusMessage *release_profile(DBusConnection *conn,
-					DBusMessage *msg, void *user_data)
-{
-	g_dbus_unregister_interface(conn, PROFILE_PATH, PROFILE_INTERFACE);
-
-	return dbus_message_new_method_return(msg);
-}
-
-static const GDBusMethodTable methods[] = {
-	{ GDBUS_METHOD("Release", NULL, NULL, release_profile) },
-	{ }
-};
-
-void gatt_register_profile(DBusConnection *conn, GDBusProxy *proxy,
-								wordexp_t *w)
-{
-	GList *l;
-
-	l = g_list_find_custom(managers, proxy, match_proxy);
-	if (!l) {
-		rl_printf("Unable to find GattManager proxy\n");
-		return;
-	}
-
-	if (g_dbus_register_interface(conn, PROFILE_PATH,
-					PROFILE_INTERFACE, methods,
-					NULL, NULL, NULL, NULL) == FALSE) {
-		rl_printf("Failed to register profile object\n");
-		return;
-	}
-
-	if (g_dbus_proxy_method_call(l->data, "RegisterProfile",
-						register_profile_setup,
-						register_profile_reply, w,
-						NULL) == FALSE) {
+	if (!sonic_register_profile(adapter, w->we_wordv, w->we_wordc,
+						register_profile_reply, NULL))
 		rl_printf("Failed register profile\n");
-		return;
-	}
 }
 
-static void unregister_profile_reply(DBusMessage *message, void *user_data)
+static void unregister_profile_reply(const char *error, void *user_data)
 {
-	DBusConnection *conn = user_data;
-	DBusError error;
-
-	dbus_error_init(&error);
+	output_result("unregister-profile", error);
 
-	if (dbus_set_error_from_message(&error, message) == TRUE) {
-		rl_printf("Failed to unregister profile: %s\n", error.name);
-		dbus_error_free(&error);
+	if (error) {
+		rl_printf("Failed to unregister profile: %s\n", error);
 		return;
 	}
 
 	rl_printf("Profile unregistered\n");
-
-	g_dbus_unregister_interface(conn, PROFILE_PATH, PROFILE_INTERFACE);
 }
 
-static void unregister_profile_setup(DBusMessageIter *iter, void *user_data)
+void gatt_unregister_profile(struct sonic_adapter *adapter)
 {
-	const char *path = PROFILE_PATH;
-
-	dbus_message_iter_append_basic(iter, DBUS_TYPE_OBJECT_PATH, &path);
-}
-
-void gatt_unregister_profile(DBusConnection *conn, GDBusProxy *proxy)
-{
-	GList *l;
-
-	l = g_list_find_custom(managers, proxy, match_proxy);
-	if (!l) {
-		rl_printf("Unable to find GattManager proxy\n");
-		return;
-	}
-
-	if (g_dbus_proxy_method_call(l->data, "UnregisterProfile",
-						unregister_profile_setup,
-						unregister_profile_reply, conn,
-						NULL) == FALSE) {
+	if (!sonic_unregister_profile(adapter, unregister_profile_reply, NULL))
 		rl_printf("Failed unregister profile\n");
-		return;
-	}
 }
@@ -21,28 +21,13 @@
  *
  */
 
-void gatt_add_service(GDBusProxy *proxy);
-void gatt_remove_service(GDBusProxy *proxy);
-
-void gatt_add_characteristic(GDBusProxy *proxy);
-void gatt_remove_characteristic(GDBusProxy *proxy);
-
-void gatt_add_descriptor(GDBusProxy *proxy);
-void gatt_remove_descriptor(GDBusProxy *proxy);
-
 void gatt_list_attributes(const char *device);
-GDBusProxy *gatt_select_attribute(const char *path);
+struct sonic_attr *gatt_select_attribute(const char *path);
 char *gatt_attribute_generator(const char *text, int state);
-GList *gatt_get_charpaths();
-
-void gatt_read_attribute(GDBusProxy *proxy, const char * arg);
-void gatt_read_attribute_sync(GDBusProxy *proxy, const char * arg);
-void gatt_write_attribute(GDBusProxy *proxy, const char *arg);
-void gatt_notify_attribute(GDBusProxy *proxy, bool enable);
 
-void gatt_add_manager(GDBusProxy *proxy);
-void gatt_remove_manager(GDBusProxy *proxy);
+void gatt_read_attribute(struct sonic_attr *attr);
+void gatt_write_attribute(struct sonic_attr *attr, const char *arg);
+void gatt_notify_attribute(struct sonic_attr *attr, bool enable);
 
-void gatt_register_profile(DBusConnection *conn, GDBusProxy *proxy,
-								wordexp_t *w);
-void gatt_unregister_profile(DBusConnection *conn, GDBusProxy *proxy);
+void gatt_register_profile(struct sonic_adapter *adapter, wordexp_t *w);
+void gatt_unregister_profile(struct sonic_adapter *adapter);
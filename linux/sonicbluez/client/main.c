@@ -18,33 +18,24 @@
 
 #include "ble_api.h"
 #include "app_api.h"
-#include "gdbus/gdbus.h"
 #include "agent.h"
 #include "display.h"
+#include "output.h"
 
 char *auto_register_agent = NULL;
 
 GMainLoop *main_loop;
-DBusConnection *dbus_conn;
-GDBusProxy *agent_manager;
+struct sonic_ctx *sonic;
 
-struct adapter *default_ctrl;
-GDBusProxy *default_dev;
-GDBusProxy *default_attr;
-GList *ctrl_list;
+struct sonic_device *default_dev;
+struct sonic_attr *default_attr;
 
 static guint input = 0;
 
-static void proxy_leak(gpointer data)
+static void signal_watch(struct sonic_ctx *ctx, const char *interface,
+					const char *member, void *user_data)
 {
-	printf("Leaking proxy %p\n", data);
-}
-
-static void message_handler(DBusConnection *connection,
-					DBusMessage *message, void *user_data)
-{
-	rl_printf("[SIGNAL] %s.%s\n", dbus_message_get_interface(message),
-					dbus_message_get_member(message));
+	rl_printf("[SIGNAL] %s.%s\n", interface, member);
 }
 
 static gboolean input_handler(GIOChannel *channel, GIOCondition condition,
@@ -79,7 +70,7 @@ static guint setup_standard_input(void)
 	return source;
 }
 
-static void connect_handler(DBusConnection *connection, void *user_data)
+static void connect_handler(struct sonic_ctx *ctx, void *user_data)
 {
 	rl_set_prompt(PROMPT_ON);
 	printf("\r");
@@ -87,7 +78,7 @@ static void connect_handler(DBusConnection *connection, void *user_data)
 	rl_redisplay();
 }
 
-static void disconnect_handler(DBusConnection *connection, void *user_data)
+static void disconnect_handler(struct sonic_ctx *ctx, void *user_data)
 {
 	if (input > 0) {
 		g_source_remove(input);
@@ -99,10 +90,8 @@ static void disconnect_handler(DBusConnection *connection, void *user_data)
 	rl_on_new_line();
 	rl_redisplay();
 
-	g_list_free_full(ctrl_list, proxy_leak);
-	ctrl_list = NULL;
-
-	default_ctrl = NULL;
+	default_dev = NULL;
+	default_attr = NULL;
 }
 
 static char *cmd_generator(const char *text, int state)
@@ -129,7 +118,7 @@ static char **cmd_completion(const char *text, int start, int end)
 {
 	char **matches = NULL;
 
-	if (agent_completion() == TRUE) {
+	if (agent_completion(sonic) == TRUE) {
 		rl_attempted_completion_over = 1;
 		return NULL;
 	}
@@ -162,6 +151,7 @@ static char **cmd_completion(const char *text, int start, int end)
 
 static void rl_handler(char *input)
 {
+	enum sonic_prio prio;
 	char *cmd, *arg;
 	int i;
 
@@ -176,7 +166,7 @@ static void rl_handler(char *input)
 	if (!strlen(input))
 		goto done;
 
-	if (agent_input(dbus_conn, input) == TRUE)
+	if (agent_input(sonic, input) == TRUE)
 		goto done;
 
 	add_history(input);
@@ -196,7 +186,10 @@ static void rl_handler(char *input)
 			continue;
 
 		if (cmd_table[i].func) {
+			//whatever the operator asks for goes ahead of bulk work
+			prio = sonic_set_priority(sonic, SONIC_PRIO_INTERACTIVE);
 			cmd_table[i].func(arg);
+			sonic_set_priority(sonic, prio);
 			goto done;
 		}
 	}
@@ -307,6 +300,7 @@ static guint setup_signalfd(void)
 }
 
 static gboolean option_version = FALSE;
+static enum output_mode option_output = OUTPUT_TEXT;
 
 static gboolean parse_agent(const char *key, const char *value,
 					gpointer user_data, GError **error)
@@ -319,26 +313,71 @@ static gboolean parse_agent(const char *key, const char *value,
 	return TRUE;
 }
 
+static gboolean parse_output(const char *key, const char *value,
+					gpointer user_data, GError **error)
+{
+	if (output_parse_mode(value, &option_output))
+		return TRUE;
+
+	g_set_error(error, G_OPTION_ERROR, G_OPTION_ERROR_BAD_VALUE,
+					"Invalid output format %s", value);
+	return FALSE;
+}
+
 static GOptionEntry options[] = {
 	{ "version", 'v', 0, G_OPTION_ARG_NONE, &option_version,
 				"Show version information and exit" },
 	{ "agent", 'a', G_OPTION_FLAG_OPTIONAL_ARG,
 				G_OPTION_ARG_CALLBACK, parse_agent,
 				"Register agent handler", "CAPABILITY" },
+	{ "output", 'o', 0, G_OPTION_ARG_CALLBACK, parse_output,
+				"Record format on stdout (text, json, binary)",
+				"FORMAT" },
 	{ NULL },
 };
 
-static void client_ready(GDBusClient *client, void *user_data)
+static void client_ready(struct sonic_ctx *ctx, void *user_data)
 {
 	if (!input)
 		input = setup_standard_input();
 }
 
+static void open_inventory(void)
+{
+	char *dir, *path;
+
+	dir = g_build_filename(g_get_user_cache_dir(), "sonic", NULL);
+	path = g_build_filename(dir, "inventory", NULL);
+
+	if (g_mkdir_with_parents(dir, 0700) < 0 ||
+				!sonic_inventory_open(sonic, path))
+		fprintf(stderr, "Failed to open inventory %s\n", path);
+
+	g_free(path);
+	g_free(dir);
+}
+
+static const struct sonic_callbacks callbacks = {
+	.ready			= client_ready,
+	.service_connected	= connect_handler,
+	.service_disconnected	= disconnect_handler,
+	.adapter_added		= adapter_added,
+	.adapter_removed	= adapter_removed,
+	.device_added		= device_added,
+	.device_removed		= device_removed,
+	.device_changed		= device_changed,
+	.attribute_removed	= attribute_removed,
+	.agent_manager_added	= agent_manager_added,
+	.agent_manager_removed	= agent_manager_removed,
+	.agent_request		= agent_request,
+	.signal			= signal_watch,
+	.notify			= attribute_notify,
+};
+
 int main(int argc, char *argv[])
 {
 	GOptionContext *context;
 	GError *error = NULL;
-	GDBusClient *client;
 	guint signal;
 
 	auto_register_agent = NULL;
@@ -361,8 +400,12 @@ int main(int argc, char *argv[])
 		exit(0);
 	}
 
+	if (output_init(option_output) == false) {
+		perror("Failed to set up output");
+		exit(1);
+	}
+
 	main_loop = g_main_loop_new(NULL, FALSE);
-	dbus_conn = g_dbus_setup_bus(DBUS_BUS_SYSTEM, NULL, NULL);
 
 	setlinebuf(stdout);
 	rl_attempted_completion_function = cmd_completion;
@@ -374,21 +417,18 @@ int main(int argc, char *argv[])
 	rl_redisplay();
 
 	signal = setup_signalfd();
-	client = g_dbus_client_new(dbus_conn, "org.bluez", "/org/bluez");
-
-	g_dbus_client_set_connect_watch(client, connect_handler, NULL);
-	g_dbus_client_set_disconnect_watch(client, disconnect_handler, NULL);
-	g_dbus_client_set_signal_watch(client, message_handler, NULL);
-
-	g_dbus_client_set_proxy_handlers(client, proxy_added, proxy_removed,
-							property_changed, NULL);
+	sonic = sonic_ctx_new(&callbacks, NULL);
+	if (!sonic) {
+		fprintf(stderr, "Failed to create bluez client\n");
+		exit(1);
+	}
 
-	g_dbus_client_set_ready_watch(client, client_ready, NULL);
+	open_inventory();
 
 	init_client();
 	g_main_loop_run(main_loop);
 
-	g_dbus_client_unref(client);
+	sonic_ctx_free(sonic);
 	g_source_remove(signal);
 	if (input > 0)
 		g_source_remove(input);
@@ -396,12 +436,11 @@ int main(int argc, char *argv[])
 	rl_message("");
 	rl_callback_handler_remove();
 
-	dbus_connection_unref(dbus_conn);
 	g_main_loop_unref(main_loop);
 
-	g_list_free_full(ctrl_list, proxy_leak);
-
 	g_free(auto_register_agent);
 
+	output_cleanup();
+
 	return 0;
 }
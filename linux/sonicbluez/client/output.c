@@ -0,0 +1,448 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <inttypes.h>
+
+#include "output.h"
+
+#define RECORD_MAX 4096
+
+struct record {
+	uint8_t data[RECORD_MAX];
+	size_t len;
+	bool overflow;
+};
+
+static enum output_mode mode = OUTPUT_TEXT;
+static int out_fd = -1;
+
+static const char * const type_names[] = {
+	[OUTPUT_TYPE_ADAPTER]	= "adapter",
+	[OUTPUT_TYPE_DEVICE]	= "device",
+	[OUTPUT_TYPE_PROPERTY]	= "property",
+	[OUTPUT_TYPE_RESULT]	= "result",
+	[OUTPUT_TYPE_SAMPLE]	= "sample",
+};
+
+static const char * const event_names[] = {
+	[OUTPUT_NONE]	= NULL,
+	[OUTPUT_NEW]	= "new",
+	[OUTPUT_DEL]	= "del",
+	[OUTPUT_CHG]	= "chg",
+};
+
+static const char * const char_names[SONIC_CHAR_MAX + 1] = {
+	[SONIC_CHAR_BUZZ]	= "buzz",
+	[SONIC_CHAR_MODE]	= "mode",
+	[SONIC_CHAR_FIXEDINT]	= "fixedint",
+	[SONIC_CHAR_RANDINT]	= "randint",
+	[SONIC_CHAR_RSSI]	= "rssi",
+	[SONIC_CHAR_RSSIMIN]	= "rssimin",
+	[SONIC_CHAR_PASS]	= "pass",
+	[SONIC_CHAR_SOLAR]	= "solar",
+	[SONIC_CHAR_SOLARMIN]	= "solarmin",
+	[SONIC_CHAR_OTA]	= "ota",
+	[SONIC_CHAR_PROGRESS]	= "progress",
+	[SONIC_CHAR_STACONF]	= "staconf",
+	[SONIC_CHAR_APINFO]	= "apinfo",
+	[SONIC_CHAR_STREAM]	= "stream",
+	[SONIC_CHAR_REPORT]	= "report",
+	[SONIC_CHAR_INVALID]	= "unknown",
+};
+
+bool output_parse_mode(const char *arg, enum output_mode *out)
+{
+	if (!arg || !strcmp(arg, "text"))
+		*out = OUTPUT_TEXT;
+	else if (!strcmp(arg, "json"))
+		*out = OUTPUT_JSON;
+	else if (!strcmp(arg, "binary"))
+		*out = OUTPUT_BINARY;
+	else
+		return false;
+
+	return true;
+}
+
+bool output_init(enum output_mode new_mode)
+{
+	mode = new_mode;
+
+	if (mode == OUTPUT_TEXT)
+		return true;
+
+	/* Keep stdout for records, everything else goes to stderr */
+	fflush(stdout);
+
+	out_fd = dup(STDOUT_FILENO);
+	if (out_fd < 0)
+		goto fail;
+
+	if (dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+		close(out_fd);
+		out_fd = -1;
+		goto fail;
+	}
+
+	return true;
+
+fail:
+	mode = OUTPUT_TEXT;
+	return false;
+}
+
+void output_cleanup(void)
+{
+	if (out_fd >= 0)
+		close(out_fd);
+
+	out_fd = -1;
+	mode = OUTPUT_TEXT;
+}
+
+bool output_enabled(void)
+{
+	return mode != OUTPUT_TEXT;
+}
+
+static uint64_t now_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void put(struct record *r, const void *data, size_t len)
+{
+	if (r->overflow || len > sizeof(r->data) - r->len) {
+		r->overflow = true;
+		return;
+	}
+
+	memcpy(r->data + r->len, data, len);
+	r->len += len;
+}
+
+static void put_u8(struct record *r, uint8_t val)
+{
+	put(r, &val, 1);
+}
+
+static void put_le16(struct record *r, uint16_t val)
+{
+	uint8_t buf[2] = { val, val >> 8 };
+
+	put(r, buf, sizeof(buf));
+}
+
+static void put_le32(struct record *r, uint32_t val)
+{
+	uint8_t buf[4] = { val, val >> 8, val >> 16, val >> 24 };
+
+	put(r, buf, sizeof(buf));
+}
+
+static void put_le64(struct record *r, uint64_t val)
+{
+	put_le32(r, val);
+	put_le32(r, val >> 32);
+}
+
+static void put_bytes8(struct record *r, const void *data, size_t len)
+{
+	if (len > UINT8_MAX)
+		len = UINT8_MAX;
+
+	put_u8(r, len);
+	put(r, data, len);
+}
+
+static void put_bytes16(struct record *r, const void *data, size_t len)
+{
+	if (len > UINT16_MAX)
+		len = UINT16_MAX;
+
+	put_le16(r, len);
+	put(r, data, len);
+}
+
+static void put_str8(struct record *r, const char *str)
+{
+	put_bytes8(r, str ? str : "", str ? strlen(str) : 0);
+}
+
+static void put_addr(struct record *r, const char *address)
+{
+	uint8_t addr[6] = { 0 };
+	unsigned int i;
+
+	for (i = 0; address && i < sizeof(addr); i++) {
+		char *end;
+
+		addr[i] = strtoul(address, &end, 16);
+		if (*end != ':')
+			break;
+		address = end + 1;
+	}
+
+	put(r, addr, sizeof(addr));
+}
+
+static void put_fmt(struct record *r, const char *fmt, ...)
+{
+	size_t avail = sizeof(r->data) - r->len;
+	va_list args;
+	int len;
+
+	if (r->overflow)
+		return;
+
+	va_start(args, fmt);
+	len = vsnprintf((char *) r->data + r->len, avail, fmt, args);
+	va_end(args);
+
+	if (len < 0 || (size_t) len >= avail) {
+		r->overflow = true;
+		return;
+	}
+
+	r->len += len;
+}
+
+static void put_json_str(struct record *r, const char *str)
+{
+	static const char hexdigits[] = "0123456789abcdef";
+
+	put_u8(r, '"');
+
+	for (; str && *str; str++) {
+		unsigned char c = *str;
+
+		if (c == '"' || c == '\\') {
+			put_u8(r, '\\');
+			put_u8(r, c);
+		} else if (c < 0x20) {
+			char esc[6] = { '\\', 'u', '0', '0',
+					hexdigits[c >> 4], hexdigits[c & 0xf] };
+
+			put(r, esc, sizeof(esc));
+		} else
+			put_u8(r, c);
+	}
+
+	put_u8(r, '"');
+}
+
+static void put_json_key(struct record *r, const char *key, const char *str)
+{
+	put_fmt(r, ",\"%s\":", key);
+	put_json_str(r, str);
+}
+
+static void record_begin(struct record *r, enum output_type type,
+						enum output_event event)
+{
+	uint64_t ts = now_usec();
+
+	r->len = 0;
+	r->overflow = false;
+
+	if (mode == OUTPUT_JSON) {
+		put_fmt(r, "{\"ts\":%" PRIu64 ",\"type\":\"%s\"", ts,
+							type_names[type]);
+		if (event_names[event])
+			put_fmt(r, ",\"event\":\"%s\"", event_names[event]);
+		return;
+	}
+
+	/* Length is filled in by record_end */
+	put_le16(r, 0);
+	put_u8(r, type);
+	put_u8(r, event);
+	put_le64(r, ts);
+}
+
+static void record_end(struct record *r)
+{
+	size_t off = 0;
+
+	if (mode == OUTPUT_JSON) {
+		put(r, "}\n", 2);
+	} else if (!r->overflow) {
+		r->data[0] = (r->len - 2) & 0xff;
+		r->data[1] = (r->len - 2) >> 8;
+	}
+
+	/* Never emit a partial record */
+	if (r->overflow)
+		return;
+
+	while (off < r->len) {
+		ssize_t n = write(out_fd, r->data + off, r->len - off);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return;
+		}
+
+		off += n;
+	}
+}
+
+static void output_node(enum output_type type, enum output_event event,
+				const char *address, const char *name)
+{
+	struct record r;
+
+	if (mode == OUTPUT_TEXT)
+		return;
+
+	record_begin(&r, type, event);
+
+	if (mode == OUTPUT_JSON) {
+		put_json_key(&r, "address", address);
+		if (name)
+			put_json_key(&r, "name", name);
+	} else {
+		put_addr(&r, address);
+		put_str8(&r, name);
+	}
+
+	record_end(&r);
+}
+
+void output_adapter(enum output_event event, const char *address,
+							const char *name)
+{
+	output_node(OUTPUT_TYPE_ADAPTER, event, address, name);
+}
+
+void output_device(enum output_event event, const char *address,
+							const char *name)
+{
+	output_node(OUTPUT_TYPE_DEVICE, event, address, name);
+}
+
+void output_property(const char *address, const char *name,
+					const struct sonic_value *value)
+{
+	struct record r;
+	const char *valstr = NULL;
+	int32_t valnum = 0;
+	char kind;
+
+	if (mode == OUTPUT_TEXT || !value)
+		return;
+
+	switch (value->type) {
+	case SONIC_VALUE_BOOL:
+		valnum = value->b;
+		kind = 'b';
+		break;
+	case SONIC_VALUE_INT16:
+	case SONIC_VALUE_INT32:
+		valnum = value->i;
+		kind = 'n';
+		break;
+	case SONIC_VALUE_UINT16:
+	case SONIC_VALUE_UINT32:
+		valnum = value->u;
+		kind = 'n';
+		break;
+	case SONIC_VALUE_STRING:
+		valstr = value->s;
+		kind = 's';
+		break;
+	default:
+		/* Containers are not interesting to collectors */
+		return;
+	}
+
+	record_begin(&r, OUTPUT_TYPE_PROPERTY, OUTPUT_CHG);
+
+	if (mode == OUTPUT_JSON) {
+		put_json_key(&r, "address", address);
+		put_json_key(&r, "name", name);
+		if (kind == 's')
+			put_json_key(&r, "value", valstr);
+		else if (kind == 'b')
+			put_fmt(&r, ",\"value\":%s", valnum ? "true" : "false");
+		else
+			put_fmt(&r, ",\"value\":%" PRId32, valnum);
+	} else {
+		put_addr(&r, address);
+		put_str8(&r, name);
+		put_u8(&r, kind);
+		if (kind == 's')
+			put_str8(&r, valstr);
+		else if (kind == 'b')
+			put_u8(&r, valnum);
+		else
+			put_le32(&r, valnum);
+	}
+
+	record_end(&r);
+}
+
+void output_result(const char *command, const char *error)
+{
+	struct record r;
+
+	if (mode == OUTPUT_TEXT)
+		return;
+
+	record_begin(&r, OUTPUT_TYPE_RESULT, OUTPUT_NONE);
+
+	if (mode == OUTPUT_JSON) {
+		put_json_key(&r, "command", command);
+		if (error)
+			put_json_key(&r, "error", error);
+		else
+			put_fmt(&r, ",\"error\":null");
+	} else {
+		put_str8(&r, command);
+		put_str8(&r, error);
+	}
+
+	record_end(&r);
+}
+
+void output_sample(const char *address, enum sonic_char chr,
+					const uint8_t *value, size_t len)
+{
+	struct record r;
+	size_t i;
+
+	if (mode == OUTPUT_TEXT)
+		return;
+
+	if (chr > SONIC_CHAR_INVALID)
+		chr = SONIC_CHAR_INVALID;
+
+	record_begin(&r, OUTPUT_TYPE_SAMPLE, OUTPUT_NONE);
+
+	if (mode == OUTPUT_JSON) {
+		put_json_key(&r, "address", address);
+		put_fmt(&r, ",\"char\":\"%s\",\"value\":[", char_names[chr]);
+		for (i = 0; i < len; i++)
+			put_fmt(&r, i ? ",%u" : "%u", value[i]);
+		put_u8(&r, ']');
+	} else {
+		put_addr(&r, address);
+		put_u8(&r, chr);
+		put_bytes16(&r, value, len);
+	}
+
+	record_end(&r);
+}
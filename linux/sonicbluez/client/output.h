@@ -0,0 +1,74 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "libsonic/sonic.h"
+
+/*
+ * Machine readable output. In text mode (the default) every call below is
+ * a no-op and the console output is left as it is. In json and binary
+ * mode records are written to the original stdout while the prompt and
+ * human readable text move to stderr.
+ *
+ * json: one object per line, e.g.
+ *   {"ts":1234567,"type":"sample","address":"4A:AD:05:A8:9F:E7",
+ *    "char":"rssi","value":[45]}
+ *
+ * binary: a stream of little endian records
+ *   u16 length (of everything after this field)
+ *   u8  type (enum output_type)
+ *   u8  event (enum output_event)
+ *   u64 ts (CLOCK_MONOTONIC, usec)
+ *   payload:
+ *     adapter, device: addr[6] str8 name
+ *     property:        addr[6] str8 name u8 'b'|'n'|'s' value
+ *                      ('b': u8, 'n': s32, 's': str8)
+ *     result:          str8 command str8 error (empty on success)
+ *     sample:          addr[6] u8 char u16 length value
+ *   where str8 is u8 length followed by that many bytes and addr is the
+ *   address as printed (most significant byte first).
+ *
+ * Records are built in a stack buffer and written with a single write(),
+ * nothing is allocated per record.
+ */
+
+enum output_mode {
+	OUTPUT_TEXT,
+	OUTPUT_JSON,
+	OUTPUT_BINARY,
+};
+
+enum output_type {
+	OUTPUT_TYPE_ADAPTER	= 1,
+	OUTPUT_TYPE_DEVICE	= 2,
+	OUTPUT_TYPE_PROPERTY	= 3,
+	OUTPUT_TYPE_RESULT	= 4,
+	OUTPUT_TYPE_SAMPLE	= 5,
+};
+
+enum output_event {
+	OUTPUT_NONE	= 0,
+	OUTPUT_NEW	= 1,
+	OUTPUT_DEL	= 2,
+	OUTPUT_CHG	= 3,
+};
+
+bool output_parse_mode(const char *arg, enum output_mode *mode);
+bool output_init(enum output_mode mode);
+void output_cleanup(void);
+bool output_enabled(void);
+
+void output_adapter(enum output_event event, const char *address,
+							const char *name);
+void output_device(enum output_event event, const char *address,
+							const char *name);
+void output_property(const char *address, const char *name,
+					const struct sonic_value *value);
+void output_result(const char *command, const char *error);
+void output_sample(const char *address, enum sonic_char chr,
+					const uint8_t *value, size_t len);
+
+#endif	/* OUTPUT_H */
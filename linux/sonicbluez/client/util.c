@@ -34,11 +34,13 @@
 #include <dirent.h>
 #include <limits.h>
 #include <string.h>
+#include <inttypes.h>
+
+#include <glib.h>
 
 #include "util.h"
 #include "uuid.h"
 #include "display.h"
-//#include "gdbus/gdbus.h"
 
 void *btd_malloc(size_t size)
 {
@@ -155,137 +157,99 @@ void util_clear_uid(unsigned int *bitmap, uint8_t id)
 	*bitmap &= ~(1 << (id - 1));
 }
 
-void print_service(GDBusProxy *proxy, const char *description)
+void print_service(struct sonic_attr *attr, const char *description)
 {
-	DBusMessageIter iter;
+	struct sonic_value primary;
 	const char *uuid, *text;
-	dbus_bool_t primary;
 
-	if (g_dbus_proxy_get_property(proxy, "UUID", &iter) == FALSE)
+	uuid = sonic_attr_get_uuid(attr);
+	if (!uuid)
 		return;
 
-	dbus_message_iter_get_basic(&iter, &uuid);
-
-	if (g_dbus_proxy_get_property(proxy, "Primary", &iter) == FALSE)
+	if (!sonic_attr_get_property(attr, "Primary", &primary))
 		return;
 
-	dbus_message_iter_get_basic(&iter, &primary);
-
-
 	text = uuidstr_to_str(uuid);
 	if (!text)
 		rl_printf("%s%s%s%s Service\n\t%s\n\t%s\n",
 					description ? "[" : "",
 					description ? : "",
 					description ? "] " : "",
-					primary ? "Primary" : "Secondary",
-					g_dbus_proxy_get_path(proxy),
+					primary.b ? "Primary" : "Secondary",
+					sonic_attr_get_path(attr),
 					uuid);
 	else
 		rl_printf("%s%s%s%s Service\n\t%s\n\t%s\n\t%s\n",
 					description ? "[" : "",
 					description ? : "",
 					description ? "] " : "",
-					primary ? "Primary" : "Secondary",
-					g_dbus_proxy_get_path(proxy),
+					primary.b ? "Primary" : "Secondary",
+					sonic_attr_get_path(attr),
 					uuid, text);
+
+	sonic_value_clear(&primary);
 }
 
-void print_characteristic(GDBusProxy *proxy, const char *description)
+void print_characteristic(struct sonic_attr *attr, const char *description)
 {
-	DBusMessageIter iter;
 	const char *uuid, *text;
 
-	if (g_dbus_proxy_get_property(proxy, "UUID", &iter) == FALSE)
+	uuid = sonic_attr_get_uuid(attr);
+	if (!uuid)
 		return;
 
-	dbus_message_iter_get_basic(&iter, &uuid);
-
 	text = uuidstr_to_str(uuid);
 	if (!text)
 		rl_printf("%s%s%sCharacteristic\n\t%s\n\t%s\n",
 					description ? "[" : "",
 					description ? : "",
 					description ? "] " : "",
-					g_dbus_proxy_get_path(proxy),
+					sonic_attr_get_path(attr),
 					uuid);
 	else
 		rl_printf("%s%s%sCharacteristic\n\t%s\n\t%s\n\t%s\n",
 					description ? "[" : "",
 					description ? : "",
 					description ? "] " : "",
-					g_dbus_proxy_get_path(proxy),
+					sonic_attr_get_path(attr),
 					uuid, text);
 }
 
-void print_descriptor(GDBusProxy *proxy, const char *description)
+void print_descriptor(struct sonic_attr *attr, const char *description)
 {
-	DBusMessageIter iter;
 	const char *uuid, *text;
 
-	if (g_dbus_proxy_get_property(proxy, "UUID", &iter) == FALSE)
+	uuid = sonic_attr_get_uuid(attr);
+	if (!uuid)
 		return;
 
-	dbus_message_iter_get_basic(&iter, &uuid);
-
 	text = uuidstr_to_str(uuid);
 	if (!text)
 		rl_printf("%s%s%sDescriptor\n\t%s\n\t%s\n",
 					description ? "[" : "",
 					description ? : "",
 					description ? "] " : "",
-					g_dbus_proxy_get_path(proxy),
+					sonic_attr_get_path(attr),
 					uuid);
 	else
 		rl_printf("%s%s%sDescriptor\n\t%s\n\t%s\n\t%s\n",
 					description ? "[" : "",
 					description ? : "",
 					description ? "] " : "",
-					g_dbus_proxy_get_path(proxy),
+					sonic_attr_get_path(attr),
 					uuid, text);
 }
 
-/*
-void print_adapter(GDBusProxy *proxy, const char *description)
-{
-	DBusMessageIter iter;
-	const char *address, *name;
-
-	if (g_dbus_proxy_get_property(proxy, "Address", &iter) == FALSE)
-		return;
-
-	dbus_message_iter_get_basic(&iter, &address);
-
-	if (g_dbus_proxy_get_property(proxy, "Alias", &iter) == TRUE)
-		dbus_message_iter_get_basic(&iter, &name);
-	else
-		name = "<unknown>";
-
-	rl_printf("%s%s%sController %s %s %s\n",
-				description ? "[" : "",
-				description ? : "",
-				description ? "] " : "",
-				address, name,
-				default_ctrl &&
-				default_ctrl->proxy == proxy ?
-				"[default]" : "");
-
-}
-*/
-
-void print_device(GDBusProxy *proxy, const char *description)
+void print_device(struct sonic_device *device, const char *description)
 {
-	DBusMessageIter iter;
 	const char *address, *name;
 
-	if (g_dbus_proxy_get_property(proxy, "Address", &iter) == FALSE)
+	address = sonic_device_get_address(device);
+	if (!address)
 		return;
 
-	dbus_message_iter_get_basic(&iter, &address);
-
-	if (g_dbus_proxy_get_property(proxy, "Alias", &iter) == TRUE)
-		dbus_message_iter_get_basic(&iter, &name);
-	else
+	name = sonic_device_get_alias(device);
+	if (!name)
 		name = "<unknown>";
 
 	rl_printf("%s%s%sDevice %s %s\n",
@@ -295,76 +259,55 @@ void print_device(GDBusProxy *proxy, const char *description)
 				address, name);
 }
 
-void print_iter(const char *label, const char *name,
-						DBusMessageIter *iter)
+void print_value(const char *label, const char *name,
+					const struct sonic_value *value)
 {
-	dbus_bool_t valbool;
-	dbus_uint32_t valu32;
-	dbus_uint16_t valu16;
-	dbus_int16_t vals16;
-	unsigned char byte;
-	const char *valstr;
-	DBusMessageIter subiter;
 	char *entry;
+	size_t i;
 
-	if (iter == NULL) {
+	if (value == NULL) {
 		rl_printf("%s%s is nil\n", label, name);
 		return;
 	}
 
-	switch (dbus_message_iter_get_arg_type(iter)) {
-	case DBUS_TYPE_INVALID:
-		rl_printf("%s%s is invalid\n", label, name);
-		break;
-	case DBUS_TYPE_STRING:
-	case DBUS_TYPE_OBJECT_PATH:
-		dbus_message_iter_get_basic(iter, &valstr);
-		rl_printf("%s%s: %s\n", label, name, valstr);
+	switch (value->type) {
+	case SONIC_VALUE_STRING:
+		rl_printf("%s%s: %s\n", label, name, value->s);
 		break;
-	case DBUS_TYPE_BOOLEAN:
-		dbus_message_iter_get_basic(iter, &valbool);
-		rl_printf("%s%s: %s\n", label, name,
-					valbool == TRUE ? "yes" : "no");
+	case SONIC_VALUE_BOOL:
+		rl_printf("%s%s: %s\n", label, name, value->b ? "yes" : "no");
 		break;
-	case DBUS_TYPE_UINT32:
-		dbus_message_iter_get_basic(iter, &valu32);
-		rl_printf("%s%s: 0x%06x\n", label, name, valu32);
+	case SONIC_VALUE_UINT32:
+		rl_printf("%s%s: 0x%06" PRIx64 "\n", label, name, value->u);
 		break;
-	case DBUS_TYPE_UINT16:
-		dbus_message_iter_get_basic(iter, &valu16);
-		rl_printf("%s%s: 0x%04x\n", label, name, valu16);
+	case SONIC_VALUE_UINT16:
+		rl_printf("%s%s: 0x%04" PRIx64 "\n", label, name, value->u);
 		break;
-	case DBUS_TYPE_INT16:
-		dbus_message_iter_get_basic(iter, &vals16);
-		rl_printf("mybytes6\n");
-		rl_printf("%s%s: %d\n", label, name, vals16);
+	case SONIC_VALUE_UINT64:
+		rl_printf("%s%s: 0x%" PRIx64 "\n", label, name, value->u);
 		break;
-	case DBUS_TYPE_BYTE:
-		dbus_message_iter_get_basic(iter, &byte);
-		rl_printf("mybyte\n");
-		rl_printf("%s%s: 0x%02x\n", label, name, byte);
+	case SONIC_VALUE_INT16:
+	case SONIC_VALUE_INT32:
+	case SONIC_VALUE_INT64:
+		rl_printf("%s%s: %" PRId64 "\n", label, name, value->i);
 		break;
-	case DBUS_TYPE_VARIANT:
-		dbus_message_iter_recurse(iter, &subiter);
-		print_iter(label, name, &subiter);
+	case SONIC_VALUE_BYTE:
+		rl_printf("%s%s: 0x%02" PRIx64 "\n", label, name, value->u);
 		break;
-	case DBUS_TYPE_ARRAY:
-		dbus_message_iter_recurse(iter, &subiter);
-		while (dbus_message_iter_get_arg_type(&subiter) !=
-							DBUS_TYPE_INVALID) {
-			print_iter(label, name, &subiter);
-			dbus_message_iter_next(&subiter);
-		}
+	case SONIC_VALUE_ARRAY:
+		for (i = 0; i < value->count; i++)
+			print_value(label, name, &value->items[i]);
 		break;
-	case DBUS_TYPE_DICT_ENTRY:
-		dbus_message_iter_recurse(iter, &subiter);
+	case SONIC_VALUE_DICT_ENTRY:
+		if (value->count < 2)
+			break;
+
 		entry = g_strconcat(name, " Key", NULL);
-		print_iter(label, entry, &subiter);
+		print_value(label, entry, &value->items[0]);
 		g_free(entry);
 
 		entry = g_strconcat(name, " Value", NULL);
-		dbus_message_iter_next(&subiter);
-		print_iter(label, entry, &subiter);
+		print_value(label, entry, &value->items[1]);
 		g_free(entry);
 		break;
 	default:
@@ -373,29 +316,54 @@ void print_iter(const char *label, const char *name,
 	}
 }
 
-void print_property(GDBusProxy *proxy, const char *name)
+void print_adapter_property(struct sonic_adapter *adapter, const char *name)
+{
+	struct sonic_value value;
+
+	if (!sonic_adapter_get_property(adapter, name, &value))
+		return;
+
+	print_value("\t", name, &value);
+	sonic_value_clear(&value);
+}
+
+void print_device_property(struct sonic_device *device, const char *name)
 {
-	DBusMessageIter iter;
+	struct sonic_value value;
 
-	if (g_dbus_proxy_get_property(proxy, name, &iter) == FALSE)
+	if (!sonic_device_get_property(device, name, &value))
 		return;
 
-	print_iter("\t", name, &iter);
+	print_value("\t", name, &value);
+	sonic_value_clear(&value);
 }
 
-void print_uuids(GDBusProxy *proxy)
+void print_attr_property(struct sonic_attr *attr, const char *name)
 {
-	DBusMessageIter iter, value;
+	struct sonic_value value;
 
-	if (g_dbus_proxy_get_property(proxy, "UUIDs", &iter) == FALSE)
+	if (!sonic_attr_get_property(attr, name, &value))
 		return;
 
-	dbus_message_iter_recurse(&iter, &value);
+	print_value("\t", name, &value);
+	sonic_value_clear(&value);
+}
+
+void print_uuids(struct sonic_device *device)
+{
+	struct sonic_value uuids;
+	size_t i;
 
-	while (dbus_message_iter_get_arg_type(&value) == DBUS_TYPE_STRING) {
+	if (!sonic_device_get_property(device, "UUIDs", &uuids))
+		return;
+
+	for (i = 0; i < uuids.count; i++) {
 		const char *uuid, *text;
 
-		dbus_message_iter_get_basic(&value, &uuid);
+		if (uuids.items[i].type != SONIC_VALUE_STRING)
+			break;
+
+		uuid = uuids.items[i].s;
 
 		text = uuidstr_to_str(uuid);
 		if (text) {
@@ -418,7 +386,7 @@ void print_uuids(GDBusProxy *proxy)
 						str, 26 - n, ' ', uuid);
 		} else
 			rl_printf("\tUUID: %*c(%s)\n", 26, ' ', uuid);
-
-		dbus_message_iter_next(&value);
 	}
+
+	sonic_value_clear(&uuids);
 }
@@ -26,7 +26,7 @@
 #include <alloca.h>
 #include <byteswap.h>
 #include <string.h>
-#include "gdbus/gdbus.h"
+#include "libsonic/sonic.h"
 
 #if __BYTE_ORDER == __LITTLE_ENDIAN
 #define le16_to_cpu(val) (val)
@@ -108,14 +108,16 @@ unsigned char util_get_dt(const char *parent, const char *name);
 
 uint8_t util_get_uid(unsigned int *bitmap, uint8_t max);
 void util_clear_uid(unsigned int *bitmap, uint8_t id);
-void print_characteristic(GDBusProxy *proxy, const char *description);
-void print_service(GDBusProxy *proxy, const char *description);
-void print_descriptor(GDBusProxy *proxy, const char *description);
-//void print_adapter(GDBusProxy *proxy, const char *description);
-void print_device(GDBusProxy *proxy, const char *description);
-void print_iter(const char *label, const char *name, DBusMessageIter *iter);
-void print_property(GDBusProxy *proxy, const char *name);
-void print_uuids(GDBusProxy *proxy);
+void print_characteristic(struct sonic_attr *attr, const char *description);
+void print_service(struct sonic_attr *attr, const char *description);
+void print_descriptor(struct sonic_attr *attr, const char *description);
+void print_device(struct sonic_device *device, const char *description);
+void print_value(const char *label, const char *name,
+					const struct sonic_value *value);
+void print_adapter_property(struct sonic_adapter *adapter, const char *name);
+void print_device_property(struct sonic_device *device, const char *name);
+void print_attr_property(struct sonic_attr *attr, const char *name);
+void print_uuids(struct sonic_device *device);
 
 static inline int8_t get_s8(const void *ptr)
 {
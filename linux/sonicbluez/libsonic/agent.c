@@ -0,0 +1,456 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2012  Intel Corporation. All rights reserved.
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "sonic-private.h"
+
+#define AGENT_PATH "/org/bluez/agent"
+#define AGENT_INTERFACE "org.bluez.Agent1"
+
+static void agent_notify(struct sonic_ctx *ctx,
+				enum sonic_agent_request request,
+				struct sonic_agent_info *info)
+{
+	if (ctx->cb.agent_request)
+		ctx->cb.agent_request(ctx, request, info, ctx->user_data);
+}
+
+static void agent_clear_pending(struct sonic_ctx *ctx)
+{
+	if (!ctx->agent_pending)
+		return;
+
+	dbus_message_unref(ctx->agent_pending);
+	ctx->agent_pending = NULL;
+}
+
+/* bluetoothd asks one thing at a time, a newer request wins */
+static void agent_set_pending(struct sonic_ctx *ctx, DBusMessage *msg,
+					enum sonic_agent_request request)
+{
+	if (ctx->agent_pending)
+		g_dbus_send_error(ctx->conn, ctx->agent_pending,
+					"org.bluez.Error.Canceled", NULL);
+
+	agent_clear_pending(ctx);
+
+	ctx->agent_pending = dbus_message_ref(msg);
+	ctx->agent_pending_request = request;
+}
+
+/* Forget the agent, bluetoothd did (or is gone) */
+void sonic_agent_release(struct sonic_ctx *ctx)
+{
+	ctx->agent_registered = false;
+	agent_clear_pending(ctx);
+
+	g_dbus_unregister_interface(ctx->conn, AGENT_PATH, AGENT_INTERFACE);
+}
+
+static void agent_get_device(struct sonic_ctx *ctx, DBusMessage *msg,
+						struct sonic_agent_info *info)
+{
+	DBusMessageIter iter;
+	const char *path;
+
+	memset(info, 0, sizeof(*info));
+
+	if (!dbus_message_iter_init(msg, &iter) ||
+			dbus_message_iter_get_arg_type(&iter) !=
+							DBUS_TYPE_OBJECT_PATH)
+		return;
+
+	dbus_message_iter_get_basic(&iter, &path);
+	info->device = sonic_device_from_path(ctx, path);
+}
+
+static DBusMessage *release_agent(DBusConnection *conn,
+					DBusMessage *msg, void *user_data)
+{
+	struct sonic_ctx *ctx = user_data;
+	struct sonic_agent_info info;
+
+	memset(&info, 0, sizeof(info));
+
+	sonic_agent_release(ctx);
+	agent_notify(ctx, SONIC_AGENT_RELEASE, &info);
+
+	return dbus_message_new_method_return(msg);
+}
+
+static DBusMessage *request_pincode(DBusConnection *conn,
+					DBusMessage *msg, void *user_data)
+{
+	struct sonic_ctx *ctx = user_data;
+	struct sonic_agent_info info;
+
+	agent_get_device(ctx, msg, &info);
+
+	agent_set_pending(ctx, msg, SONIC_AGENT_PINCODE);
+	agent_notify(ctx, SONIC_AGENT_PINCODE, &info);
+
+	return NULL;
+}
+
+static DBusMessage *display_pincode(DBusConnection *conn,
+					DBusMessage *msg, void *user_data)
+{
+	struct sonic_ctx *ctx = user_data;
+	struct sonic_agent_info info;
+	const char *device;
+
+	agent_get_device(ctx, msg, &info);
+
+	dbus_message_get_args(msg, NULL, DBUS_TYPE_OBJECT_PATH, &device,
+				DBUS_TYPE_STRING, &info.pincode,
+				DBUS_TYPE_INVALID);
+
+	agent_notify(ctx, SONIC_AGENT_DISPLAY_PINCODE, &info);
+
+	return dbus_message_new_method_return(msg);
+}
+
+static DBusMessage *request_passkey(DBusConnection *conn,
+					DBusMessage *msg, void *user_data)
+{
+	struct sonic_ctx *ctx = user_data;
+	struct sonic_agent_info info;
+
+	agent_get_device(ctx, msg, &info);
+
+	agent_set_pending(ctx, msg, SONIC_AGENT_PASSKEY);
+	agent_notify(ctx, SONIC_AGENT_PASSKEY, &info);
+
+	return NULL;
+}
+
+static DBusMessage *display_passkey(DBusConnection *conn,
+					DBusMessage *msg, void *user_data)
+{
+	struct sonic_ctx *ctx = user_data;
+	struct sonic_agent_info info;
+	const char *device;
+	dbus_uint32_t passkey = 0;
+	dbus_uint16_t entered = 0;
+
+	agent_get_device(ctx, msg, &info);
+
+	dbus_message_get_args(msg, NULL, DBUS_TYPE_OBJECT_PATH, &device,
+			DBUS_TYPE_UINT32, &passkey, DBUS_TYPE_UINT16, &entered,
+							DBUS_TYPE_INVALID);
+
+	info.passkey = passkey;
+	info.entered = entered;
+	agent_notify(ctx, SONIC_AGENT_DISPLAY_PASSKEY, &info);
+
+	return dbus_message_new_method_return(msg);
+}
+
+static DBusMessage *request_confirmation(DBusConnection *conn,
+					DBusMessage *msg, void *user_data)
+{
+	struct sonic_ctx *ctx = user_data;
+	struct sonic_agent_info info;
+	const char *device;
+	dbus_uint32_t passkey = 0;
+
+	agent_get_device(ctx, msg, &info);
+
+	dbus_message_get_args(msg, NULL, DBUS_TYPE_OBJECT_PATH, &device,
+				DBUS_TYPE_UINT32, &passkey, DBUS_TYPE_INVALID);
+
+	info.passkey = passkey;
+	agent_set_pending(ctx, msg, SONIC_AGENT_CONFIRM);
+	agent_notify(ctx, SONIC_AGENT_CONFIRM, &info);
+
+	return NULL;
+}
+
+static DBusMessage *request_authorization(DBusConnection *conn,
+					DBusMessage *msg, void *user_data)
+{
+	struct sonic_ctx *ctx = user_data;
+	struct sonic_agent_info info;
+
+	agent_get_device(ctx, msg, &info);
+
+	agent_set_pending(ctx, msg, SONIC_AGENT_AUTHORIZE);
+	agent_notify(ctx, SONIC_AGENT_AUTHORIZE, &info);
+
+	return NULL;
+}
+
+static DBusMessage *authorize_service(DBusConnection *conn,
+					DBusMessage *msg, void *user_data)
+{
+	struct sonic_ctx *ctx = user_data;
+	struct sonic_agent_info info;
+	const char *device;
+
+	agent_get_device(ctx, msg, &info);
+
+	dbus_message_get_args(msg, NULL, DBUS_TYPE_OBJECT_PATH, &device,
+				DBUS_TYPE_STRING, &info.uuid, DBUS_TYPE_INVALID);
+
+	agent_set_pending(ctx, msg, SONIC_AGENT_AUTHORIZE_SERVICE);
+	agent_notify(ctx, SONIC_AGENT_AUTHORIZE_SERVICE, &info);
+
+	return NULL;
+}
+
+static DBusMessage *cancel_request(DBusConnection *conn,
+					DBusMessage *msg, void *user_data)
+{
+	struct sonic_ctx *ctx = user_data;
+	struct sonic_agent_info info;
+
+	memset(&info, 0, sizeof(info));
+
+	agent_clear_pending(ctx);
+	agent_notify(ctx, SONIC_AGENT_CANCEL, &info);
+
+	return dbus_message_new_method_return(msg);
+}
+
+static const GDBusMethodTable methods[] = {
+	{ GDBUS_METHOD("Release", NULL, NULL, release_agent) },
+	{ GDBUS_ASYNC_METHOD("RequestPinCode",
+			GDBUS_ARGS({ "device", "o" }),
+			GDBUS_ARGS({ "pincode", "s" }), request_pincode) },
+	{ GDBUS_METHOD("DisplayPinCode",
+			GDBUS_ARGS({ "device", "o" }, { "pincode", "s" }),
+			NULL, display_pincode) },
+	{ GDBUS_ASYNC_METHOD("RequestPasskey",
+			GDBUS_ARGS({ "device", "o" }),
+			GDBUS_ARGS({ "passkey", "u" }), request_passkey) },
+	{ GDBUS_METHOD("DisplayPasskey",
+			GDBUS_ARGS({ "device", "o" }, { "passkey", "u" },
+							{ "entered", "q" }),
+			NULL, display_passkey) },
+	{ GDBUS_ASYNC_METHOD("RequestConfirmation",
+			GDBUS_ARGS({ "device", "o" }, { "passkey", "u" }),
+			NULL, request_confirmation) },
+	{ GDBUS_ASYNC_METHOD("RequestAuthorization",
+			GDBUS_ARGS({ "device", "o" }),
+			NULL, request_authorization) },
+	{ GDBUS_ASYNC_METHOD("AuthorizeService",
+			GDBUS_ARGS({ "device", "o" }, { "uuid", "s" }),
+			NULL,  authorize_service) },
+	{ GDBUS_METHOD("Cancel", NULL, NULL, cancel_request) },
+	{ }
+};
+
+static void register_agent_setup(DBusMessageIter *iter, void *user_data)
+{
+	struct sonic_call *call = user_data;
+	const char *path = AGENT_PATH;
+	const char *capability = call->setup_data;
+
+	dbus_message_iter_append_basic(iter, DBUS_TYPE_OBJECT_PATH, &path);
+	dbus_message_iter_append_basic(iter, DBUS_TYPE_STRING, &capability);
+}
+
+static void register_agent_reply(DBusMessage *message, void *user_data)
+{
+	struct sonic_call *call = user_data;
+	DBusError error;
+
+	dbus_error_init(&error);
+
+	if (dbus_set_error_from_message(&error, message) == TRUE) {
+		g_dbus_unregister_interface(call->ctx->conn, AGENT_PATH,
+							AGENT_INTERFACE);
+
+		if (call->result)
+			call->result(error.name, call->user_data);
+		dbus_error_free(&error);
+		return;
+	}
+
+	call->ctx->agent_registered = true;
+
+	if (call->result)
+		call->result(NULL, call->user_data);
+}
+
+/* capability NULL or empty lets bluetoothd pick (KeyboardDisplay) */
+bool sonic_agent_register(struct sonic_ctx *ctx, const char *capability,
+				sonic_result_func_t func, void *user_data)
+{
+	if (!ctx->agent_manager || ctx->agent_registered)
+		return false;
+
+	if (g_dbus_register_interface(ctx->conn, AGENT_PATH,
+					AGENT_INTERFACE, methods,
+					NULL, NULL, ctx, NULL) == FALSE)
+		return false;
+
+	if (sonic_call_method(ctx, ctx->agent_manager, "RegisterAgent",
+					register_agent_setup,
+					capability ? capability : "",
+					register_agent_reply,
+					func, NULL, user_data))
+		return true;
+
+	g_dbus_unregister_interface(ctx->conn, AGENT_PATH, AGENT_INTERFACE);
+	return false;
+}
+
+static void agent_path_setup(DBusMessageIter *iter, void *user_data)
+{
+	const char *path = AGENT_PATH;
+
+	dbus_message_iter_append_basic(iter, DBUS_TYPE_OBJECT_PATH, &path);
+}
+
+static void unregister_agent_reply(DBusMessage *message, void *user_data)
+{
+	struct sonic_call *call = user_data;
+	DBusError error;
+
+	dbus_error_init(&error);
+
+	if (dbus_set_error_from_message(&error, message) == TRUE) {
+		if (call->result)
+			call->result(error.name, call->user_data);
+		dbus_error_free(&error);
+		return;
+	}
+
+	sonic_agent_release(call->ctx);
+
+	if (call->result)
+		call->result(NULL, call->user_data);
+}
+
+bool sonic_agent_unregister(struct sonic_ctx *ctx,
+				sonic_result_func_t func, void *user_data)
+{
+	if (!ctx->agent_manager || !ctx->agent_registered)
+		return false;
+
+	return sonic_call_method(ctx, ctx->agent_manager, "UnregisterAgent",
+					agent_path_setup, NULL,
+					unregister_agent_reply,
+					func, NULL, user_data);
+}
+
+bool sonic_agent_request_default(struct sonic_ctx *ctx,
+				sonic_result_func_t func, void *user_data)
+{
+	if (!ctx->agent_manager || !ctx->agent_registered)
+		return false;
+
+	return sonic_call_method(ctx, ctx->agent_manager,
+					"RequestDefaultAgent",
+					agent_path_setup, NULL, NULL,
+					func, NULL, user_data);
+}
+
+bool sonic_agent_is_registered(struct sonic_ctx *ctx)
+{
+	return ctx->agent_registered;
+}
+
+bool sonic_agent_is_pending(struct sonic_ctx *ctx)
+{
+	return ctx->agent_pending != NULL;
+}
+
+bool sonic_agent_reply_pincode(struct sonic_ctx *ctx, const char *pincode)
+{
+	if (!ctx->agent_pending ||
+			ctx->agent_pending_request != SONIC_AGENT_PINCODE)
+		return false;
+
+	g_dbus_send_reply(ctx->conn, ctx->agent_pending, DBUS_TYPE_STRING,
+					&pincode, DBUS_TYPE_INVALID);
+	agent_clear_pending(ctx);
+
+	return true;
+}
+
+bool sonic_agent_reply_passkey(struct sonic_ctx *ctx, uint32_t passkey)
+{
+	dbus_uint32_t value = passkey;
+
+	if (!ctx->agent_pending ||
+			ctx->agent_pending_request != SONIC_AGENT_PASSKEY)
+		return false;
+
+	g_dbus_send_reply(ctx->conn, ctx->agent_pending, DBUS_TYPE_UINT32,
+					&value, DBUS_TYPE_INVALID);
+	agent_clear_pending(ctx);
+
+	return true;
+}
+
+bool sonic_agent_accept(struct sonic_ctx *ctx)
+{
+	if (!ctx->agent_pending)
+		return false;
+
+	switch (ctx->agent_pending_request) {
+	case SONIC_AGENT_CONFIRM:
+	case SONIC_AGENT_AUTHORIZE:
+	case SONIC_AGENT_AUTHORIZE_SERVICE:
+		break;
+	default:
+		return false;
+	}
+
+	g_dbus_send_reply(ctx->conn, ctx->agent_pending, DBUS_TYPE_INVALID);
+	agent_clear_pending(ctx);
+
+	return true;
+}
+
+static bool agent_error(struct sonic_ctx *ctx, const char *name)
+{
+	if (!ctx->agent_pending)
+		return false;
+
+	g_dbus_send_error(ctx->conn, ctx->agent_pending, name, NULL);
+	agent_clear_pending(ctx);
+
+	return true;
+}
+
+bool sonic_agent_reject(struct sonic_ctx *ctx)
+{
+	return agent_error(ctx, "org.bluez.Error.Rejected");
+}
+
+bool sonic_agent_cancel(struct sonic_ctx *ctx)
+{
+	return agent_error(ctx, "org.bluez.Error.Canceled");
+}
@@ -0,0 +1,326 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "sonic-private.h"
+
+/* Two step operation: switch the mode, then act on a characteristic */
+struct sonic_op {
+	struct sonic_device *device;
+	enum sonic_char chr;
+	uint8_t value;
+	bool enable;
+	sonic_result_func_t result;
+	sonic_value_func_t read;
+	void *user_data;
+	enum sonic_prio prio;
+};
+
+static struct sonic_op *op_new(struct sonic_device *device,
+				enum sonic_char chr, sonic_result_func_t result,
+				sonic_value_func_t read, void *user_data)
+{
+	struct sonic_op *op = g_new0(struct sonic_op, 1);
+
+	op->device = device;
+	op->chr = chr;
+	op->result = result;
+	op->read = read;
+	op->user_data = user_data;
+	op->prio = device->ctx->prio;
+
+	return op;
+}
+
+/* Later steps run from a reply, issue them in the class we started in */
+static enum sonic_prio op_resume(struct sonic_op *op)
+{
+	return sonic_set_priority(op->device->ctx, op->prio);
+}
+
+static void op_done(struct sonic_op *op, const char *error)
+{
+	if (op->result)
+		op->result(error, op->user_data);
+
+	g_free(op);
+}
+
+static bool op_start(struct sonic_op *op, enum sonic_mode mode,
+						sonic_result_func_t next)
+{
+	if (sonic_set_mode(op->device, mode, next, op))
+		return true;
+
+	g_free(op);
+	return false;
+}
+
+bool sonic_buzz(struct sonic_device *device, bool enable,
+				sonic_result_func_t func, void *user_data)
+{
+	uint8_t value = enable ? 0x01 : 0x00;
+
+	return sonic_write(device, SONIC_CHAR_BUZZ, &value, sizeof(value),
+							func, user_data);
+}
+
+bool sonic_set_mode(struct sonic_device *device, enum sonic_mode mode,
+				sonic_result_func_t func, void *user_data)
+{
+	uint8_t value = mode;
+
+	return sonic_write(device, SONIC_CHAR_MODE, &value, sizeof(value),
+							func, user_data);
+}
+
+static void set_loop_value(const char *error, void *user_data)
+{
+	struct sonic_op *op = user_data;
+	enum sonic_prio prio;
+	bool ret;
+
+	if (error) {
+		op_done(op, error);
+		return;
+	}
+
+	prio = op_resume(op);
+	ret = sonic_write(op->device, op->chr, &op->value, sizeof(op->value),
+						op->result, op->user_data);
+	sonic_set_priority(op->device->ctx, prio);
+
+	if (!ret) {
+		op_done(op, "org.bluez.Error.NotAvailable");
+		return;
+	}
+
+	g_free(op);
+}
+
+bool sonic_set_loop(struct sonic_device *device, enum sonic_char chr,
+				uint8_t value, sonic_result_func_t func,
+				void *user_data)
+{
+	struct sonic_op *op;
+
+	if (!sonic_device_get_char(device, chr))
+		return false;
+
+	op = op_new(device, chr, func, NULL, user_data);
+	op->value = value;
+
+	return op_start(op, value ? SONIC_MODE_LOOP : SONIC_MODE_IDLE,
+							set_loop_value);
+}
+
+static void stats_notify(const char *error, void *user_data)
+{
+	struct sonic_op *op = user_data;
+	enum sonic_prio prio;
+	bool ret;
+
+	if (error) {
+		op_done(op, error);
+		return;
+	}
+
+	prio = op_resume(op);
+	ret = sonic_notify(op->device, op->chr, op->enable, op->result,
+							op->user_data);
+	sonic_set_priority(op->device->ctx, prio);
+
+	if (!ret) {
+		op_done(op, "org.bluez.Error.NotAvailable");
+		return;
+	}
+
+	g_free(op);
+}
+
+bool sonic_stats(struct sonic_device *device, enum sonic_char chr,
+				bool enable, sonic_result_func_t func,
+				void *user_data)
+{
+	struct sonic_op *op;
+
+	if (chr != SONIC_CHAR_RSSI && chr != SONIC_CHAR_SOLAR)
+		return false;
+
+	if (!sonic_device_get_char(device, chr))
+		return false;
+
+	op = op_new(device, chr, func, NULL, user_data);
+	op->enable = enable;
+
+	/* Unsubscribing does not need the loop running */
+	if (!enable) {
+		stats_notify(NULL, op);
+		return true;
+	}
+
+	return op_start(op, SONIC_MODE_LOOP, stats_notify);
+}
+
+/* One policy record, must match REPORT_RECORD_LEN in the firmware */
+bool sonic_set_report(struct sonic_device *device, enum sonic_char chr,
+				uint8_t deadband, uint8_t min_s, uint16_t max_s,
+				sonic_result_func_t func, void *user_data)
+{
+	uint8_t value[5];
+
+	if (chr != SONIC_CHAR_RSSI && chr != SONIC_CHAR_SOLAR)
+		return false;
+
+	/* Low byte of the reading's UUID, see char_uuids */
+	value[0] = chr == SONIC_CHAR_RSSI ? 0x05 : 0x08;
+	value[1] = deadband;
+	value[2] = min_s;
+	value[3] = max_s >> 8;
+	value[4] = max_s;
+
+	return sonic_write(device, SONIC_CHAR_REPORT, value, sizeof(value),
+							func, user_data);
+}
+
+/* Stream frame layout, must match ble_stream.h in the firmware */
+#define STREAM_HDR_LEN		7
+#define STREAM_SAMPLE_LEN	3
+
+int sonic_stream_parse(const uint8_t *value, size_t len,
+				struct sonic_sample *samples, unsigned int max)
+{
+	uint32_t time;
+	uint16_t period;
+	unsigned int count, i;
+	const uint8_t *s;
+
+	if (len < STREAM_HDR_LEN)
+		return -1;
+
+	time = ((uint32_t) value[0] << 24) | (value[1] << 16) |
+						(value[2] << 8) | value[3];
+	period = (value[4] << 8) | value[5];
+	count = value[6];
+
+	if (len != STREAM_HDR_LEN + count * STREAM_SAMPLE_LEN)
+		return -1;
+
+	for (i = 0; i < count && i < max; i++) {
+		s = value + STREAM_HDR_LEN + i * STREAM_SAMPLE_LEN;
+		samples[i].time = time + i * period;
+		samples[i].rssi = (int8_t) s[0];
+		samples[i].light = (s[1] << 8) | s[2];
+	}
+
+	return count;
+}
+
+static void fwupdate_read(const char *error, void *user_data)
+{
+	struct sonic_op *op = user_data;
+	enum sonic_prio prio;
+	bool ret;
+
+	if (error) {
+		op->read(error, NULL, 0, op->user_data);
+		g_free(op);
+		return;
+	}
+
+	prio = op_resume(op);
+	ret = sonic_read(op->device, SONIC_CHAR_PASS, op->read, op->user_data);
+	sonic_set_priority(op->device->ctx, prio);
+
+	if (!ret)
+		op->read("org.bluez.Error.NotAvailable", NULL, 0,
+							op->user_data);
+
+	g_free(op);
+}
+
+bool sonic_fwupdate(struct sonic_device *device,
+				sonic_value_func_t func, void *user_data)
+{
+	struct sonic_op *op;
+
+	if (!func || !sonic_device_get_char(device, SONIC_CHAR_PASS))
+		return false;
+
+	op = op_new(device, SONIC_CHAR_PASS, NULL, func, user_data);
+
+	return op_start(op, SONIC_MODE_FWUPDATE, fwupdate_read);
+}
+
+static void fwupdate_station_mode(const char *error, void *user_data)
+{
+	struct sonic_op *op = user_data;
+	enum sonic_prio prio;
+	bool ret;
+
+	if (error) {
+		op_done(op, error);
+		return;
+	}
+
+	/* The config is in, switching the mode starts the download */
+	prio = op_resume(op);
+	ret = sonic_set_mode(op->device, SONIC_MODE_FWUPDATE_STA, op->result,
+								op->user_data);
+	sonic_set_priority(op->device->ctx, prio);
+
+	if (!ret) {
+		op_done(op, "org.bluez.Error.NotAvailable");
+		return;
+	}
+
+	g_free(op);
+}
+
+bool sonic_fwupdate_station(struct sonic_device *device, const char *ssid,
+				const char *pass, uint32_t addr, uint16_t port,
+				sonic_result_func_t func, void *user_data)
+{
+	uint8_t value[1 + 32 + 1 + 64 + 4 + 2];
+	size_t ssid_len, pass_len, len = 0;
+	struct sonic_op *op;
+
+	ssid_len = ssid ? strlen(ssid) : 0;
+	pass_len = pass ? strlen(pass) : 0;
+
+	/* WPA2 passphrases are 8..63 characters, a PSK is 64 hex digits */
+	if (!ssid_len || ssid_len > 32 || (pass_len && pass_len < 8) ||
+						pass_len > 64 || !addr || !port)
+		return false;
+
+	if (!sonic_device_get_char(device, SONIC_CHAR_STACONF))
+		return false;
+
+	value[len++] = ssid_len;
+	memcpy(value + len, ssid, ssid_len);
+	len += ssid_len;
+	value[len++] = pass_len;
+	if (pass_len)
+		memcpy(value + len, pass, pass_len);
+	len += pass_len;
+	memcpy(value + len, &addr, 4);
+	len += 4;
+	memcpy(value + len, &port, 2);
+	len += 2;
+
+	op = op_new(device, SONIC_CHAR_STACONF, func, NULL, user_data);
+
+	/* The write copies value */
+	if (sonic_write(device, SONIC_CHAR_STACONF, value, len,
+						fwupdate_station_mode, op))
+		return true;
+
+	g_free(op);
+	return false;
+}
@@ -0,0 +1,721 @@
+/*
+ *
+ *  BlueZ - Bluetooth protocol stack for Linux
+ *
+ *  Copyright (C) 2014  Intel Corporation. All rights reserved.
+ *
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/uio.h>
+
+#include <glib.h>
+
+#include "sonic-private.h"
+
+#define PROFILE_PATH "/org/bluez/profile"
+#define PROFILE_INTERFACE "org.bluez.GattProfile1"
+
+/* Indexed by enum sonic_char */
+static const char * const char_uuids[SONIC_CHAR_MAX] = {
+	[SONIC_CHAR_BUZZ]	= "0000ff01-0000-1000-8000-00805f9b34fb",
+	[SONIC_CHAR_MODE]	= "0000ff02-0000-1000-8000-00805f9b34fb",
+	[SONIC_CHAR_FIXEDINT]	= "0000ff03-0000-1000-8000-00805f9b34fb",
+	[SONIC_CHAR_RANDINT]	= "0000ff04-0000-1000-8000-00805f9b34fb",
+	[SONIC_CHAR_RSSI]	= "0000ff05-0000-1000-8000-00805f9b34fb",
+	[SONIC_CHAR_RSSIMIN]	= "0000ff06-0000-1000-8000-00805f9b34fb",
+	[SONIC_CHAR_PASS]	= "0000ff07-0000-1000-8000-00805f9b34fb",
+	[SONIC_CHAR_SOLAR]	= "0000ff08-0000-1000-8000-00805f9b34fb",
+	[SONIC_CHAR_SOLARMIN]	= "0000ff09-0000-1000-8000-00805f9b34fb",
+	[SONIC_CHAR_OTA]	= "0000ff0a-0000-1000-8000-00805f9b34fb",
+	[SONIC_CHAR_PROGRESS]	= "0000ff0b-0000-1000-8000-00805f9b34fb",
+	[SONIC_CHAR_STACONF]	= "0000ff0c-0000-1000-8000-00805f9b34fb",
+	[SONIC_CHAR_APINFO]	= "0000ff0d-0000-1000-8000-00805f9b34fb",
+	[SONIC_CHAR_STREAM]	= "0000ff0e-0000-1000-8000-00805f9b34fb",
+	[SONIC_CHAR_REPORT]	= "0000ff0f-0000-1000-8000-00805f9b34fb",
+};
+
+enum sonic_char sonic_char_from_uuid(const char *uuid)
+{
+	int i;
+
+	if (!uuid)
+		return SONIC_CHAR_INVALID;
+
+	for (i = 0; i < SONIC_CHAR_MAX; i++) {
+		if (!strcasecmp(uuid, char_uuids[i]))
+			return i;
+	}
+
+	return SONIC_CHAR_INVALID;
+}
+
+static const char *attr_get_uuid(GDBusProxy *proxy)
+{
+	DBusMessageIter iter;
+	const char *uuid;
+
+	if (!g_dbus_proxy_get_property(proxy, "UUID", &iter))
+		return NULL;
+
+	dbus_message_iter_get_basic(&iter, &uuid);
+
+	return uuid;
+}
+
+static gboolean attr_is_child(GDBusProxy *proxy, const char *property,
+								GList *source)
+{
+	GList *l;
+	DBusMessageIter iter;
+	const char *parent;
+
+	if (!g_dbus_proxy_get_property(proxy, property, &iter))
+		return FALSE;
+
+	dbus_message_iter_get_basic(&iter, &parent);
+
+	for (l = source; l; l = g_list_next(l)) {
+		struct sonic_attr *attr = l->data;
+
+		if (!strcmp(g_dbus_proxy_get_path(attr->proxy), parent))
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+static struct sonic_attr *attr_new(GDBusProxy *proxy)
+{
+	struct sonic_attr *attr = g_new0(struct sonic_attr, 1);
+
+	attr->proxy = proxy;
+
+	return attr;
+}
+
+static struct sonic_attr *attr_find(GList *source, GDBusProxy *proxy)
+{
+	GList *l;
+
+	for (l = source; l; l = g_list_next(l)) {
+		struct sonic_attr *attr = l->data;
+
+		if (attr->proxy == proxy)
+			return attr;
+	}
+
+	return NULL;
+}
+
+/* Unlink the attribute of proxy, tell the user and free it */
+static GList *attr_remove(struct sonic_ctx *ctx, GList *source,
+							GDBusProxy *proxy)
+{
+	struct sonic_attr *attr = attr_find(source, proxy);
+
+	if (!attr)
+		return source;
+
+	source = g_list_remove(source, attr);
+
+	if (ctx->cb.attribute_removed)
+		ctx->cb.attribute_removed(attr, ctx->user_data);
+
+	g_free(attr);
+
+	return source;
+}
+
+void sonic_gatt_add_service(struct sonic_ctx *ctx, GDBusProxy *proxy)
+{
+	DBusMessageIter iter;
+	const char *device;
+
+	if (!g_dbus_proxy_get_property(proxy, "Device", &iter))
+		return;
+
+	dbus_message_iter_get_basic(&iter, &device);
+
+	if (!sonic_device_from_path(ctx, device))
+		return;
+
+	ctx->services = g_list_append(ctx->services, attr_new(proxy));
+}
+
+void sonic_gatt_remove_service(struct sonic_ctx *ctx, GDBusProxy *proxy)
+{
+	ctx->services = attr_remove(ctx, ctx->services, proxy);
+}
+
+void sonic_gatt_add_characteristic(struct sonic_ctx *ctx, GDBusProxy *proxy)
+{
+	struct sonic_device *device;
+	struct sonic_attr *attr;
+	enum sonic_char chr;
+
+	if (!attr_is_child(proxy, "Service", ctx->services))
+		return;
+
+	attr = attr_new(proxy);
+	ctx->characteristics = g_list_append(ctx->characteristics, attr);
+
+	chr = sonic_char_from_uuid(attr_get_uuid(proxy));
+	if (chr == SONIC_CHAR_INVALID)
+		return;
+
+	device = sonic_device_from_path(ctx, g_dbus_proxy_get_path(proxy));
+	if (!device)
+		return;
+
+	device->chars[chr] = attr;
+	sonic_inventory_set_handle(device, chr, proxy);
+}
+
+void sonic_gatt_remove_characteristic(struct sonic_ctx *ctx,
+							GDBusProxy *proxy)
+{
+	struct sonic_device *device;
+	int i;
+
+	device = sonic_device_from_path(ctx, g_dbus_proxy_get_path(proxy));
+	if (device) {
+		for (i = 0; i < SONIC_CHAR_MAX; i++) {
+			if (device->chars[i] &&
+					device->chars[i]->proxy == proxy)
+				device->chars[i] = NULL;
+		}
+	}
+
+	ctx->characteristics = attr_remove(ctx, ctx->characteristics, proxy);
+}
+
+void sonic_gatt_add_descriptor(struct sonic_ctx *ctx, GDBusProxy *proxy)
+{
+	if (!attr_is_child(proxy, "Characteristic", ctx->characteristics))
+		return;
+
+	ctx->descriptors = g_list_append(ctx->descriptors, attr_new(proxy));
+}
+
+void sonic_gatt_remove_descriptor(struct sonic_ctx *ctx, GDBusProxy *proxy)
+{
+	ctx->descriptors = attr_remove(ctx, ctx->descriptors, proxy);
+}
+
+void sonic_gatt_add_manager(struct sonic_ctx *ctx, GDBusProxy *proxy)
+{
+	ctx->managers = g_list_append(ctx->managers, proxy);
+}
+
+void sonic_gatt_remove_manager(struct sonic_ctx *ctx, GDBusProxy *proxy)
+{
+	ctx->managers = g_list_remove(ctx->managers, proxy);
+}
+
+void sonic_gatt_free(struct sonic_ctx *ctx)
+{
+	g_list_free_full(ctx->services, g_free);
+	ctx->services = NULL;
+	g_list_free_full(ctx->characteristics, g_free);
+	ctx->characteristics = NULL;
+	g_list_free_full(ctx->descriptors, g_free);
+	ctx->descriptors = NULL;
+	g_list_free(ctx->managers);
+	ctx->managers = NULL;
+}
+
+/* Borrow the byte array behind iter without copying it */
+static bool iter_get_bytes(DBusMessageIter *iter, const uint8_t **value,
+								int *len)
+{
+	DBusMessageIter sub;
+
+	if (dbus_message_iter_get_arg_type(iter) == DBUS_TYPE_VARIANT) {
+		dbus_message_iter_recurse(iter, &sub);
+		return iter_get_bytes(&sub, value, len);
+	}
+
+	if (dbus_message_iter_get_arg_type(iter) != DBUS_TYPE_ARRAY ||
+			dbus_message_iter_get_element_type(iter) !=
+							DBUS_TYPE_BYTE)
+		return false;
+
+	dbus_message_iter_recurse(iter, &sub);
+	dbus_message_iter_get_fixed_array(&sub, value, len);
+
+	return *len >= 0;
+}
+
+void sonic_gatt_value_changed(struct sonic_ctx *ctx, GDBusProxy *proxy,
+							DBusMessageIter *iter)
+{
+	struct sonic_device *device;
+	struct sonic_attr *attr;
+	enum sonic_char chr = SONIC_CHAR_INVALID;
+	const uint8_t *value;
+	int len, i;
+
+	if (!ctx->cb.notify || !iter)
+		return;
+
+	attr = attr_find(ctx->characteristics, proxy);
+	if (!attr)
+		attr = attr_find(ctx->descriptors, proxy);
+	if (!attr)
+		return;
+
+	if (!iter_get_bytes(iter, &value, &len))
+		return;
+
+	device = sonic_device_from_path(ctx, g_dbus_proxy_get_path(proxy));
+	if (device) {
+		for (i = 0; i < SONIC_CHAR_MAX; i++) {
+			if (device->chars[i] == attr) {
+				chr = i;
+				break;
+			}
+		}
+	}
+
+	ctx->cb.notify(device, attr, chr, value, len, ctx->user_data);
+}
+
+GList *sonic_get_services(struct sonic_ctx *ctx)
+{
+	return ctx->services;
+}
+
+GList *sonic_get_characteristics(struct sonic_ctx *ctx)
+{
+	return ctx->characteristics;
+}
+
+GList *sonic_get_descriptors(struct sonic_ctx *ctx)
+{
+	return ctx->descriptors;
+}
+
+static struct sonic_attr *select_attr(const char *path, GList *source)
+{
+	GList *l;
+
+	for (l = source; l; l = g_list_next(l)) {
+		struct sonic_attr *attr = l->data;
+
+		if (strcmp(path, g_dbus_proxy_get_path(attr->proxy)) == 0)
+			return attr;
+	}
+
+	return NULL;
+}
+
+struct sonic_attr *sonic_find_attribute(struct sonic_ctx *ctx,
+						const char *path)
+{
+	struct sonic_attr *attr;
+
+	if (!path)
+		return NULL;
+
+	attr = select_attr(path, ctx->services);
+	if (attr)
+		return attr;
+
+	attr = select_attr(path, ctx->characteristics);
+	if (attr)
+		return attr;
+
+	return select_attr(path, ctx->descriptors);
+}
+
+const char *sonic_attr_get_path(struct sonic_attr *attr)
+{
+	return g_dbus_proxy_get_path(attr->proxy);
+}
+
+const char *sonic_attr_get_uuid(struct sonic_attr *attr)
+{
+	return attr_get_uuid(attr->proxy);
+}
+
+bool sonic_attr_get_property(struct sonic_attr *attr, const char *name,
+						struct sonic_value *value)
+{
+	return sonic_value_from_proxy(attr->proxy, name, value);
+}
+
+struct sonic_attr *sonic_device_get_char(struct sonic_device *device,
+						enum sonic_char chr)
+{
+	if (!device || chr >= SONIC_CHAR_MAX)
+		return NULL;
+
+	return device->chars[chr];
+}
+
+static bool attr_is_value(struct sonic_attr *attr)
+{
+	const char *iface;
+
+	if (!attr)
+		return false;
+
+	iface = g_dbus_proxy_get_interface(attr->proxy);
+
+	return !strcmp(iface, "org.bluez.GattCharacteristic1") ||
+			!strcmp(iface, "org.bluez.GattDescriptor1");
+}
+
+static bool attr_is_char(struct sonic_attr *attr)
+{
+	return attr && !strcmp(g_dbus_proxy_get_interface(attr->proxy),
+					"org.bluez.GattCharacteristic1");
+}
+
+static void read_reply(DBusMessage *message, void *user_data)
+{
+	struct sonic_call *call = user_data;
+	DBusError error;
+	DBusMessageIter iter;
+	const uint8_t *value;
+	int len;
+
+	dbus_error_init(&error);
+
+	if (dbus_set_error_from_message(&error, message) == TRUE) {
+		call->value(error.name, NULL, 0, call->user_data);
+		dbus_error_free(&error);
+		return;
+	}
+
+	dbus_message_iter_init(message, &iter);
+
+	if (!iter_get_bytes(&iter, &value, &len)) {
+		call->value("org.bluez.Error.InvalidValueLength", NULL, 0,
+							call->user_data);
+		return;
+	}
+
+	call->value(NULL, value, len, call->user_data);
+}
+
+static void options_setup(DBusMessageIter *iter)
+{
+	DBusMessageIter dict;
+
+	dbus_message_iter_open_container(iter, DBUS_TYPE_ARRAY,
+					DBUS_DICT_ENTRY_BEGIN_CHAR_AS_STRING
+					DBUS_TYPE_STRING_AS_STRING
+					DBUS_TYPE_VARIANT_AS_STRING
+					DBUS_DICT_ENTRY_END_CHAR_AS_STRING,
+					&dict);
+	/* TODO: Add offset support */
+	dbus_message_iter_close_container(iter, &dict);
+}
+
+static void read_setup(DBusMessageIter *iter, void *user_data)
+{
+	options_setup(iter);
+}
+
+bool sonic_attr_read(struct sonic_ctx *ctx, struct sonic_attr *attr,
+				sonic_value_func_t func, void *user_data)
+{
+	if (!attr_is_value(attr) || !func)
+		return false;
+
+	return sonic_call_method(ctx, attr->proxy, "ReadValue", read_setup, NULL,
+					read_reply, NULL, func, user_data);
+}
+
+static void write_setup(DBusMessageIter *iter, void *user_data)
+{
+	struct sonic_call *call = user_data;
+	const struct iovec *iov = call->setup_data;
+	DBusMessageIter array;
+
+	dbus_message_iter_open_container(iter, DBUS_TYPE_ARRAY, "y", &array);
+	dbus_message_iter_append_fixed_array(&array, DBUS_TYPE_BYTE,
+						&iov->iov_base, iov->iov_len);
+	dbus_message_iter_close_container(iter, &array);
+
+	options_setup(iter);
+}
+
+bool sonic_attr_write(struct sonic_ctx *ctx, struct sonic_attr *attr,
+				const uint8_t *value, size_t len,
+				sonic_result_func_t func, void *user_data)
+{
+	struct iovec iov;
+
+	if (!attr_is_value(attr))
+		return false;
+
+	iov.iov_base = (void *) value;
+	iov.iov_len = len;
+
+	return sonic_call_method(ctx, attr->proxy, "WriteValue", write_setup,
+					&iov, NULL, func, NULL, user_data);
+}
+
+bool sonic_attr_notify(struct sonic_ctx *ctx, struct sonic_attr *attr,
+				bool enable, sonic_result_func_t func,
+				void *user_data)
+{
+	if (!attr_is_char(attr))
+		return false;
+
+	return sonic_call_method(ctx, attr->proxy,
+				enable ? "StartNotify" : "StopNotify",
+				NULL, NULL, NULL, func, NULL, user_data);
+}
+
+/* The fd callback does not fit a sonic_call, carry it along */
+struct acquire_req {
+	sonic_fd_func_t func;
+	void *user_data;
+};
+
+/* Also the call result, so the scheduler can fail queued calls */
+static void acquire_result(const char *error, void *user_data)
+{
+	struct acquire_req *req = user_data;
+
+	req->func(error, -1, 0, req->user_data);
+	g_free(req);
+}
+
+static void acquire_reply(DBusMessage *message, void *user_data)
+{
+	struct sonic_call *call = user_data;
+	struct acquire_req *req = call->user_data;
+	DBusError error;
+	int fd;
+	uint16_t mtu;
+
+	dbus_error_init(&error);
+
+	if (dbus_set_error_from_message(&error, message) == TRUE) {
+		acquire_result(error.name, req);
+		dbus_error_free(&error);
+		return;
+	}
+
+	if (dbus_message_get_args(message, NULL, DBUS_TYPE_UNIX_FD, &fd,
+					DBUS_TYPE_UINT16, &mtu,
+					DBUS_TYPE_INVALID) == FALSE) {
+		acquire_result("org.bluez.Error.Failed", req);
+		return;
+	}
+
+	req->func(NULL, fd, mtu, req->user_data);
+	g_free(req);
+}
+
+static void acquire_setup(DBusMessageIter *iter, void *user_data)
+{
+	options_setup(iter);
+}
+
+bool sonic_attr_acquire(struct sonic_ctx *ctx, struct sonic_attr *attr,
+				bool write, sonic_fd_func_t func,
+				void *user_data)
+{
+	struct acquire_req *req;
+
+	if (!attr_is_char(attr) || !func)
+		return false;
+
+	req = g_new0(struct acquire_req, 1);
+	req->func = func;
+	req->user_data = user_data;
+
+	if (sonic_call_method(ctx, attr->proxy,
+				write ? "AcquireWrite" : "AcquireNotify",
+				acquire_setup, NULL, acquire_reply,
+				acquire_result, NULL, req))
+		return true;
+
+	g_free(req);
+	return false;
+}
+
+bool sonic_read(struct sonic_device *device, enum sonic_char chr,
+				sonic_value_func_t func, void *user_data)
+{
+	return sonic_attr_read(device->ctx, sonic_device_get_char(device, chr),
+							func, user_data);
+}
+
+bool sonic_write(struct sonic_device *device, enum sonic_char chr,
+				const uint8_t *value, size_t len,
+				sonic_result_func_t func, void *user_data)
+{
+	return sonic_attr_write(device->ctx,
+				sonic_device_get_char(device, chr),
+				value, len, func, user_data);
+}
+
+bool sonic_notify(struct sonic_device *device, enum sonic_char chr,
+				bool enable, sonic_result_func_t func,
+				void *user_data)
+{
+	return sonic_attr_notify(device->ctx,
+				sonic_device_get_char(device, chr),
+				enable, func, user_data);
+}
+
+bool sonic_acquire(struct sonic_device *device, enum sonic_char chr,
+				bool write, sonic_fd_func_t func,
+				void *user_data)
+{
+	return sonic_attr_acquire(device->ctx,
+				sonic_device_get_char(device, chr),
+				write, func, user_data);
+}
+
+struct profile_uuids {
+	char * const *uuids;
+	size_t count;
+};
+
+static void register_profile_setup(DBusMessageIter *iter, void *user_data)
+{
+	struct sonic_call *call = user_data;
+	const struct profile_uuids *p = call->setup_data;
+	DBusMessageIter uuids, opt;
+	const char *path = PROFILE_PATH;
+	size_t i;
+
+	dbus_message_iter_append_basic(iter, DBUS_TYPE_OBJECT_PATH, &path);
+
+	dbus_message_iter_open_container(iter, DBUS_TYPE_ARRAY, "s", &uuids);
+	for (i = 0; i < p->count; i++)
+		dbus_message_iter_append_basic(&uuids, DBUS_TYPE_STRING,
+							&p->uuids[i]);
+	dbus_message_iter_close_container(iter, &uuids);
+
+	dbus_message_iter_open_container(iter, DBUS_TYPE_ARRAY,
+					DBUS_DICT_ENTRY_BEGIN_CHAR_AS_STRING
+					DBUS_TYPE_STRING_AS_STRING
+					DBUS_TYPE_VARIANT_AS_STRING
+					DBUS_DICT_ENTRY_END_CHAR_AS_STRING,
+					&opt);
+	dbus_message_iter_close_container(iter, &opt);
+}
+
+static int match_proxy(const void *a, const void *b)
+{
+	GDBusProxy *proxy1 = (void *) a;
+	GDBusProxy *proxy2 = (void *) b;
+
+	return strcmp(g_dbus_proxy_get_path(proxy1),
+						g_dbus_proxy_get_path(proxy2));
+}
+
+static DBusMessage *release_profile(DBusConnection *conn,
+					DBusMessage *msg, void *user_data)
+{
+	g_dbus_unregister_interface(conn, PROFILE_PATH, PROFILE_INTERFACE);
+
+	return dbus_message_new_method_return(msg);
+}
+
+static const GDBusMethodTable methods[] = {
+	{ GDBUS_METHOD("Release", NULL, NULL, release_profile) },
+	{ }
+};
+
+bool sonic_register_profile(struct sonic_adapter *adapter,
+				char * const *uuids, size_t count,
+				sonic_result_func_t func, void *user_data)
+{
+	struct sonic_ctx *ctx = adapter->ctx;
+	struct profile_uuids p = { uuids, count };
+	GList *l;
+
+	l = g_list_find_custom(ctx->managers, adapter->proxy, match_proxy);
+	if (!l)
+		return false;
+
+	if (g_dbus_register_interface(ctx->conn, PROFILE_PATH,
+					PROFILE_INTERFACE, methods,
+					NULL, NULL, NULL, NULL) == FALSE)
+		return false;
+
+	if (sonic_call_method(ctx, l->data, "RegisterProfile",
+					register_profile_setup, &p, NULL,
+					func, NULL, user_data))
+		return true;
+
+	g_dbus_unregister_interface(ctx->conn, PROFILE_PATH,
+						PROFILE_INTERFACE);
+	return false;
+}
+
+static void unregister_profile_reply(DBusMessage *message, void *user_data)
+{
+	struct sonic_call *call = user_data;
+	DBusError error;
+
+	dbus_error_init(&error);
+
+	if (dbus_set_error_from_message(&error, message) == TRUE) {
+		if (call->result)
+			call->result(error.name, call->user_data);
+		dbus_error_free(&error);
+		return;
+	}
+
+	g_dbus_unregister_interface(call->ctx->conn, PROFILE_PATH,
+							PROFILE_INTERFACE);
+
+	if (call->result)
+		call->result(NULL, call->user_data);
+}
+
+static void unregister_profile_setup(DBusMessageIter *iter, void *user_data)
+{
+	const char *path = PROFILE_PATH;
+
+	dbus_message_iter_append_basic(iter, DBUS_TYPE_OBJECT_PATH, &path);
+}
+
+bool sonic_unregister_profile(struct sonic_adapter *adapter,
+				sonic_result_func_t func, void *user_data)
+{
+	struct sonic_ctx *ctx = adapter->ctx;
+	GList *l;
+
+	l = g_list_find_custom(ctx->managers, adapter->proxy, match_proxy);
+	if (!l)
+		return false;
+
+	return sonic_call_method(ctx, l->data, "UnregisterProfile",
+					unregister_profile_setup, NULL,
+					unregister_profile_reply,
+					func, NULL, user_data);
+}
@@ -0,0 +1,315 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <glib.h>
+
+#include "sonic-private.h"
+
+#define INVENTORY_MAGIC		"SNCI"
+#define INVENTORY_VERSION	1
+#define INVENTORY_CAPACITY	256
+
+/*
+ * On disk layout: a header followed by a fixed array of entries. The file
+ * is sized for INVENTORY_CAPACITY entries up front and updated in place
+ * through the mapping; the kernel writes it back. A single writer is
+ * assumed.
+ */
+struct inventory_header {
+	char magic[4];
+	uint16_t version;
+	uint16_t entry_size;
+	uint32_t capacity;
+	uint32_t count;
+};
+
+struct inventory_file {
+	struct inventory_header hdr;
+	struct sonic_inventory_entry entries[INVENTORY_CAPACITY];
+};
+
+struct sonic_inventory {
+	int fd;
+	struct inventory_file *file;
+};
+
+static void inventory_reset(struct inventory_file *file)
+{
+	memset(file, 0, sizeof(*file));
+	memcpy(file->hdr.magic, INVENTORY_MAGIC, sizeof(file->hdr.magic));
+	file->hdr.version = INVENTORY_VERSION;
+	file->hdr.entry_size = sizeof(struct sonic_inventory_entry);
+	file->hdr.capacity = INVENTORY_CAPACITY;
+}
+
+static bool inventory_valid(const struct inventory_file *file)
+{
+	return !memcmp(file->hdr.magic, INVENTORY_MAGIC,
+						sizeof(file->hdr.magic)) &&
+		file->hdr.version == INVENTORY_VERSION &&
+		file->hdr.entry_size == sizeof(struct sonic_inventory_entry) &&
+		file->hdr.capacity == INVENTORY_CAPACITY &&
+		file->hdr.count <= INVENTORY_CAPACITY;
+}
+
+bool sonic_inventory_open(struct sonic_ctx *ctx, const char *path)
+{
+	struct sonic_inventory *inv;
+	struct stat st;
+	void *map;
+	int fd;
+
+	sonic_inventory_close(ctx);
+
+	fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (fd < 0)
+		return false;
+
+	if (fstat(fd, &st) < 0)
+		goto fail;
+
+	if (st.st_size != sizeof(struct inventory_file) &&
+			ftruncate(fd, sizeof(struct inventory_file)) < 0)
+		goto fail;
+
+	map = mmap(NULL, sizeof(struct inventory_file), PROT_READ | PROT_WRITE,
+							MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+		goto fail;
+
+	inv = g_new0(struct sonic_inventory, 1);
+	inv->fd = fd;
+	inv->file = map;
+
+	/* New, truncated or foreign files start out empty */
+	if (!inventory_valid(inv->file))
+		inventory_reset(inv->file);
+
+	ctx->inventory = inv;
+
+	return true;
+
+fail:
+	close(fd);
+	return false;
+}
+
+void sonic_inventory_close(struct sonic_ctx *ctx)
+{
+	struct sonic_inventory *inv = ctx->inventory;
+
+	if (!inv)
+		return;
+
+	msync(inv->file, sizeof(struct inventory_file), MS_ASYNC);
+	munmap(inv->file, sizeof(struct inventory_file));
+	close(inv->fd);
+	g_free(inv);
+
+	ctx->inventory = NULL;
+}
+
+unsigned int sonic_inventory_count(struct sonic_ctx *ctx)
+{
+	if (!ctx->inventory)
+		return 0;
+
+	return ctx->inventory->file->hdr.count;
+}
+
+const struct sonic_inventory_entry *sonic_inventory_get(struct sonic_ctx *ctx,
+							unsigned int index)
+{
+	if (index >= sonic_inventory_count(ctx))
+		return NULL;
+
+	return &ctx->inventory->file->entries[index];
+}
+
+static struct sonic_inventory_entry *inventory_lookup(struct sonic_ctx *ctx,
+							const char *address)
+{
+	struct inventory_file *file;
+	unsigned int i;
+
+	if (!ctx->inventory || !address)
+		return NULL;
+
+	file = ctx->inventory->file;
+
+	for (i = 0; i < file->hdr.count; i++) {
+		if (!strcasecmp(file->entries[i].address, address))
+			return &file->entries[i];
+	}
+
+	return NULL;
+}
+
+const struct sonic_inventory_entry *sonic_inventory_find(struct sonic_ctx *ctx,
+							const char *address)
+{
+	return inventory_lookup(ctx, address);
+}
+
+/*
+ * Find the entry for device. Only devices we have been connected or
+ * paired to, or whose buzzer characteristics resolved, get a new entry
+ * (create), so discovery of unrelated devices does not churn the file.
+ * When full, the stalest entry is recycled.
+ */
+static struct sonic_inventory_entry *inventory_entry(struct sonic_device *device,
+								bool create)
+{
+	struct sonic_ctx *ctx = device->ctx;
+	struct sonic_inventory_entry *entry;
+	struct inventory_file *file;
+	const char *address;
+	unsigned int i;
+
+	if (!ctx->inventory)
+		return NULL;
+
+	address = sonic_device_get_address(device);
+	if (!address)
+		return NULL;
+
+	entry = inventory_lookup(ctx, address);
+	if (entry || !create)
+		return entry;
+
+	file = ctx->inventory->file;
+
+	if (file->hdr.count < file->hdr.capacity) {
+		entry = &file->entries[file->hdr.count++];
+	} else {
+		entry = &file->entries[0];
+
+		for (i = 1; i < file->hdr.count; i++) {
+			if (file->entries[i].last_seen < entry->last_seen)
+				entry = &file->entries[i];
+		}
+	}
+
+	memset(entry, 0, sizeof(*entry));
+	g_strlcpy(entry->address, address, sizeof(entry->address));
+
+	return entry;
+}
+
+static void set_flag(struct sonic_inventory_entry *entry, uint8_t flag,
+								bool set)
+{
+	if (set)
+		entry->flags |= flag;
+	else
+		entry->flags &= ~flag;
+}
+
+void sonic_inventory_update(struct sonic_device *device)
+{
+	struct sonic_inventory_entry *entry;
+	DBusMessageIter iter;
+	const char *str;
+	dbus_int16_t rssi;
+
+	entry = inventory_entry(device, sonic_device_is_paired(device) ||
+					sonic_device_is_connected(device));
+	if (!entry)
+		return;
+
+	entry->last_seen = time(NULL);
+
+	str = sonic_device_get_alias(device);
+	if (str)
+		g_strlcpy(entry->alias, str, sizeof(entry->alias));
+
+	set_flag(entry, SONIC_INVENTORY_PAIRED,
+					sonic_device_is_paired(device));
+
+	if (g_dbus_proxy_get_property(device->proxy, "AddressType", &iter)) {
+		dbus_message_iter_get_basic(&iter, &str);
+		set_flag(entry, SONIC_INVENTORY_RANDOM, !strcmp(str, "random"));
+	}
+
+	if (g_dbus_proxy_get_property(device->proxy, "RSSI", &iter)) {
+		dbus_message_iter_get_basic(&iter, &rssi);
+		entry->rssi = rssi;
+	}
+}
+
+void sonic_inventory_property(struct sonic_device *device, const char *name,
+							DBusMessageIter *iter)
+{
+	struct sonic_inventory_entry *entry;
+	const char *str;
+	dbus_int16_t rssi;
+	dbus_bool_t val = FALSE;
+
+	if (!device->ctx->inventory || !iter)
+		return;
+
+	if (!strcmp(name, "Paired") || !strcmp(name, "Connected"))
+		dbus_message_iter_get_basic(iter, &val);
+	else if (strcmp(name, "RSSI") && strcmp(name, "Alias"))
+		return;
+
+	entry = inventory_entry(device, val == TRUE);
+	if (!entry)
+		return;
+
+	entry->last_seen = time(NULL);
+
+	if (!strcmp(name, "RSSI")) {
+		dbus_message_iter_get_basic(iter, &rssi);
+		entry->rssi = rssi;
+	} else if (!strcmp(name, "Alias")) {
+		dbus_message_iter_get_basic(iter, &str);
+		g_strlcpy(entry->alias, str, sizeof(entry->alias));
+	} else if (!strcmp(name, "Paired")) {
+		set_flag(entry, SONIC_INVENTORY_PAIRED, val);
+	}
+}
+
+/* BlueZ names characteristic objects after their handle: .../charXXXX */
+void sonic_inventory_set_handle(struct sonic_device *device,
+				enum sonic_char chr, GDBusProxy *proxy)
+{
+	struct sonic_inventory_entry *entry;
+	const char *name;
+
+	if (!device->ctx->inventory || chr >= SONIC_CHAR_MAX)
+		return;
+
+	name = strrchr(g_dbus_proxy_get_path(proxy), '/');
+	if (!name || strncmp(name, "/char", 5))
+		return;
+
+	entry = inventory_entry(device, true);
+	if (!entry)
+		return;
+
+	entry->handles[chr] = strtoul(name + 5, NULL, 16);
+}
+
+void sonic_inventory_set_firmware(struct sonic_device *device,
+							const char *firmware)
+{
+	struct sonic_inventory_entry *entry = inventory_entry(device, true);
+
+	if (!entry || !firmware)
+		return;
+
+	g_strlcpy(entry->firmware, firmware, sizeof(entry->firmware));
+}
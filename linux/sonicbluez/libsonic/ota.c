@@ -0,0 +1,392 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include "sonic-private.h"
+
+/* OTA wire protocol v2, must match ota_proto.h in the firmware */
+#define OTA_MAGIC		"SOTA"
+#define OTA_VERSION		2
+#define OTA_HELLO_LEN		44
+#define OTA_DATA_HDR_LEN	12
+#define OTA_ACK_LEN		8
+#define OTA_FRAME_MAX		512	/* ATT value limit */
+#define OTA_TIMEOUT		10	/* seconds without an ack, then fail */
+
+enum ota_status {
+	OTA_ST_OK,
+	OTA_ST_RESEND,
+	OTA_ST_DONE,
+	OTA_ST_FAIL,
+};
+
+/*
+ * One transfer. Frames go out as writes without response on the
+ * acquired write socket, acks come back as notifications on the
+ * acquired notify socket, so neither passes through bluetoothd's D-Bus
+ * queue. Frames are sent ahead of the last ack up to the window the
+ * device announced; a full socket buffer parks the sender on G_IO_OUT.
+ */
+struct sonic_ota {
+	struct sonic_device *device;
+	const uint8_t *data;
+	uint32_t size;
+	uint8_t hello[OTA_HELLO_LEN];
+	uint16_t chunk;
+
+	GIOChannel *write_io;
+	GIOChannel *notify_io;
+	guint write_watch;
+	guint notify_watch;
+	guint timeout;
+
+	bool started;
+	uint32_t acked;
+	uint32_t next;
+	uint32_t window;
+
+	sonic_progress_func_t progress;
+	sonic_result_func_t func;
+	void *user_data;
+};
+
+uint32_t sonic_ota_crc32(const uint8_t *buf, size_t len)
+{
+	uint32_t crc = 0xffffffff;
+	int k;
+
+	while (len--) {
+		crc ^= *buf++;
+		for (k = 0; k < 8; k++)
+			crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+	}
+
+	return ~crc;
+}
+
+static void put_be32(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+static uint32_t get_be32(const uint8_t *p)
+{
+	return ((uint32_t) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static void io_free(GIOChannel **io, guint *watch)
+{
+	if (*watch)
+		g_source_remove(*watch);
+	*watch = 0;
+
+	/* Closes the socket, see io_new */
+	if (*io)
+		g_io_channel_unref(*io);
+	*io = NULL;
+}
+
+static void ota_finish(struct sonic_ota *ota, const char *error)
+{
+	io_free(&ota->write_io, &ota->write_watch);
+	io_free(&ota->notify_io, &ota->notify_watch);
+
+	if (ota->timeout)
+		g_source_remove(ota->timeout);
+
+	if (ota->func)
+		ota->func(error, ota->user_data);
+
+	g_free(ota);
+}
+
+static gboolean ota_stalled(gpointer user_data)
+{
+	struct sonic_ota *ota = user_data;
+
+	ota->timeout = 0;
+	ota_finish(ota, "org.bluez.Error.Failed");
+
+	return FALSE;
+}
+
+static void ota_kick(struct sonic_ota *ota)
+{
+	if (ota->timeout)
+		g_source_remove(ota->timeout);
+
+	ota->timeout = g_timeout_add_seconds(OTA_TIMEOUT, ota_stalled, ota);
+}
+
+/* 0 sent, 1 socket full, -1 error */
+static int ota_send(struct sonic_ota *ota, const uint8_t *buf, size_t len)
+{
+	int fd = g_io_channel_unix_get_fd(ota->write_io);
+	ssize_t ret;
+
+	/* SOCK_SEQPACKET, each write is one ATT write */
+	ret = write(fd, buf, len);
+	if (ret == (ssize_t) len)
+		return 0;
+
+	if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		return 1;
+
+	return -1;
+}
+
+static int ota_send_frame(struct sonic_ota *ota)
+{
+	uint8_t frame[OTA_FRAME_MAX];
+	uint32_t len = MIN(ota->chunk, ota->size - ota->next);
+	int ret;
+
+	put_be32(frame, ota->next / ota->chunk);
+	frame[4] = len >> 8;
+	frame[5] = len;
+	frame[6] = 0;
+	frame[7] = 0;
+	put_be32(frame + 8, sonic_ota_crc32(ota->data + ota->next, len));
+	memcpy(frame + OTA_DATA_HDR_LEN, ota->data + ota->next, len);
+
+	ret = ota_send(ota, frame, OTA_DATA_HDR_LEN + len);
+	if (!ret)
+		ota->next += len;
+
+	return ret;
+}
+
+static gboolean write_ready(GIOChannel *io, GIOCondition cond,
+							gpointer user_data);
+
+/* false once the transfer is over (and ota freed) */
+static bool ota_pump(struct sonic_ota *ota)
+{
+	int ret = 0;
+
+	while (ota->next < ota->size && ota->next - ota->acked < ota->window) {
+		ret = ota_send_frame(ota);
+		if (ret)
+			break;
+	}
+
+	if (ret < 0) {
+		ota_finish(ota, "org.bluez.Error.Failed");
+		return false;
+	}
+
+	if (ret > 0 && !ota->write_watch)
+		ota->write_watch = g_io_add_watch(ota->write_io,
+						G_IO_OUT | G_IO_HUP | G_IO_ERR,
+						write_ready, ota);
+
+	return true;
+}
+
+static gboolean write_ready(GIOChannel *io, GIOCondition cond,
+							gpointer user_data)
+{
+	struct sonic_ota *ota = user_data;
+
+	ota->write_watch = 0;
+
+	if (cond & (G_IO_HUP | G_IO_ERR)) {
+		ota_finish(ota, "org.bluez.Error.NotConnected");
+		return FALSE;
+	}
+
+	ota_pump(ota);
+
+	return FALSE;
+}
+
+/* false once the transfer is over (and ota freed) */
+static bool ota_ack(struct sonic_ota *ota, const uint8_t *ack)
+{
+	uint32_t offset = get_be32(ack + 4);
+	uint32_t acked = ota->acked;
+
+	ota_kick(ota);
+
+	if (!ota->started) {
+		ota->window = ((ack[2] << 8) | ack[3]) * ota->chunk;
+		if (ack[0] != OTA_ST_OK || offset > ota->size || !ota->window) {
+			ota_finish(ota, "org.bluez.Error.NotPermitted");
+			return false;
+		}
+
+		ota->started = true;
+		ota->acked = ota->next = offset;
+	} else {
+		switch (ack[0]) {
+		case OTA_ST_OK:
+			if (offset > ota->acked && offset <= ota->next)
+				ota->acked = offset;
+			break;
+		case OTA_ST_RESEND:
+			if (offset > ota->size) {
+				ota_finish(ota, "org.bluez.Error.Failed");
+				return false;
+			}
+			ota->acked = ota->next = offset;
+			break;
+		case OTA_ST_DONE:
+			if (ota->progress)
+				ota->progress(ota->size, ota->size,
+							ota->user_data);
+			ota_finish(ota, NULL);
+			return false;
+		default:
+			ota_finish(ota, "org.bluez.Error.Failed");
+			return false;
+		}
+	}
+
+	if (ota->progress && ota->acked != acked)
+		ota->progress(ota->acked, ota->size, ota->user_data);
+
+	/* A parked sender resumes from its watch */
+	if (ota->write_watch)
+		return true;
+
+	return ota_pump(ota);
+}
+
+/* Removing a watch from its own callback is fine, see ota_finish */
+static gboolean notify_ready(GIOChannel *io, GIOCondition cond,
+							gpointer user_data)
+{
+	struct sonic_ota *ota = user_data;
+	uint8_t ack[OTA_FRAME_MAX];
+	ssize_t len;
+
+	if (cond & (G_IO_HUP | G_IO_ERR)) {
+		ota_finish(ota, "org.bluez.Error.NotConnected");
+		return FALSE;
+	}
+
+	len = read(g_io_channel_unix_get_fd(io), ack, sizeof(ack));
+	if (len < 0 && (errno == EAGAIN || errno == EINTR))
+		return TRUE;
+
+	if (len != OTA_ACK_LEN) {
+		ota_finish(ota, "org.bluez.Error.Failed");
+		return FALSE;
+	}
+
+	return ota_ack(ota, ack) ? TRUE : FALSE;
+}
+
+static GIOChannel *io_new(int fd)
+{
+	GIOChannel *io = g_io_channel_unix_new(fd);
+
+	g_io_channel_set_close_on_unref(io, TRUE);
+	g_io_channel_set_encoding(io, NULL, NULL);
+	g_io_channel_set_buffered(io, FALSE);
+	g_io_channel_set_flags(io, G_IO_FLAG_NONBLOCK, NULL);
+
+	return io;
+}
+
+static void acquire_write_reply(const char *error, int fd, uint16_t mtu,
+							void *user_data)
+{
+	struct sonic_ota *ota = user_data;
+
+	if (error) {
+		ota_finish(ota, error);
+		return;
+	}
+
+	/* mtu is the ATT MTU, a write without response takes mtu - 3 */
+	if (mtu < 3 + OTA_DATA_HDR_LEN + 1) {
+		close(fd);
+		ota_finish(ota, "org.bluez.Error.NotSupported");
+		return;
+	}
+
+	/* Full frames fill the ATT value, the rest is the frame header */
+	ota->chunk = MIN(mtu - 3, OTA_FRAME_MAX) - OTA_DATA_HDR_LEN;
+	ota->hello[6] = ota->chunk >> 8;
+	ota->hello[7] = ota->chunk;
+	ota->write_io = io_new(fd);
+
+	/* Same hello after a failure resumes */
+	if (ota_send(ota, ota->hello, sizeof(ota->hello))) {
+		ota_finish(ota, "org.bluez.Error.Failed");
+		return;
+	}
+
+	ota_kick(ota);
+}
+
+static void acquire_notify_reply(const char *error, int fd, uint16_t mtu,
+							void *user_data)
+{
+	struct sonic_ota *ota = user_data;
+	bool ret;
+
+	if (error) {
+		ota_finish(ota, error);
+		return;
+	}
+
+	ota->notify_io = io_new(fd);
+	ota->notify_watch = g_io_add_watch(ota->notify_io,
+					G_IO_IN | G_IO_HUP | G_IO_ERR,
+					notify_ready, ota);
+
+	/* Subscribed, acks can't get lost between the hello and here */
+	ret = sonic_acquire(ota->device, SONIC_CHAR_OTA, true,
+						acquire_write_reply, ota);
+	if (!ret)
+		ota_finish(ota, "org.bluez.Error.NotAvailable");
+}
+
+bool sonic_ota_start(struct sonic_device *device, const uint8_t *data,
+				uint32_t size, sonic_progress_func_t progress,
+				sonic_result_func_t func, void *user_data)
+{
+	struct sonic_ota *ota;
+	GChecksum *sum;
+	gsize sum_len = 32;
+
+	if (!data || !size || !sonic_device_get_char(device, SONIC_CHAR_OTA))
+		return false;
+
+	ota = g_new0(struct sonic_ota, 1);
+	ota->device = device;
+	ota->data = data;
+	ota->size = size;
+	ota->progress = progress;
+	ota->func = func;
+	ota->user_data = user_data;
+
+	memcpy(ota->hello, OTA_MAGIC, 4);
+	ota->hello[4] = OTA_VERSION;
+	put_be32(ota->hello + 8, size);
+
+	sum = g_checksum_new(G_CHECKSUM_SHA256);
+	g_checksum_update(sum, data, size);
+	g_checksum_get_digest(sum, ota->hello + 12, &sum_len);
+	g_checksum_free(sum);
+
+	if (sonic_acquire(device, SONIC_CHAR_OTA, false,
+					acquire_notify_reply, ota))
+		return true;
+
+	g_free(ota);
+	return false;
+}
@@ -0,0 +1,493 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <glib.h>
+
+#include "sonic-private.h"
+
+#define POOL_TICK_SECONDS	2
+#define POOL_RETRY_MAX		60	/* seconds */
+#define POOL_HALF_LIFE		(10 * 60 * G_USEC_PER_SEC)
+#define POOL_HISTORY		4	/* entries kept per connection slot */
+
+/*
+ * Connection pool. Devices are tracked by address so an entry outlives
+ * the bluetoothd object (and can be reconnected from the inventory).
+ * Entries are kept most recently used first. At most limit of them are
+ * held connected; beyond that the least recently used are disconnected
+ * and remembered as evicted. A periodic tick reconnects pooled devices
+ * that dropped (keep-alive) and, whenever a slot is free, brings back
+ * the evicted entry most likely to be used next.
+ */
+struct pool_waiter {
+	sonic_result_func_t func;
+	void *user_data;
+};
+
+struct pool_entry {
+	struct sonic_pool *pool;
+	char address[18];
+	unsigned int uses;
+	gint64 last_used;
+	bool evicted;
+	bool connecting;
+	unsigned int failures;
+	gint64 retry_at;
+	GSList *waiters;
+};
+
+struct sonic_pool {
+	struct sonic_ctx *ctx;
+	unsigned int limit;
+	GQueue entries;
+	guint tick;
+};
+
+static struct pool_entry *pool_lookup(struct sonic_pool *pool,
+							const char *address)
+{
+	GList *l;
+
+	for (l = pool->entries.head; l; l = l->next) {
+		struct pool_entry *entry = l->data;
+
+		if (!strcasecmp(entry->address, address))
+			return entry;
+	}
+
+	return NULL;
+}
+
+static void entry_complete(struct pool_entry *entry, const char *error)
+{
+	GSList *waiters = entry->waiters, *l;
+
+	entry->waiters = NULL;
+
+	for (l = waiters; l; l = l->next) {
+		struct pool_waiter *waiter = l->data;
+
+		if (waiter->func)
+			waiter->func(error, waiter->user_data);
+	}
+
+	g_slist_free_full(waiters, g_free);
+}
+
+static void entry_free(void *data)
+{
+	struct pool_entry *entry = data;
+
+	entry_complete(entry, "org.bluez.Error.Canceled");
+	g_free(entry);
+}
+
+static bool entry_connected(struct pool_entry *entry,
+						struct sonic_device **device)
+{
+	*device = sonic_find_device(entry->pool->ctx, entry->address);
+
+	return *device && sonic_device_is_connected(*device);
+}
+
+/*
+ * Slots taken by pool entries: connected, being connected, or asked for
+ * and about to connect. Other peripherals don't count.
+ */
+static unsigned int pool_connected(struct sonic_pool *pool)
+{
+	unsigned int count = 0;
+	GList *l;
+
+	for (l = pool->entries.head; l; l = l->next) {
+		struct pool_entry *entry = l->data;
+		struct sonic_device *device;
+
+		if (entry->connecting || entry->waiters ||
+					entry_connected(entry, &device))
+			count++;
+	}
+
+	return count;
+}
+
+/* Pool and entries may go away while a connect is pending */
+struct pool_connect {
+	struct sonic_ctx *ctx;
+	char address[18];
+};
+
+static void connect_reply(const char *error, void *user_data)
+{
+	struct pool_connect *req = user_data;
+	struct pool_entry *entry = NULL;
+	struct sonic_device *device;
+
+	if (req->ctx->pool)
+		entry = pool_lookup(req->ctx->pool, req->address);
+
+	g_free(req);
+
+	if (!entry || !entry->connecting)
+		return;
+
+	entry->connecting = false;
+
+	if (!error) {
+		entry->failures = 0;
+
+		/* Otherwise completed once ServicesResolved flips */
+		if (entry_connected(entry, &device) &&
+					sonic_device_is_resolved(device))
+			entry_complete(entry, NULL);
+		return;
+	}
+
+	entry->failures++;
+	entry->retry_at = g_get_monotonic_time() +
+			MIN(1 << MIN(entry->failures, 6), POOL_RETRY_MAX) *
+							G_USEC_PER_SEC;
+	entry_complete(entry, error);
+}
+
+static bool entry_connect(struct pool_entry *entry)
+{
+	struct sonic_pool *pool = entry->pool;
+	const struct sonic_inventory_entry *cached;
+	struct sonic_adapter *adapter;
+	struct sonic_device *device;
+	struct pool_connect *req;
+	bool ret = false;
+
+	if (entry->connecting)
+		return true;
+
+	req = g_new0(struct pool_connect, 1);
+	req->ctx = pool->ctx;
+	g_strlcpy(req->address, entry->address, sizeof(req->address));
+
+	device = sonic_find_device(pool->ctx, entry->address);
+	if (device) {
+		ret = sonic_device_connect(device, connect_reply, req);
+	} else {
+		adapter = sonic_get_default_adapter(pool->ctx);
+		cached = sonic_inventory_find(pool->ctx, entry->address);
+
+		if (adapter && cached)
+			ret = sonic_adapter_connect_address(adapter,
+				entry->address,
+				cached->flags & SONIC_INVENTORY_RANDOM,
+				connect_reply, req);
+	}
+
+	if (!ret) {
+		g_free(req);
+		return false;
+	}
+
+	entry->connecting = true;
+	entry->evicted = false;
+
+	return true;
+}
+
+/* Disconnect least recently used entries until within the limit */
+static void pool_evict(struct sonic_pool *pool)
+{
+	unsigned int connected = pool_connected(pool);
+	GList *l;
+
+	for (l = pool->entries.tail; l && connected > pool->limit;
+							l = l->prev) {
+		struct pool_entry *entry = l->data;
+		struct sonic_device *device;
+
+		/* Never evict the entry just asked for */
+		if (l == pool->entries.head)
+			break;
+
+		if (entry->waiters || !entry_connected(entry, &device))
+			continue;
+
+		if (sonic_device_disconnect(device, NULL, NULL)) {
+			entry->evicted = true;
+			connected--;
+		}
+	}
+}
+
+/* Forget the oldest entries nobody is connected to or waiting on */
+static void pool_trim(struct sonic_pool *pool)
+{
+	unsigned int max = MAX(pool->limit, 1) * POOL_HISTORY;
+	GList *l = pool->entries.tail;
+
+	while (l && pool->entries.length > max) {
+		struct pool_entry *entry = l->data;
+		struct sonic_device *device;
+		GList *prev = l->prev;
+
+		if (!entry->waiters && !entry->connecting &&
+					!entry_connected(entry, &device)) {
+			g_queue_delete_link(&pool->entries, l);
+			entry_free(entry);
+		}
+
+		l = prev;
+	}
+}
+
+/* Frequency decayed by recency: higher means more likely needed again */
+static double entry_score(struct pool_entry *entry, gint64 now)
+{
+	double age = (double) (now - entry->last_used) / POOL_HALF_LIFE;
+
+	return entry->uses / (1.0 + age * age);
+}
+
+static gboolean pool_tick(gpointer user_data)
+{
+	struct sonic_pool *pool = user_data;
+	unsigned int connected = pool_connected(pool);
+	gint64 now = g_get_monotonic_time();
+	struct pool_entry *best = NULL;
+	double best_score = 0;
+	GList *l;
+
+	if (connected >= pool->limit)
+		return TRUE;
+
+	for (l = pool->entries.head; l; l = l->next) {
+		struct pool_entry *entry = l->data;
+		struct sonic_device *device;
+		double score;
+
+		if (entry->connecting || entry->retry_at > now ||
+					entry_connected(entry, &device))
+			continue;
+
+		score = entry_score(entry, now);
+
+		/* Dropped connections (not evicted) come back first */
+		if (!entry->evicted)
+			score += 1e6;
+
+		if (!best || score > best_score) {
+			best = entry;
+			best_score = score;
+		}
+	}
+
+	/* One at a time, the controller serializes connection setup anyway */
+	if (best) {
+		enum sonic_prio prio = sonic_set_priority(pool->ctx,
+							SONIC_PRIO_BULK);
+
+		entry_connect(best);
+		sonic_set_priority(pool->ctx, prio);
+	}
+
+	return TRUE;
+}
+
+static struct sonic_pool *pool_get(struct sonic_ctx *ctx)
+{
+	struct sonic_pool *pool = ctx->pool;
+
+	if (pool)
+		return pool;
+
+	pool = g_new0(struct sonic_pool, 1);
+	pool->ctx = ctx;
+	g_queue_init(&pool->entries);
+	ctx->pool = pool;
+
+	return pool;
+}
+
+void sonic_pool_set_limit(struct sonic_ctx *ctx, unsigned int limit)
+{
+	struct sonic_pool *pool;
+
+	if (!limit) {
+		sonic_pool_free(ctx);
+		return;
+	}
+
+	pool = pool_get(ctx);
+	pool->limit = limit;
+
+	if (!pool->tick)
+		pool->tick = g_timeout_add_seconds(POOL_TICK_SECONDS,
+							pool_tick, pool);
+
+	pool_evict(pool);
+	pool_trim(pool);
+}
+
+unsigned int sonic_pool_get_limit(struct sonic_ctx *ctx)
+{
+	return ctx->pool ? ctx->pool->limit : 0;
+}
+
+static struct pool_entry *pool_use(struct sonic_pool *pool,
+							const char *address)
+{
+	struct pool_entry *entry = pool_lookup(pool, address);
+	char *p;
+
+	if (entry) {
+		g_queue_remove(&pool->entries, entry);
+	} else {
+		entry = g_new0(struct pool_entry, 1);
+		entry->pool = pool;
+		/* Same form as bluetoothd reports it */
+		g_strlcpy(entry->address, address, sizeof(entry->address));
+		for (p = entry->address; *p; p++)
+			*p = g_ascii_toupper(*p);
+	}
+
+	g_queue_push_head(&pool->entries, entry);
+
+	entry->uses++;
+	entry->last_used = g_get_monotonic_time();
+	entry->retry_at = 0;
+
+	return entry;
+}
+
+void sonic_pool_touch(struct sonic_ctx *ctx, const char *address)
+{
+	if (!ctx->pool || !address)
+		return;
+
+	pool_use(ctx->pool, address);
+	pool_trim(ctx->pool);
+}
+
+bool sonic_pool_acquire(struct sonic_ctx *ctx, const char *address,
+				sonic_result_func_t func, void *user_data)
+{
+	struct sonic_pool *pool = ctx->pool;
+	struct pool_entry *entry;
+	struct pool_waiter *waiter;
+	struct sonic_device *device;
+
+	if (!pool || !address)
+		return false;
+
+	entry = pool_use(pool, address);
+
+	if (entry_connected(entry, &device) &&
+				sonic_device_is_resolved(device)) {
+		entry->evicted = false;
+		if (func)
+			func(NULL, user_data);
+		pool_trim(pool);
+		return true;
+	}
+
+	waiter = g_new0(struct pool_waiter, 1);
+	waiter->func = func;
+	waiter->user_data = user_data;
+	entry->waiters = g_slist_append(entry->waiters, waiter);
+
+	/* Make room for it before the controller is asked for another link */
+	pool_evict(pool);
+
+	if (!entry->connecting && !(device &&
+				sonic_device_is_connected(device)) &&
+				!entry_connect(entry)) {
+		entry->waiters = g_slist_remove(entry->waiters, waiter);
+		g_free(waiter);
+		pool_trim(pool);
+		return false;
+	}
+
+	pool_trim(pool);
+
+	return true;
+}
+
+void sonic_pool_release(struct sonic_ctx *ctx, const char *address)
+{
+	struct pool_entry *entry;
+
+	if (!ctx->pool || !address)
+		return;
+
+	entry = pool_lookup(ctx->pool, address);
+	if (!entry)
+		return;
+
+	g_queue_remove(&ctx->pool->entries, entry);
+	entry_free(entry);
+}
+
+GList *sonic_pool_get_addresses(struct sonic_ctx *ctx)
+{
+	GList *list = NULL, *l;
+
+	if (!ctx->pool)
+		return NULL;
+
+	for (l = ctx->pool->entries.head; l; l = l->next) {
+		struct pool_entry *entry = l->data;
+
+		list = g_list_append(list, entry->address);
+	}
+
+	return list;
+}
+
+void sonic_pool_device_changed(struct sonic_device *device, const char *name,
+							DBusMessageIter *iter)
+{
+	struct sonic_pool *pool = device->ctx->pool;
+	struct pool_entry *entry;
+	dbus_bool_t value;
+
+	if (!pool || !iter)
+		return;
+
+	if (strcmp(name, "ServicesResolved"))
+		return;
+
+	entry = pool_lookup(pool, sonic_device_get_address(device));
+	if (!entry)
+		return;
+
+	dbus_message_iter_get_basic(iter, &value);
+	if (value == FALSE)
+		return;
+
+	entry->connecting = false;
+	entry->failures = 0;
+	entry_complete(entry, NULL);
+
+	/* Links not set up through acquire (keep-alive, other clients) */
+	pool_evict(pool);
+}
+
+void sonic_pool_free(struct sonic_ctx *ctx)
+{
+	struct sonic_pool *pool = ctx->pool;
+
+	if (!pool)
+		return;
+
+	if (pool->tick)
+		g_source_remove(pool->tick);
+
+	while (!g_queue_is_empty(&pool->entries))
+		entry_free(g_queue_pop_head(&pool->entries));
+	g_free(pool);
+
+	ctx->pool = NULL;
+}
@@ -0,0 +1,455 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "sonic-private.h"
+
+/*
+ * Method call scheduler. Every call is assigned a priority class, each
+ * class has its own concurrency budget (calls in flight at bluetoothd).
+ * A call that fits its budget is issued right away; otherwise it waits
+ * in its class, queued per device and the devices per adapter, and is
+ * picked round robin across adapters, then devices, when a slot frees
+ * up. Classes are served in priority order.
+ *
+ * bluetoothd serializes ATT requests per device, so bulk and telemetry
+ * calls are additionally held back while their device has a call in
+ * flight. An interactive call thus waits behind at most one queued
+ * request per device, no matter how much bulk work is pending.
+ */
+static const unsigned int default_budget[SONIC_PRIO_MAX] = {
+	[SONIC_PRIO_INTERACTIVE]	= 4,
+	[SONIC_PRIO_CONTROL]		= 4,
+	[SONIC_PRIO_BULK]		= 2,
+	[SONIC_PRIO_TELEMETRY]		= 1,
+};
+
+/* Round robin queue: key is an adapter or device path */
+struct sched_queue {
+	char *key;
+	GQueue items;
+};
+
+struct sched_class {
+	unsigned int budget;
+	unsigned int active;
+	unsigned int queued;
+	GQueue adapters;	/* sched_queue of sched_queue of calls */
+};
+
+struct sonic_sched {
+	struct sonic_ctx *ctx;
+	struct sched_class classes[SONIC_PRIO_MAX];
+	GHashTable *busy;	/* device path -> calls in flight */
+	guint idle;
+};
+
+static struct sonic_sched *sched_get(struct sonic_ctx *ctx)
+{
+	struct sonic_sched *sched = ctx->sched;
+	int i;
+
+	if (sched)
+		return sched;
+
+	sched = g_new0(struct sonic_sched, 1);
+	sched->ctx = ctx;
+	sched->busy = g_hash_table_new_full(g_str_hash, g_str_equal,
+								g_free, NULL);
+
+	for (i = SONIC_PRIO_INTERACTIVE; i < SONIC_PRIO_MAX; i++) {
+		sched->classes[i].budget = default_budget[i];
+		g_queue_init(&sched->classes[i].adapters);
+	}
+
+	ctx->sched = sched;
+
+	return sched;
+}
+
+enum sonic_prio sonic_set_priority(struct sonic_ctx *ctx,
+						enum sonic_prio prio)
+{
+	enum sonic_prio old = ctx->prio;
+
+	ctx->prio = prio < SONIC_PRIO_MAX ? prio : SONIC_PRIO_DEFAULT;
+
+	return old;
+}
+
+void sonic_sched_set_budget(struct sonic_ctx *ctx, enum sonic_prio prio,
+							unsigned int budget)
+{
+	struct sonic_sched *sched;
+
+	if (prio == SONIC_PRIO_DEFAULT || prio >= SONIC_PRIO_MAX)
+		return;
+
+	sched = sched_get(ctx);
+	sched->classes[prio].budget = MAX(budget, 1);
+}
+
+static enum sonic_prio classify(struct sonic_ctx *ctx, const char *method)
+{
+	if (ctx->prio != SONIC_PRIO_DEFAULT)
+		return ctx->prio;
+
+	if (!strcmp(method, "StartNotify") || !strcmp(method, "StopNotify"))
+		return SONIC_PRIO_TELEMETRY;
+
+	return SONIC_PRIO_CONTROL;
+}
+
+/* /org/bluez/hci0/dev_XX/service000a/char000b -> depth components */
+static char *path_prefix(const char *path, int depth)
+{
+	const char *p = path;
+
+	while (depth-- > 0 && p) {
+		p = strchr(p + 1, '/');
+	}
+
+	return p ? g_strndup(path, p - path) : g_strdup(path);
+}
+
+static bool call_blocked(struct sonic_sched *sched, struct sonic_call *call)
+{
+	if (call->prio <= SONIC_PRIO_CONTROL)
+		return false;
+
+	return g_hash_table_lookup(sched->busy, call->device) != NULL;
+}
+
+static void sched_kick(struct sonic_sched *sched);
+
+static void call_done(void *data)
+{
+	struct sonic_call *call = data;
+	struct sonic_sched *sched = call->ctx->sched;
+	unsigned int busy;
+
+	if (sched) {
+		sched->classes[call->prio].active--;
+
+		busy = GPOINTER_TO_UINT(g_hash_table_lookup(sched->busy,
+							call->device));
+		if (busy > 1)
+			g_hash_table_insert(sched->busy,
+					g_strdup(call->device),
+					GUINT_TO_POINTER(busy - 1));
+		else
+			g_hash_table_remove(sched->busy, call->device);
+
+		sched_kick(sched);
+	}
+
+	sonic_call_free(call);
+}
+
+static bool call_dispatch(struct sonic_sched *sched, struct sonic_call *call,
+						GDBusSetupFunction setup)
+{
+	unsigned int busy;
+
+	if (g_dbus_proxy_method_call(call->proxy, call->method, setup,
+					call->reply, call, call_done) == FALSE)
+		return false;
+
+	sched->classes[call->prio].active++;
+
+	busy = GPOINTER_TO_UINT(g_hash_table_lookup(sched->busy, call->device));
+	g_hash_table_insert(sched->busy, g_strdup(call->device),
+						GUINT_TO_POINTER(busy + 1));
+
+	return true;
+}
+
+static void copy_args(DBusMessageIter *src, DBusMessageIter *dst)
+{
+	int type;
+
+	while ((type = dbus_message_iter_get_arg_type(src)) !=
+							DBUS_TYPE_INVALID) {
+		DBusMessageIter sub_src, sub_dst;
+		DBusBasicValue value;
+		char *sig = NULL;
+		const void *fixed;
+		int len;
+
+		if (dbus_type_is_basic(type)) {
+			dbus_message_iter_get_basic(src, &value);
+			dbus_message_iter_append_basic(dst, type, &value);
+			dbus_message_iter_next(src);
+			continue;
+		}
+
+		dbus_message_iter_recurse(src, &sub_src);
+
+		if (type == DBUS_TYPE_ARRAY) {
+			sig = dbus_message_iter_get_signature(src);
+			dbus_message_iter_open_container(dst, type, sig + 1,
+								&sub_dst);
+		} else if (type == DBUS_TYPE_VARIANT) {
+			sig = dbus_message_iter_get_signature(&sub_src);
+			dbus_message_iter_open_container(dst, type, sig,
+								&sub_dst);
+		} else {
+			dbus_message_iter_open_container(dst, type, NULL,
+								&sub_dst);
+		}
+
+		/* Attribute values, copy them in one go */
+		if (type == DBUS_TYPE_ARRAY &&
+			dbus_type_is_fixed(dbus_message_iter_get_element_type(src))) {
+			dbus_message_iter_get_fixed_array(&sub_src, &fixed, &len);
+			dbus_message_iter_append_fixed_array(&sub_dst,
+				dbus_message_iter_get_element_type(src),
+				&fixed, len);
+		} else {
+			copy_args(&sub_src, &sub_dst);
+		}
+
+		dbus_message_iter_close_container(dst, &sub_dst);
+		dbus_free(sig);
+		dbus_message_iter_next(src);
+	}
+}
+
+static void queued_setup(DBusMessageIter *iter, void *user_data)
+{
+	struct sonic_call *call = user_data;
+	DBusMessageIter src;
+
+	if (dbus_message_iter_init(call->args, &src))
+		copy_args(&src, iter);
+}
+
+static struct sched_queue *queue_find(GQueue *queue, const char *key)
+{
+	GList *l;
+
+	for (l = queue->head; l; l = l->next) {
+		struct sched_queue *q = l->data;
+
+		if (!strcmp(q->key, key))
+			return q;
+	}
+
+	return NULL;
+}
+
+static struct sched_queue *queue_get(GQueue *queue, const char *key)
+{
+	struct sched_queue *q = queue_find(queue, key);
+
+	if (q)
+		return q;
+
+	q = g_new0(struct sched_queue, 1);
+	q->key = g_strdup(key);
+	g_queue_init(&q->items);
+	g_queue_push_tail(queue, q);
+
+	return q;
+}
+
+static void queue_free(struct sched_queue *q)
+{
+	g_free(q->key);
+	g_free(q);
+}
+
+static void call_enqueue(struct sonic_sched *sched, struct sonic_call *call)
+{
+	struct sched_class *cls = &sched->classes[call->prio];
+	struct sched_queue *adapter, *device;
+	char *key;
+
+	key = path_prefix(call->device, 3);
+	adapter = queue_get(&cls->adapters, key);
+	g_free(key);
+
+	device = queue_get(&adapter->items, call->device);
+	g_queue_push_tail(&device->items, call);
+
+	cls->queued++;
+}
+
+/*
+ * Next runnable call of a class: the first adapter, then the first of its
+ * devices, with something runnable. Served queues go to the back.
+ */
+static struct sonic_call *call_dequeue(struct sonic_sched *sched,
+						struct sched_class *cls)
+{
+	unsigned int i, j, adapters, devices;
+
+	adapters = g_queue_get_length(&cls->adapters);
+
+	for (i = 0; i < adapters; i++) {
+		struct sched_queue *adapter = g_queue_pop_head(&cls->adapters);
+
+		devices = g_queue_get_length(&adapter->items);
+
+		for (j = 0; j < devices; j++) {
+			struct sched_queue *device;
+			struct sonic_call *call;
+
+			device = g_queue_pop_head(&adapter->items);
+			call = g_queue_peek_head(&device->items);
+
+			if (call_blocked(sched, call)) {
+				g_queue_push_tail(&adapter->items, device);
+				continue;
+			}
+
+			g_queue_pop_head(&device->items);
+			cls->queued--;
+
+			if (g_queue_is_empty(&device->items))
+				queue_free(device);
+			else
+				g_queue_push_tail(&adapter->items, device);
+
+			if (g_queue_is_empty(&adapter->items))
+				queue_free(adapter);
+			else
+				g_queue_push_tail(&cls->adapters, adapter);
+
+			return call;
+		}
+
+		g_queue_push_tail(&cls->adapters, adapter);
+	}
+
+	return NULL;
+}
+
+static void call_fail(struct sonic_call *call, const char *error)
+{
+	if (call->value)
+		call->value(error, NULL, 0, call->user_data);
+	else if (call->result)
+		call->result(error, call->user_data);
+
+	sonic_call_free(call);
+}
+
+static gboolean sched_run(gpointer user_data)
+{
+	struct sonic_sched *sched = user_data;
+	int i;
+
+	sched->idle = 0;
+
+	for (i = SONIC_PRIO_INTERACTIVE; i < SONIC_PRIO_MAX; i++) {
+		struct sched_class *cls = &sched->classes[i];
+
+		while (cls->queued && cls->active < cls->budget) {
+			struct sonic_call *call = call_dequeue(sched, cls);
+
+			if (!call)
+				break;
+
+			if (!call_dispatch(sched, call, call->args ?
+							queued_setup : NULL))
+				call_fail(call, "org.bluez.Error.Failed");
+		}
+	}
+
+	return FALSE;
+}
+
+/* Dispatch from the main loop, not from within a reply or destroy */
+static void sched_kick(struct sonic_sched *sched)
+{
+	if (!sched->idle)
+		sched->idle = g_idle_add(sched_run, sched);
+}
+
+bool sonic_sched_submit(struct sonic_ctx *ctx, struct sonic_call *call,
+				GDBusProxy *proxy, const char *method,
+				GDBusSetupFunction setup,
+				GDBusReturnFunction reply)
+{
+	struct sonic_sched *sched = sched_get(ctx);
+	struct sched_class *cls;
+	DBusMessageIter iter;
+
+	call->prio = classify(ctx, method);
+	call->proxy = g_dbus_proxy_ref(proxy);
+	call->method = method;
+	call->reply = reply;
+	call->device = path_prefix(g_dbus_proxy_get_path(proxy), 4);
+
+	cls = &sched->classes[call->prio];
+
+	/* Fast path, setup may still borrow the caller's data */
+	if (!cls->queued && cls->active < cls->budget &&
+						!call_blocked(sched, call))
+		return call_dispatch(sched, call, setup);
+
+	if (setup) {
+		call->args = dbus_message_new_method_call(NULL, "/", NULL,
+								method);
+		if (!call->args)
+			return false;
+
+		dbus_message_iter_init_append(call->args, &iter);
+		setup(&iter, call);
+		call->setup_data = NULL;
+	}
+
+	call_enqueue(sched, call);
+
+	return true;
+}
+
+static void free_device_queue(gpointer data)
+{
+	struct sched_queue *device = data;
+
+	g_queue_foreach(&device->items, (GFunc) sonic_call_free, NULL);
+	g_queue_clear(&device->items);
+	queue_free(device);
+}
+
+static void free_adapter_queue(gpointer data)
+{
+	struct sched_queue *adapter = data;
+
+	g_queue_foreach(&adapter->items, (GFunc) free_device_queue, NULL);
+	g_queue_clear(&adapter->items);
+	queue_free(adapter);
+}
+
+/* Queued calls are dropped without callbacks, like gdbus pending calls */
+void sonic_sched_free(struct sonic_ctx *ctx)
+{
+	struct sonic_sched *sched = ctx->sched;
+	int i;
+
+	if (!sched)
+		return;
+
+	if (sched->idle)
+		g_source_remove(sched->idle);
+
+	for (i = SONIC_PRIO_INTERACTIVE; i < SONIC_PRIO_MAX; i++) {
+		GQueue *adapters = &sched->classes[i].adapters;
+
+		g_queue_foreach(adapters, (GFunc) free_adapter_queue, NULL);
+		g_queue_clear(adapters);
+	}
+
+	g_hash_table_destroy(sched->busy);
+	g_free(sched);
+
+	ctx->sched = NULL;
+}
@@ -0,0 +1,128 @@
+#ifndef SONIC_PRIVATE_H
+#define SONIC_PRIVATE_H
+
+#include "gdbus/gdbus.h"
+#include "sonic.h"
+
+struct sonic_ctx {
+	DBusConnection *conn;
+	GDBusClient *client;
+	struct sonic_callbacks cb;
+	void *user_data;
+
+	GList *adapters;
+	struct sonic_adapter *default_adapter;
+	GDBusProxy *agent_manager;
+	bool agent_registered;
+	DBusMessage *agent_pending;	/* request waiting for a reply */
+	enum sonic_agent_request agent_pending_request;
+
+	GList *services;
+	GList *characteristics;
+	GList *descriptors;
+	GList *managers;
+
+	struct sonic_inventory *inventory;
+	struct sonic_pool *pool;
+	struct sonic_sched *sched;
+	enum sonic_prio prio;
+};
+
+struct sonic_adapter {
+	struct sonic_ctx *ctx;
+	GDBusProxy *proxy;
+	GList *devices;
+};
+
+struct sonic_device {
+	struct sonic_ctx *ctx;
+	struct sonic_adapter *adapter;
+	GDBusProxy *proxy;
+	struct sonic_attr *chars[SONIC_CHAR_MAX];
+};
+
+/* GATT service, characteristic or descriptor */
+struct sonic_attr {
+	GDBusProxy *proxy;
+};
+
+/*
+ * Pending D-Bus call, owned by the scheduler until issued, then by the
+ * gdbus call and freed on destroy
+ */
+struct sonic_call {
+	struct sonic_ctx *ctx;
+	sonic_result_func_t result;
+	sonic_value_func_t value;
+	void *user_data;
+	const void *setup_data;
+
+	/* sched.c */
+	enum sonic_prio prio;
+	GDBusProxy *proxy;
+	const char *method;		/* static string */
+	GDBusReturnFunction reply;
+	DBusMessage *args;		/* arguments of a queued call */
+	char *device;			/* device (or adapter) path */
+};
+
+struct sonic_call *sonic_call_new(struct sonic_ctx *ctx,
+					sonic_result_func_t result,
+					sonic_value_func_t value,
+					void *user_data);
+void sonic_call_free(void *data);
+void sonic_call_reply(DBusMessage *message, void *user_data);
+bool sonic_call_method(struct sonic_ctx *ctx, GDBusProxy *proxy,
+				const char *method, GDBusSetupFunction setup,
+				const void *setup_data, GDBusReturnFunction reply,
+				sonic_result_func_t result,
+				sonic_value_func_t value, void *user_data);
+
+struct sonic_device *sonic_device_from_path(struct sonic_ctx *ctx,
+							const char *path);
+bool sonic_set_property(struct sonic_ctx *ctx, GDBusProxy *proxy,
+				const char *name, int type, const void *value,
+				sonic_result_func_t func, void *user_data);
+
+/* agent.c */
+void sonic_agent_release(struct sonic_ctx *ctx);
+
+/* gatt.c */
+void sonic_gatt_add_service(struct sonic_ctx *ctx, GDBusProxy *proxy);
+void sonic_gatt_remove_service(struct sonic_ctx *ctx, GDBusProxy *proxy);
+void sonic_gatt_add_characteristic(struct sonic_ctx *ctx, GDBusProxy *proxy);
+void sonic_gatt_remove_characteristic(struct sonic_ctx *ctx,
+							GDBusProxy *proxy);
+void sonic_gatt_add_descriptor(struct sonic_ctx *ctx, GDBusProxy *proxy);
+void sonic_gatt_remove_descriptor(struct sonic_ctx *ctx, GDBusProxy *proxy);
+void sonic_gatt_add_manager(struct sonic_ctx *ctx, GDBusProxy *proxy);
+void sonic_gatt_remove_manager(struct sonic_ctx *ctx, GDBusProxy *proxy);
+void sonic_gatt_value_changed(struct sonic_ctx *ctx, GDBusProxy *proxy,
+							DBusMessageIter *iter);
+void sonic_gatt_free(struct sonic_ctx *ctx);
+
+/* value.c */
+void sonic_value_decode(DBusMessageIter *iter, struct sonic_value *value);
+bool sonic_value_from_proxy(GDBusProxy *proxy, const char *name,
+						struct sonic_value *value);
+
+/* inventory.c */
+void sonic_inventory_update(struct sonic_device *device);
+void sonic_inventory_property(struct sonic_device *device, const char *name,
+							DBusMessageIter *iter);
+void sonic_inventory_set_handle(struct sonic_device *device,
+				enum sonic_char chr, GDBusProxy *proxy);
+
+/* pool.c */
+void sonic_pool_device_changed(struct sonic_device *device, const char *name,
+							DBusMessageIter *iter);
+void sonic_pool_free(struct sonic_ctx *ctx);
+
+/* sched.c */
+bool sonic_sched_submit(struct sonic_ctx *ctx, struct sonic_call *call,
+				GDBusProxy *proxy, const char *method,
+				GDBusSetupFunction setup,
+				GDBusReturnFunction reply);
+void sonic_sched_free(struct sonic_ctx *ctx);
+
+#endif	/* SONIC_PRIVATE_H */
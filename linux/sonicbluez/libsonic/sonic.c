@@ -0,0 +1,747 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <glib.h>
+
+#include "sonic-private.h"
+
+struct sonic_call *sonic_call_new(struct sonic_ctx *ctx,
+					sonic_result_func_t result,
+					sonic_value_func_t value,
+					void *user_data)
+{
+	struct sonic_call *call = g_new0(struct sonic_call, 1);
+
+	call->ctx = ctx;
+	call->result = result;
+	call->value = value;
+	call->user_data = user_data;
+
+	return call;
+}
+
+void sonic_call_free(void *data)
+{
+	struct sonic_call *call = data;
+
+	if (call->proxy)
+		g_dbus_proxy_unref(call->proxy);
+
+	if (call->args)
+		dbus_message_unref(call->args);
+
+	g_free(call->device);
+	g_free(call);
+}
+
+void sonic_call_reply(DBusMessage *message, void *user_data)
+{
+	struct sonic_call *call = user_data;
+	DBusError error;
+
+	dbus_error_init(&error);
+
+	if (dbus_set_error_from_message(&error, message) == TRUE) {
+		if (call->result)
+			call->result(error.name, call->user_data);
+		dbus_error_free(&error);
+		return;
+	}
+
+	if (call->result)
+		call->result(NULL, call->user_data);
+}
+
+static void call_property_result(const DBusError *error, void *user_data)
+{
+	struct sonic_call *call = user_data;
+
+	if (!call->result)
+		return;
+
+	if (dbus_error_is_set(error))
+		call->result(error->name, call->user_data);
+	else
+		call->result(NULL, call->user_data);
+}
+
+/*
+ * Issue a method call on behalf of the caller, through the scheduler.
+ * setup runs synchronously from here and finds setup_data in the call,
+ * so it may borrow caller memory without copying (calls that have to
+ * wait get their arguments copied by the scheduler).
+ */
+bool sonic_call_method(struct sonic_ctx *ctx, GDBusProxy *proxy,
+				const char *method, GDBusSetupFunction setup,
+				const void *setup_data, GDBusReturnFunction reply,
+				sonic_result_func_t result,
+				sonic_value_func_t value, void *user_data)
+{
+	struct sonic_call *call;
+
+	if (!proxy)
+		return false;
+
+	call = sonic_call_new(ctx, result, value, user_data);
+	call->setup_data = setup_data;
+
+	if (sonic_sched_submit(ctx, call, proxy, method, setup,
+					reply ? reply : sonic_call_reply))
+		return true;
+
+	sonic_call_free(call);
+	return false;
+}
+
+static bool call_method(struct sonic_ctx *ctx, GDBusProxy *proxy,
+				const char *method, GDBusSetupFunction setup,
+				const void *setup_data, sonic_result_func_t func,
+				void *user_data)
+{
+	return sonic_call_method(ctx, proxy, method, setup, setup_data,
+					NULL, func, NULL, user_data);
+}
+
+static const char *proxy_get_string(GDBusProxy *proxy, const char *name)
+{
+	DBusMessageIter iter;
+	const char *str;
+
+	if (g_dbus_proxy_get_property(proxy, name, &iter) == FALSE)
+		return NULL;
+
+	dbus_message_iter_get_basic(&iter, &str);
+
+	return str;
+}
+
+static bool proxy_get_bool(GDBusProxy *proxy, const char *name)
+{
+	DBusMessageIter iter;
+	dbus_bool_t value;
+
+	if (g_dbus_proxy_get_property(proxy, name, &iter) == FALSE)
+		return false;
+
+	dbus_message_iter_get_basic(&iter, &value);
+
+	return value == TRUE;
+}
+
+static struct sonic_adapter *find_parent(struct sonic_ctx *ctx,
+							GDBusProxy *device)
+{
+	const char *path;
+	GList *l;
+
+	path = proxy_get_string(device, "Adapter");
+	if (!path)
+		return NULL;
+
+	for (l = ctx->adapters; l; l = g_list_next(l)) {
+		struct sonic_adapter *adapter = l->data;
+
+		if (!strcmp(g_dbus_proxy_get_path(adapter->proxy), path))
+			return adapter;
+	}
+
+	return NULL;
+}
+
+static struct sonic_device *device_from_proxy(struct sonic_ctx *ctx,
+							GDBusProxy *proxy)
+{
+	GList *l, *d;
+
+	for (l = ctx->adapters; l; l = g_list_next(l)) {
+		struct sonic_adapter *adapter = l->data;
+
+		for (d = adapter->devices; d; d = g_list_next(d)) {
+			struct sonic_device *device = d->data;
+
+			if (device->proxy == proxy)
+				return device;
+		}
+	}
+
+	return NULL;
+}
+
+/* Find the device owning an object path (the device itself or a child) */
+struct sonic_device *sonic_device_from_path(struct sonic_ctx *ctx,
+							const char *path)
+{
+	GList *l, *d;
+
+	if (!path)
+		return NULL;
+
+	for (l = ctx->adapters; l; l = g_list_next(l)) {
+		struct sonic_adapter *adapter = l->data;
+
+		for (d = adapter->devices; d; d = g_list_next(d)) {
+			struct sonic_device *device = d->data;
+			const char *dev_path;
+			size_t len;
+
+			dev_path = g_dbus_proxy_get_path(device->proxy);
+			len = strlen(dev_path);
+
+			if (!strncmp(path, dev_path, len) &&
+					(path[len] == '\0' || path[len] == '/'))
+				return device;
+		}
+	}
+
+	return NULL;
+}
+
+static void device_free(void *data)
+{
+	g_free(data);
+}
+
+static void adapter_free(void *data)
+{
+	struct sonic_adapter *adapter = data;
+
+	g_list_free_full(adapter->devices, device_free);
+	g_free(adapter);
+}
+
+static void device_added(struct sonic_ctx *ctx, GDBusProxy *proxy)
+{
+	struct sonic_adapter *adapter = find_parent(ctx, proxy);
+	struct sonic_device *device;
+
+	if (!adapter)
+		return;
+
+	device = g_new0(struct sonic_device, 1);
+	device->ctx = ctx;
+	device->adapter = adapter;
+	device->proxy = proxy;
+
+	adapter->devices = g_list_append(adapter->devices, device);
+
+	sonic_inventory_update(device);
+
+	if (ctx->cb.device_added)
+		ctx->cb.device_added(device, ctx->user_data);
+}
+
+static void device_removed(struct sonic_ctx *ctx, GDBusProxy *proxy)
+{
+	struct sonic_device *device = device_from_proxy(ctx, proxy);
+
+	if (!device)
+		return;
+
+	device->adapter->devices = g_list_remove(device->adapter->devices,
+								device);
+
+	if (ctx->cb.device_removed)
+		ctx->cb.device_removed(device, ctx->user_data);
+
+	device_free(device);
+}
+
+static void adapter_added(struct sonic_ctx *ctx, GDBusProxy *proxy)
+{
+	struct sonic_adapter *adapter = g_new0(struct sonic_adapter, 1);
+
+	adapter->ctx = ctx;
+	adapter->proxy = proxy;
+	ctx->adapters = g_list_append(ctx->adapters, adapter);
+
+	if (!ctx->default_adapter)
+		ctx->default_adapter = adapter;
+
+	if (ctx->cb.adapter_added)
+		ctx->cb.adapter_added(adapter, ctx->user_data);
+}
+
+static void adapter_removed(struct sonic_ctx *ctx, GDBusProxy *proxy)
+{
+	GList *l;
+
+	for (l = ctx->adapters; l; l = g_list_next(l)) {
+		struct sonic_adapter *adapter = l->data;
+
+		if (adapter->proxy != proxy)
+			continue;
+
+		if (ctx->cb.adapter_removed)
+			ctx->cb.adapter_removed(adapter, ctx->user_data);
+
+		if (ctx->default_adapter == adapter)
+			ctx->default_adapter = NULL;
+
+		ctx->adapters = g_list_delete_link(ctx->adapters, l);
+		adapter_free(adapter);
+		return;
+	}
+}
+
+static void proxy_added(GDBusProxy *proxy, void *user_data)
+{
+	struct sonic_ctx *ctx = user_data;
+	const char *interface;
+
+	interface = g_dbus_proxy_get_interface(proxy);
+
+	if (!strcmp(interface, "org.bluez.Device1")) {
+		device_added(ctx, proxy);
+	} else if (!strcmp(interface, "org.bluez.Adapter1")) {
+		adapter_added(ctx, proxy);
+	} else if (!strcmp(interface, "org.bluez.AgentManager1")) {
+		if (!ctx->agent_manager) {
+			ctx->agent_manager = proxy;
+
+			if (ctx->cb.agent_manager_added)
+				ctx->cb.agent_manager_added(ctx,
+							ctx->user_data);
+		}
+	} else if (!strcmp(interface, "org.bluez.GattService1")) {
+		sonic_gatt_add_service(ctx, proxy);
+	} else if (!strcmp(interface, "org.bluez.GattCharacteristic1")) {
+		sonic_gatt_add_characteristic(ctx, proxy);
+	} else if (!strcmp(interface, "org.bluez.GattDescriptor1")) {
+		sonic_gatt_add_descriptor(ctx, proxy);
+	} else if (!strcmp(interface, "org.bluez.GattManager1")) {
+		sonic_gatt_add_manager(ctx, proxy);
+	}
+}
+
+static void proxy_removed(GDBusProxy *proxy, void *user_data)
+{
+	struct sonic_ctx *ctx = user_data;
+	const char *interface;
+
+	interface = g_dbus_proxy_get_interface(proxy);
+
+	if (!strcmp(interface, "org.bluez.Device1")) {
+		device_removed(ctx, proxy);
+	} else if (!strcmp(interface, "org.bluez.Adapter1")) {
+		adapter_removed(ctx, proxy);
+	} else if (!strcmp(interface, "org.bluez.AgentManager1")) {
+		if (ctx->agent_manager == proxy) {
+			ctx->agent_manager = NULL;
+			sonic_agent_release(ctx);
+
+			if (ctx->cb.agent_manager_removed)
+				ctx->cb.agent_manager_removed(ctx,
+							ctx->user_data);
+		}
+	} else if (!strcmp(interface, "org.bluez.GattService1")) {
+		sonic_gatt_remove_service(ctx, proxy);
+	} else if (!strcmp(interface, "org.bluez.GattCharacteristic1")) {
+		sonic_gatt_remove_characteristic(ctx, proxy);
+	} else if (!strcmp(interface, "org.bluez.GattDescriptor1")) {
+		sonic_gatt_remove_descriptor(ctx, proxy);
+	} else if (!strcmp(interface, "org.bluez.GattManager1")) {
+		sonic_gatt_remove_manager(ctx, proxy);
+	}
+}
+
+static void property_changed(GDBusProxy *proxy, const char *name,
+					DBusMessageIter *iter, void *user_data)
+{
+	struct sonic_ctx *ctx = user_data;
+	const char *interface;
+
+	interface = g_dbus_proxy_get_interface(proxy);
+
+	if (!strcmp(interface, "org.bluez.Device1")) {
+		struct sonic_device *device;
+
+		device = device_from_proxy(ctx, proxy);
+		if (!device)
+			return;
+
+		sonic_inventory_property(device, name, iter);
+		sonic_pool_device_changed(device, name, iter);
+
+		if (ctx->cb.device_changed) {
+			struct sonic_value value;
+
+			sonic_value_decode(iter, &value);
+			ctx->cb.device_changed(device, name, &value,
+							ctx->user_data);
+			sonic_value_clear(&value);
+		}
+	} else if (!strcmp(interface, "org.bluez.GattCharacteristic1") ||
+			!strcmp(interface, "org.bluez.GattDescriptor1")) {
+		if (!strcmp(name, "Value"))
+			sonic_gatt_value_changed(ctx, proxy, iter);
+	}
+}
+
+static void connect_handler(DBusConnection *connection, void *user_data)
+{
+	struct sonic_ctx *ctx = user_data;
+
+	if (ctx->cb.service_connected)
+		ctx->cb.service_connected(ctx, ctx->user_data);
+}
+
+static void disconnect_handler(DBusConnection *connection, void *user_data)
+{
+	struct sonic_ctx *ctx = user_data;
+
+	g_list_free_full(ctx->adapters, adapter_free);
+	ctx->adapters = NULL;
+	ctx->default_adapter = NULL;
+	ctx->agent_manager = NULL;
+	sonic_agent_release(ctx);
+	sonic_gatt_free(ctx);
+
+	if (ctx->cb.service_disconnected)
+		ctx->cb.service_disconnected(ctx, ctx->user_data);
+}
+
+static void message_handler(DBusConnection *connection,
+					DBusMessage *message, void *user_data)
+{
+	struct sonic_ctx *ctx = user_data;
+
+	if (ctx->cb.signal)
+		ctx->cb.signal(ctx, dbus_message_get_interface(message),
+					dbus_message_get_member(message),
+					ctx->user_data);
+}
+
+static void client_ready(GDBusClient *client, void *user_data)
+{
+	struct sonic_ctx *ctx = user_data;
+
+	if (ctx->cb.ready)
+		ctx->cb.ready(ctx, ctx->user_data);
+}
+
+struct sonic_ctx *sonic_ctx_new(const struct sonic_callbacks *callbacks,
+				void *user_data)
+{
+	struct sonic_ctx *ctx;
+	DBusConnection *conn;
+
+	conn = g_dbus_setup_bus(DBUS_BUS_SYSTEM, NULL, NULL);
+	if (!conn)
+		return NULL;
+
+	ctx = g_new0(struct sonic_ctx, 1);
+	ctx->conn = conn;
+	ctx->user_data = user_data;
+
+	if (callbacks)
+		ctx->cb = *callbacks;
+
+	ctx->client = g_dbus_client_new(conn, "org.bluez", "/org/bluez");
+	if (!ctx->client) {
+		dbus_connection_unref(ctx->conn);
+		g_free(ctx);
+		return NULL;
+	}
+
+	g_dbus_client_set_connect_watch(ctx->client, connect_handler, ctx);
+	g_dbus_client_set_disconnect_watch(ctx->client, disconnect_handler,
+									ctx);
+	g_dbus_client_set_signal_watch(ctx->client, message_handler, ctx);
+	g_dbus_client_set_proxy_handlers(ctx->client, proxy_added,
+					proxy_removed, property_changed, ctx);
+	g_dbus_client_set_ready_watch(ctx->client, client_ready, ctx);
+
+	return ctx;
+}
+
+void sonic_ctx_free(struct sonic_ctx *ctx)
+{
+	if (!ctx)
+		return;
+
+	sonic_pool_free(ctx);
+	sonic_sched_free(ctx);
+	sonic_agent_release(ctx);
+	g_dbus_client_unref(ctx->client);
+
+	g_list_free_full(ctx->adapters, adapter_free);
+	sonic_gatt_free(ctx);
+	sonic_inventory_close(ctx);
+
+	dbus_connection_unref(ctx->conn);
+	g_free(ctx);
+}
+
+GList *sonic_get_adapters(struct sonic_ctx *ctx)
+{
+	return ctx->adapters;
+}
+
+struct sonic_adapter *sonic_get_default_adapter(struct sonic_ctx *ctx)
+{
+	return ctx->default_adapter;
+}
+
+void sonic_set_default_adapter(struct sonic_ctx *ctx,
+					struct sonic_adapter *adapter)
+{
+	ctx->default_adapter = adapter;
+}
+
+struct sonic_adapter *sonic_find_adapter(struct sonic_ctx *ctx,
+						const char *address)
+{
+	GList *l;
+
+	if (!address)
+		return NULL;
+
+	for (l = ctx->adapters; l; l = g_list_next(l)) {
+		struct sonic_adapter *adapter = l->data;
+		const char *str = sonic_adapter_get_address(adapter);
+
+		if (str && !strcasecmp(str, address))
+			return adapter;
+	}
+
+	return NULL;
+}
+
+const char *sonic_adapter_get_address(struct sonic_adapter *adapter)
+{
+	return proxy_get_string(adapter->proxy, "Address");
+}
+
+const char *sonic_adapter_get_alias(struct sonic_adapter *adapter)
+{
+	return proxy_get_string(adapter->proxy, "Alias");
+}
+
+GList *sonic_adapter_get_devices(struct sonic_adapter *adapter)
+{
+	return adapter->devices;
+}
+
+bool sonic_adapter_get_property(struct sonic_adapter *adapter,
+				const char *name, struct sonic_value *value)
+{
+	return sonic_value_from_proxy(adapter->proxy, name, value);
+}
+
+/* Property writes go straight to bluetoothd, they are not scheduled */
+bool sonic_set_property(struct sonic_ctx *ctx, GDBusProxy *proxy,
+				const char *name, int type, const void *value,
+				sonic_result_func_t func, void *user_data)
+{
+	struct sonic_call *call;
+
+	call = sonic_call_new(ctx, func, NULL, user_data);
+
+	if (g_dbus_proxy_set_property_basic(proxy, name, type, value,
+					call_property_result, call,
+					sonic_call_free) == TRUE)
+		return true;
+
+	sonic_call_free(call);
+	return false;
+}
+
+bool sonic_adapter_set_powered(struct sonic_adapter *adapter, bool powered,
+				sonic_result_func_t func, void *user_data)
+{
+	dbus_bool_t value = powered ? TRUE : FALSE;
+
+	return sonic_set_property(adapter->ctx, adapter->proxy, "Powered",
+					DBUS_TYPE_BOOLEAN, &value,
+					func, user_data);
+}
+
+bool sonic_adapter_set_alias(struct sonic_adapter *adapter, const char *alias,
+				sonic_result_func_t func, void *user_data)
+{
+	return sonic_set_property(adapter->ctx, adapter->proxy, "Alias",
+					DBUS_TYPE_STRING, &alias,
+					func, user_data);
+}
+
+bool sonic_adapter_set_discovery(struct sonic_adapter *adapter, bool enable,
+				sonic_result_func_t func, void *user_data)
+{
+	return call_method(adapter->ctx, adapter->proxy,
+				enable ? "StartDiscovery" : "StopDiscovery",
+				NULL, NULL, func, user_data);
+}
+
+static void remove_device_setup(DBusMessageIter *iter, void *user_data)
+{
+	struct sonic_call *call = user_data;
+	const char *path = call->setup_data;
+
+	dbus_message_iter_append_basic(iter, DBUS_TYPE_OBJECT_PATH, &path);
+}
+
+bool sonic_adapter_remove_device(struct sonic_adapter *adapter,
+				struct sonic_device *device,
+				sonic_result_func_t func, void *user_data)
+{
+	return call_method(adapter->ctx, adapter->proxy, "RemoveDevice",
+				remove_device_setup,
+				g_dbus_proxy_get_path(device->proxy),
+				func, user_data);
+}
+
+struct connect_address {
+	const char *address;
+	const char *type;
+};
+
+static void dict_append_string(DBusMessageIter *dict, const char *key,
+							const char *value)
+{
+	DBusMessageIter entry, variant;
+
+	dbus_message_iter_open_container(dict, DBUS_TYPE_DICT_ENTRY, NULL,
+									&entry);
+	dbus_message_iter_append_basic(&entry, DBUS_TYPE_STRING, &key);
+	dbus_message_iter_open_container(&entry, DBUS_TYPE_VARIANT,
+					DBUS_TYPE_STRING_AS_STRING, &variant);
+	dbus_message_iter_append_basic(&variant, DBUS_TYPE_STRING, &value);
+	dbus_message_iter_close_container(&entry, &variant);
+	dbus_message_iter_close_container(dict, &entry);
+}
+
+static void connect_address_setup(DBusMessageIter *iter, void *user_data)
+{
+	struct sonic_call *call = user_data;
+	const struct connect_address *addr = call->setup_data;
+	DBusMessageIter dict;
+
+	dbus_message_iter_open_container(iter, DBUS_TYPE_ARRAY,
+					DBUS_DICT_ENTRY_BEGIN_CHAR_AS_STRING
+					DBUS_TYPE_STRING_AS_STRING
+					DBUS_TYPE_VARIANT_AS_STRING
+					DBUS_DICT_ENTRY_END_CHAR_AS_STRING,
+					&dict);
+	dict_append_string(&dict, "Address", addr->address);
+	dict_append_string(&dict, "AddressType", addr->type);
+	dbus_message_iter_close_container(iter, &dict);
+}
+
+/* Needs bluetoothd running with --experimental */
+bool sonic_adapter_connect_address(struct sonic_adapter *adapter,
+				const char *address, bool random,
+				sonic_result_func_t func, void *user_data)
+{
+	struct connect_address addr = {
+		.address = address,
+		.type = random ? "random" : "public",
+	};
+
+	return call_method(adapter->ctx, adapter->proxy, "ConnectDevice",
+				connect_address_setup, &addr, func, user_data);
+}
+
+struct sonic_device *sonic_find_device(struct sonic_ctx *ctx,
+						const char *address)
+{
+	GList *l;
+
+	if (!address || !ctx->default_adapter)
+		return NULL;
+
+	for (l = ctx->default_adapter->devices; l; l = g_list_next(l)) {
+		struct sonic_device *device = l->data;
+		const char *str = sonic_device_get_address(device);
+
+		if (str && !strcasecmp(str, address))
+			return device;
+	}
+
+	return NULL;
+}
+
+struct sonic_adapter *sonic_device_get_adapter(struct sonic_device *device)
+{
+	return device->adapter;
+}
+
+const char *sonic_device_get_address(struct sonic_device *device)
+{
+	return proxy_get_string(device->proxy, "Address");
+}
+
+const char *sonic_device_get_alias(struct sonic_device *device)
+{
+	return proxy_get_string(device->proxy, "Alias");
+}
+
+const char *sonic_device_get_path(struct sonic_device *device)
+{
+	return g_dbus_proxy_get_path(device->proxy);
+}
+
+bool sonic_device_get_property(struct sonic_device *device,
+				const char *name, struct sonic_value *value)
+{
+	return sonic_value_from_proxy(device->proxy, name, value);
+}
+
+bool sonic_device_set_alias(struct sonic_device *device, const char *alias,
+				sonic_result_func_t func, void *user_data)
+{
+	return sonic_set_property(device->ctx, device->proxy, "Alias",
+					DBUS_TYPE_STRING, &alias,
+					func, user_data);
+}
+
+bool sonic_device_set_trusted(struct sonic_device *device, bool trusted,
+				sonic_result_func_t func, void *user_data)
+{
+	dbus_bool_t value = trusted ? TRUE : FALSE;
+
+	return sonic_set_property(device->ctx, device->proxy, "Trusted",
+					DBUS_TYPE_BOOLEAN, &value,
+					func, user_data);
+}
+
+bool sonic_device_is_connected(struct sonic_device *device)
+{
+	return proxy_get_bool(device->proxy, "Connected");
+}
+
+bool sonic_device_is_paired(struct sonic_device *device)
+{
+	return proxy_get_bool(device->proxy, "Paired");
+}
+
+bool sonic_device_is_resolved(struct sonic_device *device)
+{
+	return proxy_get_bool(device->proxy, "ServicesResolved");
+}
+
+bool sonic_device_connect(struct sonic_device *device,
+				sonic_result_func_t func, void *user_data)
+{
+	return call_method(device->ctx, device->proxy, "Connect",
+					NULL, NULL, func, user_data);
+}
+
+bool sonic_device_disconnect(struct sonic_device *device,
+				sonic_result_func_t func, void *user_data)
+{
+	return call_method(device->ctx, device->proxy, "Disconnect",
+					NULL, NULL, func, user_data);
+}
+
+bool sonic_device_pair(struct sonic_device *device,
+				sonic_result_func_t func, void *user_data)
+{
+	return call_method(device->ctx, device->proxy, "Pair",
+					NULL, NULL, func, user_data);
+}
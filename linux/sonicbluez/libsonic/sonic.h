@@ -0,0 +1,450 @@
+#ifndef SONIC_H
+#define SONIC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include <glib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct sonic_ctx;
+struct sonic_adapter;
+struct sonic_device;
+struct sonic_attr;
+
+/* Buzzer characteristics, resolved by UUID (0000ffXX-...) per device */
+enum sonic_char {
+	SONIC_CHAR_BUZZ,	/* 0xff01 buzzer on / off */
+	SONIC_CHAR_MODE,	/* 0xff02 idle / fw update / loop */
+	SONIC_CHAR_FIXEDINT,	/* 0xff03 fixed beep interval */
+	SONIC_CHAR_RANDINT,	/* 0xff04 random beeps per hour */
+	SONIC_CHAR_RSSI,	/* 0xff05 rssi %, notify */
+	SONIC_CHAR_RSSIMIN,	/* 0xff06 rssi threshold % */
+	SONIC_CHAR_PASS,	/* 0xff07 OTA AP passphrase */
+	SONIC_CHAR_SOLAR,	/* 0xff08 light sensor %, notify */
+	SONIC_CHAR_SOLARMIN,	/* 0xff09 light threshold % */
+	SONIC_CHAR_OTA,		/* 0xff0a OTA frames in, acks notified */
+	SONIC_CHAR_PROGRESS,	/* 0xff0b OTA progress, notify */
+	SONIC_CHAR_STACONF,	/* 0xff0c OTA station config, write only */
+	SONIC_CHAR_APINFO,	/* 0xff0d OTA AP ssid, channel and address */
+	SONIC_CHAR_STREAM,	/* 0xff0e batched rssi / light samples, notify */
+	SONIC_CHAR_REPORT,	/* 0xff0f rssi / light reporting policy */
+	SONIC_CHAR_MAX,
+	SONIC_CHAR_INVALID = SONIC_CHAR_MAX
+};
+
+enum sonic_mode {
+	SONIC_MODE_IDLE		= 0x00,
+	SONIC_MODE_FWUPDATE	= 0x01,
+	SONIC_MODE_LOOP		= 0x02,
+	SONIC_MODE_FWUPDATE_STA	= 0x03,	/* pull from a host server */
+};
+
+/*
+ * Scheduling classes of D-Bus calls, highest priority first. DEFAULT
+ * picks TELEMETRY for notification setup and CONTROL for the rest.
+ */
+enum sonic_prio {
+	SONIC_PRIO_DEFAULT,
+	SONIC_PRIO_INTERACTIVE,	/* operator commands */
+	SONIC_PRIO_CONTROL,	/* connection management, single commands */
+	SONIC_PRIO_BULK,	/* fleet wide reconfiguration */
+	SONIC_PRIO_TELEMETRY,	/* notification setup */
+	SONIC_PRIO_MAX,
+};
+
+/*
+ * Completion callbacks. error is NULL on success, otherwise the D-Bus
+ * error name. Values point into the D-Bus reply and are only valid for
+ * the duration of the callback; copy them if they need to outlive it.
+ */
+typedef void (*sonic_result_func_t)(const char *error, void *user_data);
+typedef void (*sonic_value_func_t)(const char *error, const uint8_t *value,
+						size_t len, void *user_data);
+/* fd is owned by the callee (close it), -1 on error */
+typedef void (*sonic_fd_func_t)(const char *error, int fd, uint16_t mtu,
+							void *user_data);
+
+/*
+ * Decoded bluetoothd property. Variants are unwrapped, strings and object
+ * paths are STRING, containers hold their elements in items (a dict entry
+ * is a key and a value). Strings point into the D-Bus message, like the
+ * values above; sonic_value_clear frees the items.
+ */
+enum sonic_value_type {
+	SONIC_VALUE_INVALID,	/* type libsonic doesn't decode */
+	SONIC_VALUE_BOOL,	/* b */
+	SONIC_VALUE_BYTE,	/* u */
+	SONIC_VALUE_INT16,	/* i */
+	SONIC_VALUE_UINT16,	/* u */
+	SONIC_VALUE_INT32,	/* i */
+	SONIC_VALUE_UINT32,	/* u */
+	SONIC_VALUE_INT64,	/* i */
+	SONIC_VALUE_UINT64,	/* u */
+	SONIC_VALUE_STRING,	/* s */
+	SONIC_VALUE_ARRAY,	/* items, count */
+	SONIC_VALUE_DICT_ENTRY,	/* items[0] key, items[1] value */
+};
+
+struct sonic_value {
+	enum sonic_value_type type;
+	bool b;
+	int64_t i;
+	uint64_t u;
+	const char *s;
+	struct sonic_value *items;
+	size_t count;
+};
+
+void sonic_value_clear(struct sonic_value *value);
+
+/*
+ * Pairing agent requests. PINCODE, PASSKEY, CONFIRM, AUTHORIZE and
+ * AUTHORIZE_SERVICE wait for one of the sonic_agent_reply functions,
+ * until bluetoothd gives up on them (CANCEL). RELEASE: bluetoothd
+ * dropped the agent.
+ */
+enum sonic_agent_request {
+	SONIC_AGENT_RELEASE,
+	SONIC_AGENT_PINCODE,
+	SONIC_AGENT_DISPLAY_PINCODE,	/* pincode */
+	SONIC_AGENT_PASSKEY,
+	SONIC_AGENT_DISPLAY_PASSKEY,	/* passkey, entered */
+	SONIC_AGENT_CONFIRM,		/* passkey */
+	SONIC_AGENT_AUTHORIZE,
+	SONIC_AGENT_AUTHORIZE_SERVICE,	/* uuid */
+	SONIC_AGENT_CANCEL,
+};
+
+struct sonic_agent_info {
+	struct sonic_device *device;	/* NULL if not known (yet) */
+	const char *pincode;
+	uint32_t passkey;
+	uint16_t entered;		/* digits typed on the remote side */
+	const char *uuid;
+};
+
+struct sonic_callbacks {
+	void (*ready)(struct sonic_ctx *ctx, void *user_data);
+	void (*service_connected)(struct sonic_ctx *ctx, void *user_data);
+	void (*service_disconnected)(struct sonic_ctx *ctx, void *user_data);
+
+	void (*adapter_added)(struct sonic_adapter *adapter, void *user_data);
+	void (*adapter_removed)(struct sonic_adapter *adapter,
+							void *user_data);
+
+	void (*device_added)(struct sonic_device *device, void *user_data);
+	void (*device_removed)(struct sonic_device *device, void *user_data);
+	/* value is freed once this returns */
+	void (*device_changed)(struct sonic_device *device, const char *name,
+				const struct sonic_value *value,
+				void *user_data);
+
+	/* attr is freed once this returns */
+	void (*attribute_removed)(struct sonic_attr *attr, void *user_data);
+
+	/* bluetoothd's AgentManager1 came up / went away */
+	void (*agent_manager_added)(struct sonic_ctx *ctx, void *user_data);
+	void (*agent_manager_removed)(struct sonic_ctx *ctx, void *user_data);
+	void (*agent_request)(struct sonic_ctx *ctx,
+				enum sonic_agent_request request,
+				const struct sonic_agent_info *info,
+				void *user_data);
+
+	/* Any other signal bluetoothd sends */
+	void (*signal)(struct sonic_ctx *ctx, const char *interface,
+				const char *member, void *user_data);
+
+	/*
+	 * Characteristic value changed (notification or read update).
+	 * chr is SONIC_CHAR_INVALID for attributes that are not part of
+	 * the buzzer service. value is not copied, see above.
+	 */
+	void (*notify)(struct sonic_device *device, struct sonic_attr *attr,
+				enum sonic_char chr, const uint8_t *value,
+				size_t len, void *user_data);
+};
+
+/*
+ * Connects to the system bus and attaches it to the default GLib main
+ * context, which has to be run for any callback to be called.
+ */
+struct sonic_ctx *sonic_ctx_new(const struct sonic_callbacks *callbacks,
+				void *user_data);
+void sonic_ctx_free(struct sonic_ctx *ctx);
+
+/* Adapters */
+GList *sonic_get_adapters(struct sonic_ctx *ctx);
+struct sonic_adapter *sonic_get_default_adapter(struct sonic_ctx *ctx);
+void sonic_set_default_adapter(struct sonic_ctx *ctx,
+					struct sonic_adapter *adapter);
+struct sonic_adapter *sonic_find_adapter(struct sonic_ctx *ctx,
+						const char *address);
+const char *sonic_adapter_get_address(struct sonic_adapter *adapter);
+const char *sonic_adapter_get_alias(struct sonic_adapter *adapter);
+GList *sonic_adapter_get_devices(struct sonic_adapter *adapter);
+/* Any Adapter1 property, clear value with sonic_value_clear */
+bool sonic_adapter_get_property(struct sonic_adapter *adapter,
+				const char *name, struct sonic_value *value);
+
+bool sonic_adapter_set_powered(struct sonic_adapter *adapter, bool powered,
+				sonic_result_func_t func, void *user_data);
+/* An empty alias goes back to the system name */
+bool sonic_adapter_set_alias(struct sonic_adapter *adapter, const char *alias,
+				sonic_result_func_t func, void *user_data);
+bool sonic_adapter_set_discovery(struct sonic_adapter *adapter, bool enable,
+				sonic_result_func_t func, void *user_data);
+bool sonic_adapter_remove_device(struct sonic_adapter *adapter,
+				struct sonic_device *device,
+				sonic_result_func_t func, void *user_data);
+
+/* Devices */
+struct sonic_device *sonic_find_device(struct sonic_ctx *ctx,
+						const char *address);
+struct sonic_adapter *sonic_device_get_adapter(struct sonic_device *device);
+const char *sonic_device_get_address(struct sonic_device *device);
+const char *sonic_device_get_alias(struct sonic_device *device);
+/* Object path, attribute paths of the device start with it */
+const char *sonic_device_get_path(struct sonic_device *device);
+bool sonic_device_is_connected(struct sonic_device *device);
+bool sonic_device_is_paired(struct sonic_device *device);
+bool sonic_device_is_resolved(struct sonic_device *device);
+/* Any Device1 property, clear value with sonic_value_clear */
+bool sonic_device_get_property(struct sonic_device *device,
+				const char *name, struct sonic_value *value);
+
+bool sonic_device_set_alias(struct sonic_device *device, const char *alias,
+				sonic_result_func_t func, void *user_data);
+bool sonic_device_set_trusted(struct sonic_device *device, bool trusted,
+				sonic_result_func_t func, void *user_data);
+
+bool sonic_device_connect(struct sonic_device *device,
+				sonic_result_func_t func, void *user_data);
+bool sonic_device_disconnect(struct sonic_device *device,
+				sonic_result_func_t func, void *user_data);
+bool sonic_device_pair(struct sonic_device *device,
+				sonic_result_func_t func, void *user_data);
+
+/* Buzzer characteristics */
+struct sonic_attr *sonic_device_get_char(struct sonic_device *device,
+						enum sonic_char chr);
+enum sonic_char sonic_char_from_uuid(const char *uuid);
+
+bool sonic_read(struct sonic_device *device, enum sonic_char chr,
+				sonic_value_func_t func, void *user_data);
+bool sonic_write(struct sonic_device *device, enum sonic_char chr,
+				const uint8_t *value, size_t len,
+				sonic_result_func_t func, void *user_data);
+bool sonic_notify(struct sonic_device *device, enum sonic_char chr,
+				bool enable, sonic_result_func_t func,
+				void *user_data);
+bool sonic_acquire(struct sonic_device *device, enum sonic_char chr,
+				bool write, sonic_fd_func_t func,
+				void *user_data);
+
+/*
+ * Persistent inventory of known buzzers, kept in a memory mapped file and
+ * updated as devices, properties and characteristics show up. Entries
+ * survive restarts, so devices bluetoothd has forgotten can still be
+ * targeted by address (see sonic_adapter_connect_address).
+ */
+#define SONIC_INVENTORY_ALIAS_LEN	32
+#define SONIC_INVENTORY_FW_LEN		32
+
+#define SONIC_INVENTORY_PAIRED		0x01
+#define SONIC_INVENTORY_RANDOM		0x02
+
+struct sonic_inventory_entry {
+	char address[18];
+	uint8_t flags;
+	uint8_t reserved;
+	int16_t rssi;				/* last RSSI, 0 if unknown */
+	uint16_t handles[SONIC_CHAR_MAX];	/* value handles, 0 if unknown */
+	int64_t last_seen;			/* seconds since the epoch */
+	char alias[SONIC_INVENTORY_ALIAS_LEN];
+	char firmware[SONIC_INVENTORY_FW_LEN];
+};
+
+bool sonic_inventory_open(struct sonic_ctx *ctx, const char *path);
+void sonic_inventory_close(struct sonic_ctx *ctx);
+unsigned int sonic_inventory_count(struct sonic_ctx *ctx);
+const struct sonic_inventory_entry *sonic_inventory_get(struct sonic_ctx *ctx,
+							unsigned int index);
+const struct sonic_inventory_entry *sonic_inventory_find(struct sonic_ctx *ctx,
+							const char *address);
+void sonic_inventory_set_firmware(struct sonic_device *device,
+							const char *firmware);
+
+/* Connect to an address bluetoothd may not know about (ConnectDevice) */
+bool sonic_adapter_connect_address(struct sonic_adapter *adapter,
+				const char *address, bool random,
+				sonic_result_func_t func, void *user_data);
+
+/*
+ * Calls issued until the next change use prio (chained buzzer operations
+ * keep the class they were started with). Returns the previous class so
+ * callers can restore it. Each class has a budget of calls in flight;
+ * calls beyond it are queued fairly across adapters and devices.
+ */
+enum sonic_prio sonic_set_priority(struct sonic_ctx *ctx,
+						enum sonic_prio prio);
+void sonic_sched_set_budget(struct sonic_ctx *ctx, enum sonic_prio prio,
+							unsigned int budget);
+
+/*
+ * Connection pool. With a limit set, devices acquired through the pool
+ * are kept connected, most recently used first; beyond the limit the
+ * least recently used are disconnected. Devices that drop are
+ * reconnected in the background, and evicted devices are brought back
+ * by use frequency and recency whenever a connection slot frees up.
+ * A limit of 0 (the default) disables the pool.
+ */
+void sonic_pool_set_limit(struct sonic_ctx *ctx, unsigned int limit);
+unsigned int sonic_pool_get_limit(struct sonic_ctx *ctx);
+/* Connect (if needed), func is called once services are resolved */
+bool sonic_pool_acquire(struct sonic_ctx *ctx, const char *address,
+				sonic_result_func_t func, void *user_data);
+/* Count a use of an address without connecting it */
+void sonic_pool_touch(struct sonic_ctx *ctx, const char *address);
+/* Drop an address from the pool, e.g. before an explicit disconnect */
+void sonic_pool_release(struct sonic_ctx *ctx, const char *address);
+/* Pooled addresses, most recently used first. Free with g_list_free */
+GList *sonic_pool_get_addresses(struct sonic_ctx *ctx);
+
+/*
+ * Generic GATT attributes (services, characteristics, descriptors). The
+ * lists hold struct sonic_attr and belong to the context.
+ */
+GList *sonic_get_services(struct sonic_ctx *ctx);
+GList *sonic_get_characteristics(struct sonic_ctx *ctx);
+GList *sonic_get_descriptors(struct sonic_ctx *ctx);
+struct sonic_attr *sonic_find_attribute(struct sonic_ctx *ctx,
+						const char *path);
+const char *sonic_attr_get_path(struct sonic_attr *attr);
+const char *sonic_attr_get_uuid(struct sonic_attr *attr);
+/* Any GattService1, GattCharacteristic1 or GattDescriptor1 property */
+bool sonic_attr_get_property(struct sonic_attr *attr, const char *name,
+						struct sonic_value *value);
+
+bool sonic_attr_read(struct sonic_ctx *ctx, struct sonic_attr *attr,
+				sonic_value_func_t func, void *user_data);
+bool sonic_attr_write(struct sonic_ctx *ctx, struct sonic_attr *attr,
+				const uint8_t *value, size_t len,
+				sonic_result_func_t func, void *user_data);
+bool sonic_attr_notify(struct sonic_ctx *ctx, struct sonic_attr *attr,
+				bool enable, sonic_result_func_t func,
+				void *user_data);
+/*
+ * AcquireWrite / AcquireNotify: a socket carrying one write without
+ * response (or one notification) per packet, bypassing D-Bus for bulk
+ * transfers. mtu is the largest packet the link takes.
+ */
+bool sonic_attr_acquire(struct sonic_ctx *ctx, struct sonic_attr *attr,
+				bool write, sonic_fd_func_t func,
+				void *user_data);
+
+bool sonic_register_profile(struct sonic_adapter *adapter,
+				char * const *uuids, size_t count,
+				sonic_result_func_t func, void *user_data);
+bool sonic_unregister_profile(struct sonic_adapter *adapter,
+				sonic_result_func_t func, void *user_data);
+
+/*
+ * Pairing agent, exported on the context's connection. Requests come in
+ * through the agent_request callback. Registration is lost when
+ * bluetoothd goes away (agent_manager_removed).
+ */
+bool sonic_agent_register(struct sonic_ctx *ctx, const char *capability,
+				sonic_result_func_t func, void *user_data);
+bool sonic_agent_unregister(struct sonic_ctx *ctx,
+				sonic_result_func_t func, void *user_data);
+bool sonic_agent_request_default(struct sonic_ctx *ctx,
+				sonic_result_func_t func, void *user_data);
+bool sonic_agent_is_registered(struct sonic_ctx *ctx);
+/* A request waits for an answer */
+bool sonic_agent_is_pending(struct sonic_ctx *ctx);
+/* Answer the pending request, false if there is none */
+bool sonic_agent_reply_pincode(struct sonic_ctx *ctx, const char *pincode);
+bool sonic_agent_reply_passkey(struct sonic_ctx *ctx, uint32_t passkey);
+/* CONFIRM, AUTHORIZE and AUTHORIZE_SERVICE */
+bool sonic_agent_accept(struct sonic_ctx *ctx);
+bool sonic_agent_reject(struct sonic_ctx *ctx);
+bool sonic_agent_cancel(struct sonic_ctx *ctx);
+
+/* Buzzer operations */
+bool sonic_buzz(struct sonic_device *device, bool enable,
+				sonic_result_func_t func, void *user_data);
+bool sonic_set_mode(struct sonic_device *device, enum sonic_mode mode,
+				sonic_result_func_t func, void *user_data);
+/*
+ * Switch the loop to a schedule / threshold characteristic (FIXEDINT,
+ * RANDINT, RSSIMIN or SOLARMIN). A value of 0 puts the device in idle.
+ */
+bool sonic_set_loop(struct sonic_device *device, enum sonic_char chr,
+				uint8_t value, sonic_result_func_t func,
+				void *user_data);
+/* Enter loop mode and subscribe to RSSI or SOLAR notifications */
+bool sonic_stats(struct sonic_device *device, enum sonic_char chr,
+				bool enable, sonic_result_func_t func,
+				void *user_data);
+/*
+ * Reporting policy of SONIC_CHAR_RSSI or SONIC_CHAR_SOLAR. The device
+ * notifies a reading once it moved more than deadband %, at least every
+ * max_s seconds (0: on change only) and never twice within min_s seconds.
+ */
+bool sonic_set_report(struct sonic_device *device, enum sonic_char chr,
+				uint8_t deadband, uint8_t min_s, uint16_t max_s,
+				sonic_result_func_t func, void *user_data);
+/*
+ * One sample of a SONIC_CHAR_STREAM notification. Subscribing with
+ * sonic_notify starts the stream, the device doesn't need loop mode.
+ */
+struct sonic_sample {
+	uint32_t time;		/* ms since the device booted */
+	int8_t rssi;		/* dBm */
+	uint16_t light;		/* mV */
+};
+
+/*
+ * Unpack a stream notification into at most max samples. Returns the
+ * number of samples in the notification, -1 if it is malformed.
+ */
+int sonic_stream_parse(const uint8_t *value, size_t len,
+				struct sonic_sample *samples, unsigned int max);
+/* Put the device into fw update mode and read back the AP passphrase */
+bool sonic_fwupdate(struct sonic_device *device,
+				sonic_value_func_t func, void *user_data);
+/*
+ * Station mode update: the device joins ssid (pass NULL or empty for an
+ * open network) and fetches the image from the server at addr:port,
+ * both in network byte order. Progress comes in on SONIC_CHAR_PROGRESS.
+ */
+bool sonic_fwupdate_station(struct sonic_device *device, const char *ssid,
+				const char *pass, uint32_t addr, uint16_t port,
+				sonic_result_func_t func, void *user_data);
+
+/*
+ * Firmware update over the OTA characteristic, protocol v2 (see
+ * ota_proto.h in the firmware) without the WiFi AP. data must stay
+ * valid until func is called. progress, if set, is called whenever the
+ * device acknowledges more of the image. Sending the same image again
+ * after a failure resumes where the device left off.
+ */
+typedef void (*sonic_progress_func_t)(uint32_t done, uint32_t total,
+							void *user_data);
+
+bool sonic_ota_start(struct sonic_device *device, const uint8_t *data,
+				uint32_t size, sonic_progress_func_t progress,
+				sonic_result_func_t func, void *user_data);
+/* CRC-32 (IEEE 802.3) as used by OTA data frames */
+uint32_t sonic_ota_crc32(const uint8_t *buf, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* SONIC_H */
@@ -0,0 +1,140 @@
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "sonic-private.h"
+
+static void decode_items(DBusMessageIter *iter, struct sonic_value *value)
+{
+	DBusMessageIter sub, count;
+	size_t i;
+
+	dbus_message_iter_recurse(iter, &sub);
+
+	count = sub;
+	while (dbus_message_iter_get_arg_type(&count) != DBUS_TYPE_INVALID) {
+		value->count++;
+		dbus_message_iter_next(&count);
+	}
+
+	if (!value->count)
+		return;
+
+	value->items = g_new0(struct sonic_value, value->count);
+
+	for (i = 0; i < value->count; i++) {
+		sonic_value_decode(&sub, &value->items[i]);
+		dbus_message_iter_next(&sub);
+	}
+}
+
+void sonic_value_decode(DBusMessageIter *iter, struct sonic_value *value)
+{
+	dbus_bool_t valbool;
+	uint8_t byte;
+	dbus_int16_t vals16;
+	dbus_uint16_t valu16;
+	dbus_int32_t vals32;
+	dbus_uint32_t valu32;
+	dbus_int64_t vals64;
+	dbus_uint64_t valu64;
+	DBusMessageIter sub;
+
+	memset(value, 0, sizeof(*value));
+
+	switch (dbus_message_iter_get_arg_type(iter)) {
+	case DBUS_TYPE_BOOLEAN:
+		dbus_message_iter_get_basic(iter, &valbool);
+		value->type = SONIC_VALUE_BOOL;
+		value->b = valbool == TRUE;
+		break;
+	case DBUS_TYPE_BYTE:
+		dbus_message_iter_get_basic(iter, &byte);
+		value->type = SONIC_VALUE_BYTE;
+		value->u = byte;
+		break;
+	case DBUS_TYPE_INT16:
+		dbus_message_iter_get_basic(iter, &vals16);
+		value->type = SONIC_VALUE_INT16;
+		value->i = vals16;
+		break;
+	case DBUS_TYPE_UINT16:
+		dbus_message_iter_get_basic(iter, &valu16);
+		value->type = SONIC_VALUE_UINT16;
+		value->u = valu16;
+		break;
+	case DBUS_TYPE_INT32:
+		dbus_message_iter_get_basic(iter, &vals32);
+		value->type = SONIC_VALUE_INT32;
+		value->i = vals32;
+		break;
+	case DBUS_TYPE_UINT32:
+		dbus_message_iter_get_basic(iter, &valu32);
+		value->type = SONIC_VALUE_UINT32;
+		value->u = valu32;
+		break;
+	case DBUS_TYPE_INT64:
+		dbus_message_iter_get_basic(iter, &vals64);
+		value->type = SONIC_VALUE_INT64;
+		value->i = vals64;
+		break;
+	case DBUS_TYPE_UINT64:
+		dbus_message_iter_get_basic(iter, &valu64);
+		value->type = SONIC_VALUE_UINT64;
+		value->u = valu64;
+		break;
+	case DBUS_TYPE_STRING:
+	case DBUS_TYPE_OBJECT_PATH:
+		dbus_message_iter_get_basic(iter, &value->s);
+		value->type = SONIC_VALUE_STRING;
+		break;
+	case DBUS_TYPE_VARIANT:
+		dbus_message_iter_recurse(iter, &sub);
+		sonic_value_decode(&sub, value);
+		break;
+	case DBUS_TYPE_ARRAY:
+		value->type = SONIC_VALUE_ARRAY;
+		decode_items(iter, value);
+		break;
+	case DBUS_TYPE_DICT_ENTRY:
+		value->type = SONIC_VALUE_DICT_ENTRY;
+		decode_items(iter, value);
+		break;
+	default:
+		value->type = SONIC_VALUE_INVALID;
+		break;
+	}
+}
+
+bool sonic_value_from_proxy(GDBusProxy *proxy, const char *name,
+						struct sonic_value *value)
+{
+	DBusMessageIter iter;
+
+	memset(value, 0, sizeof(*value));
+
+	if (!proxy || g_dbus_proxy_get_property(proxy, name, &iter) == FALSE)
+		return false;
+
+	sonic_value_decode(&iter, value);
+
+	return true;
+}
+
+void sonic_value_clear(struct sonic_value *value)
+{
+	size_t i;
+
+	if (!value)
+		return;
+
+	for (i = 0; i < value->count; i++)
+		sonic_value_clear(&value->items[i]);
+
+	g_free(value->items);
+	memset(value, 0, sizeof(*value));
+}
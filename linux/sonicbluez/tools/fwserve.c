@@ -0,0 +1,783 @@
+/*
+ * Firmware image server for station mode updates (ota_station).
+ *
+ * Buzzers that joined the maintenance network connect here and are sent
+ * the image in the v1 format recv_fw expects: the size as a big endian
+ * u64, then the raw image. One epoll loop serves every client; images
+ * go out with sendfile from a single open file, so all clients share
+ * the same page cache copy and nothing is copied through userspace.
+ *
+ * --simulate N connects N clients to the server from the same loop and
+ * checks what they receive against the image, for testing on localhost
+ * (or against another host with --connect).
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <glib.h>
+
+#define DEFAULT_PORT		5000	/* PORT_NUMBER in the firmware */
+#define DEFAULT_MAX_CLIENTS	256
+#define HDR_LEN			8
+#define IDLE_TIMEOUT		30	/* seconds without progress, then drop */
+#define TICK_MS			1000
+#define MAX_EVENTS		64
+#define RECV_BUF		65536
+
+/*
+ * One version of an image. A new version is opened when the file on
+ * disk changes (replace it with rename, not in place); clients keep the
+ * version they started with until they are done.
+ */
+struct image {
+	int fd;
+	const uint8_t *data;
+	size_t size;
+	dev_t dev;
+	ino_t ino;
+	struct timespec mtime;
+	unsigned int version;
+	unsigned int refs;
+};
+
+/* Anything in the epoll set */
+struct source {
+	int fd;
+	bool closed;	/* events already fetched for it are skipped */
+	void (*func)(struct source *source, uint32_t events);
+};
+
+enum peer_state {
+	PEER_HEADER,
+	PEER_BODY,
+	PEER_DRAIN,	/* image sent, waiting for the device to close */
+};
+
+struct peer {
+	struct source source;
+	struct peer *next;
+	bool sim;
+	enum peer_state state;
+	struct image *image;
+	uint8_t hdr[HDR_LEN];
+	size_t hdr_off;
+	off_t offset;
+	char name[INET_ADDRSTRLEN + 6];
+
+	struct timespec start;
+	off_t last_offset;
+	unsigned int idle;
+	uint32_t rate;		/* bytes/s, smoothed */
+
+	size_t budget;		/* simulated clients: bytes left this tick */
+	bool paused;
+};
+
+struct stats {
+	unsigned int accepted;
+	unsigned int refused;
+	unsigned int done;
+	unsigned int failed;
+	unsigned int sim_done;
+	unsigned int sim_failed;
+	uint64_t bytes;
+};
+
+static int epfd = -1;
+static const char *image_path;
+static struct image *current;
+static unsigned int image_versions;
+static struct peer *peers;
+static struct peer *closed_peers;	/* freed after each epoll batch */
+static unsigned int peer_count;
+static struct stats stats;
+static bool running = true;
+
+static gint option_port = DEFAULT_PORT;
+static gchar *option_address;
+static gint option_max = DEFAULT_MAX_CLIENTS;
+static gint option_simulate;
+static gchar *option_connect;
+static gint option_rate;
+static gboolean option_verbose;
+
+static GOptionEntry options[] = {
+	{ "port", 'p', 0, G_OPTION_ARG_INT, &option_port,
+				"TCP port (default 5000)", "PORT" },
+	{ "address", 'a', 0, G_OPTION_ARG_STRING, &option_address,
+				"Listen on this address only", "ADDRESS" },
+	{ "max-clients", 'm', 0, G_OPTION_ARG_INT, &option_max,
+				"Clients served at once (default 256)", "N" },
+	{ "simulate", 's', 0, G_OPTION_ARG_INT, &option_simulate,
+				"Run N simulated clients and exit", "N" },
+	{ "connect", 'c', 0, G_OPTION_ARG_STRING, &option_connect,
+				"Simulated clients connect here, no server",
+				"ADDRESS" },
+	{ "rate", 'r', 0, G_OPTION_ARG_INT, &option_rate,
+				"KiB/s per simulated client (default no limit)",
+				"KIB" },
+	{ "verbose", 'v', 0, G_OPTION_ARG_NONE, &option_verbose,
+				"Show per client progress every second" },
+	{ NULL },
+};
+
+static double elapsed(const struct timespec *since)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - since->tv_sec) +
+				(now.tv_nsec - since->tv_nsec) / 1e9;
+}
+
+static void image_unref(struct image *image)
+{
+	if (--image->refs)
+		return;
+
+	munmap((void *) image->data, image->size);
+	close(image->fd);
+	g_free(image);
+}
+
+static bool image_changed(const struct stat *st)
+{
+	return !current || current->dev != st->st_dev ||
+			current->ino != st->st_ino ||
+			current->size != (size_t) st->st_size ||
+			current->mtime.tv_sec != st->st_mtim.tv_sec ||
+			current->mtime.tv_nsec != st->st_mtim.tv_nsec;
+}
+
+/* The current version of the image, with a reference for the caller */
+static struct image *image_get(void)
+{
+	struct image *image;
+	struct stat st;
+	void *data;
+	int fd;
+
+	if (stat(image_path, &st) < 0 || !image_changed(&st))
+		goto done;
+
+	fd = open(image_path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0 || fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) ||
+				st.st_size == 0 || st.st_size > UINT32_MAX) {
+		fprintf(stderr, "Invalid image %s\n", image_path);
+		if (fd >= 0)
+			close(fd);
+		goto done;
+	}
+
+	/* sendfile reads the page cache, the mapping is for verifying */
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (data == MAP_FAILED) {
+		perror("Failed to map image");
+		close(fd);
+		goto done;
+	}
+
+	madvise(data, st.st_size, MADV_WILLNEED);
+	posix_fadvise(fd, 0, st.st_size, POSIX_FADV_SEQUENTIAL);
+
+	image = g_new0(struct image, 1);
+	image->fd = fd;
+	image->data = data;
+	image->size = st.st_size;
+	image->dev = st.st_dev;
+	image->ino = st.st_ino;
+	image->mtime = st.st_mtim;
+	image->version = ++image_versions;
+	image->refs = 1;
+
+	printf("Image %s version %u, %zu bytes\n", image_path,
+					image->version, image->size);
+
+	if (current)
+		image_unref(current);
+	current = image;
+
+done:
+	if (current)
+		current->refs++;
+
+	return current;
+}
+
+static int epoll_set(struct source *source, int op, uint32_t events)
+{
+	struct epoll_event ev = { .events = events, .data.ptr = source };
+
+	return epoll_ctl(epfd, op, source->fd, &ev);
+}
+
+static void peer_free(struct peer *peer, bool ok, const char *reason)
+{
+	struct peer **p;
+	double secs = elapsed(&peer->start);
+
+	for (p = &peers; *p; p = &(*p)->next) {
+		if (*p == peer) {
+			*p = peer->next;
+			break;
+		}
+	}
+
+	if (peer->sim) {
+		if (ok)
+			stats.sim_done++;
+		else
+			stats.sim_failed++;
+	} else {
+		peer_count--;
+		if (ok)
+			stats.done++;
+		else
+			stats.failed++;
+	}
+
+	printf("%s %s %s: %lld bytes in %.1f s, %.1f KiB/s%s%s\n",
+				peer->sim ? "Simulated" : "Client",
+				peer->name, ok ? "done" : "failed",
+				(long long) peer->offset, secs,
+				secs > 0 ? peer->offset / secs / 1024 : 0,
+				reason ? ", " : "", reason ? reason : "");
+
+	epoll_ctl(epfd, EPOLL_CTL_DEL, peer->source.fd, NULL);
+	close(peer->source.fd);
+	peer->source.closed = true;
+
+	peer->next = closed_peers;
+	closed_peers = peer;
+}
+
+static void peer_reap(void)
+{
+	struct peer *peer;
+
+	while (closed_peers) {
+		peer = closed_peers;
+		closed_peers = peer->next;
+
+		image_unref(peer->image);
+		g_free(peer);
+	}
+}
+
+static struct peer *peer_new(int fd, bool sim, struct image *image,
+					void (*func)(struct source *, uint32_t))
+{
+	struct peer *peer = g_new0(struct peer, 1);
+	uint64_t size = image->size;
+	int i;
+
+	peer->source.fd = fd;
+	peer->source.func = func;
+	peer->sim = sim;
+	peer->image = image;
+	peer->budget = SIZE_MAX;
+	clock_gettime(CLOCK_MONOTONIC, &peer->start);
+
+	for (i = 0; i < HDR_LEN; i++)
+		peer->hdr[i] = size >> (56 - 8 * i);
+
+	peer->next = peers;
+	peers = peer;
+
+	return peer;
+}
+
+/* Server side: header, then the image straight from the page cache */
+static void client_event(struct source *source, uint32_t events)
+{
+	struct peer *peer = (struct peer *) source;
+	uint8_t buf[64];
+	ssize_t ret;
+
+	if (peer->state == PEER_DRAIN) {
+		ret = recv(source->fd, buf, sizeof(buf), 0);
+		if (ret == 0)
+			peer_free(peer, true, NULL);
+		else if (ret < 0 && errno != EAGAIN && errno != EINTR)
+			peer_free(peer, true, "reset after the image");
+		return;
+	}
+
+	if (events & (EPOLLERR | EPOLLHUP)) {
+		peer_free(peer, false, "connection lost");
+		return;
+	}
+
+	if (!(events & EPOLLOUT))
+		return;
+
+	if (peer->state == PEER_HEADER) {
+		ret = send(source->fd, peer->hdr + peer->hdr_off,
+				HDR_LEN - peer->hdr_off, MSG_MORE | MSG_NOSIGNAL);
+		if (ret < 0) {
+			if (errno != EAGAIN && errno != EINTR)
+				peer_free(peer, false, strerror(errno));
+			return;
+		}
+
+		peer->hdr_off += ret;
+		if (peer->hdr_off < HDR_LEN)
+			return;
+
+		peer->state = PEER_BODY;
+	}
+
+	/*
+	 * One call per wakeup, as much as the socket buffer takes, so a
+	 * fast client can't starve the others.
+	 */
+	ret = sendfile(source->fd, peer->image->fd, &peer->offset,
+					peer->image->size - peer->offset);
+	if (ret < 0) {
+		if (errno != EAGAIN && errno != EINTR)
+			peer_free(peer, false, strerror(errno));
+		return;
+	}
+
+	if (ret == 0) {
+		peer_free(peer, false, "image truncated");
+		return;
+	}
+
+	stats.bytes += ret;
+
+	if ((size_t) peer->offset < peer->image->size)
+		return;
+
+	/* The device closes once it has read everything */
+	shutdown(source->fd, SHUT_WR);
+	peer->state = PEER_DRAIN;
+	epoll_set(source, EPOLL_CTL_MOD, EPOLLIN | EPOLLRDHUP);
+}
+
+static void listen_event(struct source *source, uint32_t events)
+{
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	struct image *image;
+	struct peer *peer;
+	int fd;
+
+	fd = accept4(source->fd, (struct sockaddr *) &addr, &len,
+					SOCK_NONBLOCK | SOCK_CLOEXEC);
+	if (fd < 0)
+		return;
+
+	stats.accepted++;
+
+	/* The device retries, no point in queueing it up here */
+	if (peer_count >= (unsigned int) option_max) {
+		stats.refused++;
+		close(fd);
+		return;
+	}
+
+	image = image_get();
+	if (!image) {
+		close(fd);
+		return;
+	}
+
+	peer = peer_new(fd, false, image, client_event);
+	snprintf(peer->name, sizeof(peer->name), "%s:%u",
+			inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
+	peer_count++;
+
+	if (option_verbose)
+		printf("Client %s connected, image version %u\n", peer->name,
+								image->version);
+
+	epoll_set(&peer->source, EPOLL_CTL_ADD, EPOLLOUT | EPOLLRDHUP);
+}
+
+/* Simulated device: read the size and image, compare with the original */
+static void sim_event(struct source *source, uint32_t events)
+{
+	struct peer *peer = (struct peer *) source;
+	uint8_t buf[RECV_BUF];
+	uint64_t size = 0;
+	ssize_t ret;
+	size_t want;
+	int i;
+
+	if (peer->state == PEER_HEADER) {
+		ret = recv(source->fd, peer->hdr + peer->hdr_off,
+					HDR_LEN - peer->hdr_off, 0);
+		if (ret <= 0) {
+			if (ret < 0 && (errno == EAGAIN || errno == EINTR))
+				return;
+			peer_free(peer, false, ret ? strerror(errno) :
+							"closed before the size");
+			return;
+		}
+
+		peer->hdr_off += ret;
+		if (peer->hdr_off < HDR_LEN)
+			return;
+
+		for (i = 0; i < HDR_LEN; i++)
+			size = size << 8 | peer->hdr[i];
+
+		if (size != peer->image->size) {
+			peer_free(peer, false, "size mismatch");
+			return;
+		}
+
+		peer->state = PEER_BODY;
+	}
+
+	want = MIN(sizeof(buf), peer->budget);
+	want = MIN(want, peer->image->size - peer->offset);
+
+	ret = recv(source->fd, buf, want, 0);
+	if (ret <= 0) {
+		if (ret < 0 && (errno == EAGAIN || errno == EINTR))
+			return;
+		peer_free(peer, false, ret ? strerror(errno) :
+							"closed early");
+		return;
+	}
+
+	if (memcmp(buf, peer->image->data + peer->offset, ret)) {
+		peer_free(peer, false, "data mismatch");
+		return;
+	}
+
+	peer->offset += ret;
+
+	if ((size_t) peer->offset == peer->image->size) {
+		peer_free(peer, true, NULL);
+		return;
+	}
+
+	/* Rate limited, sit out the rest of the tick */
+	if (peer->budget != SIZE_MAX) {
+		peer->budget -= ret;
+		if (!peer->budget) {
+			peer->paused = true;
+			epoll_set(source, EPOLL_CTL_MOD, 0);
+		}
+	}
+}
+
+static bool sim_start(const struct sockaddr_in *server, struct image *image,
+							unsigned int index)
+{
+	struct peer *peer;
+	int fd;
+
+	fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return false;
+
+	if (connect(fd, (const struct sockaddr *) server,
+				sizeof(*server)) < 0 && errno != EINPROGRESS) {
+		close(fd);
+		return false;
+	}
+
+	image->refs++;
+	peer = peer_new(fd, true, image, sim_event);
+	snprintf(peer->name, sizeof(peer->name), "#%u", index);
+
+	if (option_rate > 0)
+		peer->budget = (size_t) option_rate * 1024 * TICK_MS / 1000;
+
+	return epoll_set(&peer->source, EPOLL_CTL_ADD,
+					EPOLLIN | EPOLLRDHUP) == 0;
+}
+
+static void tick(void)
+{
+	struct peer *peer, *next;
+	uint64_t total = 0;
+	uint32_t inst;
+
+	for (peer = peers; peer; peer = next) {
+		next = peer->next;
+
+		inst = (peer->offset - peer->last_offset) * 1000 / TICK_MS;
+		peer->rate = peer->rate ? (peer->rate * 3 + inst) / 4 : inst;
+
+		if (peer->offset != peer->last_offset || peer->paused)
+			peer->idle = 0;
+		else if (++peer->idle >= IDLE_TIMEOUT) {
+			peer_free(peer, false, "stalled");
+			continue;
+		}
+
+		peer->last_offset = peer->offset;
+
+		if (!peer->sim)
+			total += peer->rate;
+
+		if (option_verbose && peer->state == PEER_BODY)
+			printf("  %s %s %lld/%zu %u%% %u KiB/s\n",
+				peer->sim ? "sim" : "client", peer->name,
+				(long long) peer->offset, peer->image->size,
+				(unsigned int) (peer->offset * 100 /
+							peer->image->size),
+				peer->rate / 1024);
+
+		if (option_rate > 0 && peer->sim) {
+			peer->budget = (size_t) option_rate * 1024 *
+							TICK_MS / 1000;
+			if (peer->paused) {
+				peer->paused = false;
+				epoll_set(&peer->source, EPOLL_CTL_MOD,
+						EPOLLIN | EPOLLRDHUP);
+			}
+		}
+	}
+
+	if (!option_connect && (peer_count || option_verbose))
+		printf("%u clients, %u done, %u failed, %u refused, "
+				"%" PRIu64 " KiB/s\n", peer_count, stats.done,
+				stats.failed, stats.refused, total / 1024);
+
+	if (option_simulate && stats.sim_done + stats.sim_failed ==
+					(unsigned int) option_simulate &&
+					(option_connect || !peer_count))
+		running = false;
+}
+
+static void timer_event(struct source *source, uint32_t events)
+{
+	uint64_t expired;
+
+	if (read(source->fd, &expired, sizeof(expired)) == sizeof(expired))
+		tick();
+}
+
+static void signal_event(struct source *source, uint32_t events)
+{
+	struct signalfd_siginfo si;
+
+	if (read(source->fd, &si, sizeof(si)) == sizeof(si))
+		running = false;
+}
+
+static int listen_start(struct sockaddr_in *addr)
+{
+	int fd, one = 1;
+
+	fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	if (bind(fd, (struct sockaddr *) addr, sizeof(*addr)) < 0 ||
+					listen(fd, SOMAXCONN) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static int timer_start(void)
+{
+	struct itimerspec its = {
+		.it_interval = { TICK_MS / 1000, TICK_MS % 1000 * 1000000 },
+		.it_value = { TICK_MS / 1000, TICK_MS % 1000 * 1000000 },
+	};
+	int fd;
+
+	fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (fd >= 0)
+		timerfd_settime(fd, 0, &its, NULL);
+
+	return fd;
+}
+
+static int signal_start(void)
+{
+	sigset_t mask;
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	sigprocmask(SIG_BLOCK, &mask, NULL);
+
+	/* Dropped clients would otherwise kill the server */
+	signal(SIGPIPE, SIG_IGN);
+
+	return signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+}
+
+static bool parse_options(int *argc, char **argv[])
+{
+	GOptionContext *context;
+	GError *error = NULL;
+	bool ret;
+
+	context = g_option_context_new("IMAGE");
+	g_option_context_add_main_entries(context, options, NULL);
+
+	ret = g_option_context_parse(context, argc, argv, &error);
+	if (!ret) {
+		fprintf(stderr, "%s\n", error->message);
+		g_error_free(error);
+	} else if (*argc != 2) {
+		fprintf(stderr, "%s", g_option_context_get_help(context,
+								TRUE, NULL));
+		ret = false;
+	}
+
+	g_option_context_free(context);
+
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	struct source listener = { .fd = -1, .func = listen_event };
+	struct source timer = { .fd = -1, .func = timer_event };
+	struct source sig = { .fd = -1, .func = signal_event };
+	struct epoll_event events[MAX_EVENTS];
+	struct sockaddr_in addr;
+	struct source *source;
+	struct image *image;
+	int i, n;
+
+	if (!parse_options(&argc, &argv))
+		return EXIT_FAILURE;
+
+	if (option_port <= 0 || option_port > UINT16_MAX ||
+				option_max <= 0 || option_simulate < 0 ||
+				(option_connect && !option_simulate)) {
+		fprintf(stderr, "Invalid options\n");
+		return EXIT_FAILURE;
+	}
+
+	/* The first version, simulated clients check against it */
+	image_path = argv[1];
+	image = image_get();
+	if (!image)
+		return EXIT_FAILURE;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(option_port);
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+	if (option_address && !inet_aton(option_address, &addr.sin_addr)) {
+		fprintf(stderr, "Invalid address %s\n", option_address);
+		return EXIT_FAILURE;
+	}
+
+	setlinebuf(stdout);
+
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	timer.fd = timer_start();
+	sig.fd = signal_start();
+	if (epfd < 0 || timer.fd < 0 || sig.fd < 0) {
+		perror("Failed to set up the main loop");
+		return EXIT_FAILURE;
+	}
+
+	epoll_set(&timer, EPOLL_CTL_ADD, EPOLLIN);
+	epoll_set(&sig, EPOLL_CTL_ADD, EPOLLIN);
+
+	if (!option_connect) {
+		listener.fd = listen_start(&addr);
+		if (listener.fd < 0) {
+			perror("Failed to listen");
+			return EXIT_FAILURE;
+		}
+
+		epoll_set(&listener, EPOLL_CTL_ADD, EPOLLIN);
+		printf("Serving %s on %s:%d, up to %d clients\n", image_path,
+				inet_ntoa(addr.sin_addr), option_port,
+				option_max);
+	}
+
+	if (option_simulate) {
+		if (option_connect &&
+				!inet_aton(option_connect, &addr.sin_addr)) {
+			fprintf(stderr, "Invalid address %s\n", option_connect);
+			return EXIT_FAILURE;
+		}
+
+		if (!option_connect && addr.sin_addr.s_addr == INADDR_ANY)
+			addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+		for (i = 0; i < option_simulate; i++) {
+			if (!sim_start(&addr, image, i)) {
+				perror("Failed to start simulated client");
+				return EXIT_FAILURE;
+			}
+		}
+	}
+
+	while (running) {
+		n = epoll_wait(epfd, events, MAX_EVENTS, -1);
+		if (n < 0 && errno != EINTR) {
+			perror("epoll_wait");
+			break;
+		}
+
+		for (i = 0; i < n; i++) {
+			source = events[i].data.ptr;
+			if (!source->closed)
+				source->func(source, events[i].events);
+		}
+
+		peer_reap();
+	}
+
+	while (peers)
+		peer_free(peers, false, "shutting down");
+	peer_reap();
+
+	if (!option_connect)
+		printf("%u accepted, %u done, %u failed, %u refused, "
+				"%" PRIu64 " bytes sent\n", stats.accepted,
+				stats.done, stats.failed, stats.refused,
+				stats.bytes);
+
+	if (option_simulate)
+		printf("%u simulated clients done, %u failed\n",
+					stats.sim_done, stats.sim_failed);
+
+	image_unref(image);
+	image_unref(current);
+
+	if (listener.fd >= 0)
+		close(listener.fd);
+	close(timer.fd);
+	close(sig.fd);
+	close(epfd);
+
+	return stats.failed || stats.sim_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}